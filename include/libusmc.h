@@ -54,6 +54,8 @@
 #define ERR_INVALID_ID        -40
 #define ERR_INVALID_PARAM     -41
 #define ERR_INVALID_VALUE     -42
+#define ERR_INTERLOCK         -43
+#define ERR_VERIFY            -44
 
 
 
@@ -155,6 +157,20 @@ typedef struct _USMC_StartParameters
 } USMC_StartParameters;
 
 
+typedef struct _USMC_LockStats
+{
+    uint64_t Acquisitions; // Number of times the device lock has been taken.
+    uint64_t Contended;    // Number of times a caller had to wait for the lock.
+    uint64_t WaitTime;     // Total time spent waiting for the lock (ns).
+    bool Locked;           // If TRUE the lock is held now.
+} USMC_LockStats;
+
+
+// Transport (see usmc_transport.h)
+class USMC_transport;
+class USMC_Device;
+
+
 /**
  * @class USMC
  * Public interface to USMC devices
@@ -168,6 +184,20 @@ public:
      */
     static USMC* getInstance();
 
+    /**
+     * Get instance of USMC using a custom transport (e.g. the simulator).
+     * The transport is used only if the instance does not exist yet and it
+     * must stay valid until shutdown() is called.
+     * @param transport the transport.
+     * @return pointer to USMC instance
+     */
+    static USMC* getInstance(USMC_transport* transport);
+
+    /**
+     * Check if the instance exists (without creating it)
+     */
+    static bool hasInstance() { return NULL != _instance; }
+
     /**
      * Shutdown library
      */
@@ -192,6 +222,24 @@ public:
      */
     virtual int getDeviceID(const std::string& serial)const = 0;
 
+    /**
+     * Get a direct handle to a device
+     * @param device the index of the desired device.
+     * @param handle a pointer to the USMC_Device to initialize.
+     * @see USMC_Device
+     * @return 0 on success, negative error number on error
+     */
+    virtual int getDevice(int device, USMC_Device* handle) = 0;
+
+    /**
+     * Get a direct handle to a device, given the serial number
+     * @param serial the serial number of the desired device.
+     * @param handle a pointer to the USMC_Device to initialize.
+     * @see USMC_Device
+     * @return 0 on success, negative error number on error
+     */
+    int getDevice(const std::string& serial, USMC_Device* handle);
+
     /**
      * Configure debugging
      * @param en Enable flag
@@ -230,6 +278,14 @@ public:
      */
     virtual int getSerialNumber(int device, std::string& serial)const = 0;
 
+    /**
+     * Get the physical location of the device (USB bus and port numbers, e.g. 1-2.3)
+     * @param device the index of the desired device.
+     * @param path a string where the path is stored.
+     * @return 0 on success, negative error number on error
+     */
+    virtual int getBusPath(int device, std::string& path)const = 0;
+
     /**
      * Get device firmware version
      * @param device the index of the desired device.
@@ -349,6 +405,36 @@ public:
      */
     virtual int getEncoderState(int device, USMC_EncoderState* state) = 0;
 
+    /**
+     * Add an exclusion zone between two axes. Axis A cannot enter [minA, maxA]
+     * while axis B may be inside [minB, maxB], and vice versa. Moves that could
+     * violate a zone are rejected with ERR_INTERLOCK. An axis with zones must have
+     * a known position (see getState) before it can be moved. Backlash overshoot
+     * is not accounted for, so include it as a margin in the ranges.
+     * @param deviceA the index of the first device.
+     * @param minA lower bound of the zone on the first device, in steps.
+     * @param maxA upper bound of the zone on the first device, in steps.
+     * @param deviceB the index of the second device.
+     * @param minB lower bound of the zone on the second device, in steps.
+     * @param maxB upper bound of the zone on the second device, in steps.
+     * @return the zone index on success, negative error number on error
+     */
+    virtual int addExclusionZone(int deviceA, int minA, int maxA, int deviceB, int minB, int maxB) = 0;
+
+    /**
+     * Remove all the exclusion zones
+     */
+    virtual void clearExclusionZones() = 0;
+
+    /**
+     * Get the contention counters of the lock serializing the USB access to a device
+     * @param device the index of the desired device.
+     * @param stats a pointer to a USMC_LockStats structure.
+     * @see USMC_LockStats
+     * @return 0 on success, negative error number on error
+     */
+    virtual int getLockStats(int device, USMC_LockStats* stats)const = 0;
+
 protected:
     // Constructor and destructor
     USMC();
@@ -359,6 +445,9 @@ private:
     USMC(const USMC& obj);
     USMC& operator=(const USMC& obj);
 
+    // The recorder deletes the instance it wraps
+    friend class USMC_recorder;
+
     // Instance
     static USMC* _instance;
 };
@@ -35,7 +35,42 @@
 #include <libusmc.h>
 #include <usmctypes.h>
 #include <usmc_mutex.h>
-
+#include <usmc_interlock.h>
+#include <usmc_transport.h>
+#include <usmc_device.h>
+
+
+// Default logging functions
+void usmc_log_error(const char* fmt, ...);
+void usmc_log_warn(const char* fmt, ...);
+void usmc_log_info(const char* fmt, ...);
+void usmc_log_debug(const char* fmt, ...);
+
+
+// Commands of a cyclic exchange
+#define USMC_EXCHANGE_NONE    0
+#define USMC_EXCHANGE_MOVE    1
+#define USMC_EXCHANGE_STOP    2
+#define USMC_EXCHANGE_PACKET  3     // Move with the goto packet already encoded in go_to.
+
+// Exchange of one device in a cyclic batch (see USMC_Cyclic)
+typedef struct _USMC_ExchangeSlot
+{
+    USMC_DeviceRecord* dev;     // Device record.
+    int command;                // One of USMC_EXCHANGE_*.
+    int destination;            // Destination of a move.
+    int command_result;         // Result of the command (unchanged without a command).
+    const USMC_Mode* mode;      // Mode written before the command (NULL for none).
+    const USMC_Parameters* params;  // Parameters written before the command (NULL for none).
+    int config_result;          // Result of the mode and parameters writes.
+    USMC_State state;           // State read after the command.
+    int state_result;           // Result of the state read.
+    uint32_t seq;               // Interlock sequence of the state read.
+    GO_TO_PACKET go_to;         // Transfer buffers.
+    STATE_PACKET state_packet;
+    MODE_PACKET mode_packet;
+    PARAMETERS_PACKET params_packet;
+} USMC_ExchangeSlot;
 
 
 // USMC implementation
@@ -50,6 +85,9 @@ public:
     // Get device ID by serial number
     virtual int getDeviceID(const std::string& serial)const;
 
+    // Get device handle
+    virtual int getDevice(int device, USMC_Device* handle);
+
     // Enable debug
     virtual void debug(bool en);
 
@@ -68,6 +106,9 @@ public:
     // Get serial number
     virtual int getSerialNumber(int device, std::string& serial)const;
 
+    // Get bus path
+    virtual int getBusPath(int device, std::string& path)const;
+
     // Get firmware version
     virtual int getVersion(int device, uint32_t& version)const;
 
@@ -110,46 +151,90 @@ public:
     // Get encoder state
     virtual int getEncoderState(int device, USMC_EncoderState* state);
 
+    // Add exclusion zone
+    virtual int addExclusionZone(int deviceA, int minA, int maxA, int deviceB, int minB, int maxB);
+
+    // Remove exclusion zones
+    virtual void clearExclusionZones();
+
+    // Get lock counters
+    virtual int getLockStats(int device, USMC_LockStats* stats)const;
+
 public:
     // Destructor
     virtual ~USMC_impl();
 
 protected:
-    // Constructor
-    USMC_impl();
+    // Constructor (NULL transport - libusb)
+    USMC_impl(USMC_transport* transport = NULL);
 
     // Clamp values
     int clamp ( int val, int min, int max ) { return val > max ? max : ( val < min ? min : val ); }
     float clamp ( float val, float min, float max ) { return val > max ? max : ( val < min ? min : val ); }
 
     // Initialize structures to default values
-    void initDefaults(int id);
+    void initDefaults(USMC_DeviceRecord& dev);
 
     // Check if the device ID is valid
     bool checkDevice(int device)const;
 
+    // Device operations shared by the index-based interface and USMC_Device
+    int device_get_state(USMC_DeviceRecord& dev, USMC_State* state);
+    int device_set_speed(USMC_DeviceRecord& dev, float speed);
+    int device_set_start_parameters(USMC_DeviceRecord& dev, const USMC_StartParameters* start_params);
+    int device_move(USMC_DeviceRecord& dev, int destination);
+
+    // Send the slot configuration writes and commands and read the states in one
+    // pipelined batch. Slots must be sorted by device index and requests must
+    // hold 2 entries per slot plus one for each mode and parameters write.
+    // Invalid parameters cancel the command of the slot, a failed
+    // configuration transfer does not.
+    void device_exchange(USMC_ExchangeSlot* slots, size_t n, USMC_TransferRequest* requests);
+
+    // Decode a state packet
+    void decode_state(const USMC_DeviceRecord& dev, const STATE_PACKET& packet, USMC_State& state);
+
+    // Pre-encode the goto payload (the cache write lock must be held)
+    void encode_goto(USMC_DeviceRecord& dev);
+
+    // Encode a complete goto packet (speed <= 0 uses the device speed)
+    void encode_move(USMC_DeviceRecord& dev, int destination, float speed, GO_TO_PACKET& packet);
+
+    // Check the ranges of the parameters
+    bool check_parameters(const USMC_Parameters& params)const;
+
+    // Encode a mode packet and its setup words
+    void encode_mode(const USMC_Mode& mode, MODE_PACKET& packet, uint16_t& wValue, uint16_t& wIndex);
+
+    // Encode a parameters packet and its setup words
+    void encode_parameters(const USMC_DeviceRecord& dev, const USMC_Parameters& params, PARAMETERS_PACKET& packet, uint16_t& wValue, uint16_t& wIndex);
+
+    // Encode speed and start parameters in a goto packet
+    void encode_payload(GO_TO_PACKET& packet, float speed, const USMC_StartParameters& start_params);
+
     // USB communication methods
-    int usmc_get_version(int id, uint32_t& version);
-    int usmc_get_serial(int id, char* serial, size_t len);
-    int usmc_get_encoder_state(int id, USMC_EncoderState& state);
-    int usmc_get_state(int id, USMC_State& state);
-    int usmc_goto(int id, int position, float speed, const USMC_StartParameters& params);
-    int usmc_set_mode(int id, const USMC_Mode& mode);
-    int usmc_set_parameters(int id, const USMC_Parameters& params);
-//  int usmc_set_serial(int id);  // NOT IMPLEMENTED
-    int usmc_set_current_position(int id, int32_t position);
-//  int usmc_download(int id);    // NOT IMPLEMENTED
-    int usmc_stop(int id);
-//  int usmc_emulate(int id);     // NOT IMPLEMENTED
-    int usmc_save(int id);
+    int usmc_get_version(USMC_DeviceRecord& dev, uint32_t& version);
+    int usmc_get_serial(USMC_DeviceRecord& dev, char* serial, size_t len);
+    int usmc_get_encoder_state(USMC_DeviceRecord& dev, USMC_EncoderState& state);
+    int usmc_get_state(USMC_DeviceRecord& dev, USMC_State& state);
+    int usmc_goto(USMC_DeviceRecord& dev, int position, const uint8_t* data);
+    int usmc_set_mode(USMC_DeviceRecord& dev, const USMC_Mode& mode);
+    int usmc_set_parameters(USMC_DeviceRecord& dev, const USMC_Parameters& params);
+    int usmc_set_serial(USMC_DeviceRecord& dev, const char* serial, const char* password);
+    int usmc_set_current_position(USMC_DeviceRecord& dev, int32_t position);
+//  int usmc_download(USMC_DeviceRecord& dev);    // NOT IMPLEMENTED
+    int usmc_stop(USMC_DeviceRecord& dev);
+//  int usmc_emulate(USMC_DeviceRecord& dev);     // NOT IMPLEMENTED
+    int usmc_save(USMC_DeviceRecord& dev);
 
 private:
     // Private copy constructor
     USMC_impl(const USMC_impl& obj);
     USMC_impl& operator=(const USMC_impl& obj);
 
-    // Libusb context
-    libusb_context* _usb_ctx;
+    // Transport
+    USMC_transport* _transport;
+    bool _own_transport;
 
     // Logger functions
     void (*_error_logger)(const char*, ...);
@@ -163,27 +248,17 @@ private:
     // USB timeout
     int _timeout;
 
-    // Device handle
-    std::vector<libusb_device_handle*> _dev;
-
-    // Device mutexes
-    std::vector<USMC_mutex*> _locks;
-
-    // Firmware version
-    std::vector<uint32_t> _version;
-
-    // Serial number
-    std::vector<std::string> _serial;
-
-    // Speeds
-    std::vector<float> _speed;
+    // Device records
+    std::vector<USMC_DeviceRecord*> _devices;
 
-    // Device parameters structures
-    std::vector<USMC_Parameters*> _params;
-    std::vector<USMC_Mode*> _mode;
-    std::vector<USMC_StartParameters*> _start_params;
+    // Collision interlock
+    USMC_interlock _interlock;
 
     friend class USMC;
+    friend class USMC_Device;
+    friend class USMC_Cyclic;
+    friend class USMC_PathExecutor;
+    friend class USMC_Provisioner;
 };
 
 
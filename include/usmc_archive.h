@@ -0,0 +1,333 @@
+/***************************************************//**
+ * @file    usmc_archive.h
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * Compressed archive of full-rate state streams. Samples are grouped in
+ * blocks of a single device; inside a block every field is stored as the
+ * varint-encoded delta from the previous sample, and fields that did not
+ * change (flags, step divisor, temperature, voltage) cost a single bit.
+ * Blocks are independent, so the block index at the end of the file allows
+ * random access, while a file without index (e.g. after a crash) can still
+ * be decoded sequentially. The index keeps the time span of every block,
+ * so a time window of a device is read by decoding only its blocks.
+ *
+ * Temperature and voltage are quantized to 0.01 degC and 1 mV, finer than
+ * the resolution of the controller ADC.
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#ifndef USMC_ARCHIVE_H
+#define USMC_ARCHIVE_H
+
+#include <stdint.h>
+#include <cstdio>
+#include <vector>
+#include <pthread.h>
+#include <libusmc.h>
+#include <usmc_mutex.h>
+#include <usmc_cycle.h>
+#include <usmc_c.h>
+
+// Default number of samples of a block
+#define USMC_ARCHIVE_BLOCK    1024
+
+// Default size of the queue between the producers and the writer thread
+#define USMC_ARCHIVE_QUEUE    65536
+
+
+typedef struct _USMC_ArchiveSample
+{
+    uint64_t time;          // Sample time (us).
+    int device;             // Device index.
+    USMC_State state;       // Device state.
+} USMC_ArchiveSample;
+
+
+typedef struct _USMC_ArchiveBlock
+{
+    uint64_t offset;        // Offset of the block in the file.
+    int device;             // Device of the samples.
+    uint32_t count;         // Number of samples.
+    uint32_t length;        // Length of the encoded samples (bytes).
+    uint64_t t_first;       // Time of the first sample (us).
+    uint64_t t_last;        // Time of the last sample (us).
+} USMC_ArchiveBlock;
+
+
+typedef struct _USMC_ArchiveSeries
+{
+    std::vector<uint64_t> time;     // Sample times (us).
+    std::vector<int> position;      // Positions (1/8 steps).
+    std::vector<uint32_t> flags;    // State flags (USMC_STATE_* of usmc_c.h).
+    std::vector<uint8_t> divisor;   // Step divisors.
+    std::vector<float> temp;        // Temperatures (degC).
+    std::vector<float> voltage;     // Voltages (V).
+} USMC_ArchiveSeries;
+
+
+typedef struct _USMC_ArchiveStats
+{
+    uint64_t samples;       // Samples written.
+    uint64_t dropped;       // Samples dropped because the queue was full.
+    uint64_t blocks;        // Blocks written.
+    uint64_t bytes;         // Bytes written.
+    double bytes_sample;    // Mean size of a sample in the file (bytes).
+} USMC_ArchiveStats;
+
+
+/**
+ * @class USMC_ArchiveWriter
+ * Archive writer. Samples are queued without blocking or allocating memory
+ * and encoded by a background thread, so the writer can be fed by a
+ * USMC_Cyclic. The queue has a single producer.
+ */
+class USMC_ArchiveWriter : public USMC_CycleSink {
+public:
+    // Constructor and destructor
+    USMC_ArchiveWriter();
+    virtual ~USMC_ArchiveWriter();
+
+    /**
+     * Create an archive and start the writer thread
+     * @param filename the archive file.
+     * @param ndevices number of devices.
+     * @param block_samples maximum number of samples of a block.
+     * @param queue size of the sample queue.
+     * @return 0 on success, negative error number on error
+     */
+    int open(const char* filename, int ndevices, uint32_t block_samples = USMC_ARCHIVE_BLOCK, uint32_t queue = USMC_ARCHIVE_QUEUE);
+
+    /**
+     * Write the queued samples and the block index and close the archive
+     * @return 0 on success, negative error number on error
+     */
+    int close();
+
+    /**
+     * Queue a sample. The times of each device must not decrease, so that
+     * the reader can binary-search them.
+     * @param device the device index.
+     * @param time_us the sample time (us).
+     * @param state the device state.
+     * @return 0 on success, ERR_USB_OVERFLOW if the queue is full, ERR_INVALID_VALUE if the time goes back, negative error number on error
+     */
+    int add(int device, uint64_t time_us, const USMC_State& state);
+
+    /**
+     * Queue a sample read by a USMC_Cyclic. The time is converted to wall-clock
+     * time with the offset of the first sample, so the archived times follow
+     * the library clock and do not step back with the wall clock.
+     */
+    virtual void push(int device, uint64_t time_us, const USMC_State& state);
+
+    /**
+     * Get the writer statistics
+     * @param stats a pointer to a USMC_ArchiveStats structure.
+     */
+    void getStats(USMC_ArchiveStats* stats);
+
+private:
+    // Private copy constructor
+    USMC_ArchiveWriter(const USMC_ArchiveWriter& obj);
+    USMC_ArchiveWriter& operator=(const USMC_ArchiveWriter& obj);
+
+    // Quantized sample
+    typedef struct _record {
+        uint64_t time;
+        int32_t device;
+        int32_t position;
+        uint32_t flags;
+        int32_t temp;
+        int32_t voltage;
+        uint8_t divisor;
+    } record;
+
+    // Open block of a device
+    typedef struct _block {
+        std::vector<uint8_t> data;
+        uint32_t count;
+        uint64_t t_first;
+        record last;
+    } block;
+
+    // Thread entry point
+    static void* thread_main(void* arg);
+
+    // Writer loop
+    void run();
+
+    // Encode a sample
+    void encode(const record& r);
+
+    // Write the block of a device
+    void write_block(int device);
+
+    // Archive file
+    FILE* _file;
+    int _ndevices;
+    uint32_t _block_samples;
+    int _result;
+
+    // Sample queue (single producer, single consumer)
+    std::vector<record> _queue;
+    uint32_t _head;
+    uint32_t _tail;
+
+    // Last queued time of each device and wall-clock offset (producer side)
+    std::vector<uint64_t> _last;
+    bool _anchored;
+    int64_t _wall_offset;
+
+    // Open blocks and index
+    std::vector<block> _blocks;
+    std::vector<USMC_ArchiveBlock> _index;
+    uint64_t _offset;
+
+    // Thread
+    pthread_t _thread;
+    bool _started;
+    volatile bool _stop;
+
+    // Statistics
+    USMC_mutex _lock;
+    USMC_ArchiveStats _stats;
+    uint64_t _dropped;
+};
+
+
+/**
+ * @class USMC_ArchiveReader
+ * Archive reader
+ */
+class USMC_ArchiveReader {
+public:
+    // Constructor and destructor
+    USMC_ArchiveReader();
+    ~USMC_ArchiveReader();
+
+    /**
+     * Open an archive. If the block index is missing (archive not closed)
+     * it is rebuilt from the block headers.
+     * @return 0 on success, negative error number on error
+     */
+    int open(const char* filename);
+
+    /**
+     * Close the archive
+     */
+    void close();
+
+    /**
+     * Number of blocks
+     */
+    size_t blocks()const { return _index.size(); }
+
+    /**
+     * Number of devices (highest device index with samples + 1)
+     */
+    int devices()const { return _ndevices; }
+
+    /**
+     * Get a block of the index
+     */
+    const USMC_ArchiveBlock& block(size_t i)const { return _index[i]; }
+
+    /**
+     * Decode a block. The sequential decoding continues from the next block.
+     * @param i the block number.
+     * @param samples vector where the samples are appended.
+     * @return the number of samples decoded, negative error number on error
+     */
+    int readBlock(size_t i, std::vector<USMC_ArchiveSample>& samples);
+
+    /**
+     * Decode the archive sequentially. Samples are returned in block order
+     * (in time order for each device).
+     * @param sample a pointer to a USMC_ArchiveSample structure.
+     * @return 1 if a sample was read, 0 at the end of the archive, negative error number on error
+     */
+    int next(USMC_ArchiveSample* sample);
+
+    /**
+     * Restart the sequential decoding from a block
+     */
+    void rewind(size_t block = 0);
+
+    /**
+     * Get the samples of a device in a time window. Only the blocks of the
+     * device overlapping the window are read. The sequential decoding
+     * continues from the block after the last one read.
+     * @param device the device index.
+     * @param t0 window start (us).
+     * @param t1 window end (us, excluded).
+     * @param samples vector where the samples are appended.
+     * @return the number of samples appended, negative error number on error
+     */
+    int query(int device, uint64_t t0, uint64_t t1, std::vector<USMC_ArchiveSample>& samples);
+
+    /**
+     * Get the samples of a device in a time window as arrays
+     * @param series structure where the samples are appended.
+     * @return the number of samples appended, negative error number on error
+     */
+    int query(int device, uint64_t t0, uint64_t t1, USMC_ArchiveSeries& series);
+
+private:
+    // Private copy constructor
+    USMC_ArchiveReader(const USMC_ArchiveReader& obj);
+    USMC_ArchiveReader& operator=(const USMC_ArchiveReader& obj);
+
+    // Load the encoded samples of a block
+    int load(size_t i);
+
+    // Decode the next sample of the loaded block
+    int decode(USMC_ArchiveSample* sample);
+
+    // Build the time index of each device
+    int build_time_index();
+
+    // Decode the samples of a device in a time window
+    int range(int device, uint64_t t0, uint64_t t1, void (*append)(void*, const USMC_ArchiveSample&), void* out);
+
+    // Archive file
+    FILE* _file;
+    std::vector<USMC_ArchiveBlock> _index;
+
+    // Blocks of each device and their start times. The blocks of a device
+    // whose times are not increasing (written by an older writer) are
+    // scanned in full instead of binary-searched.
+    int _ndevices;
+    std::vector<std::vector<size_t> > _devices;
+    std::vector<std::vector<uint64_t> > _starts;
+    std::vector<bool> _ordered;
+
+    // Decoder state
+    std::vector<uint8_t> _data;
+    size_t _block;
+    size_t _pos;
+    uint32_t _left;
+    int64_t _prev[6];
+};
+
+#endif
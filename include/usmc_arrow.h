@@ -0,0 +1,149 @@
+/***************************************************//**
+ * @file    usmc_arrow.h
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * Apache Arrow IPC export of archived telemetry and scan results, readable
+ * by pyarrow, pandas and polars without parsing. The writer has no external
+ * dependency: it encodes the Arrow metadata itself and writes the column
+ * buffers straight from the library arrays.
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#ifndef USMC_ARROW_H
+#define USMC_ARROW_H
+
+#include <stdint.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <usmc_archive.h>
+#include <usmc_scan.h>
+
+
+/**
+ * @class USMC_ArrowWriter
+ * Arrow IPC writer. The schema is set by the first batch written:
+ *
+ * telemetry: time (timestamp[us, UTC]), device (int32), position (int32),
+ *            flags (uint32, USMC_STATE_*), divisor (uint8), temp (float32),
+ *            voltage (float32)
+ *
+ * scan:      time (timestamp[us, UTC]), position_N (int32), encoder_N
+ *            (int32, if read), value (float64)
+ *
+ * Scan times are converted from the library clock to wall-clock time, so
+ * scans must be exported by the process that ran them.
+ */
+class USMC_ArrowWriter {
+public:
+    // Constructor and destructor
+    USMC_ArrowWriter();
+    ~USMC_ArrowWriter();
+
+    /**
+     * Create an output file
+     * @param filename the output file.
+     * @param stream if TRUE write the IPC stream format, otherwise the IPC file format (random access).
+     * @return 0 on success, negative error number on error
+     */
+    int open(const char* filename, bool stream = false);
+
+    /**
+     * Terminate the stream (and write the footer of the file format) and close the file
+     * @return 0 on success, negative error number on error
+     */
+    int close();
+
+    /**
+     * Write the samples of a device as a record batch
+     * @param device the device index.
+     * @param series the samples.
+     * @return 0 on success, negative error number on error
+     */
+    int writeTelemetry(int device, const USMC_ArchiveSeries& series);
+
+    /**
+     * Write a time window of all the devices of an archive (a batch for each device)
+     * @param reader an open archive.
+     * @param t0 window start (us).
+     * @param t1 window end (us, excluded).
+     * @return the number of rows written, negative error number on error
+     */
+    int writeArchive(USMC_ArchiveReader& reader, uint64_t t0, uint64_t t1);
+
+    /**
+     * Write scan results as a record batch
+     * @param data the scan results.
+     * @param naxes number of scan axes.
+     * @return 0 on success, negative error number on error
+     */
+    int writeScan(const USMC_ScanData& data, int naxes);
+
+private:
+    // Private copy constructor
+    USMC_ArrowWriter(const USMC_ArrowWriter& obj);
+    USMC_ArrowWriter& operator=(const USMC_ArrowWriter& obj);
+
+    // Column of a batch (data points to the library array, or is NULL for
+    // a column filled with a constant)
+    typedef struct _column {
+        std::string name;
+        int type;
+        const void* data;
+        int32_t constant;
+        int64_t shift;
+    } column;
+
+    // Record block of the file footer
+    typedef struct _block {
+        int64_t offset;
+        int32_t metadata;
+        int64_t body;
+    } block;
+
+    // Write a record batch (and the schema before the first one)
+    int writeBatch(int kind, const std::vector<column>& columns, size_t rows);
+
+    // Write an encapsulated message
+    int writeMessage(const std::vector<uint8_t>& metadata, block* b);
+
+    // Write a column buffer
+    int writeColumn(const column& c, size_t rows);
+
+    // Write raw bytes
+    int write(const void* data, size_t len);
+
+    // Output file
+    FILE* _file;
+    bool _stream;
+    uint64_t _offset;
+    int _result;
+
+    // Schema
+    int _kind;
+    std::vector<column> _schema;
+    std::vector<block> _batches;
+};
+
+#endif
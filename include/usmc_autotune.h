@@ -0,0 +1,127 @@
+/***************************************************//**
+ * @file    usmc_autotune.h
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * Automatic speed and acceleration tuning. Runs back and forth strokes with
+ * increasing speed and then shorter AccelT/DecelT, checking for missed steps
+ * with the encoder or an external position reference, and recommends the
+ * fastest reliable settings with a safety margin.
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#ifndef USMC_AUTOTUNE_H
+#define USMC_AUTOTUNE_H
+
+#include <stdint.h>
+#include <libusmc.h>
+
+/**
+ * External position reference, used when the axis has no encoder
+ * @param user the user pointer given to the tuner.
+ * @param position pointer to store the measured position in steps.
+ * @return 0 on success, negative error number to abort the tuning
+ */
+typedef int (*USMC_ReferenceFn)(void* user, double* position);
+
+
+typedef struct _USMC_AutotuneConfig
+{
+    int device;             // Device index.
+    int stroke;             // Test stroke length (steps, sign gives the direction).
+    float start_speed;      // First speed tested (steps/sec).
+    float max_speed;        // Highest speed tested (steps/sec).
+    float speed_factor;     // Speed increase between tests (> 1).
+    int repeats;            // Back and forth strokes for each setting.
+    double tolerance;       // Largest position error accepted (steps).
+    float margin;           // Safety margin applied to the result (0 < margin <= 1).
+    bool apply;             // Apply the recommended settings at the end.
+    uint32_t poll_us;       // State polling period while waiting for moves.
+    int timeout_ms;         // Timeout of each move (0 - wait forever).
+} USMC_AutotuneConfig;
+
+
+typedef struct _USMC_AutotuneResult
+{
+    float max_speed;              // Highest speed without missed steps (steps/sec).
+    float min_accel;              // Shortest AccelT/DecelT without missed steps (ms).
+    float speed;                  // Recommended speed (steps/sec).
+    USMC_Parameters parameters;   // Recommended parameters.
+    double max_error;             // Largest error measured with accepted settings (steps).
+    int strokes;                  // Number of strokes run.
+    double wall_time;             // Duration of the tuning in seconds.
+} USMC_AutotuneResult;
+
+
+/**
+ * @class USMC_Autotune
+ * Speed and acceleration tuner
+ */
+class USMC_Autotune {
+public:
+    // Constructor
+    USMC_Autotune(USMC* usmc);
+
+    /**
+     * Fill a configuration with default values
+     */
+    static void defaults(USMC_AutotuneConfig* config);
+
+    /**
+     * Set an external position reference (required if the encoder is disabled)
+     */
+    void setReference(USMC_ReferenceFn reference, void* user);
+
+    /**
+     * Run the tuning. The axis returns to its starting position and the
+     * original settings are restored unless config.apply is set. Settings
+     * that fail lose steps, so the axis should be homed again afterwards.
+     * @param config the tuning configuration.
+     * @param result a pointer to a USMC_AutotuneResult structure.
+     * @return 0 on success, negative error number on error
+     */
+    int run(const USMC_AutotuneConfig& config, USMC_AutotuneResult* result);
+
+private:
+    // Read the reference position (steps)
+    int readReference(double& position);
+
+    // Run the strokes of one setting, returning the largest error
+    int test(double& error);
+
+    // Library instance
+    USMC* _usmc;
+
+    // Reference
+    USMC_ReferenceFn _reference;
+    void* _user;
+
+    // Current run
+    USMC_AutotuneConfig _config;
+    bool _encoder;
+    float _enc_mult;
+    int _home;
+    int _strokes;
+};
+
+#endif
@@ -0,0 +1,278 @@
+/***************************************************//**
+ * @file    usmc_c.h
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * C interface to the library, for bindings through a foreign function
+ * interface (Python ctypes, Julia ccall, LabVIEW CLFN...). All the types
+ * are plain C with fixed-size fields and no padding, so they can be mapped
+ * directly (e.g. on numpy structured arrays).
+ *
+ * Besides the per-device calls (usmc_dev_*) there are batch calls
+ * (usmc_ctx_*) working on an array of devices and writing into buffers
+ * owned by the caller, so a foreign runtime crosses the FFI boundary once
+ * per batch instead of once per axis.
+ *
+ * All functions return 0 on success and a negative error number (the
+ * ERR_* codes of libusmc.h) on error. Batch functions return the first
+ * error and, if results is not NULL, store the result of each device.
+ *
+ * When the library records a session (USMC_RECORD), the calls go through
+ * the USMC interface instead of the device handles, so every call of the
+ * context is in the session file.
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#ifndef USMC_C_H
+#define USMC_C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ABI version (incremented on incompatible changes)
+#define USMC_C_ABI_VERSION      1
+
+// Flags of usmc_state
+#define USMC_STATE_LOFT         0x0001
+#define USMC_STATE_FULLPOWER    0x0002
+#define USMC_STATE_CW_CCW       0x0004
+#define USMC_STATE_POWER        0x0008
+#define USMC_STATE_FULLSPEED    0x0010
+#define USMC_STATE_ARESET       0x0020
+#define USMC_STATE_RUN          0x0040
+#define USMC_STATE_SYNCIN       0x0080
+#define USMC_STATE_SYNCOUT      0x0100
+#define USMC_STATE_ROTTR        0x0200
+#define USMC_STATE_ROTTRERR     0x0400
+#define USMC_STATE_EMRESET      0x0800
+#define USMC_STATE_TRAILER1     0x1000
+#define USMC_STATE_TRAILER2     0x2000
+
+// Log levels
+#define USMC_LOG_NONE           0
+#define USMC_LOG_ERROR          1
+#define USMC_LOG_WARN           2
+#define USMC_LOG_INFO           3
+#define USMC_LOG_DEBUG          4
+
+
+// Library context (opaque)
+typedef struct usmc_ctx usmc_ctx;
+
+// Device state (see USMC_State)
+typedef struct usmc_state
+{
+    int32_t cur_pos;    // Current position (in 1/8 steps).
+    float temp;         // Temperature of the power driver.
+    float voltage;      // Input power source voltage.
+    uint32_t flags;     // USMC_STATE_* flags.
+    uint32_t sdivisor;  // Step is divided by this factor.
+} usmc_state;
+
+// Encoder state (see USMC_EncoderState)
+typedef struct usmc_encoder_state
+{
+    int32_t encoder_pos;
+    int32_t ecur_pos;
+} usmc_encoder_state;
+
+// Device mode (see USMC_Mode, booleans are 0 or 1)
+typedef struct usmc_mode
+{
+    uint8_t pmode;
+    uint8_t preg;
+    uint8_t reset_d;
+    uint8_t em_reset;
+    uint8_t tr1t;
+    uint8_t tr2t;
+    uint8_t rot_trt;
+    uint8_t tr_swap;
+    uint8_t tr1_en;
+    uint8_t tr2_en;
+    uint8_t rot_tr_en;
+    uint8_t rot_tr_op;
+    uint8_t butt1t;
+    uint8_t butt2t;
+    uint8_t reset_rt;
+    uint8_t sync_out_en;
+    uint8_t sync_out_r;
+    uint8_t sync_in_op;
+    uint8_t sync_invert;
+    uint8_t encoder_en;
+    uint8_t encoder_inv;
+    uint8_t res_b_enc;
+    uint8_t res_enc;
+    uint8_t reserved;
+    uint32_t sync_count;
+} usmc_mode;
+
+// Device parameters (see USMC_Parameters)
+typedef struct usmc_parameters
+{
+    float accel_t;
+    float decel_t;
+    float p_timeout;
+    float b_timeout1;
+    float b_timeout2;
+    float b_timeout3;
+    float b_timeout4;
+    float b_timeout_r;
+    float b_timeout_d;
+    float min_p;
+    float bto1p;
+    float bto2p;
+    float bto3p;
+    float bto4p;
+    float max_temp;
+    float loft_period;
+    float enc_mult;
+    uint32_t start_pos;
+    uint16_t max_loft;
+    uint16_t rt_delta;
+    uint16_t rt_min_error;
+    uint16_t syn_outp;
+} usmc_parameters;
+
+// Start parameters (see USMC_StartParameters, booleans are 0 or 1)
+typedef struct usmc_start_parameters
+{
+    uint8_t sdivisor;
+    uint8_t def_dir;
+    uint8_t loft_en;
+    uint8_t sl_start;
+    uint8_t wsync_in;
+    uint8_t sync_out_r;
+    uint8_t force_loft;
+    uint8_t reserved;
+} usmc_start_parameters;
+
+
+/**
+ * ABI version of the library
+ */
+int usmc_abi_version(void);
+
+/**
+ * Description of an error number
+ */
+const char* usmc_strerror(int error);
+
+/**
+ * Open the library and probe the USB devices. Only one context can be open
+ * and it cannot be opened while the C++ interface holds the USMC instance.
+ * @return the context, NULL on error
+ */
+usmc_ctx* usmc_ctx_open(void);
+
+/**
+ * Open the library on simulated controllers (see USMC_Simulator)
+ * @param axes number of simulated axes.
+ * @return the context, NULL on error
+ */
+usmc_ctx* usmc_ctx_open_sim(int axes);
+
+/**
+ * Close the library
+ */
+void usmc_ctx_close(usmc_ctx* ctx);
+
+/**
+ * Set the verbosity of the library log (USMC_LOG_*, default USMC_LOG_INFO)
+ */
+void usmc_ctx_set_log_level(usmc_ctx* ctx, int level);
+
+/**
+ * Number of devices
+ */
+int usmc_ctx_count(usmc_ctx* ctx);
+
+/**
+ * Index of a device, given the serial number
+ * @return the index, negative error number if not found
+ */
+int usmc_ctx_find(usmc_ctx* ctx, const char* serial);
+
+/**
+ * Read the state of several devices
+ * @param devices array of device indexes.
+ * @param n number of devices.
+ * @param states array of n states.
+ * @param results array of n results (may be NULL).
+ */
+int usmc_ctx_poll_states(usmc_ctx* ctx, const int* devices, size_t n, usmc_state* states, int* results);
+
+/**
+ * Read the position of several devices
+ * @param positions array of n positions.
+ */
+int usmc_ctx_poll_positions(usmc_ctx* ctx, const int* devices, size_t n, int32_t* positions, int* results);
+
+/**
+ * Read the encoder state of several devices
+ * @param states array of n encoder states.
+ */
+int usmc_ctx_poll_encoders(usmc_ctx* ctx, const int* devices, size_t n, usmc_encoder_state* states, int* results);
+
+/**
+ * Move several devices
+ * @param destinations array of n destinations.
+ */
+int usmc_ctx_move(usmc_ctx* ctx, const int* devices, size_t n, const int32_t* destinations, int* results);
+
+/**
+ * Stop several devices
+ */
+int usmc_ctx_stop(usmc_ctx* ctx, const int* devices, size_t n, int* results);
+
+/**
+ * Set the speed of several devices
+ * @param speeds array of n speeds.
+ */
+int usmc_ctx_set_speeds(usmc_ctx* ctx, const int* devices, size_t n, const float* speeds, int* results);
+
+// Single device calls (see the corresponding USMC methods)
+int usmc_dev_serial(usmc_ctx* ctx, int device, char* serial, size_t len);
+int usmc_dev_version(usmc_ctx* ctx, int device, uint32_t* version);
+int usmc_dev_get_state(usmc_ctx* ctx, int device, usmc_state* state);
+int usmc_dev_get_encoder_state(usmc_ctx* ctx, int device, usmc_encoder_state* state);
+int usmc_dev_get_mode(usmc_ctx* ctx, int device, usmc_mode* mode);
+int usmc_dev_set_mode(usmc_ctx* ctx, int device, const usmc_mode* mode);
+int usmc_dev_get_parameters(usmc_ctx* ctx, int device, usmc_parameters* parameters);
+int usmc_dev_set_parameters(usmc_ctx* ctx, int device, const usmc_parameters* parameters);
+int usmc_dev_get_start_parameters(usmc_ctx* ctx, int device, usmc_start_parameters* start_params);
+int usmc_dev_set_start_parameters(usmc_ctx* ctx, int device, const usmc_start_parameters* start_params);
+int usmc_dev_get_speed(usmc_ctx* ctx, int device, float* speed);
+int usmc_dev_set_speed(usmc_ctx* ctx, int device, float speed);
+int usmc_dev_move(usmc_ctx* ctx, int device, int32_t destination);
+int usmc_dev_stop(usmc_ctx* ctx, int device);
+int usmc_dev_set_position(usmc_ctx* ctx, int device, int32_t position);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,77 @@
+/***************************************************//**
+ * @file    usmc_clock.h
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * Time base used by the library threads (programs, scans, loops).
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#ifndef USMC_CLOCK_H
+#define USMC_CLOCK_H
+
+#include <stdint.h>
+
+/**
+ * @class USMC_clock
+ * Time source. The library uses the system monotonic clock unless another
+ * clock is installed (e.g. the virtual clock of the simulator).
+ */
+class USMC_clock {
+public:
+    // Destructor
+    virtual ~USMC_clock() {}
+
+    // Current time in microseconds
+    virtual uint64_t now_us() = 0;
+
+    // Suspend the calling thread for the given time in microseconds
+    virtual void sleep_us(uint64_t us) = 0;
+};
+
+/**
+ * Install a clock used by usmc_time_us() and usmc_sleep_us()
+ * @param clock the clock (NULL restores the system clock)
+ */
+void usmc_set_clock(USMC_clock* clock);
+
+/**
+ * Get the current time
+ * @return monotonic time in microseconds
+ */
+uint64_t usmc_time_us();
+
+/**
+ * Convert a time of usmc_time_us() to wall-clock time
+ * @param time a time returned by usmc_time_us()
+ * @return microseconds since the epoch
+ */
+uint64_t usmc_wall_time_us(uint64_t time);
+
+/**
+ * Suspend the calling thread
+ * @param us the time to sleep in microseconds
+ */
+void usmc_sleep_us(uint64_t us);
+
+#endif
@@ -0,0 +1,286 @@
+/***************************************************//**
+ * @file    usmc_cycle.h
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * Cyclic exchange mode. At a fixed period the library reads the state of
+ * every device of the cycle and flushes the commands queued since the
+ * previous cycle, with the transfers of all the devices pipelined on the
+ * bus. Clients read the states from the process image and queue commands
+ * without waiting for the USB, like on a fieldbus.
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#ifndef USMC_CYCLE_H
+#define USMC_CYCLE_H
+
+#include <stdint.h>
+#include <vector>
+#include <pthread.h>
+#include <libusmc.h>
+#include <usmc_device.h>
+#include <usmc_mutex.h>
+#include <usmc_transport.h>
+
+
+typedef struct _USMC_CycleStats
+{
+    uint64_t cycles;        // Completed cycles.
+    uint64_t overruns;      // Cycles ending after the start of the next one.
+    uint64_t missed;        // Cycle starts skipped because of overruns.
+    uint64_t errors;        // Failed commands and state reads.
+    uint32_t period;        // Configured period (us).
+    double mean_period;     // Mean achieved period (us).
+    double jitter;          // RMS delay of the cycle start from the schedule (us).
+    double max_jitter;      // Maximum delay of the cycle start from the schedule (us).
+    double mean_exchange;   // Mean duration of the bus exchange (us).
+    double max_exchange;    // Maximum duration of the bus exchange (us).
+    double bus_load;        // Mean fraction of the period spent in the bus exchange.
+    double transfers;       // Mean number of control transfers per cycle.
+    double bytes;           // Mean bytes on the bus per cycle (setup and payload).
+} USMC_CycleStats;
+
+
+/**
+ * Cycle callback, called on the cycle thread after every exchange. States
+ * read with USMC_Cyclic::getState() are those of this cycle and the commands
+ * queued here are flushed at the next one.
+ * @param user the user pointer given to setCallback().
+ * @param cycle the number of the cycle (starting from 1).
+ */
+typedef void (*USMC_CycleFn)(void* user, uint64_t cycle);
+
+
+/**
+ * @class USMC_CycleSink
+ * Receiver of the states read by a USMC_Cyclic (e.g. telemetry stores).
+ * push() is called on the cycle thread for every state read successfully,
+ * so it must not block or allocate memory.
+ */
+class USMC_CycleSink {
+public:
+    // Destructor
+    virtual ~USMC_CycleSink() {}
+
+    /**
+     * Receive a state
+     * @param device the device index.
+     * @param time_us the time of the read (see usmc_time_us()).
+     * @param state the device state.
+     */
+    virtual void push(int device, uint64_t time_us, const USMC_State& state) = 0;
+};
+
+
+struct _USMC_ExchangeSlot;
+
+/**
+ * @class USMC_Cyclic
+ * Cyclic exchange engine. Commands are latched: within a cycle a new move
+ * replaces the pending one and a stop cancels it. Configuration changes are
+ * written before the moves of the same cycle.
+ */
+class USMC_Cyclic {
+public:
+    // Constructor and destructor
+    USMC_Cyclic(USMC* usmc);
+    ~USMC_Cyclic();
+
+    /**
+     * Add a device to the cycle (only while stopped)
+     * @return 0 on success, negative error number on error
+     */
+    int addDevice(int device);
+
+    /**
+     * Set the cycle period (only while stopped, default 5 ms)
+     * @param us the period in microseconds
+     * @return 0 on success, negative error number on error
+     */
+    int setPeriod(uint32_t us);
+
+    /**
+     * Set the cycle callback (only while stopped, NULL to disable)
+     */
+    int setCallback(USMC_CycleFn callback, void* user);
+
+    /**
+     * Add a receiver of the states (only while stopped). The sink must stay
+     * valid while the cycle runs.
+     * @return 0 on success, negative error number on error
+     */
+    int addSink(USMC_CycleSink* sink);
+
+    /**
+     * Start the cycle thread
+     * @return 0 on success, negative error number on error
+     */
+    int start();
+
+    /**
+     * Stop the cycle thread. Pending commands are discarded.
+     */
+    void stop();
+
+    /**
+     * Check if the cycle is running
+     */
+    bool running()const { return _started; }
+
+    /**
+     * Read a device state from the process image
+     * @param state a pointer to a USMC_State structure.
+     * @param cycle optional pointer to store the cycle of the state.
+     * @return the result of the last state read, ERR_USB_NOT_FOUND before the first cycle
+     */
+    int getState(int device, USMC_State* state, uint64_t* cycle = NULL);
+
+    /**
+     * Get the result of the last commands flushed to a device
+     * @return 0 on success, negative error number on error
+     */
+    int getCommandResult(int device);
+
+    /**
+     * Queue a move
+     * @return 0 on success, negative error number on error
+     */
+    int moveTo(int device, int destination);
+
+    /**
+     * Queue a stop (cancels the pending move)
+     * @return 0 on success, negative error number on error
+     */
+    int stopDevice(int device);
+
+    /**
+     * Queue a speed change (applied before the move of the same cycle)
+     * @return 0 on success, negative error number on error
+     */
+    int setSpeed(int device, float speed);
+
+    /**
+     * Queue a change of the start parameters
+     * @return 0 on success, negative error number on error
+     */
+    int setStartParameters(int device, const USMC_StartParameters* start_params);
+
+    /**
+     * Queue a change of the mode (written in the batch of the cycle, before
+     * the move of the same cycle)
+     * @return 0 on success, negative error number on error
+     */
+    int setMode(int device, const USMC_Mode* mode);
+
+    /**
+     * Queue a change of the parameters (written in the batch of the cycle,
+     * invalid parameters cancel the move of the same cycle)
+     * @return 0 on success, negative error number on error
+     */
+    int setParameters(int device, const USMC_Parameters* parameters);
+
+    /**
+     * Get the cycle statistics
+     * @param stats a pointer to a USMC_CycleStats structure.
+     */
+    void getStats(USMC_CycleStats* stats);
+
+    /**
+     * Reset the cycle statistics
+     */
+    void resetStats();
+
+private:
+    // Private copy constructor
+    USMC_Cyclic(const USMC_Cyclic& obj);
+    USMC_Cyclic& operator=(const USMC_Cyclic& obj);
+
+    // Commands of a device to be flushed at the next cycle
+    typedef struct _output {
+        int command;                        // USMC_EXCHANGE_* command.
+        int destination;
+        bool speed_set;
+        float speed;
+        bool start_set;
+        USMC_StartParameters start_params;
+        bool mode_set;
+        USMC_Mode mode;
+        bool params_set;
+        USMC_Parameters params;
+    } output;
+
+    // Thread entry point
+    static void* thread_main(void* arg);
+
+    // Cycle loop
+    void run();
+
+    // Slot of a device (-1 if not in the cycle)
+    int slot(int device)const;
+
+    // Library instance
+    USMC* _usmc;
+
+    // Devices of the cycle (sorted by index) and their handles
+    std::vector<int> _devices;
+    std::vector<USMC_Device> _handles;
+
+    // Exchange buffers
+    struct _USMC_ExchangeSlot* _slots;
+    USMC_TransferRequest* _requests;
+
+    // Pending and flushed commands
+    USMC_mutex _lock;
+    std::vector<output> _pending;
+    std::vector<output> _active;
+
+    // Process image
+    USMC_rwmutex _image_lock;
+    std::vector<USMC_State> _states;
+    std::vector<int> _state_results;
+    std::vector<int> _command_results;
+    uint64_t _cycle;
+
+    // Configuration
+    uint32_t _period;
+    USMC_CycleFn _callback;
+    void* _user;
+    std::vector<USMC_CycleSink*> _sinks;
+
+    // Thread
+    pthread_t _thread;
+    bool _started;
+    volatile bool _stop;
+
+    // Statistics accumulators
+    USMC_mutex _stats_lock;
+    USMC_CycleStats _stats;
+    uint64_t _first_start;
+    uint64_t _last_start;
+    double _sum_jitter2;
+    double _sum_exchange;
+    double _sum_transfers;
+    double _sum_bytes;
+};
+
+#endif
@@ -0,0 +1,183 @@
+/***************************************************//**
+ * @file    usmc_device.h
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * Per-device handle. A USMC_Device is obtained once from USMC::getDevice()
+ * and keeps a direct pointer to the library record of the device, so its
+ * calls skip the virtual dispatch and the ID check of the index-based
+ * interface. Cached values are read inline and moveTo() sends a goto
+ * command pre-encoded when the speed or the start parameters change.
+ *
+ * Handles stay valid until USMC::shutdown(). Calls made through a handle
+ * are not seen by a USMC_recorder.
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#ifndef USMC_DEVICE_H
+#define USMC_DEVICE_H
+
+#include <stdint.h>
+#include <string>
+#include <libusmc.h>
+#include <usmc_mutex.h>
+
+
+// Library record of an open device
+typedef struct _USMC_DeviceRecord
+{
+    int id;                             // Device index.
+    void* handle;                       // Transport handle.
+    USMC_mutex lock;                    // Serializes the USB access.
+    USMC_mutex config_lock;             // Serializes the configuration writes.
+    USMC_rwmutex cache_lock;            // Protects the cached configuration.
+    uint32_t version;                   // Firmware version.
+    std::string serial;                 // Serial number (cache_lock, changed by provisioning).
+    std::string path;                   // Bus path.
+    float speed;                        // Speed (steps/sec).
+    USMC_Parameters params;             // Cached parameters.
+    USMC_Mode mode;                     // Cached mode.
+    USMC_StartParameters start_params;  // Cached start parameters.
+    uint8_t goto_data[3];               // Pre-encoded goto payload (speed and start parameters).
+} USMC_DeviceRecord;
+
+
+class USMC_impl;
+
+/**
+ * @class USMC_Device
+ * Direct handle to a device
+ */
+class USMC_Device {
+public:
+    // Constructor (invalid handle)
+    USMC_Device() : _impl(NULL), _dev(NULL) {}
+
+    /**
+     * Check if the handle refers to a device
+     */
+    bool valid()const { return NULL != _dev; }
+
+    /**
+     * Device index in the USMC interface
+     */
+    int id()const { return _dev->id; }
+
+    /**
+     * Serial number
+     */
+    std::string serial()const {
+        USMC_read_lock cache_lock(&_dev->cache_lock);
+        return _dev->serial;
+    }
+
+    /**
+     * Bus path
+     */
+    const std::string& path()const { return _dev->path; }
+
+    /**
+     * Firmware version
+     */
+    uint32_t version()const { return _dev->version; }
+
+    /**
+     * Current speed (steps/sec)
+     */
+    float speed()const {
+        USMC_read_lock cache_lock(&_dev->cache_lock);
+        return _dev->speed;
+    }
+
+    /**
+     * Copy of the cached mode
+     */
+    void getMode(USMC_Mode& mode)const {
+        USMC_read_lock cache_lock(&_dev->cache_lock);
+        mode = _dev->mode;
+    }
+
+    /**
+     * Copy of the cached parameters
+     */
+    void getParameters(USMC_Parameters& parameters)const {
+        USMC_read_lock cache_lock(&_dev->cache_lock);
+        parameters = _dev->params;
+    }
+
+    /**
+     * Copy of the cached start parameters
+     */
+    void getStartParameters(USMC_StartParameters& start_params)const {
+        USMC_read_lock cache_lock(&_dev->cache_lock);
+        start_params = _dev->start_params;
+    }
+
+    /**
+     * Set the speed and pre-encode the goto command
+     * @see USMC::setSpeed
+     */
+    int setSpeed(float speed);
+
+    /**
+     * Set the start parameters and pre-encode the goto command
+     * @see USMC::setStartParameters
+     */
+    int setStartParameters(const USMC_StartParameters* start_params);
+
+    /**
+     * Read the device state
+     * @see USMC::getState
+     */
+    int getState(USMC_State* state);
+
+    /**
+     * Read the encoder state
+     * @see USMC::getEncoderState
+     */
+    int getEncoderState(USMC_EncoderState* state);
+
+    /**
+     * Move to position with the pre-encoded goto command
+     * @see USMC::moveTo
+     */
+    int moveTo(int destination);
+
+    /**
+     * Stop the device
+     * @see USMC::stop
+     */
+    int stop();
+
+private:
+    // Library and record
+    USMC_impl* _impl;
+    USMC_DeviceRecord* _dev;
+
+    friend class USMC_impl;
+    friend class USMC_Cyclic;
+    friend class USMC_PathExecutor;
+    friend class USMC_Provisioner;
+};
+
+#endif
@@ -0,0 +1,153 @@
+/***************************************************//**
+ * @file    usmc_fault.h
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * Fault injection transport. Wraps another transport (USB or simulator) and
+ * injects timeouts, disconnections, pipe errors, short reads, extra latency
+ * and devices disappearing during a move, to exercise the error paths.
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#ifndef USMC_FAULT_H
+#define USMC_FAULT_H
+
+#include <stdint.h>
+#include <vector>
+#include <usmc_mutex.h>
+#include <usmc_transport.h>
+
+
+typedef struct _USMC_FaultConfig
+{
+    double timeout;             // Probability of a timeout (the transfer blocks for its timeout).
+    double no_device;           // Probability of a NO_DEVICE error.
+    double pipe;                // Probability of a PIPE error.
+    double short_read;          // Probability of a short read (IN requests).
+    uint32_t latency_min;       // Minimum added latency (us).
+    uint32_t latency_max;       // Maximum added latency (us).
+    double disappear;           // Probability that a device disappears after a move request.
+    uint32_t disappear_delay;   // Time after the move request when the device disappears (us).
+    int request;                // Inject only on this bRequest (-1 - all requests).
+    uint64_t seed;              // Random generator seed.
+} USMC_FaultConfig;
+
+
+typedef struct _USMC_FaultStats
+{
+    uint64_t transfers;         // Transfers requested.
+    uint64_t timeouts;          // Injected timeouts.
+    uint64_t no_device;         // Injected NO_DEVICE errors (including disappeared devices).
+    uint64_t pipe;              // Injected PIPE errors.
+    uint64_t short_reads;       // Injected short reads.
+    uint64_t disappeared;       // Devices disappeared.
+    uint64_t latency;           // Total added latency (us).
+} USMC_FaultStats;
+
+
+/**
+ * @class USMC_fault_transport
+ * Transport wrapper injecting faults
+ */
+class USMC_fault_transport : public USMC_transport {
+public:
+    // Constructor (the wrapped transport is not owned)
+    USMC_fault_transport(USMC_transport* transport);
+    virtual ~USMC_fault_transport();
+
+    /**
+     * Fill a configuration with default values (no faults)
+     */
+    static void defaults(USMC_FaultConfig* config);
+
+    /**
+     * Set the fault configuration (also reseeds the random generator)
+     */
+    void configure(const USMC_FaultConfig& config);
+
+    /**
+     * Enable or disable fault injection
+     */
+    void enable(bool en);
+
+    /**
+     * Make a device disappear now (index in the order of open, closed
+     * devices keep their index and give ERR_INVALID_ID)
+     */
+    int disconnect(int device);
+
+    /**
+     * Bring back a disappeared device
+     */
+    int reconnect(int device);
+
+    /**
+     * Get the fault counters
+     */
+    void getStats(USMC_FaultStats* stats);
+
+    /**
+     * Reset the fault counters
+     */
+    void resetStats();
+
+    // Transport interface
+    virtual int open(std::vector<void*>& handles, void (*logger)(const char*, ...));
+    virtual void close(void* handle);
+    virtual int control_transfer(void* handle, uint8_t bRequestType, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, uint8_t* data, uint16_t wLength, unsigned int timeout);
+    virtual const char* strerror(int error);
+    virtual std::string path(void* handle);
+    virtual USMC_clock* clock();
+
+private:
+    // Private copy constructor
+    USMC_fault_transport(const USMC_fault_transport& obj);
+    USMC_fault_transport& operator=(const USMC_fault_transport& obj);
+
+    // Wrapped device
+    typedef struct _device {
+        void* handle;
+        bool gone;
+        bool pending;           // Will disappear at gone_at
+        uint64_t gone_at;
+    } device;
+
+    // Random number in [0, 1)
+    double random();
+
+    // Check if a fault with the given probability happens
+    bool happens(double probability);
+
+    // Wrapped transport
+    USMC_transport* _transport;
+
+    // Configuration and state (protected by _lock)
+    USMC_mutex _lock;
+    USMC_FaultConfig _config;
+    bool _enabled;
+    uint64_t _state;
+    USMC_FaultStats _stats;
+    std::vector<device*> _devices;
+};
+
+#endif
@@ -0,0 +1,168 @@
+/***************************************************//**
+ * @file    usmc_feedback.h
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * External feedback loop. The library reads an external sensor through a
+ * callback and runs PID corrections on its own thread at a fixed rate
+ * (e.g. beam pointing stabilization with a camera driving two axes). The
+ * corrections retarget the axes while they move, so a new correction does
+ * not wait for the previous one to complete.
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#ifndef USMC_FEEDBACK_H
+#define USMC_FEEDBACK_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <libusmc.h>
+#include <usmc_device.h>
+#include <usmc_mutex.h>
+
+// Maximum number of axes of a feedback loop
+#define USMC_MAX_FB_AXES      4
+
+
+/**
+ * Sensor callback of the feedback loop
+ * @param user the user pointer given to the loop.
+ * @param error array where the error of each axis (setpoint - measurement, in sensor units) is stored.
+ * @param naxes number of axes.
+ * @return 0 on success, 1 if no new measurement is available (the iteration is skipped), negative error number to stop the loop
+ */
+typedef int (*USMC_SensorFn)(void* user, double* error, int naxes);
+
+
+typedef struct _USMC_FeedbackConfig
+{
+    int naxes;                                  // Number of axes.
+    int device[USMC_MAX_FB_AXES];               // Device index of each axis.
+    double kp[USMC_MAX_FB_AXES];                // Proportional gain (steps per sensor unit).
+    double ki[USMC_MAX_FB_AXES];                // Integral gain (steps per sensor unit and second).
+    double kd[USMC_MAX_FB_AXES];                // Derivative gain (steps per sensor unit per second).
+    double deadband[USMC_MAX_FB_AXES];          // Errors smaller than this (sensor units) are not corrected.
+    double integral_limit[USMC_MAX_FB_AXES];    // Anti-windup bound of the integral term (steps, 0 - unlimited).
+    int max_step[USMC_MAX_FB_AXES];             // Largest correction per iteration (steps, 0 - unlimited).
+    int min[USMC_MAX_FB_AXES];                  // Lower position limit (steps).
+    int max[USMC_MAX_FB_AXES];                  // Upper position limit (steps, min >= max disables the limits).
+    float speed[USMC_MAX_FB_AXES];              // Speed of the corrections (steps/sec).
+    uint32_t period_us;                         // Loop period.
+} USMC_FeedbackConfig;
+
+
+typedef struct _USMC_FeedbackStats
+{
+    bool running;                       // TRUE while the loop is running.
+    int result;                         // Result of the loop (0 or the error that stopped it).
+    uint64_t iterations;                // Loop iterations.
+    uint64_t corrections;               // Moves commanded.
+    uint64_t deadband;                  // Axis iterations inside the dead-band.
+    uint64_t no_data;                   // Iterations without a new measurement.
+    uint64_t overruns;                  // Iterations longer than the period.
+    double rate;                        // Achieved loop rate (Hz).
+    double mean_sensor;                 // Mean duration of the sensor callback (us).
+    double mean_latency;                // Mean time from the measurement to the last move sent (us).
+    double max_latency;                 // Maximum time from the measurement to the last move sent (us).
+    double rms_error[USMC_MAX_FB_AXES]; // RMS error of each axis (sensor units).
+    double last_error[USMC_MAX_FB_AXES];// Last error of each axis (sensor units).
+    int target[USMC_MAX_FB_AXES];       // Last target of each axis (steps).
+} USMC_FeedbackStats;
+
+
+/**
+ * @class USMC_FeedbackLoop
+ * PID feedback loop on an external sensor. The output of the controller is
+ * an offset from the position of the axes when the loop starts.
+ */
+class USMC_FeedbackLoop {
+public:
+    // Constructor and destructor
+    USMC_FeedbackLoop(USMC* usmc);
+    ~USMC_FeedbackLoop();
+
+    /**
+     * Fill a configuration with default values
+     */
+    static void defaults(USMC_FeedbackConfig* config);
+
+    /**
+     * Start the loop
+     * @param config the loop configuration.
+     * @param sensor the sensor callback (called on the loop thread).
+     * @param user user pointer passed to the callback.
+     * @return 0 on success, negative error number on error
+     */
+    int start(const USMC_FeedbackConfig& config, USMC_SensorFn sensor, void* user);
+
+    /**
+     * Stop the loop. The axes are stopped and their speed restored.
+     * @return the loop result
+     */
+    int stop();
+
+    /**
+     * Get the loop statistics
+     * @param stats a pointer to a USMC_FeedbackStats structure.
+     */
+    void getStats(USMC_FeedbackStats* stats);
+
+private:
+    // Private copy constructor
+    USMC_FeedbackLoop(const USMC_FeedbackLoop& obj);
+    USMC_FeedbackLoop& operator=(const USMC_FeedbackLoop& obj);
+
+    // Thread entry point
+    static void* thread_main(void* arg);
+
+    // Loop
+    int run();
+
+    // Library instance
+    USMC* _usmc;
+
+    // Configuration
+    USMC_FeedbackConfig _config;
+    USMC_SensorFn _sensor;
+    void* _user;
+    USMC_Device _handles[USMC_MAX_FB_AXES];
+    int _origin[USMC_MAX_FB_AXES];
+    float _saved_speed[USMC_MAX_FB_AXES];
+
+    // Thread
+    pthread_t _thread;
+    bool _started;
+    volatile bool _stop;
+
+    // Statistics
+    USMC_mutex _lock;
+    USMC_FeedbackStats _stats;
+    uint64_t _start_time;
+    uint64_t _last_time;
+    double _sum_sensor;
+    double _sum_latency;
+    uint64_t _latency_count;
+    double _sum_error2[USMC_MAX_FB_AXES];
+};
+
+#endif
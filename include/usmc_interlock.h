@@ -0,0 +1,113 @@
+/***************************************************//**
+ * @file    usmc_interlock.h
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * Collision interlock between axes sharing physical space. Each exclusion
+ * zone forbids axis A to be inside [minA, maxA] while axis B is inside
+ * [minB, maxB]. Every axis tracks the interval it may currently occupy
+ * (hull of the last measured position and the commanded targets), so a
+ * move is checked against both targets and live positions.
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#ifndef USMC_INTERLOCK_H
+#define USMC_INTERLOCK_H
+
+#include <stdint.h>
+#include <vector>
+#include <usmc_mutex.h>
+
+// Maximum number of exclusion zones a single axis can take part in
+#define USMC_MAX_AXIS_ZONES   8
+
+
+class USMC_interlock {
+public:
+    // Constructor and destructor
+    USMC_interlock();
+    ~USMC_interlock();
+
+    // Add tracking for a newly probed axis
+    void addAxis();
+
+    // Remove all axes and zones
+    void clear();
+
+    // Add an exclusion zone (returns the zone index or a negative error)
+    int addZone(int devA, int minA, int maxA, int devB, int minB, int maxB);
+
+    // Remove all exclusion zones
+    void clearZones();
+
+    // Check a move against the zones and reserve its path (returns ERR_INTERLOCK on conflict)
+    int reserve(int device, int destination);
+
+    // Take a snapshot of the command sequence before reading the device state
+    uint32_t snapshot(int device);
+
+    // Update the axis interval with a measured position
+    void update(int device, uint32_t seq, int position, bool running);
+
+    // Forget the axis position (e.g. after a change of coordinates)
+    void invalidate(int device);
+
+    // Check if the axis takes part in any exclusion zone
+    bool involved(int device);
+
+private:
+    // Private copy constructor
+    USMC_interlock(const USMC_interlock& obj);
+    USMC_interlock& operator=(const USMC_interlock& obj);
+
+    // Exclusion zone
+    typedef struct _zone {
+        int dev[2];
+        int min[2];
+        int max[2];
+    } zone;
+
+    // Per axis tracking record
+    typedef struct _axis {
+        USMC_mutex lock;
+        bool known;        // False until the first measured position
+        int lo;            // Lower bound of the interval the axis may occupy
+        int hi;            // Upper bound of the interval the axis may occupy
+        int target;        // Last commanded destination
+        uint32_t seq;      // Command sequence number
+        int nzones;
+        int zones[USMC_MAX_AXIS_ZONES];
+    } axis;
+
+    // Check if two intervals overlap
+    static bool overlap(int lo1, int hi1, int lo2, int hi2) { return lo1 <= hi2 && lo2 <= hi1; }
+
+    // Zone configuration lock (exclusive only while zones are edited)
+    USMC_rwmutex _config;
+
+    // Zones and axes
+    std::vector<zone> _zones;
+    std::vector<axis*> _axes;
+};
+
+#endif
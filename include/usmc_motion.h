@@ -0,0 +1,116 @@
+/***************************************************//**
+ * @file    usmc_motion.h
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * Motion time model and motion helpers shared by the scan engines.
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#ifndef USMC_MOTION_H
+#define USMC_MOTION_H
+
+#include <stdint.h>
+#include <libusmc.h>
+
+
+/**
+ * Measurement callback used by the scan engines
+ * @param user the user pointer given to the engine.
+ * @param value pointer to store the measured value (larger is better for optimizations).
+ * @return 0 on success, negative error number to abort the scan
+ */
+typedef int (*USMC_MeasureFn)(void* user, double* value);
+
+
+/**
+ * @class USMC_MotionModel
+ * Trapezoidal move time model of one axis. With slow start enabled the axis
+ * ramps up to speed in AccelT and down in DecelT, otherwise it starts and
+ * stops at full speed. Short moves use a triangular profile.
+ */
+class USMC_MotionModel {
+public:
+    // Constructor
+    USMC_MotionModel();
+
+    /**
+     * Load the model parameters of a device
+     * @return 0 on success, negative error number on error
+     */
+    int load(USMC* usmc, int device);
+
+    /**
+     * Set the model parameters
+     * @param speed speed in steps/sec.
+     * @param accel acceleration time in ms.
+     * @param decel deceleration time in ms.
+     * @param slow_start TRUE if slow start/stop mode is enabled.
+     */
+    void set(float speed, float accel, float decel, bool slow_start);
+
+    /**
+     * Set the fixed overhead of each move (command and settling time)
+     * @param seconds overhead in seconds
+     */
+    void setOverhead(double seconds) { _overhead = seconds; }
+
+    /**
+     * Estimate the duration of a move
+     * @param distance the move distance in steps (sign is ignored)
+     * @return the estimated time in seconds (0 for a null move)
+     */
+    double moveTime(int distance)const;
+
+    /**
+     * Estimate the duration of a move between two positions
+     * @return the estimated time in seconds
+     */
+    double moveTime(int from, int to)const { return moveTime(to - from); }
+
+    /**
+     * Get the modelled speed in steps/sec
+     */
+    float speed()const { return _speed; }
+
+private:
+    float _speed;
+    float _accel;
+    float _decel;
+    bool _slow_start;
+    double _overhead;
+};
+
+
+/**
+ * Wait for a device to stop
+ * @param usmc the library instance.
+ * @param device the index of the desired device.
+ * @param poll_us the polling period in microseconds.
+ * @param timeout_ms timeout in milliseconds (0 to wait forever).
+ * @param state optional pointer to store the final state.
+ * @return 0 on success, negative error number on error
+ */
+int usmc_wait_idle(USMC* usmc, int device, uint32_t poll_us, int timeout_ms, USMC_State* state = NULL);
+
+#endif
@@ -30,6 +30,7 @@
 #ifndef USMC_MUTEX_H
 #define USMC_MUTEX_H
 
+#include <stdint.h>
 #include <pthread.h>
 
 
@@ -43,8 +44,20 @@ public:
     void acquire();
     void release();
 
+    // Contention counters (may be read from any thread)
+    uint64_t acquisitions()const { return __atomic_load_n(&_acquisitions, __ATOMIC_RELAXED); }
+    uint64_t contended()const { return __atomic_load_n(&_contended, __ATOMIC_RELAXED); }
+    uint64_t wait_ns()const { return __atomic_load_n(&_wait_ns, __ATOMIC_RELAXED); }
+    bool locked()const { return __atomic_load_n(&_locked, __ATOMIC_RELAXED); }
+
 private:
     pthread_mutex_t _mutex;
+
+    // Counters, written only by the owner
+    uint64_t _acquisitions;
+    uint64_t _contended;
+    uint64_t _wait_ns;
+    bool _locked;
 };
 
 
@@ -58,4 +71,42 @@ private:
     USMC_mutex* _mutex;
 };
 
+
+class USMC_rwmutex {
+public:
+    // Constructor and destructor
+    USMC_rwmutex();
+    ~USMC_rwmutex();
+
+    // Acquire and release methods
+    void acquire_read();
+    void acquire_write();
+    void release();
+
+private:
+    pthread_rwlock_t _rwlock;
+};
+
+
+class USMC_read_lock {
+public:
+    // Constructor and destructor
+    USMC_read_lock(USMC_rwmutex* mutex);
+    ~USMC_read_lock();
+
+private:
+    USMC_rwmutex* _mutex;
+};
+
+
+class USMC_write_lock {
+public:
+    // Constructor and destructor
+    USMC_write_lock(USMC_rwmutex* mutex);
+    ~USMC_write_lock();
+
+private:
+    USMC_rwmutex* _mutex;
+};
+
 #endif
@@ -0,0 +1,196 @@
+/***************************************************//**
+ * @file    usmc_nexus.h
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * NeXus/HDF5 scan output. Every scan becomes an NXentry with an NXdata
+ * group holding the timestamps, positions, encoder readings, measured
+ * value and user detector channels as chunked, extensible datasets. The
+ * points are queued in a bounded buffer and written by a background
+ * thread, so the scan never waits for the disk.
+ *
+ * Optional: built only when HDF5 is found.
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#ifndef USMC_NEXUS_H
+#define USMC_NEXUS_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <libusmc.h>
+#include <usmc_mutex.h>
+#include <usmc_scan.h>
+
+// Maximum number of user detector channels
+#define USMC_MAX_DETECTORS    8
+
+// Default dataset chunk (points)
+#define USMC_NEXUS_CHUNK      4096
+
+// Default size of the point buffer
+#define USMC_NEXUS_BUFFER     65536
+
+
+typedef struct _USMC_NexusStats
+{
+    uint64_t scans;         // Scans started.
+    uint64_t points;        // Points written to the file.
+    uint32_t max_queued;    // Largest number of points waiting in the buffer.
+    uint64_t writes;        // Dataset writes.
+    double max_write;       // Longest dataset write (us).
+    int result;             // Write result (0 or the first error).
+} USMC_NexusStats;
+
+
+/**
+ * @class USMC_NexusSink
+ * Scan sink writing NeXus files. If the buffer fills up the point is
+ * refused with ERR_USB_OVERFLOW and the scan is aborted, so that no point
+ * is silently lost.
+ */
+class USMC_NexusSink : public USMC_ScanSink {
+public:
+    // Constructor and destructor
+    USMC_NexusSink();
+    virtual ~USMC_NexusSink();
+
+    /**
+     * Create a file and start the writer thread
+     * @param filename the output file.
+     * @param chunk dataset chunk size (points).
+     * @param buffer size of the point buffer.
+     * @return 0 on success, negative error number on error
+     */
+    int open(const char* filename, uint32_t chunk = USMC_NEXUS_CHUNK, uint32_t buffer = USMC_NEXUS_BUFFER);
+
+    /**
+     * Write the buffered points and close the file
+     * @return 0 on success, negative error number on error
+     */
+    int close();
+
+    /**
+     * Set the user detector channels (before open())
+     * @param n number of channels.
+     * @param names dataset names of the channels.
+     * @return 0 on success, negative error number on error
+     */
+    int setDetectors(int n, const char* const* names);
+
+    /**
+     * Set the value of a detector channel for the next point (call it from
+     * the measurement callback)
+     */
+    void detector(int i, double value);
+
+    /**
+     * Get the writer statistics
+     * @param stats a pointer to a USMC_NexusStats structure.
+     */
+    void getStats(USMC_NexusStats* stats);
+
+    // USMC_ScanSink interface
+    virtual int begin(const USMC_ScanConfig& config);
+    virtual int point(uint64_t time, const int* position, const int* encoder, double value);
+    virtual void end(int result);
+
+private:
+    // Private copy constructor
+    USMC_NexusSink(const USMC_NexusSink& obj);
+    USMC_NexusSink& operator=(const USMC_NexusSink& obj);
+
+    // Buffered record (start of scan, point or end of scan)
+    typedef struct _record {
+        int kind;
+        int naxes;
+        uint64_t time;
+        int position[USMC_MAX_SCAN_AXES];
+        int encoder[USMC_MAX_SCAN_AXES];
+        double value;
+        double detector[USMC_MAX_DETECTORS];
+    } record;
+
+    // Queue a record
+    int enqueue(const record& r);
+
+    // Thread entry point
+    static void* thread_main(void* arg);
+
+    // Writer loop
+    void run();
+
+    // Create the groups and datasets of a scan
+    void createEntry(const record& r);
+
+    // Close the current scan
+    void closeEntry(int result);
+
+    // Append the staged points to the datasets
+    void flush();
+
+    // Output file (HDF5 identifiers)
+    int64_t _file;
+    int64_t _entry;
+    int64_t _datasets[2 + 2 * USMC_MAX_SCAN_AXES + USMC_MAX_DETECTORS];
+    int _ndatasets;
+    uint32_t _chunk;
+    int _scan;
+
+    // Detector channels
+    int _ndetectors;
+    std::vector<std::string> _names;
+    double _staged[USMC_MAX_DETECTORS];
+
+    // Record queue (single producer, single consumer)
+    std::vector<record> _queue;
+    uint32_t _head;
+    uint32_t _tail;
+    uint32_t _max_queued;
+    int _result;
+
+    // Points staged by the writer thread, column by column
+    std::vector<uint64_t> _time;
+    std::vector<int> _position[USMC_MAX_SCAN_AXES];
+    std::vector<int> _encoder[USMC_MAX_SCAN_AXES];
+    std::vector<double> _value;
+    std::vector<double> _detector[USMC_MAX_DETECTORS];
+    size_t _staged_points;
+    uint64_t _written;
+    int64_t _wall_offset;   // Wall-clock offset of the open entry.
+    int _naxes;
+    bool _read_encoder;
+
+    // Thread
+    pthread_t _thread;
+    bool _started;
+    volatile bool _stop;
+
+    // Statistics
+    USMC_mutex _lock;
+    USMC_NexusStats _stats;
+};
+
+#endif
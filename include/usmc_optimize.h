@@ -0,0 +1,135 @@
+/***************************************************//**
+ * @file    usmc_optimize.h
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * Peak search (autofocus, beam alignment). Maximizes a user measurement by
+ * golden-section or parabolic search along one axis, or by coordinate-wise
+ * search along several axes.
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#ifndef USMC_OPTIMIZE_H
+#define USMC_OPTIMIZE_H
+
+#include <stdint.h>
+#include <vector>
+#include <libusmc.h>
+#include <usmc_motion.h>
+
+// Maximum number of axes of an optimization
+#define USMC_MAX_OPT_AXES     8
+
+// Search methods
+#define USMC_OPT_GOLDEN       0   // Golden-section search down to the tolerance
+#define USMC_OPT_PARABOLIC    1   // Golden-section bracketing followed by a parabolic interpolation step
+
+
+typedef struct _USMC_OptimizeConfig
+{
+    int naxes;                          // Number of axes to optimize.
+    int device[USMC_MAX_OPT_AXES];      // Device index of each axis.
+    int min[USMC_MAX_OPT_AXES];         // Lower search bound (steps).
+    int max[USMC_MAX_OPT_AXES];         // Upper search bound (steps).
+    int tolerance[USMC_MAX_OPT_AXES];   // Final bracket width (steps).
+    int method;                         // USMC_OPT_GOLDEN or USMC_OPT_PARABOLIC.
+    int backlash;                       // Overshoot (steps) used to approach every point from the same side (0 to disable).
+    bool approach_positive;             // Approach direction (TRUE - from lower positions).
+    int max_sweeps;                     // Maximum number of coordinate-wise passes.
+    int max_evaluations;                // Maximum number of measurements (0 - unlimited).
+    uint32_t poll_us;                   // State polling period while waiting for moves.
+    int timeout_ms;                     // Timeout of each move (0 - wait forever).
+} USMC_OptimizeConfig;
+
+
+typedef struct _USMC_OptimizeResult
+{
+    int position[USMC_MAX_OPT_AXES];    // Best position found.
+    double value;                       // Measurement at the best position.
+    int evaluations;                    // Number of measurements.
+    int moves;                          // Number of moves commanded.
+    double wall_time;                   // Duration of the search in seconds.
+    double model_time;                  // Motion time estimated by the motion model in seconds.
+} USMC_OptimizeResult;
+
+
+/**
+ * @class USMC_Optimizer
+ * Peak search engine
+ */
+class USMC_Optimizer {
+public:
+    // Constructor
+    USMC_Optimizer(USMC* usmc);
+
+    /**
+     * Fill a configuration with default values
+     */
+    static void defaults(USMC_OptimizeConfig* config);
+
+    /**
+     * Run the optimization. The axes are left at the best position.
+     * @param config the search configuration.
+     * @param measure the measurement callback.
+     * @param user user pointer passed to the callback.
+     * @param result a pointer to a USMC_OptimizeResult structure.
+     * @return 0 on success, negative error number on error
+     */
+    int run(const USMC_OptimizeConfig& config, USMC_MeasureFn measure, void* user, USMC_OptimizeResult* result);
+
+private:
+    // Evaluated point
+    typedef struct _sample {
+        int x;
+        double f;
+    } sample;
+
+    // Line search along one axis within [lo, hi]
+    int search(int axis, int lo, int hi, int& best, double& fbest);
+
+    // Move one axis approaching from the configured side
+    int moveAxis(int axis, int position);
+
+    // Estimated time to reach a position approaching from the configured side
+    double approachTime(int axis, int from, int to)const;
+
+    // Move and measure
+    int evaluate(int axis, int position, double& value);
+
+    // Check if the evaluation budget is exhausted
+    bool exhausted()const { return _config.max_evaluations > 0 && _result.evaluations >= _config.max_evaluations; }
+
+    // Library instance
+    USMC* _usmc;
+
+    // Current run
+    USMC_OptimizeConfig _config;
+    USMC_MeasureFn _measure;
+    void* _user;
+    int _pos[USMC_MAX_OPT_AXES];
+    USMC_MotionModel _model[USMC_MAX_OPT_AXES];
+    std::vector<sample> _samples;
+    USMC_OptimizeResult _result;
+};
+
+#endif
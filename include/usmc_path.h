@@ -0,0 +1,342 @@
+/***************************************************//**
+ * @file    usmc_path.h
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * Trajectory files and their executor. A path is a binary file of fixed-size
+ * points (one position per axis, optional speed and flags) that is memory
+ * mapped instead of loaded, so paths with millions of points open at once
+ * and only the pages around the execution cursor stay resident. The executor
+ * encodes the goto packets of a window of points ahead of the cursor and
+ * sends the moves of each point to all the axes in one pipelined batch.
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#ifndef USMC_PATH_H
+#define USMC_PATH_H
+
+#include <stdint.h>
+#include <cstdio>
+#include <vector>
+#include <pthread.h>
+#include <libusmc.h>
+#include <usmc_device.h>
+#include <usmc_mutex.h>
+#include <usmc_transport.h>
+
+// Maximum number of axes of a path
+#define USMC_MAX_PATH_AXES    8
+
+// Optional fields of the points
+#define USMC_PATH_SPEED       0x01  // Speed of the moves to the point (steps/sec, 0 - device speed).
+#define USMC_PATH_FLAGS       0x02  // Point flags (USMC_POINT_*).
+
+// Point flags
+#define USMC_POINT_NOWAIT     0x01  // Send the next point without waiting for the axes to stop.
+#define USMC_POINT_CALLBACK   0x02  // Call the point callback when the axes stop (with NOWAIT, as soon as the moves are sent).
+
+// Default number of points encoded ahead of the execution cursor
+#define USMC_PATH_WINDOW      256
+
+
+/**
+ * Point callback of the executor. It is called on the executor thread after
+ * the axes stopped at the point or, if the point also has USMC_POINT_NOWAIT,
+ * right after its moves are sent, while the axes are still moving (e.g. to
+ * trigger an acquisition at the start of a continuous segment).
+ * @param user the user pointer given to setCallback().
+ * @param point the index of the point.
+ * @return 0 on success, negative error number to abort the path
+ */
+typedef int (*USMC_PathFn)(void* user, uint64_t point);
+
+
+/**
+ * @class USMC_PathWriter
+ * Writer of path files
+ */
+class USMC_PathWriter {
+public:
+    // Constructor and destructor
+    USMC_PathWriter();
+    ~USMC_PathWriter();
+
+    /**
+     * Create a path file
+     * @param filename the path file.
+     * @param naxes number of axes.
+     * @param fields optional fields of the points (USMC_PATH_*).
+     * @return 0 on success, negative error number on error
+     */
+    int open(const char* filename, int naxes, uint32_t fields = 0);
+
+    /**
+     * Append a point
+     * @param position the position of each axis (steps).
+     * @param speed the speed of the moves (steps/sec, 0 - device speed).
+     * @param flags the point flags (USMC_POINT_*).
+     * @return 0 on success, negative error number on error
+     */
+    int add(const int* position, float speed = 0.0f, uint32_t flags = 0);
+
+    /**
+     * Write the number of points and close the file
+     * @return 0 on success, negative error number on error
+     */
+    int close();
+
+private:
+    // Private copy constructor
+    USMC_PathWriter(const USMC_PathWriter& obj);
+    USMC_PathWriter& operator=(const USMC_PathWriter& obj);
+
+    FILE* _file;
+    int _naxes;
+    uint32_t _fields;
+    uint64_t _points;
+    int _result;
+};
+
+
+/**
+ * @class USMC_Path
+ * Memory-mapped path file (read only)
+ */
+class USMC_Path {
+public:
+    // Constructor and destructor
+    USMC_Path();
+    ~USMC_Path();
+
+    /**
+     * Map a path file
+     * @return 0 on success, negative error number on error
+     */
+    int open(const char* filename);
+
+    /**
+     * Unmap the file
+     */
+    void close();
+
+    /**
+     * Number of points
+     */
+    uint64_t size()const { return _points; }
+
+    /**
+     * Number of axes
+     */
+    int naxes()const { return _naxes; }
+
+    /**
+     * Optional fields of the points (USMC_PATH_*)
+     */
+    uint32_t fields()const { return _fields; }
+
+    /**
+     * Position of an axis at a point (steps)
+     */
+    int position(uint64_t point, int axis)const { return record(point)[axis]; }
+
+    /**
+     * Speed of the moves to a point (steps/sec, 0 - device speed)
+     */
+    float speed(uint64_t point)const;
+
+    /**
+     * Flags of a point (USMC_POINT_*)
+     */
+    uint32_t flags(uint64_t point)const;
+
+    /**
+     * Ask the kernel to read a range of points ahead
+     */
+    void prefetch(uint64_t first, uint64_t last)const;
+
+    /**
+     * Drop the pages of a range of points already used
+     */
+    void release(uint64_t first, uint64_t last)const;
+
+private:
+    // Private copy constructor
+    USMC_Path(const USMC_Path& obj);
+    USMC_Path& operator=(const USMC_Path& obj);
+
+    // Record of a point
+    const int32_t* record(uint64_t point)const {
+        return reinterpret_cast<const int32_t*>(_data + point * _stride);
+    }
+
+    // Apply an advice to the pages of a range of points
+    void advise(uint64_t first, uint64_t last, int advice)const;
+
+    // Mapping
+    int _fd;
+    void* _base;
+    size_t _length;
+    const uint8_t* _data;
+
+    // Layout
+    uint64_t _points;
+    int _naxes;
+    uint32_t _fields;
+    uint32_t _stride;
+};
+
+
+typedef struct _USMC_PathStatus
+{
+    bool running;           // TRUE while the path is executing.
+    uint64_t point;         // Index of the point being executed.
+    uint64_t points;        // Number of points of the path.
+    uint64_t moves;         // Move commands sent.
+    uint64_t encoded;       // Points encoded ahead of execution.
+    int result;             // Result of the last run (0 or negative error number).
+} USMC_PathStatus;
+
+
+struct _USMC_ExchangeSlot;
+
+/**
+ * @class USMC_PathExecutor
+ * Executes a path on a dedicated thread. At each point the axes whose
+ * position changed are moved together, then the executor waits for all of
+ * them to stop (unless the point has USMC_POINT_NOWAIT). Points are encoded
+ * up to a window ahead, so a change of the device speed or start parameters
+ * during the execution applies to the points encoded afterwards.
+ */
+class USMC_PathExecutor {
+public:
+    // Constructor and destructor
+    USMC_PathExecutor(USMC* usmc);
+    ~USMC_PathExecutor();
+
+    /**
+     * Start the execution of a path. The path must stay open until the
+     * execution ends.
+     * @param path an open path.
+     * @param devices the device index of each axis of the path.
+     * @return 0 on success, negative error number on error
+     */
+    int start(const USMC_Path& path, const int* devices);
+
+    /**
+     * Abort the path and stop its devices
+     */
+    void abort();
+
+    /**
+     * Wait for the path to finish
+     * @return the path result
+     */
+    int wait();
+
+    /**
+     * Set the point callback (only while stopped, NULL to disable)
+     * @return 0 on success, negative error number on error
+     */
+    int setCallback(USMC_PathFn callback, void* user);
+
+    /**
+     * Set the number of points encoded ahead of the cursor (only while stopped)
+     * @return 0 on success, negative error number on error
+     */
+    int setWindow(uint32_t points);
+
+    /**
+     * Set the state polling period while waiting for the axes
+     * @param us polling period in microseconds
+     */
+    void setPollPeriod(uint32_t us) { _poll = us; }
+
+    /**
+     * Set the timeout of each point
+     * @param ms timeout in milliseconds (0 to wait forever)
+     */
+    void setTimeout(int ms) { _timeout = ms; }
+
+    /**
+     * Get the execution status
+     * @param status a pointer to a USMC_PathStatus structure.
+     */
+    void getStatus(USMC_PathStatus* status);
+
+private:
+    // Private copy constructor
+    USMC_PathExecutor(const USMC_PathExecutor& obj);
+    USMC_PathExecutor& operator=(const USMC_PathExecutor& obj);
+
+    // Thread entry point
+    static void* thread_main(void* arg);
+
+    // Executor loop
+    int run();
+
+    // Encode the points up to the end of the window starting at the cursor
+    void encode(uint64_t cursor);
+
+    // Wait for the axes to stop
+    int waitIdle();
+
+    // Release the buffers
+    void release();
+
+    // Library instance
+    USMC* _usmc;
+
+    // Path and axes (sorted by device index, so the access locks are taken in order)
+    const USMC_Path* _path;
+    int _naxes;
+    int _axis[USMC_MAX_PATH_AXES];
+    USMC_Device _handles[USMC_MAX_PATH_AXES];
+
+    // Ring of encoded points (naxes slots per point)
+    struct _USMC_ExchangeSlot* _ring;
+    uint32_t* _flags;
+    uint32_t _window;
+    uint64_t _encoded;
+    int _last[USMC_MAX_PATH_AXES];
+
+    // Exchange buffers
+    struct _USMC_ExchangeSlot* _poll_slots;
+    USMC_TransferRequest* _requests;
+
+    // Configuration
+    USMC_PathFn _callback;
+    void* _user;
+    uint32_t _poll;
+    int _timeout;
+
+    // Thread
+    pthread_t _thread;
+    bool _started;
+    volatile bool _abort;
+
+    // Status
+    USMC_mutex _lock;
+    USMC_PathStatus _status;
+};
+
+#endif
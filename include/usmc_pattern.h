@@ -0,0 +1,242 @@
+/***************************************************//**
+ * @file    usmc_pattern.h
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * Generators of 2-D scan patterns: serpentine raster, Archimedean spiral,
+ * Lissajous figure and concentric rings. Points are computed on demand from
+ * their index, so patterns of any size are iterated without allocating and
+ * can be streamed to a path file (see usmc_path.h) or timed with the motion
+ * model before running them.
+ *
+ * Pattern sizes are given in user units, converted to steps with the scale
+ * of each axis (1 step per unit by default) around the pattern origin.
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#ifndef USMC_PATTERN_H
+#define USMC_PATTERN_H
+
+#include <stdint.h>
+#include <libusmc.h>
+#include <usmc_motion.h>
+#include <usmc_path.h>
+
+
+/**
+ * @class USMC_Pattern
+ * Base class of the pattern generators. A pattern is iterated with next()
+ * or accessed by index with point(). Invalid sizes give an empty pattern.
+ */
+class USMC_Pattern {
+public:
+    // Constructor and destructor
+    USMC_Pattern();
+    virtual ~USMC_Pattern() {}
+
+    /**
+     * Number of points
+     */
+    virtual uint64_t size()const = 0;
+
+    /**
+     * Set the scale of the axes (steps per unit, default 1)
+     */
+    void setScale(double x, double y);
+
+    /**
+     * Set the origin of the pattern (units): the first corner of a raster,
+     * the center of the other patterns
+     */
+    void setOrigin(double x, double y);
+
+    /**
+     * Get a point
+     * @param i the point index.
+     * @param position array of 2 elements where the position (steps) is stored.
+     * @return 0 on success, negative error number on error
+     */
+    int point(uint64_t i, int* position)const;
+
+    /**
+     * Get the next point and advance
+     * @param position array of 2 elements where the position (steps) is stored.
+     * @return TRUE if a point was returned, FALSE at the end of the pattern
+     */
+    bool next(int* position);
+
+    /**
+     * Restart the iteration
+     */
+    void rewind() { _cursor = 0; }
+
+    /**
+     * Estimate the time to run the pattern from its first point. Both axes
+     * move at each point and the slower one sets the time.
+     * @param models the motion model of each axis.
+     * @param dwell time spent at each point (seconds).
+     * @return the estimated time in seconds
+     */
+    double estimateTime(const USMC_MotionModel* models, double dwell = 0.0)const;
+
+    /**
+     * Append the pattern to a path
+     * @param writer an open path writer with 2 axes.
+     * @param speed speed of the moves (steps/sec, 0 - device speed).
+     * @param flags flags of the points (USMC_POINT_*).
+     * @return 0 on success, negative error number on error
+     */
+    int write(USMC_PathWriter& writer, float speed = 0.0f, uint32_t flags = 0)const;
+
+protected:
+    // Position of a point relative to the origin (units)
+    virtual void locate(uint64_t i, double& x, double& y)const = 0;
+
+private:
+    double _scale[2];
+    double _origin[2];
+    uint64_t _cursor;
+};
+
+
+/**
+ * @class USMC_SerpentinePattern
+ * Raster of nx by ny points along x, reversing direction on every row
+ */
+class USMC_SerpentinePattern : public USMC_Pattern {
+public:
+    /**
+     * Constructor
+     * @param nx points per row.
+     * @param ny number of rows.
+     * @param dx point spacing along x (units).
+     * @param dy row spacing (units).
+     */
+    USMC_SerpentinePattern(uint32_t nx, uint32_t ny, double dx, double dy);
+
+    virtual uint64_t size()const { return uint64_t(_nx) * _ny; }
+
+protected:
+    virtual void locate(uint64_t i, double& x, double& y)const;
+
+private:
+    uint32_t _nx;
+    uint32_t _ny;
+    double _dx;
+    double _dy;
+};
+
+
+/**
+ * @class USMC_SpiralPattern
+ * Archimedean spiral from the center outwards with points at constant
+ * distance along the curve
+ */
+class USMC_SpiralPattern : public USMC_Pattern {
+public:
+    /**
+     * Constructor
+     * @param radius outer radius (units).
+     * @param pitch distance between turns (units).
+     * @param spacing distance between points along the curve (units).
+     */
+    USMC_SpiralPattern(double radius, double pitch, double spacing);
+
+    virtual uint64_t size()const { return _points; }
+
+protected:
+    virtual void locate(uint64_t i, double& x, double& y)const;
+
+private:
+    // Curve length from the center to an angle
+    double length(double theta)const;
+
+    double _b;
+    double _spacing;
+    uint64_t _points;
+};
+
+
+/**
+ * @class USMC_LissajousPattern
+ * Lissajous figure x = ax sin(fx t + phase), y = ay sin(fy t) sampled at n
+ * points over one period (integer frequencies give a closed figure)
+ */
+class USMC_LissajousPattern : public USMC_Pattern {
+public:
+    /**
+     * Constructor
+     * @param ax amplitude along x (units).
+     * @param ay amplitude along y (units).
+     * @param fx frequency along x.
+     * @param fy frequency along y.
+     * @param phase phase of x (radians).
+     * @param n number of points.
+     */
+    USMC_LissajousPattern(double ax, double ay, double fx, double fy, double phase, uint64_t n);
+
+    virtual uint64_t size()const { return _n; }
+
+protected:
+    virtual void locate(uint64_t i, double& x, double& y)const;
+
+private:
+    double _ax;
+    double _ay;
+    double _fx;
+    double _fy;
+    double _phase;
+    uint64_t _n;
+};
+
+
+/**
+ * @class USMC_RingsPattern
+ * Center point and concentric rings, with the number of points of each
+ * ring proportional to its radius
+ */
+class USMC_RingsPattern : public USMC_Pattern {
+public:
+    /**
+     * Constructor
+     * @param radius outer radius (units).
+     * @param ring_spacing distance between rings (units).
+     * @param spacing distance between points along a ring (units).
+     */
+    USMC_RingsPattern(double radius, double ring_spacing, double spacing);
+
+    virtual uint64_t size()const { return _points; }
+
+protected:
+    virtual void locate(uint64_t i, double& x, double& y)const;
+
+private:
+    // Points before ring k (k >= 1)
+    uint64_t before(uint64_t k)const { return 1 + _per_ring * (k - 1) * k / 2; }
+
+    double _ring_spacing;
+    uint64_t _per_ring;
+    uint64_t _points;
+};
+
+#endif
@@ -0,0 +1,305 @@
+/***************************************************//**
+ * @file    usmc_program.h
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * Motion programs. A program is a compact bytecode (moves, waits, speed
+ * changes, loops and branches on device state) executed by the library on
+ * its own thread, so repetitive sequences run without client round trips.
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#ifndef USMC_PROGRAM_H
+#define USMC_PROGRAM_H
+
+#include <stdint.h>
+#include <vector>
+#include <pthread.h>
+#include <libusmc.h>
+#include <usmc_mutex.h>
+
+// Maximum nesting of program loops
+#define USMC_MAX_LOOP_DEPTH   8
+
+// Program opcodes
+#define USMC_OP_END           0
+#define USMC_OP_MOVE          1
+#define USMC_OP_MOVE_BY       2
+#define USMC_OP_STOP          3
+#define USMC_OP_SET_SPEED     4
+#define USMC_OP_WAIT_IDLE     5
+#define USMC_OP_WAIT_TIME     6
+#define USMC_OP_WAIT_FLAG     7
+#define USMC_OP_PULSE_SYNC    8
+#define USMC_OP_LOOP          9
+#define USMC_OP_END_LOOP     10
+#define USMC_OP_BRANCH       11
+#define USMC_OP_JUMP         12
+
+// Device state flags usable in waits and branches
+#define USMC_FLAG_RUN         0
+#define USMC_FLAG_POWER       1
+#define USMC_FLAG_FULLSPEED   2
+#define USMC_FLAG_SYNCIN      3
+#define USMC_FLAG_SYNCOUT     4
+#define USMC_FLAG_ROTTR       5
+#define USMC_FLAG_ROTTRERR    6
+#define USMC_FLAG_EMRESET     7
+#define USMC_FLAG_TRAILER1    8
+#define USMC_FLAG_TRAILER2    9
+#define USMC_FLAG_LOFT       10
+
+
+typedef struct _USMC_Instruction
+{
+    uint8_t opcode;  // One of USMC_OP_*.
+    uint8_t flag;    // State flag for USMC_OP_WAIT_FLAG and USMC_OP_BRANCH (one of USMC_FLAG_*).
+    bool value;      // Flag value to wait for or to branch on.
+    int device;      // Device index.
+    int32_t arg;     // Position (steps), distance (steps), wait time (us), timeout (ms) or loop count.
+    int32_t target;  // Jump target (instruction index).
+    float speed;     // Speed for USMC_OP_SET_SPEED.
+} USMC_Instruction;
+
+
+typedef struct _USMC_ProgramStatus
+{
+    bool running;         // TRUE while the program is executing.
+    int pc;               // Index of the instruction being executed.
+    uint64_t executed;    // Number of instructions executed.
+    uint64_t iterations;  // Number of loop iterations completed (progress counter).
+    int result;           // Result of the last run (0 or negative error number).
+} USMC_ProgramStatus;
+
+
+/**
+ * @class USMC_Program
+ * Motion program builder. Every builder method returns the index of the
+ * instruction it appends, to be used as a branch target.
+ */
+class USMC_Program {
+public:
+    // Constructor
+    USMC_Program();
+
+    /**
+     * Start a move to an absolute position
+     * @return the instruction index
+     */
+    int move(int device, int position);
+
+    /**
+     * Start a move relative to the current position
+     * @return the instruction index
+     */
+    int moveBy(int device, int distance);
+
+    /**
+     * Stop a device
+     * @return the instruction index
+     */
+    int stop(int device);
+
+    /**
+     * Set the speed of the following moves
+     * @return the instruction index
+     */
+    int setSpeed(int device, float speed);
+
+    /**
+     * Wait until the device is not running
+     * @param timeout_ms timeout in milliseconds (0 to wait forever)
+     * @return the instruction index
+     */
+    int waitIdle(int device, int timeout_ms = 0);
+
+    /**
+     * Wait for a fixed time
+     * @param us the time in microseconds
+     * @return the instruction index
+     */
+    int waitTime(int us);
+
+    /**
+     * Wait for a state flag of the device to take the given value
+     * @param flag one of USMC_FLAG_*
+     * @param timeout_ms timeout in milliseconds (0 to wait forever)
+     * @return the instruction index
+     */
+    int waitFlag(int device, int flag, bool value, int timeout_ms = 0);
+
+    /**
+     * Emit a pulse on SyncOUT by toggling the output polarity twice
+     * @return the instruction index
+     */
+    int pulseSync(int device);
+
+    /**
+     * Begin a loop to be repeated count times (closed by endLoop)
+     * @return the instruction index
+     */
+    int loop(int count);
+
+    /**
+     * End the innermost loop
+     * @return the instruction index
+     */
+    int endLoop();
+
+    /**
+     * Jump to target if the state flag of the device has the given value
+     * @return the instruction index
+     */
+    int branch(int device, int flag, bool value, int target);
+
+    /**
+     * Unconditional jump
+     * @return the instruction index
+     */
+    int jump(int target);
+
+    /**
+     * End the program
+     * @return the instruction index
+     */
+    int end();
+
+    /**
+     * Get the index of the next instruction to be appended
+     */
+    int label()const { return int(_code.size()); }
+
+    /**
+     * Change the target of a branch or jump (for forward references)
+     * @return 0 on success, negative error number on error
+     */
+    int patch(int instruction, int target);
+
+    /**
+     * Validate the program and resolve loops. Must be called before running.
+     * @return 0 on success, negative error number on error
+     */
+    int compile();
+
+    /**
+     * Check if the program was compiled successfully
+     */
+    bool compiled()const { return _compiled; }
+
+    /**
+     * Get the program code
+     */
+    const std::vector<USMC_Instruction>& code()const { return _code; }
+
+private:
+    // Append an instruction
+    int append(uint8_t opcode, int device, int32_t arg);
+
+    // Code
+    std::vector<USMC_Instruction> _code;
+
+    // Compiled flag
+    bool _compiled;
+};
+
+
+/**
+ * @class USMC_ProgramRunner
+ * Executes a compiled motion program on a dedicated thread. A runner
+ * drives one group of devices; use one runner per independent group.
+ */
+class USMC_ProgramRunner {
+public:
+    // Constructor and destructor
+    USMC_ProgramRunner(USMC* usmc);
+    ~USMC_ProgramRunner();
+
+    /**
+     * Start the execution of a program
+     * @param program a compiled program (the code is copied)
+     * @return 0 on success, negative error number on error
+     */
+    int start(const USMC_Program& program);
+
+    /**
+     * Abort the program and stop all the devices it uses
+     */
+    void abort();
+
+    /**
+     * Wait for the program to finish
+     * @return the program result
+     */
+    int wait();
+
+    /**
+     * Set the state polling period used by waits
+     * @param us polling period in microseconds
+     */
+    void setPollPeriod(uint32_t us);
+
+    /**
+     * Get the execution status
+     * @param status a pointer to a USMC_ProgramStatus structure.
+     */
+    void getStatus(USMC_ProgramStatus* status);
+
+    /**
+     * Get a state flag from a USMC_State structure
+     */
+    static bool getFlag(const USMC_State& state, int flag);
+
+private:
+    // Private copy constructor
+    USMC_ProgramRunner(const USMC_ProgramRunner& obj);
+    USMC_ProgramRunner& operator=(const USMC_ProgramRunner& obj);
+
+    // Thread entry point
+    static void* thread_main(void* arg);
+
+    // Interpreter
+    int run();
+
+    // Poll a device flag until it takes the given value
+    int waitCondition(int device, int flag, bool value, int timeout_ms);
+
+    // Library instance
+    USMC* _usmc;
+
+    // Program code
+    std::vector<USMC_Instruction> _code;
+
+    // Thread
+    pthread_t _thread;
+    bool _started;
+    volatile bool _abort;
+
+    // Polling period
+    uint32_t _poll;
+
+    // Status
+    USMC_mutex _lock;
+    USMC_ProgramStatus _status;
+};
+
+#endif
@@ -0,0 +1,172 @@
+/***************************************************//**
+ * @file    usmc_provision.h
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * Commissioning of new controllers. Each controller gets its serial number,
+ * a mode and parameter profile and an EEPROM save, then the serial number is
+ * read back and the state checked against the profile. Controllers are
+ * provisioned concurrently by a pool of threads: each one has its own USB
+ * handle and access lock, so the time of a batch is set by the slowest
+ * controller rather than by their number.
+ *
+ * The device records take the new serial numbers as soon as they are read
+ * back, so getDeviceID() finds the devices by their new serial numbers
+ * without probing again.
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#ifndef USMC_PROVISION_H
+#define USMC_PROVISION_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <libusmc.h>
+#include <usmc_device.h>
+
+// Maximum length of serial number and password
+#define USMC_SERIAL_LENGTH        16
+
+// Provisioning steps
+#define USMC_PROVISION_DEVICE      1  // Get the device handle.
+#define USMC_PROVISION_SERIAL      2  // Write the serial number.
+#define USMC_PROVISION_MODE        3  // Write the mode.
+#define USMC_PROVISION_PARAMETERS  4  // Write the parameters.
+#define USMC_PROVISION_SAVE        5  // Save to the EEPROM.
+#define USMC_PROVISION_VERIFY      6  // Read back and check.
+
+
+typedef struct _USMC_ProvisionResult
+{
+    int device;                             // Device index.
+    char old_serial[USMC_SERIAL_LENGTH+1];  // Serial number before provisioning.
+    char serial[USMC_SERIAL_LENGTH+1];      // Serial number read back from the controller.
+    int step;                               // Failed step (USMC_PROVISION_*, 0 on success).
+    int result;                             // Result (0 or negative error number).
+    double time;                            // Time spent on the device (s).
+} USMC_ProvisionResult;
+
+
+/**
+ * @class USMC_Provisioner
+ * Applies the same profile to a batch of controllers in parallel
+ */
+class USMC_Provisioner {
+public:
+    // Constructor
+    USMC_Provisioner(USMC* usmc);
+    ~USMC_Provisioner();
+
+    /**
+     * Set the password of the serial number writes
+     * @return 0 on success, negative error number on error
+     */
+    int setPassword(const std::string& password);
+
+    /**
+     * Set the mode written to every device
+     * @param mode the mode (NULL to keep the current one).
+     */
+    void setMode(const USMC_Mode* mode);
+
+    /**
+     * Set the parameters written to every device
+     * @param parameters the parameters (NULL to keep the current ones).
+     */
+    void setParameters(const USMC_Parameters* parameters);
+
+    /**
+     * Enable the EEPROM save (default enabled)
+     */
+    void setSave(bool save) { _save = save; }
+
+    /**
+     * Set the maximum number of devices provisioned at the same time
+     * @param threads number of threads (0 - one for each device).
+     */
+    void setThreads(int threads) { _threads = threads < 0 ? 0 : threads; }
+
+    /**
+     * Add a device to the batch
+     * @param device the device index.
+     * @param serial the new serial number (empty to keep the current one).
+     * @return 0 on success, negative error number on error
+     */
+    int addDevice(int device, const std::string& serial = std::string());
+
+    /**
+     * Remove all the devices from the batch
+     */
+    void clear() { _jobs.clear(); }
+
+    /**
+     * Provision the devices of the batch. A failing device does not stop the
+     * others.
+     * @param results the result of each device, in the order they were added.
+     * @return 0 if all the devices succeeded, otherwise the error of the first failed device
+     */
+    int run(std::vector<USMC_ProvisionResult>& results);
+
+private:
+    // Private copy constructor
+    USMC_Provisioner(const USMC_Provisioner& obj);
+    USMC_Provisioner& operator=(const USMC_Provisioner& obj);
+
+    // Device of the batch
+    typedef struct _job {
+        int device;
+        std::string serial;
+    } job;
+
+    // Thread entry point
+    static void* thread_main(void* arg);
+
+    // Provision one device
+    void provision(const job& j, USMC_ProvisionResult& result);
+
+    // Run the steps on a device
+    int steps(const job& j, USMC_Device& handle, USMC_ProvisionResult& result);
+
+    // Library instance
+    USMC* _usmc;
+
+    // Profile
+    std::string _password;
+    bool _set_mode;
+    USMC_Mode _mode;
+    bool _set_params;
+    USMC_Parameters _params;
+    bool _save;
+    int _threads;
+
+    // Batch
+    std::vector<job> _jobs;
+
+    // Run state (next job taken by the threads)
+    std::vector<USMC_ProvisionResult>* _results;
+    size_t _next;
+};
+
+#endif
@@ -0,0 +1,207 @@
+/***************************************************//**
+ * @file    usmc_record.h
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * Workload capture and replay at the public API level. USMC_recorder wraps
+ * a USMC instance and logs every call (method, arguments, result, start
+ * time, duration and thread) to a text file. USMC_replayer reads the file
+ * back and re-issues the calls against any backend, with the original
+ * timing or as fast as possible.
+ *
+ * Setting the environment variable USMC_RECORD to a file name makes
+ * USMC::getInstance() return a recorder, so an application can be captured
+ * without changes.
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#ifndef USMC_RECORD_H
+#define USMC_RECORD_H
+
+#include <stdint.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <libusmc.h>
+#include <usmc_mutex.h>
+
+
+/**
+ * @class USMC_recorder
+ * USMC interface logging all the calls to a file
+ */
+class USMC_recorder : public USMC {
+public:
+    /**
+     * Constructor. Throws std::runtime_error if the file cannot be created.
+     * @param usmc the instance receiving the calls.
+     * @param filename the session file.
+     * @param own if TRUE the instance is deleted with the recorder.
+     */
+    USMC_recorder(USMC* usmc, const char* filename, bool own = false);
+    virtual ~USMC_recorder();
+
+    /**
+     * Write buffered records to the file
+     */
+    void flush();
+
+    // USMC interface
+    virtual int probeDevices();
+    virtual size_t countDevices()const;
+    virtual int getDeviceID(const std::string& serial)const;
+    virtual int getDevice(int device, USMC_Device* handle);
+    virtual void debug(bool en);
+    virtual void set_error_logger(void (*logger)(const char*, ...));
+    virtual void set_warn_logger(void (*logger)(const char*, ...));
+    virtual void set_info_logger(void (*logger)(const char*, ...));
+    virtual void set_debug_logger(void (*logger)(const char*, ...));
+    virtual int getSerialNumber(int device, std::string& serial)const;
+    virtual int getBusPath(int device, std::string& path)const;
+    virtual int getVersion(int device, uint32_t& version)const;
+    virtual int getState(int device, USMC_State *state);
+    virtual int getMode(int device, USMC_Mode* mode)const;
+    virtual int setMode(int device, const USMC_Mode* mode);
+    virtual int getParameters(int device, USMC_Parameters* parameters)const;
+    virtual int setParameters(int device, const USMC_Parameters* parameters);
+    virtual int getStartParameters(int device, USMC_StartParameters* start_params)const;
+    virtual int setStartParameters(int device, const USMC_StartParameters* start_params);
+    virtual int getSpeed(int device, float& speed)const;
+    virtual int setSpeed(int device, float speed);
+    virtual int moveTo(int device, int destination);
+    virtual int stop(int device);
+    virtual int setCurrentPosition(int device, int position);
+    virtual int getEncoderState(int device, USMC_EncoderState* state);
+    virtual int addExclusionZone(int deviceA, int minA, int maxA, int deviceB, int minB, int maxB);
+    virtual void clearExclusionZones();
+    virtual int getLockStats(int device, USMC_LockStats* stats)const;
+
+private:
+    // Private copy constructor
+    USMC_recorder(const USMC_recorder& obj);
+    USMC_recorder& operator=(const USMC_recorder& obj);
+
+    // Write a record
+    void record(uint64_t start, const char* method, int result, const char* args)const;
+
+    // Wrapped instance
+    USMC* _usmc;
+    bool _own;
+
+    // Session file
+    FILE* _file;
+    mutable USMC_mutex _lock;
+    uint64_t _t0;
+};
+
+
+typedef struct _USMC_ReplayStats
+{
+    uint64_t calls;             // Calls issued.
+    uint64_t errors;            // Calls that returned an error.
+    uint64_t mismatches;        // Calls whose success or failure differs from the recording.
+    int threads;                // Replay threads (one for each recorded thread).
+    double recorded_time;       // Duration of the recorded session (s).
+    double wall_time;           // Duration of the replay (s).
+    double mean_latency;        // Mean call duration during the replay (us).
+    double max_latency;         // Longest call during the replay (us).
+    double recorded_latency;    // Mean call duration in the recording (us).
+} USMC_ReplayStats;
+
+
+/**
+ * @class USMC_replayer
+ * Replays a recorded session
+ */
+class USMC_replayer {
+public:
+    // Constructor
+    USMC_replayer(USMC* usmc);
+
+    /**
+     * Load a session file
+     * @return the number of calls loaded, negative error number on error
+     */
+    int load(const char* filename);
+
+    /**
+     * Replay the session. Each recorded thread is replayed by its own thread,
+     * keeping the order of its calls. probeDevices, debug and the loggers are
+     * not replayed: the backend must be ready before calling run().
+     * @param realtime if TRUE the original start times are kept, otherwise the calls are issued as fast as possible.
+     * @param stats a pointer to a USMC_ReplayStats structure.
+     * @return 0 on success, negative error number on error
+     */
+    int run(bool realtime, USMC_ReplayStats* stats);
+
+    /**
+     * Number of calls loaded
+     */
+    size_t calls()const { return _calls.size(); }
+
+private:
+    // Recorded call
+    typedef struct _call {
+        uint64_t time;
+        int thread;
+        uint32_t duration;
+        int method;
+        int result;
+        int args[6];
+        float speed;
+        USMC_Mode mode;
+        USMC_Parameters params;
+        USMC_StartParameters start;
+        std::string serial;
+    } call;
+
+    // Replay thread
+    typedef struct _player {
+        USMC_replayer* replayer;
+        std::vector<size_t> calls;
+        pthread_t thread;
+        uint64_t start;
+        bool realtime;
+        uint64_t errors;
+        uint64_t mismatches;
+        uint64_t latency;
+        uint64_t max_latency;
+    } player;
+
+    // Thread entry point
+    static void* player_main(void* arg);
+
+    // Issue a call
+    int issue(const call& c);
+
+    // Parse a record
+    bool parse(const char* line, call& c);
+
+    // Target instance
+    USMC* _usmc;
+
+    // Calls
+    std::vector<call> _calls;
+};
+
+#endif
@@ -0,0 +1,214 @@
+/***************************************************//**
+ * @file    usmc_scan.h
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * Scan engine. Visits 1-D or 2-D sets of points, calling a user measurement
+ * at each one. Besides uniform grids it supports an adaptive mode that starts
+ * coarse and refines where the measured signal changes.
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#ifndef USMC_SCAN_H
+#define USMC_SCAN_H
+
+#include <stdint.h>
+#include <vector>
+#include <map>
+#include <utility>
+#include <libusmc.h>
+#include <usmc_motion.h>
+
+// Maximum number of scan axes
+#define USMC_MAX_SCAN_AXES    2
+
+// Scan modes
+#define USMC_SCAN_GRID        0   // Uniform grid (serpentine order in 2-D)
+#define USMC_SCAN_ADAPTIVE    1   // Coarse grid refined where gradient or curvature is large
+
+
+typedef struct _USMC_ScanConfig
+{
+    int naxes;                            // Number of axes (1 or 2).
+    int device[USMC_MAX_SCAN_AXES];       // Device index of each axis.
+    int min[USMC_MAX_SCAN_AXES];          // Scan start (steps).
+    int max[USMC_MAX_SCAN_AXES];          // Scan end (steps).
+    int points[USMC_MAX_SCAN_AXES];       // Number of grid points (initial coarse grid in adaptive mode).
+    int mode;                             // USMC_SCAN_GRID or USMC_SCAN_ADAPTIVE.
+    double threshold;                     // Refinement threshold, relative to the signal range (adaptive mode).
+    int min_step[USMC_MAX_SCAN_AXES];     // Smallest point spacing (adaptive mode).
+    int max_points;                       // Maximum number of points (0 - unlimited).
+    int max_passes;                       // Maximum number of refinement passes (adaptive mode).
+    bool read_encoder;                    // Read the encoder at each point.
+    uint32_t poll_us;                     // State polling period while waiting for moves.
+    int timeout_ms;                       // Timeout of each move (0 - wait forever).
+} USMC_ScanConfig;
+
+
+/**
+ * @class USMC_ScanData
+ * Scan results, stored column by column (one array per quantity)
+ */
+class USMC_ScanData {
+public:
+    std::vector<uint64_t> time;                        // Timestamp of the measurement (us).
+    std::vector<int> position[USMC_MAX_SCAN_AXES];     // Commanded position (steps).
+    std::vector<int> encoder[USMC_MAX_SCAN_AXES];      // Encoder position (if read).
+    std::vector<double> value;                         // Measured value.
+
+    // Number of points
+    size_t size()const { return value.size(); }
+
+    // Remove all points
+    void clear();
+
+    // Reserve memory
+    void reserve(size_t n);
+};
+
+
+/**
+ * @class USMC_ScanSink
+ * Receiver of the scan points (e.g. file writers). The methods are called on
+ * the thread running the scan, so they should not block.
+ */
+class USMC_ScanSink {
+public:
+    // Destructor
+    virtual ~USMC_ScanSink() {}
+
+    /**
+     * Start of a scan
+     * @param config the scan configuration.
+     * @return 0 on success, negative error number to abort the scan
+     */
+    virtual int begin(const USMC_ScanConfig& config) { return ERR_SUCCESS; }
+
+    /**
+     * Receive a point
+     * @param time the time of the measurement (see usmc_time_us()).
+     * @param position commanded position of each axis (steps).
+     * @param encoder encoder position of each axis (0 if not read).
+     * @param value the measured value.
+     * @return 0 on success, negative error number to abort the scan
+     */
+    virtual int point(uint64_t time, const int* position, const int* encoder, double value) = 0;
+
+    /**
+     * End of a scan
+     * @param result the result of the scan.
+     */
+    virtual void end(int result) {}
+};
+
+
+/**
+ * @class USMC_Scan
+ * Scan engine
+ */
+class USMC_Scan {
+public:
+    // Constructor
+    USMC_Scan(USMC* usmc);
+
+    /**
+     * Fill a configuration with default values
+     */
+    static void defaults(USMC_ScanConfig* config);
+
+    /**
+     * Run a scan
+     * @param config the scan configuration.
+     * @param measure the measurement callback.
+     * @param user user pointer passed to the callback.
+     * @param data the object receiving the results (points are appended).
+     * @return 0 on success, negative error number on error
+     */
+    int run(const USMC_ScanConfig& config, USMC_MeasureFn measure, void* user, USMC_ScanData* data);
+
+    /**
+     * Set a receiver of the points, in addition to the USMC_ScanData (NULL to disable)
+     */
+    void setSink(USMC_ScanSink* sink) { _sink = sink; }
+
+    /**
+     * Number of moves commanded by the last scan
+     */
+    int moves()const { return _moves; }
+
+    /**
+     * Motion time of the last scan estimated by the motion model (seconds)
+     */
+    double modelTime()const { return _model_time; }
+
+private:
+    // Scan point
+    typedef std::pair<int, int> point;
+
+    // Adaptive cell (1-D interval or 2-D rectangle)
+    typedef struct _cell {
+        int x0, x1;
+        int y0, y1;
+        double score;
+    } cell;
+
+    // Scan modes
+    int runGrid();
+    int runAdaptive1D();
+    int runAdaptive2D();
+
+    // Visit a batch of points in minimal travel time order
+    int visitBatch(std::vector<point>& batch);
+
+    // Sort a batch to reduce travel time
+    void order(std::vector<point>& batch)const;
+
+    // Estimated travel time between two points (axes move together)
+    double travelTime(const point& from, const point& to)const;
+
+    // Move, measure and record a point
+    int visit(const point& p);
+
+    // Signal range of the points measured so far
+    double range()const;
+
+    // Check if the point budget is exhausted
+    bool exhausted(size_t extra = 0)const { return _config.max_points > 0 && _values.size() + extra >= size_t(_config.max_points); }
+
+    // Library instance
+    USMC* _usmc;
+
+    // Current scan
+    USMC_ScanConfig _config;
+    USMC_MeasureFn _measure;
+    void* _user;
+    USMC_ScanData* _data;
+    USMC_ScanSink* _sink;
+    int _pos[USMC_MAX_SCAN_AXES];
+    USMC_MotionModel _model[USMC_MAX_SCAN_AXES];
+    std::map<point, double> _values;
+    int _moves;
+    double _model_time;
+};
+
+#endif
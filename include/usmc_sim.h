@@ -0,0 +1,210 @@
+/***************************************************//**
+ * @file    usmc_sim.h
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * Simulated 8SMC1 bus. The simulator is a transport that decodes the vendor
+ * requests and models the controllers: trapezoidal motion from TimerPeriod
+ * and AccelT/DecelT, limit switches, driver temperature and SyncOUT pulses.
+ * It runs on a virtual clock that jumps forward on every sleep, so programs
+ * using the library run much faster than real time and deterministically.
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#ifndef USMC_SIM_H
+#define USMC_SIM_H
+
+#include <stdint.h>
+#include <vector>
+#include <usmc_mutex.h>
+#include <usmc_clock.h>
+#include <usmc_transport.h>
+
+
+/**
+ * @class USMC_sim_clock
+ * Virtual clock. Sleeping advances the time instead of waiting. All the
+ * sleeping threads advance the same clock, so the simulation is
+ * deterministic when the controllers are driven by a single thread.
+ */
+class USMC_sim_clock : public USMC_clock {
+public:
+    // Constructor
+    USMC_sim_clock();
+
+    // Clock interface
+    virtual uint64_t now_us();
+    virtual void sleep_us(uint64_t us);
+
+    // Advance time
+    void advance(uint64_t us);
+
+private:
+    USMC_mutex _mutex;
+    uint64_t _now;
+};
+
+
+typedef struct _USMC_SimAxisConfig
+{
+    char serial[17];        // Serial number.
+    uint32_t version;       // Firmware version.
+    double position;        // Initial position (steps).
+    double limit_min;       // Position of the Trailer 1 switch (steps).
+    double limit_max;       // Position of the Trailer 2 switch (steps).
+    float voltage;          // Power supply voltage (V).
+    float ambient;          // Ambient temperature at time 0 (degrees C).
+    float drift;            // Ambient temperature drift (degrees C per hour).
+    float heating;          // Temperature rise of the driver at full current (degrees C).
+    float time_constant;    // Thermal time constant of the driver (s).
+} USMC_SimAxisConfig;
+
+
+/**
+ * @class USMC_Simulator
+ * Simulated controllers
+ */
+class USMC_Simulator : public USMC_transport {
+public:
+    // Constructor and destructor
+    USMC_Simulator();
+    virtual ~USMC_Simulator();
+
+    /**
+     * Fill an axis configuration with default values
+     * @param config the configuration.
+     * @param index axis index (used for the serial number).
+     */
+    static void defaults(USMC_SimAxisConfig* config, int index);
+
+    /**
+     * Add a simulated controller (before USMC::probeDevices())
+     * @return the index of the axis
+     */
+    int addAxis(const USMC_SimAxisConfig& config);
+
+    /**
+     * Set the duration of each USB transfer in virtual time
+     */
+    void setLatency(uint32_t us);
+
+    /**
+     * Physical position of an axis (steps, not affected by setCurrentPosition)
+     */
+    double position(int axis);
+
+    /**
+     * Number of SyncOUT pulses generated by an axis
+     */
+    uint64_t syncPulses(int axis);
+
+    /**
+     * Number of USB transfers processed
+     */
+    uint64_t transfers();
+
+    // Transport interface
+    virtual int open(std::vector<void*>& handles, void (*logger)(const char*, ...));
+    virtual void close(void* handle);
+    virtual int control_transfer(void* handle, uint8_t bRequestType, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, uint8_t* data, uint16_t wLength, unsigned int timeout);
+    virtual std::string path(void* handle);
+    virtual USMC_clock* clock() { return &_clock; }
+
+private:
+    // Private copy constructor
+    USMC_Simulator(const USMC_Simulator& obj);
+    USMC_Simulator& operator=(const USMC_Simulator& obj);
+
+    // Simulated controller
+    typedef struct _axis {
+        USMC_SimAxisConfig config;
+        USMC_mutex lock;
+        bool open;
+
+        // Settings
+        double accel_t;         // Acceleration time (s)
+        double decel_t;         // Deceleration time (s)
+        bool tr1_en;
+        bool tr2_en;
+        bool tr_swap;
+        bool current_reduction;
+        bool power;
+        bool sync_en;
+        bool sync_pol;
+        uint32_t sync_count;
+        double sync_width;      // SyncOUT pulse width (steps)
+        bool enc_inv;
+        double enc_mult;
+        uint8_t divisor;        // M1 | M2 << 1
+
+        // Motion segment
+        bool running;
+        uint64_t t0;
+        double x0;
+        int dir;
+        double dist;
+        double v0, vp, a, d;
+        double ta, tc, td;
+        double vmax;
+
+        // State at the last evaluation
+        uint64_t t_eval;
+        double pos;             // Physical position (steps)
+        double origin;          // Physical position of coordinate 0
+        double enc_zero;        // Physical position of encoder 0
+        double temp;
+        double travelled;       // Steps since the last SyncOUT counter reset
+        uint64_t pulses;
+        bool after_reset;
+    } axis;
+
+    // Advance the model of an axis to time t
+    void evaluate(axis* ax, uint64_t t);
+
+    // Distance and velocity along the current segment
+    double distance(const axis* ax, double s)const;
+    double velocity(const axis* ax, double s)const;
+
+    // Plan a move to a physical position
+    void plan(axis* ax, double target, double v0, double vmax, bool slow);
+
+    // Request handlers
+    int getState(axis* ax, uint8_t* data, uint16_t wLength);
+    int getEncoderState(axis* ax, uint8_t* data, uint16_t wLength);
+    int goTo(axis* ax, uint16_t wValue, uint16_t wIndex, const uint8_t* data, uint16_t wLength);
+    int setMode(axis* ax, uint16_t wValue, uint16_t wIndex, const uint8_t* data, uint16_t wLength);
+    int setParameters(axis* ax, uint16_t wValue, uint16_t wIndex, const uint8_t* data, uint16_t wLength);
+    int setPosition(axis* ax, uint16_t wValue, uint16_t wIndex);
+    int stop(axis* ax);
+
+    // Virtual clock
+    USMC_sim_clock _clock;
+
+    // Axes
+    USMC_mutex _lock;
+    std::vector<axis*> _axes;
+    uint32_t _latency;
+    uint64_t _transfers;
+};
+
+#endif
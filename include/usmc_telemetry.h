@@ -0,0 +1,174 @@
+/***************************************************//**
+ * @file    usmc_telemetry.h
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * Multi-resolution telemetry store for long-term trending. Position,
+ * temperature and voltage of each device are downsampled into 1 s, 1 min
+ * and 1 h buckets (min/max/mean/last) kept in fixed-size rings inside a
+ * memory-mapped file, so the file never grows and a query touches only the
+ * buckets of the requested window.
+ *
+ * The store is fed incrementally (add() or as a USMC_CycleSink) without
+ * allocating memory. There must be a single writer; queries may run
+ * concurrently from other threads or processes.
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#ifndef USMC_TELEMETRY_H
+#define USMC_TELEMETRY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <libusmc.h>
+#include <usmc_cycle.h>
+
+// Resolution levels
+#define USMC_TLM_SECOND       0   // 1 s buckets
+#define USMC_TLM_MINUTE       1   // 1 min buckets
+#define USMC_TLM_HOUR         2   // 1 h buckets
+#define USMC_TLM_LEVELS       3
+
+// Default ring sizes (2 days of seconds, 60 days of minutes, 2 years of hours)
+#define USMC_TLM_SECONDS      172800
+#define USMC_TLM_MINUTES      86400
+#define USMC_TLM_HOURS        17520
+
+
+typedef struct _USMC_TelemetryChannel
+{
+    double min;     // Minimum value in the bucket.
+    double max;     // Maximum value in the bucket.
+    double sum;     // Sum of the values (mean = sum / count).
+    double last;    // Last value in the bucket.
+} USMC_TelemetryChannel;
+
+
+typedef struct _USMC_TelemetryBucket
+{
+    uint64_t start;                 // Bucket start (us since the epoch).
+    uint32_t count;                 // Number of samples.
+    uint32_t seq;                   // Update sequence (odd while the bucket is written).
+    USMC_TelemetryChannel position; // Position (steps).
+    USMC_TelemetryChannel temp;     // Temperature (degC).
+    USMC_TelemetryChannel voltage;  // Voltage (V).
+} USMC_TelemetryBucket;
+
+
+/**
+ * @class USMC_TelemetryStore
+ * Downsampling store in a memory-mapped file
+ */
+class USMC_TelemetryStore : public USMC_CycleSink {
+public:
+    // Constructor and destructor
+    USMC_TelemetryStore();
+    virtual ~USMC_TelemetryStore();
+
+    /**
+     * Open a store, creating the file if it does not exist. An existing file
+     * must have the same number of devices and ring sizes.
+     * @param filename the store file.
+     * @param ndevices number of devices.
+     * @param sizes number of buckets of each level (NULL for the defaults).
+     * @return 0 on success, negative error number on error
+     */
+    int open(const char* filename, int ndevices, const uint32_t* sizes = NULL);
+
+    /**
+     * Open an existing store for queries only
+     * @return 0 on success, negative error number on error
+     */
+    int openReadOnly(const char* filename);
+
+    /**
+     * Flush the mapped file to disk and close it
+     */
+    void close();
+
+    /**
+     * Flush the mapped file to disk
+     */
+    void sync();
+
+    /**
+     * Add a sample
+     * @param device the device index.
+     * @param time_us the sample time (us since the epoch).
+     * @param state the device state.
+     * @return 0 on success, negative error number on error
+     */
+    int add(int device, uint64_t time_us, const USMC_State& state);
+
+    /**
+     * Add a sample read by a USMC_Cyclic (the time is converted to wall-clock
+     * time with the offset taken on the first pushed sample)
+     */
+    virtual void push(int device, uint64_t time_us, const USMC_State& state);
+
+    /**
+     * Get the buckets of a device overlapping a time window. Buckets without
+     * samples, or already overwritten by newer ones, are skipped.
+     * @param device the device index.
+     * @param level one of USMC_TLM_*.
+     * @param t0 window start (us since the epoch).
+     * @param t1 window end (us since the epoch, excluded).
+     * @param buckets array where the buckets are stored.
+     * @param max size of the array.
+     * @return the number of buckets stored, negative error number on error
+     */
+    int query(int device, int level, uint64_t t0, uint64_t t1, USMC_TelemetryBucket* buckets, size_t max)const;
+
+    /**
+     * Duration of a bucket of a level in microseconds
+     */
+    static uint64_t span(int level);
+
+    /**
+     * Number of devices of the open store
+     */
+    int devices()const;
+
+private:
+    // Private copy constructor
+    USMC_TelemetryStore(const USMC_TelemetryStore& obj);
+    USMC_TelemetryStore& operator=(const USMC_TelemetryStore& obj);
+
+    // Map a file
+    int map(const char* filename, int ndevices, const uint32_t* sizes, bool create);
+
+    // Ring of a device and level
+    USMC_TelemetryBucket* ring(int device, int level)const;
+
+    // Mapped file
+    int _fd;
+    void* _base;
+    size_t _length;
+    bool _readonly;
+
+    // Wall-clock offset of the pushed samples
+    bool _anchored;
+    int64_t _wall_offset;
+};
+
+#endif
@@ -0,0 +1,145 @@
+/***************************************************//**
+ * @file    usmc_transport.h
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * Transport layer below the USB communication methods. The default transport
+ * talks to the controllers through libusb; alternative transports (simulator,
+ * fault injection) can be given to USMC::getInstance().
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#ifndef USMC_TRANSPORT_H
+#define USMC_TRANSPORT_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <usmc_clock.h>
+
+// Device vendor and product IDs
+#define USMC_VENDOR_ID     0x10c4
+#define USMC_PRODUCT_ID    0x0230
+
+// Request type bits (same values as libusb)
+#define USMC_ENDPOINT_IN   0x80
+
+
+// Control request of a batch (see USMC_transport::control_transfers)
+typedef struct _USMC_TransferRequest
+{
+    void* handle;           // Device handle.
+    uint8_t bRequestType;   // Request type.
+    uint8_t bRequest;       // Request.
+    uint16_t wValue;        // Value.
+    uint16_t wIndex;        // Index.
+    uint8_t* data;          // Payload buffer.
+    uint16_t wLength;       // Payload length.
+    int result;             // Number of bytes transferred, negative error number on error.
+} USMC_TransferRequest;
+
+
+/**
+ * @class USMC_transport
+ * Interface of a transport. Devices are identified by opaque handles.
+ */
+class USMC_transport {
+public:
+    // Destructor
+    virtual ~USMC_transport() {}
+
+    /**
+     * Open all the attached controllers
+     * @param handles vector where the handles of the opened devices are appended
+     * @param logger error logger
+     * @return 0 on success, negative error number on error
+     */
+    virtual int open(std::vector<void*>& handles, void (*logger)(const char*, ...)) = 0;
+
+    /**
+     * Close a device
+     */
+    virtual void close(void* handle) = 0;
+
+    /**
+     * Perform a control transfer (same semantics as libusb_control_transfer)
+     * @return the number of bytes transferred, negative error number on error
+     */
+    virtual int control_transfer(void* handle, uint8_t bRequestType, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, uint8_t* data, uint16_t wLength, unsigned int timeout) = 0;
+
+    /**
+     * Perform several control transfers, storing the result of each one in
+     * the request. Requests to the same device are executed in order, those
+     * to different devices may overlap. The default implementation executes
+     * them one after the other.
+     */
+    virtual void control_transfers(USMC_TransferRequest* requests, size_t n, unsigned int timeout);
+
+    /**
+     * Get a description of an error number
+     */
+    virtual const char* strerror(int error);
+
+    /**
+     * Get the physical location of a device (e.g. USB bus and ports)
+     */
+    virtual std::string path(void* handle) { return std::string(""); }
+
+    /**
+     * Get the clock of the transport (NULL for the system clock)
+     */
+    virtual USMC_clock* clock() { return NULL; }
+};
+
+
+/**
+ * @class USMC_usb_transport
+ * libusb transport. Each open device owns a transfer and a buffer allocated
+ * at open time, so the library does not allocate on control transfers
+ * (libusb still allocates internally on every submit). Transfers on
+ * the same device must be serialized by the caller (the device lock).
+ */
+class USMC_usb_transport : public USMC_transport {
+public:
+    // Constructor and destructor
+    USMC_usb_transport();
+    virtual ~USMC_usb_transport();
+
+    // Transport interface
+    virtual int open(std::vector<void*>& handles, void (*logger)(const char*, ...));
+    virtual void close(void* handle);
+    virtual int control_transfer(void* handle, uint8_t bRequestType, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, uint8_t* data, uint16_t wLength, unsigned int timeout);
+    virtual void control_transfers(USMC_TransferRequest* requests, size_t n, unsigned int timeout);
+    virtual const char* strerror(int error);
+    virtual std::string path(void* handle);
+
+private:
+    // Private copy constructor
+    USMC_usb_transport(const USMC_usb_transport& obj);
+    USMC_usb_transport& operator=(const USMC_usb_transport& obj);
+
+    // Libusb context (opaque to avoid exposing libusb.h)
+    void* _usb_ctx;
+};
+
+#endif
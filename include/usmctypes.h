@@ -116,7 +116,7 @@ typedef struct _MODE_PACKET // 7 bytes;
     __u8  INVENC   : 1;    // Invert Encoder Counter Direction.
     __u8  RESBENC  : 1;    // Reset <Encoder Position> and <SM Position in Encoder units> to 0.
     __u8  RESENC   : 1;    // Reset <SM Position in Encoder units> to <Encoder Position>.
-    __u16 SYNCCOUNT;    // Number of steps after which synchronization output signal occurs.
+    __u32 SYNCCOUNT;    // Number of steps after which synchronization output signal occurs.
 } MODE_PACKET, * PMODE_PACKET, * LPMODE_PACKET;
 
 
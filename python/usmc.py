@@ -0,0 +1,402 @@
+"""
+Python bindings for libusmc (8SMC1 stepper motor controllers).
+
+The bindings load the C interface of the library (usmc_c.h) with ctypes.
+Every call into the library releases the GIL, so other Python threads keep
+running while a call waits on USB. Batch calls read or write many devices
+with one call and return numpy structured arrays; they also accept an
+output array, so a polling loop can reuse the same buffer without copies.
+
+The asyncio variants (methods starting with 'a') run on a per-context
+worker thread, so the event loop is never blocked by USB transfers.
+
+Example:
+
+    import usmc
+    with usmc.Context(sim_axes=2) as ctx:
+        ctx.move([0, 1], [1000, -1000])
+        states = ctx.poll_states()
+        print(states['cur_pos'], states['flags'] & usmc.STATE_RUN)
+
+The library is searched in USMC_LIBRARY, then with the system loader.
+Setting USMC_RECORD to a file name records all the calls of the session.
+
+@date    May 2020
+@author  Michele Devetta
+"""
+
+import asyncio
+import concurrent.futures
+import ctypes
+import ctypes.util
+import os
+
+import numpy as np
+
+
+# Error codes (see libusmc.h)
+ERR_SUCCESS = 0
+ERR_INVALID_ID = -40
+ERR_INVALID_PARAM = -41
+ERR_INVALID_VALUE = -42
+ERR_INTERLOCK = -43
+ERR_VERIFY = -44
+
+# Flags of the state
+STATE_LOFT = 0x0001
+STATE_FULLPOWER = 0x0002
+STATE_CW_CCW = 0x0004
+STATE_POWER = 0x0008
+STATE_FULLSPEED = 0x0010
+STATE_ARESET = 0x0020
+STATE_RUN = 0x0040
+STATE_SYNCIN = 0x0080
+STATE_SYNCOUT = 0x0100
+STATE_ROTTR = 0x0200
+STATE_ROTTRERR = 0x0400
+STATE_EMRESET = 0x0800
+STATE_TRAILER1 = 0x1000
+STATE_TRAILER2 = 0x2000
+
+# Log levels
+LOG_NONE = 0
+LOG_ERROR = 1
+LOG_WARN = 2
+LOG_INFO = 3
+LOG_DEBUG = 4
+
+# ABI version these bindings are written for
+ABI_VERSION = 1
+
+
+# numpy layout of the batch structures (must match usmc_c.h)
+STATE_DTYPE = np.dtype([
+    ('cur_pos', '<i4'),
+    ('temp', '<f4'),
+    ('voltage', '<f4'),
+    ('flags', '<u4'),
+    ('sdivisor', '<u4'),
+])
+
+ENCODER_DTYPE = np.dtype([
+    ('encoder_pos', '<i4'),
+    ('ecur_pos', '<i4'),
+])
+
+
+class Mode(ctypes.Structure):
+    """Device mode (see USMC_Mode)"""
+    _fields_ = [(name, ctypes.c_uint8) for name in (
+        'pmode', 'preg', 'reset_d', 'em_reset', 'tr1t', 'tr2t', 'rot_trt',
+        'tr_swap', 'tr1_en', 'tr2_en', 'rot_tr_en', 'rot_tr_op', 'butt1t',
+        'butt2t', 'reset_rt', 'sync_out_en', 'sync_out_r', 'sync_in_op',
+        'sync_invert', 'encoder_en', 'encoder_inv', 'res_b_enc', 'res_enc',
+        'reserved')] + [('sync_count', ctypes.c_uint32)]
+
+
+class Parameters(ctypes.Structure):
+    """Device parameters (see USMC_Parameters)"""
+    _fields_ = [(name, ctypes.c_float) for name in (
+        'accel_t', 'decel_t', 'p_timeout', 'b_timeout1', 'b_timeout2',
+        'b_timeout3', 'b_timeout4', 'b_timeout_r', 'b_timeout_d', 'min_p',
+        'bto1p', 'bto2p', 'bto3p', 'bto4p', 'max_temp', 'loft_period',
+        'enc_mult')] + [
+        ('start_pos', ctypes.c_uint32),
+        ('max_loft', ctypes.c_uint16),
+        ('rt_delta', ctypes.c_uint16),
+        ('rt_min_error', ctypes.c_uint16),
+        ('syn_outp', ctypes.c_uint16),
+    ]
+
+
+class StartParameters(ctypes.Structure):
+    """Start parameters (see USMC_StartParameters)"""
+    _fields_ = [(name, ctypes.c_uint8) for name in (
+        'sdivisor', 'def_dir', 'loft_en', 'sl_start', 'wsync_in',
+        'sync_out_r', 'force_loft', 'reserved')]
+
+
+class USMCError(Exception):
+    """Error returned by the library"""
+
+    def __init__(self, code, message):
+        super().__init__('{0} ({1})'.format(message, code))
+        self.code = code
+
+
+# Library loading
+_lib = None
+
+
+def _load():
+    global _lib
+    if _lib is not None:
+        return _lib
+
+    path = os.environ.get('USMC_LIBRARY')
+    if not path:
+        path = ctypes.util.find_library('usmc') or 'libusmc.so'
+    # CDLL releases the GIL for the duration of every call
+    lib = ctypes.CDLL(path)
+
+    c_int_p = ctypes.POINTER(ctypes.c_int)
+    ctx_p = ctypes.c_void_p
+    prototypes = {
+        'usmc_abi_version': (ctypes.c_int, []),
+        'usmc_strerror': (ctypes.c_char_p, [ctypes.c_int]),
+        'usmc_ctx_open': (ctx_p, []),
+        'usmc_ctx_open_sim': (ctx_p, [ctypes.c_int]),
+        'usmc_ctx_close': (None, [ctx_p]),
+        'usmc_ctx_set_log_level': (None, [ctx_p, ctypes.c_int]),
+        'usmc_ctx_count': (ctypes.c_int, [ctx_p]),
+        'usmc_ctx_find': (ctypes.c_int, [ctx_p, ctypes.c_char_p]),
+        'usmc_ctx_poll_states': (ctypes.c_int, [ctx_p, c_int_p, ctypes.c_size_t, ctypes.c_void_p, c_int_p]),
+        'usmc_ctx_poll_positions': (ctypes.c_int, [ctx_p, c_int_p, ctypes.c_size_t, ctypes.c_void_p, c_int_p]),
+        'usmc_ctx_poll_encoders': (ctypes.c_int, [ctx_p, c_int_p, ctypes.c_size_t, ctypes.c_void_p, c_int_p]),
+        'usmc_ctx_move': (ctypes.c_int, [ctx_p, c_int_p, ctypes.c_size_t, ctypes.c_void_p, c_int_p]),
+        'usmc_ctx_stop': (ctypes.c_int, [ctx_p, c_int_p, ctypes.c_size_t, c_int_p]),
+        'usmc_ctx_set_speeds': (ctypes.c_int, [ctx_p, c_int_p, ctypes.c_size_t, ctypes.c_void_p, c_int_p]),
+        'usmc_dev_serial': (ctypes.c_int, [ctx_p, ctypes.c_int, ctypes.c_char_p, ctypes.c_size_t]),
+        'usmc_dev_version': (ctypes.c_int, [ctx_p, ctypes.c_int, ctypes.POINTER(ctypes.c_uint32)]),
+        'usmc_dev_get_mode': (ctypes.c_int, [ctx_p, ctypes.c_int, ctypes.POINTER(Mode)]),
+        'usmc_dev_set_mode': (ctypes.c_int, [ctx_p, ctypes.c_int, ctypes.POINTER(Mode)]),
+        'usmc_dev_get_parameters': (ctypes.c_int, [ctx_p, ctypes.c_int, ctypes.POINTER(Parameters)]),
+        'usmc_dev_set_parameters': (ctypes.c_int, [ctx_p, ctypes.c_int, ctypes.POINTER(Parameters)]),
+        'usmc_dev_get_start_parameters': (ctypes.c_int, [ctx_p, ctypes.c_int, ctypes.POINTER(StartParameters)]),
+        'usmc_dev_set_start_parameters': (ctypes.c_int, [ctx_p, ctypes.c_int, ctypes.POINTER(StartParameters)]),
+        'usmc_dev_get_speed': (ctypes.c_int, [ctx_p, ctypes.c_int, ctypes.POINTER(ctypes.c_float)]),
+        'usmc_dev_set_speed': (ctypes.c_int, [ctx_p, ctypes.c_int, ctypes.c_float]),
+        'usmc_dev_move': (ctypes.c_int, [ctx_p, ctypes.c_int, ctypes.c_int32]),
+        'usmc_dev_stop': (ctypes.c_int, [ctx_p, ctypes.c_int]),
+        'usmc_dev_set_position': (ctypes.c_int, [ctx_p, ctypes.c_int, ctypes.c_int32]),
+    }
+    for name, (restype, argtypes) in prototypes.items():
+        fn = getattr(lib, name)
+        fn.restype = restype
+        fn.argtypes = argtypes
+
+    if lib.usmc_abi_version() != ABI_VERSION:
+        raise ImportError('libusmc ABI version {0} is not supported'.format(lib.usmc_abi_version()))
+    _lib = lib
+    return lib
+
+
+def strerror(code):
+    """Description of an error number"""
+    return _load().usmc_strerror(code).decode()
+
+
+def _check(code):
+    if code < 0:
+        raise USMCError(code, strerror(code))
+    return code
+
+
+def _ptr(array, ctype=ctypes.c_void_p):
+    return array.ctypes.data_as(ctype)
+
+
+def _output(out, n, dtype):
+    # Caller buffers are written in place (no copy)
+    if out is None:
+        return np.empty(n, dtype=dtype)
+    if out.dtype != dtype or out.shape != (n,) or not out.flags['C_CONTIGUOUS'] or not out.flags['WRITEABLE']:
+        raise ValueError('out must be a writeable contiguous array of {0} elements of {1}'.format(n, dtype))
+    return out
+
+
+class Context(object):
+    """
+    Library context. Only one context can be open at a time.
+
+    @param sim_axes: if > 0, use simulated controllers instead of USB.
+    @param log_level: one of the LOG_* levels.
+    """
+
+    def __init__(self, sim_axes=0, log_level=LOG_INFO):
+        lib = _load()
+        self._ctx = lib.usmc_ctx_open_sim(sim_axes) if sim_axes > 0 else lib.usmc_ctx_open()
+        if not self._ctx:
+            raise USMCError(ERR_INVALID_PARAM, 'Failed to open the library (is another context open?)')
+        lib.usmc_ctx_set_log_level(self._ctx, log_level)
+        self._lib = lib
+        self._executor = concurrent.futures.ThreadPoolExecutor(max_workers=1, thread_name_prefix='usmc')
+        self._all = np.arange(self.count, dtype=np.intc)
+
+    def close(self):
+        """Close the library"""
+        if self._ctx:
+            self._executor.shutdown(wait=True)
+            self._lib.usmc_ctx_close(self._ctx)
+            self._ctx = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        self.close()
+
+    def __del__(self):
+        try:
+            self.close()
+        except Exception:
+            pass
+
+    def set_log_level(self, level):
+        """Set the verbosity of the library log"""
+        self._lib.usmc_ctx_set_log_level(self._ctx, level)
+
+    @property
+    def count(self):
+        """Number of devices"""
+        return _check(self._lib.usmc_ctx_count(self._ctx))
+
+    def find(self, serial):
+        """Index of the device with the given serial number"""
+        return _check(self._lib.usmc_ctx_find(self._ctx, serial.encode()))
+
+    def serial(self, device):
+        """Serial number of a device"""
+        buffer = ctypes.create_string_buffer(32)
+        _check(self._lib.usmc_dev_serial(self._ctx, device, buffer, 32))
+        return buffer.value.decode()
+
+    def version(self, device):
+        """Firmware version of a device"""
+        version = ctypes.c_uint32()
+        _check(self._lib.usmc_dev_version(self._ctx, device, ctypes.byref(version)))
+        return version.value
+
+    # Batch calls
+    def _devices(self, devices):
+        if devices is None:
+            return self._all
+        return np.ascontiguousarray(np.atleast_1d(devices), dtype=np.intc)
+
+    def _batch(self, fn, devices, *buffers):
+        # Raise on the first failing device, reporting all the results
+        n = len(devices)
+        results = np.empty(n, dtype=np.intc)
+        args = [_ptr(b) for b in buffers]
+        res = fn(self._ctx, _ptr(devices, ctypes.POINTER(ctypes.c_int)), n, *(args + [_ptr(results, ctypes.POINTER(ctypes.c_int))]))
+        if res < 0:
+            err = USMCError(res, strerror(res))
+            err.results = results
+            raise err
+
+    def poll_states(self, devices=None, out=None):
+        """
+        Read the state of several devices (all by default)
+        @return: numpy array of STATE_DTYPE (out if given)
+        """
+        devices = self._devices(devices)
+        out = _output(out, len(devices), STATE_DTYPE)
+        self._batch(self._lib.usmc_ctx_poll_states, devices, out)
+        return out
+
+    def poll_positions(self, devices=None, out=None):
+        """
+        Read the position of several devices (all by default)
+        @return: numpy int32 array (out if given)
+        """
+        devices = self._devices(devices)
+        out = _output(out, len(devices), np.dtype('<i4'))
+        self._batch(self._lib.usmc_ctx_poll_positions, devices, out)
+        return out
+
+    def poll_encoders(self, devices=None, out=None):
+        """
+        Read the encoder state of several devices (all by default)
+        @return: numpy array of ENCODER_DTYPE (out if given)
+        """
+        devices = self._devices(devices)
+        out = _output(out, len(devices), ENCODER_DTYPE)
+        self._batch(self._lib.usmc_ctx_poll_encoders, devices, out)
+        return out
+
+    def get_state(self, device):
+        """State of one device as a numpy record"""
+        return self.poll_states([device])[0]
+
+    def move(self, devices, destinations):
+        """Move several devices (or one) to the given positions"""
+        devices = self._devices(devices)
+        destinations = np.ascontiguousarray(np.broadcast_to(destinations, devices.shape), dtype='<i4')
+        self._batch(self._lib.usmc_ctx_move, devices, destinations)
+
+    def stop(self, devices=None):
+        """Stop several devices (all by default)"""
+        devices = self._devices(devices)
+        self._batch(self._lib.usmc_ctx_stop, devices)
+
+    def set_speeds(self, devices, speeds):
+        """Set the speed of several devices (or one)"""
+        devices = self._devices(devices)
+        speeds = np.ascontiguousarray(np.broadcast_to(speeds, devices.shape), dtype='<f4')
+        self._batch(self._lib.usmc_ctx_set_speeds, devices, speeds)
+
+    # Single device configuration
+    def get_speed(self, device):
+        speed = ctypes.c_float()
+        _check(self._lib.usmc_dev_get_speed(self._ctx, device, ctypes.byref(speed)))
+        return speed.value
+
+    def set_position(self, device, position):
+        _check(self._lib.usmc_dev_set_position(self._ctx, device, position))
+
+    def get_mode(self, device):
+        mode = Mode()
+        _check(self._lib.usmc_dev_get_mode(self._ctx, device, ctypes.byref(mode)))
+        return mode
+
+    def set_mode(self, device, mode):
+        _check(self._lib.usmc_dev_set_mode(self._ctx, device, ctypes.byref(mode)))
+
+    def get_parameters(self, device):
+        params = Parameters()
+        _check(self._lib.usmc_dev_get_parameters(self._ctx, device, ctypes.byref(params)))
+        return params
+
+    def set_parameters(self, device, params):
+        _check(self._lib.usmc_dev_set_parameters(self._ctx, device, ctypes.byref(params)))
+
+    def get_start_parameters(self, device):
+        params = StartParameters()
+        _check(self._lib.usmc_dev_get_start_parameters(self._ctx, device, ctypes.byref(params)))
+        return params
+
+    def set_start_parameters(self, device, params):
+        _check(self._lib.usmc_dev_set_start_parameters(self._ctx, device, ctypes.byref(params)))
+
+    # asyncio variants
+    def _run(self, fn, *args):
+        return asyncio.get_running_loop().run_in_executor(self._executor, fn, *args)
+
+    async def apoll_states(self, devices=None, out=None):
+        return await self._run(self.poll_states, devices, out)
+
+    async def apoll_positions(self, devices=None, out=None):
+        return await self._run(self.poll_positions, devices, out)
+
+    async def apoll_encoders(self, devices=None, out=None):
+        return await self._run(self.poll_encoders, devices, out)
+
+    async def amove(self, devices, destinations):
+        return await self._run(self.move, devices, destinations)
+
+    async def astop(self, devices=None):
+        return await self._run(self.stop, devices)
+
+    async def await_idle(self, devices=None, interval=0.01, timeout=None):
+        """Wait until none of the devices is running"""
+        loop = asyncio.get_running_loop()
+        start = loop.time()
+        devices = self._devices(devices)
+        out = np.empty(len(devices), dtype=STATE_DTYPE)
+        while True:
+            await self.apoll_states(devices, out)
+            if not np.any(out['flags'] & STATE_RUN):
+                return out
+            if timeout is not None and loop.time() - start > timeout:
+                raise asyncio.TimeoutError()
+            await asyncio.sleep(interval)
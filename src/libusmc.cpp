@@ -25,18 +25,44 @@
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  *******************************************************/
 
+#include <cstdlib>
+#include <stdexcept>
 #include <libusmc.h>
 #include <libusmc_impl.h>
+#include <usmc_record.h>
 
 
 // Instance pointer
 USMC* USMC::_instance = NULL;
 
 
+// Wrap the instance in a recorder if USMC_RECORD is set
+static USMC* record(USMC* usmc) {
+    const char* filename = getenv("USMC_RECORD");
+    if(NULL == filename || filename[0] == '\0')
+        return usmc;
+    try {
+        return new USMC_recorder(usmc, filename, true);
+    } catch(std::runtime_error& e) {
+        // Recording is optional, keep going without it
+        return usmc;
+    }
+}
+
+
 // Get instance method
 USMC* USMC::getInstance() {
     if(NULL == _instance) {
-        _instance = new USMC_impl();
+        _instance = record(new USMC_impl());
+    }
+    return _instance;
+}
+
+
+// Get instance method with custom transport
+USMC* USMC::getInstance(USMC_transport* transport) {
+    if(NULL == _instance) {
+        _instance = record(new USMC_impl(transport));
     }
     return _instance;
 }
@@ -51,6 +77,15 @@ void USMC::shutdown() {
 }
 
 
+// Get a device handle by serial number
+int USMC::getDevice(const std::string& serial, USMC_Device* handle) {
+    int device = getDeviceID(serial);
+    if(device < 0)
+        return ERR_INVALID_ID;
+    return getDevice(device, handle);
+}
+
+
 // Interface constructor
 USMC::USMC() {
 
@@ -28,7 +28,6 @@
 
 #include <iostream>
 #include <iomanip>
-#include <sstream>
 #include <stdexcept>
 #include <cstdio>
 #include <cstdarg>
@@ -37,11 +36,6 @@
 #include <libusmc.h>
 #include <libusmc_impl.h>
 
-
-// Device vendor and product IDs
-#define USMC_VENDOR_ID     0x10c4
-#define USMC_PRODUCT_ID    0x0230
-
 // Byte swapping and extraction functions
 #define HIBYTE(w)                         ((w&0xff00)>>8)
 #define LOBYTE(w)                         (w&0x00ff)
@@ -64,96 +58,101 @@
                                           (LOBYTE(LOWORD(w))<<24))
 
 
-// Default logging functions
+// Setup values of a complete goto packet
+static void goto_words(GO_TO_PACKET& goToData, uint16_t& wValue, uint16_t& wIndex) {
+    wIndex   = FIRST_WORD  ( reinterpret_cast<uint32_t*>(&goToData) );
+    wValue   = SECOND_WORD ( reinterpret_cast<uint32_t*>(&goToData) );
+}
+
+// Fill a goto packet and its setup values (data is the pre-encoded payload)
+static void goto_setup(GO_TO_PACKET& goToData, int position, const uint8_t* data, uint16_t& wValue, uint16_t& wIndex) {
+    goToData.DestPos     = ( uint32_t ) ( position * 8 );
+    memcpy(reinterpret_cast<uint8_t*>(&goToData)+4, data, 3);
+    goto_words(goToData, wValue, wIndex);
+}
+
+
+// Default logging functions (no temporary strings, the log can be called on the hot path)
+static void usmc_vlog(const char* prefix, const char* fmt, va_list args) {
+    flockfile(stdout);
+    fputs(prefix, stdout);
+    vprintf(fmt, args);
+    putchar('\n');
+    funlockfile(stdout);
+}
+
 void usmc_log_error(const char* fmt, ...) {
     va_list args;
     va_start(args, fmt);
-    std::stringstream format;
-    format << "[ERROR] " << fmt << std::endl;
-    vprintf(format.str().c_str(), args);
+    usmc_vlog("[ERROR] ", fmt, args);
     va_end(args);
 }
 
 void usmc_log_warn(const char* fmt, ...) {
     va_list args;
     va_start(args, fmt);
-    std::stringstream format;
-    format << "[WARN] " << fmt << std::endl;
-    vprintf(format.str().c_str(), args);
+    usmc_vlog("[WARN] ", fmt, args);
     va_end(args);
 }
 
 void usmc_log_info(const char* fmt, ...) {
     va_list args;
     va_start(args, fmt);
-    std::stringstream format;
-    format << "[INFO] " << fmt << std::endl;
-    vprintf(format.str().c_str(), args);
+    usmc_vlog("[INFO] ", fmt, args);
     va_end(args);
 }
 
 void usmc_log_debug(const char* fmt, ...) {
     va_list args;
     va_start(args, fmt);
-    std::stringstream format;
-    format << "[DEBUG] " << fmt << std::endl;
-    vprintf(format.str().c_str(), args);
+    usmc_vlog("[DEBUG] ", fmt, args);
     va_end(args);
 }
 
 
 // Implementation constructor
-USMC_impl::USMC_impl() : _usb_ctx(NULL), _debug(false), _timeout(10000) {
+USMC_impl::USMC_impl(USMC_transport* transport) : _transport(transport), _own_transport(false), _debug(false), _timeout(10000) {
     // Set default loggers
     _error_logger = usmc_log_error;
     _warn_logger = usmc_log_warn;
     _info_logger = usmc_log_info;
     _debug_logger = usmc_log_debug;
 
-    // Initialize libusb
-    int ret = libusb_init(&_usb_ctx);
-    if(ret) {
-        // Error
-        _usb_ctx = NULL;
-        _error_logger("Failed to initialize libusb. Error: %s", libusb_strerror(static_cast<libusb_error>(ret)));
-        throw std::runtime_error("Failed to initialize libusb");
+    // Default transport is libusb
+    if(NULL == _transport) {
+        try {
+            _transport = new USMC_usb_transport();
+            _own_transport = true;
+        } catch(std::runtime_error& e) {
+            _error_logger("%s", e.what());
+            throw;
+        }
     }
+
+    // Use the clock of the transport (e.g. virtual time of the simulator)
+    if(_transport->clock())
+        usmc_set_clock(_transport->clock());
 }
 
 
 // Implementation destructor
 USMC_impl::~USMC_impl() {
-    // Close device if is open
-    for(size_t i = 0; i < _dev.size(); i++) {
-        // Close device
-        if(_dev[i]) {
-            libusb_close(_dev[i]);
-            _dev[i] = NULL;
-        }
-        // Deallocate structures
-        if(_locks[i])
-            delete _locks[i];
-        if(_params[i])
-            delete _params[i];
-        if(_mode[i])
-            delete _mode[i];
-        if(_start_params[i])
-            delete _start_params[i];
-    }
-    _dev.clear();
-    _locks.clear();
-    _params.clear();
-    _mode.clear();
-    _start_params.clear();
-    _serial.clear();
-    _version.clear();
-    _speed.clear();
-
-    // Close libusb
-    if(_usb_ctx) {
-        libusb_exit(_usb_ctx);
-        _usb_ctx = NULL;
+    // Close devices and deallocate records
+    for(size_t i = 0; i < _devices.size(); i++) {
+        _transport->close(_devices[i]->handle);
+        delete _devices[i];
     }
+    _devices.clear();
+    _interlock.clear();
+
+    // Restore the system clock
+    if(_transport->clock())
+        usmc_set_clock(NULL);
+
+    // Close transport
+    if(_own_transport)
+        delete _transport;
+    _transport = NULL;
 }
 
 
@@ -183,125 +182,85 @@ int USMC_impl::probeDevices() {
 
     int count = 0;
 
-    // Get device list
-    libusb_device **devs;
-    ssize_t cnt = libusb_get_device_list(NULL, &devs);
-    if (cnt < 0){
-        // Failed to get device list
-        _error_logger("Failed to get device list. Error: %s", libusb_strerror(static_cast<libusb_error>(cnt)));
-        return cnt;
-    }
-
-    // Traverse device list
-    libusb_device *dev = NULL;
-    int i = 0;
-    while ((dev = devs[i++]) != NULL) {
-
-        // Get device descriptor
-        struct libusb_device_descriptor desc;
-        int r = libusb_get_device_descriptor(dev, &desc);
-        if (r < 0) {
-            _warn_logger("Failed to get device descriptor. Error: %s", libusb_strerror(static_cast<libusb_error>(r)));
-            continue;
-        }
+    // Open devices
+    std::vector<void*> handles;
+    int r = _transport->open(handles, _error_logger);
+    if(r < 0)
+        return r;
 
-        if(desc.idVendor == USMC_VENDOR_ID && desc.idProduct == USMC_PRODUCT_ID) {
-            // Found an USMC device, try to open it!
-            libusb_device_handle* dev_h = NULL;
-            r = libusb_open(dev, &dev_h);
+    for(size_t i = 0; i < handles.size(); i++) {
+        // Open successfully, we can add the device to the library
+        USMC_DeviceRecord* dev = new USMC_DeviceRecord;
+        dev->id = _devices.size();
+        dev->handle = handles[i];
+        dev->version = 0;
+        dev->speed = 200.0f;
+
+        try {
+            // Read serial number
+            char buffer[32];
+            memset(buffer, 0, 32);
+            r = usmc_get_serial(*dev, buffer, 32);
             if(r < 0) {
-                _error_logger("Failed to open device. Error: %s", libusb_strerror(static_cast<libusb_error>(r)));
-
-            } else {
-                // Next ID
-                int id = _dev.size();
-
-                // Open successfully, we can add the device to the library
-                _dev.push_back(dev_h);
-
-                // Structures
-                _locks.push_back(new USMC_mutex());
-                _params.push_back(new USMC_Parameters);
-                _mode.push_back(new USMC_Mode);
-                _start_params.push_back(new USMC_StartParameters);
-                _speed.push_back(200.0f);
-
-                try {
-                    // Read serial number
-                    char buffer[32];
-                    memset(buffer, 0, 32);
-                    r = usmc_get_serial(id, buffer, 32);
-                    if(r < 0) {
-                        _error_logger("Failed to get serial number. Error: %d", r);
-                        throw std::exception();
-                    }
-                    std::string serial(buffer);
-                    _serial.push_back(serial);
-
-                    // Read version
-                    uint32_t version = 0;
-                    r = usmc_get_version(id, version);
-                    if(r < 0) {
-                        _error_logger("Failed to get version. Error: %d", r);
-                        throw std::exception();
-                    }
-                    _version.push_back(version);
+                _error_logger("Failed to get serial number. Error: %d", r);
+                throw std::exception();
+            }
+            dev->serial = buffer;
+            dev->path = _transport->path(dev->handle);
 
-                    // Init default params
-                    initDefaults(id);
+            // Read version
+            r = usmc_get_version(*dev, dev->version);
+            if(r < 0) {
+                _error_logger("Failed to get version. Error: %d", r);
+                throw std::exception();
+            }
 
-                    // Write values to hardware to get a consistent state
-                    r = usmc_set_mode(id, *(_mode[id]));
-                    if(r < 0) {
-                        _error_logger("Failed to initialize mode. Error: %d", r);
-                        throw std::exception();
-                    }
-                    r = usmc_set_parameters(id, *(_params[id]));
-                    if(r < 0) {
-                        _error_logger("Failed to initialize parameters. Error: %d", r);
-                        throw std::exception();
-                    }
+            // Init default params
+            initDefaults(*dev);
 
-                    _info_logger("Device found and open successfully.");
-                    count++;
-
-                } catch(std::exception) {
-                    // Remove device
-                    libusb_close(_dev[id]);
-                    _dev.pop_back();
-                    delete _locks[id];
-                    _locks.pop_back();
-                    delete _params[id];
-                    _params.pop_back();
-                    delete _mode[id];
-                    _mode.pop_back();
-                    delete _start_params[id];
-                    _start_params.pop_back();
-                    _speed.pop_back();
-                    if(_serial.size() > id)
-                        _serial.pop_back();
-                    if(_version.size() > id)
-                        _version.pop_back();
-                }
+            // Write values to hardware to get a consistent state
+            r = usmc_set_mode(*dev, dev->mode);
+            if(r < 0) {
+                _error_logger("Failed to initialize mode. Error: %d", r);
+                throw std::exception();
             }
+            r = usmc_set_parameters(*dev, dev->params);
+            if(r < 0) {
+                _error_logger("Failed to initialize parameters. Error: %d", r);
+                throw std::exception();
+            }
+
+        } catch(std::exception) {
+            // Remove device
+            _transport->close(dev->handle);
+            delete dev;
+            continue;
         }
-    }
 
-    // Free device list
-    libusb_free_device_list(devs, 1);
+        _devices.push_back(dev);
+        _info_logger("Device found and open successfully.");
+        count++;
+
+        // Track position for the collision interlock
+        _interlock.addAxis();
+        USMC_State state;
+        if(usmc_get_state(*dev, state) == 0)
+            _interlock.update(dev->id, _interlock.snapshot(dev->id), state.CurPos, state.RUN);
+    }
 
     return count;
 }
 
 // Return device count
 size_t USMC_impl::countDevices()const {
-    return _dev.size();
+    return _devices.size();
 }
 
 // Get device ID by serial number
 int USMC_impl::getDeviceID(const std::string& serial)const {
-    for(size_t i = 0; i < _serial.size(); i++) {
-        if(_serial[i] == serial)
+    for(size_t i = 0; i < _devices.size(); i++) {
+        USMC_read_lock cache_lock(&_devices[i]->cache_lock);
+        if(_devices[i]->serial == serial)
             return int(i);
     }
     // Not found
@@ -310,17 +269,37 @@ int USMC_impl::getDeviceID(const std::string& serial)const {
 
 // Check if device ID is valid
 bool USMC_impl::checkDevice(int device)const {
-    if(device >= 0 && device < _dev.size())
+    if(device >= 0 && size_t(device) < _devices.size())
         return true;
     else
         return false;
 }
 
+// Get device handle
+int USMC_impl::getDevice(int device, USMC_Device* handle) {
+    if(!checkDevice(device))
+        return ERR_INVALID_ID;
+    if(NULL == handle)
+        return ERR_INVALID_PARAM;
+    handle->_impl = this;
+    handle->_dev = _devices[device];
+    return ERR_SUCCESS;
+}
+
 // Get serial number
 int USMC_impl::getSerialNumber(int device, std::string& serial)const {
     if(!checkDevice(device))
         return ERR_INVALID_ID;
-    serial = _serial[device];
+    USMC_read_lock cache_lock(&_devices[device]->cache_lock);
+    serial = _devices[device]->serial;
+    return ERR_SUCCESS;
+}
+
+// Get bus path
+int USMC_impl::getBusPath(int device, std::string& path)const {
+    if(!checkDevice(device))
+        return ERR_INVALID_ID;
+    path = _devices[device]->path;
     return ERR_SUCCESS;
 }
 
@@ -328,7 +307,7 @@ int USMC_impl::getSerialNumber(int device, std::string& serial)const {
 int USMC_impl::getVersion(int device, uint32_t& version)const {
     if(!checkDevice(device))
         return ERR_INVALID_ID;
-    version = _version[device];
+    version = _devices[device]->version;
     return ERR_SUCCESS;
 }
 
@@ -336,10 +315,7 @@ int USMC_impl::getVersion(int device, uint32_t& version)const {
 int USMC_impl::getState(int device, USMC_State *state) {
     if(!checkDevice(device))
         return ERR_INVALID_ID;
-    if(NULL == state)
-        return ERR_INVALID_PARAM;
-    // Call USB
-    return usmc_get_state(device, *state);
+    return device_get_state(*_devices[device], state);
 }
 
 // Get device mode
@@ -350,7 +326,9 @@ int USMC_impl::getMode(int device, USMC_Mode* mode)const {
         return ERR_INVALID_PARAM;
 
     // Copy structure to output
-    memcpy((void*)mode, (void*)_mode[device], sizeof(USMC_Mode));
+    USMC_DeviceRecord* dev = _devices[device];
+    USMC_read_lock cache_lock(&dev->cache_lock);
+    memcpy((void*)mode, (void*)&dev->mode, sizeof(USMC_Mode));
     return ERR_SUCCESS;
 }
 
@@ -362,12 +340,15 @@ int USMC_impl::setMode(int device, const USMC_Mode* mode) {
         return ERR_INVALID_PARAM;
 
     // USB call
-    int r = usmc_set_mode(device, *mode);
+    USMC_DeviceRecord* dev = _devices[device];
+    USMC_lock config_lock(&dev->config_lock);
+    int r = usmc_set_mode(*dev, *mode);
     if(r < 0)
         return r;
 
     // Store structure
-    memcpy((void*)_mode[device], (void*)mode, sizeof(USMC_Mode));
+    USMC_write_lock cache_lock(&dev->cache_lock);
+    memcpy((void*)&dev->mode, (void*)mode, sizeof(USMC_Mode));
     return ERR_SUCCESS;
 }
 
@@ -379,7 +360,9 @@ int USMC_impl::getParameters(int device, USMC_Parameters* parameters)const {
         return ERR_INVALID_PARAM;
 
     // Copy structure to output
-    memcpy((void*)parameters, (void*)_params[device], sizeof(USMC_Parameters));
+    USMC_DeviceRecord* dev = _devices[device];
+    USMC_read_lock cache_lock(&dev->cache_lock);
+    memcpy((void*)parameters, (void*)&dev->params, sizeof(USMC_Parameters));
     return ERR_SUCCESS;
 }
 
@@ -391,56 +374,19 @@ int USMC_impl::setParameters(int device, const USMC_Parameters* parameters) {
         return ERR_INVALID_PARAM;
 
     // Check input values
-    if(parameters->AccelT < 49.0 || parameters->AccelT > 1518.0)
-        return ERR_INVALID_VALUE;
-    if(parameters->DecelT < 49.0 || parameters->DecelT > 1518.0)
-        return ERR_INVALID_VALUE;
-
-    if(parameters->PTimeout < 1.0f || parameters->PTimeout > 9961.0f)
-        return ERR_INVALID_VALUE;
-    if(parameters->BTimeout1 < 1.0f || parameters->BTimeout1 > 9961.0f)
-        return ERR_INVALID_VALUE;
-    if(parameters->BTimeout2 < 1.0f || parameters->BTimeout2 > 9961.0f)
-        return ERR_INVALID_VALUE;
-    if(parameters->BTimeout3 < 1.0f || parameters->BTimeout3 > 9961.0f)
-        return ERR_INVALID_VALUE;
-    if(parameters->BTimeout4 < 1.0f || parameters->BTimeout4 > 9961.0f)
-        return ERR_INVALID_VALUE;
-    if(parameters->BTimeoutR < 1.0f || parameters->BTimeoutR > 9961.0f)
-        return ERR_INVALID_VALUE;
-    if(parameters->BTimeoutD < 1.0f || parameters->BTimeoutD > 9961.0f)
-        return ERR_INVALID_VALUE;
-
-    if(parameters->MaxLoft < 1 || parameters->MaxLoft > 1023)
-        return ERR_INVALID_VALUE;
-    if(parameters->RTDelta < 4 || parameters->RTDelta > 1023)
-        return ERR_INVALID_VALUE;
-    if(parameters->RTMinError < 4 || parameters->RTMinError > 1023)
-        return ERR_INVALID_VALUE;
-    if(parameters->MaxTemp < 0.0f || parameters->MaxTemp > 100.0f)
-        return ERR_INVALID_VALUE;
-
-    if(parameters->MinP < 2.0f || parameters->MinP > 625.0f)
-        return ERR_INVALID_VALUE;
-    if(parameters->BTO1P < 2.0f || parameters->BTO1P > 625.0f)
-        return ERR_INVALID_VALUE;
-    if(parameters->BTO2P < 2.0f || parameters->BTO2P > 625.0f)
-        return ERR_INVALID_VALUE;
-    if(parameters->BTO3P < 2.0f || parameters->BTO3P > 625.0f)
-        return ERR_INVALID_VALUE;
-    if(parameters->BTO4P < 2.0f || parameters->BTO4P > 625.0f)
-        return ERR_INVALID_VALUE;
-
-    if(parameters->LoftPeriod != 0 && (parameters->LoftPeriod < 16.0f || parameters->LoftPeriod > 5000.0f))
+    if(!check_parameters(*parameters))
         return ERR_INVALID_VALUE;
 
     // USB call
-    int r = usmc_set_parameters(device, *parameters);
+    USMC_DeviceRecord* dev = _devices[device];
+    USMC_lock config_lock(&dev->config_lock);
+    int r = usmc_set_parameters(*dev, *parameters);
     if(r < 0)
         return r;
 
     // Store structure
-    memcpy((void*)_params[device], (void*)parameters, sizeof(USMC_Parameters));
+    USMC_write_lock cache_lock(&dev->cache_lock);
+    memcpy((void*)&dev->params, (void*)parameters, sizeof(USMC_Parameters));
     return ERR_SUCCESS;
 }
 
@@ -452,7 +398,9 @@ int USMC_impl::getStartParameters(int device, USMC_StartParameters* start_params
         return ERR_INVALID_PARAM;
 
     // Copy structure to output
-    memcpy((void*)start_params, (void*)_start_params[device], sizeof(USMC_StartParameters));
+    USMC_DeviceRecord* dev = _devices[device];
+    USMC_read_lock cache_lock(&dev->cache_lock);
+    memcpy((void*)start_params, (void*)&dev->start_params, sizeof(USMC_StartParameters));
     return ERR_SUCCESS;
 }
 
@@ -460,19 +408,16 @@ int USMC_impl::getStartParameters(int device, USMC_StartParameters* start_params
 int USMC_impl::setStartParameters(int device, const USMC_StartParameters* start_params) {
     if(!checkDevice(device))
         return ERR_INVALID_ID;
-    if(NULL == start_params)
-        return ERR_INVALID_PARAM;
-
-    // Store structure
-    memcpy((void*)_start_params[device], (void*)start_params, sizeof(USMC_StartParameters));
-    return ERR_SUCCESS;
+    return device_set_start_parameters(*_devices[device], start_params);
 }
 
 // Get speed
 int USMC_impl::getSpeed(int device, float& speed)const {
     if(!checkDevice(device))
         return ERR_INVALID_ID;
-    speed = _speed[device];
+    USMC_DeviceRecord* dev = _devices[device];
+    USMC_read_lock cache_lock(&dev->cache_lock);
+    speed = dev->speed;
     return ERR_SUCCESS;
 };
 
@@ -480,11 +425,7 @@ int USMC_impl::getSpeed(int device, float& speed)const {
 int USMC_impl::setSpeed(int device, float speed) {
     if(!checkDevice(device))
         return ERR_INVALID_ID;
-    if(speed < 16.0f || speed > 5000.0f)
-        return ERR_INVALID_VALUE;
-
-    _speed[device] = speed;
-    return ERR_SUCCESS;
+    return device_set_speed(*_devices[device], speed);
 }
 
 // Move device to position
@@ -492,8 +433,7 @@ int USMC_impl::moveTo(int device, int destination) {
     if(!checkDevice(device))
         return ERR_INVALID_ID;
 
-    // USB call
-    return usmc_goto(device, destination, _speed[device], *(_start_params[device]));
+    return device_move(*_devices[device], destination);
 }
 
 // Stop device
@@ -502,7 +442,7 @@ int USMC_impl::stop(int device) {
         return ERR_INVALID_ID;
 
     // USB call
-    return usmc_stop(device);
+    return usmc_stop(*_devices[device]);
 }
 
 // Set current position
@@ -510,6 +450,21 @@ int USMC_impl::setCurrentPosition(int device, int position) {
     if(!checkDevice(device))
         return ERR_INVALID_ID;
 
+    // USB call
+    USMC_DeviceRecord* dev = _devices[device];
+    int r = usmc_set_current_position(*dev, position);
+    if(r < 0)
+        return r;
+
+    // Coordinates changed, interlock position must be measured again
+    _interlock.invalidate(device);
+    if(_interlock.involved(device)) {
+        USMC_State state;
+        uint32_t seq = _interlock.snapshot(device);
+        if(usmc_get_state(*dev, state) == 0)
+            _interlock.update(device, seq, state.CurPos, state.RUN);
+    }
+    return ERR_SUCCESS;
 }
 
 // Get encoder state
@@ -519,11 +474,436 @@ int USMC_impl::getEncoderState(int device, USMC_EncoderState* state) {
     if(NULL == state)
         return ERR_INVALID_PARAM;
 
-    return usmc_get_encoder_state(device, *state);
+    return usmc_get_encoder_state(*_devices[device], *state);
+}
+
+// Add exclusion zone
+int USMC_impl::addExclusionZone(int deviceA, int minA, int maxA, int deviceB, int minB, int maxB) {
+    if(!checkDevice(deviceA) || !checkDevice(deviceB))
+        return ERR_INVALID_ID;
+    return _interlock.addZone(deviceA, minA, maxA, deviceB, minB, maxB);
+}
+
+// Remove exclusion zones
+void USMC_impl::clearExclusionZones() {
+    _interlock.clearZones();
+}
+
+// Get lock counters
+int USMC_impl::getLockStats(int device, USMC_LockStats* stats)const {
+    if(!checkDevice(device))
+        return ERR_INVALID_ID;
+    if(NULL == stats)
+        return ERR_INVALID_PARAM;
+
+    const USMC_mutex& lock = _devices[device]->lock;
+    stats->Acquisitions = lock.acquisitions();
+    stats->Contended    = lock.contended();
+    stats->WaitTime     = lock.wait_ns();
+    stats->Locked       = lock.locked();
+    return ERR_SUCCESS;
+}
+
+// Read device state and refresh the interlock position
+int USMC_impl::device_get_state(USMC_DeviceRecord& dev, USMC_State* state) {
+    if(NULL == state)
+        return ERR_INVALID_PARAM;
+    // Call USB
+    uint32_t seq = _interlock.snapshot(dev.id);
+    int r = usmc_get_state(dev, *state);
+    if(r < 0)
+        return r;
+
+    // Refresh interlock position
+    _interlock.update(dev.id, seq, state->CurPos, state->RUN);
+    return ERR_SUCCESS;
+}
+
+// Set speed
+int USMC_impl::device_set_speed(USMC_DeviceRecord& dev, float speed) {
+    if(speed < 16.0f || speed > 5000.0f)
+        return ERR_INVALID_VALUE;
+
+    USMC_write_lock cache_lock(&dev.cache_lock);
+    dev.speed = speed;
+    encode_goto(dev);
+    return ERR_SUCCESS;
+}
+
+// Set move parameters
+int USMC_impl::device_set_start_parameters(USMC_DeviceRecord& dev, const USMC_StartParameters* start_params) {
+    if(NULL == start_params)
+        return ERR_INVALID_PARAM;
+
+    // Store structure
+    USMC_write_lock cache_lock(&dev.cache_lock);
+    memcpy((void*)&dev.start_params, (void*)start_params, sizeof(USMC_StartParameters));
+    encode_goto(dev);
+    return ERR_SUCCESS;
+}
+
+// Move device to position
+int USMC_impl::device_move(USMC_DeviceRecord& dev, int destination) {
+    // Check exclusion zones
+    int r = _interlock.reserve(dev.id, destination);
+    if(r < 0) {
+        _warn_logger("Move of device %d to %d rejected by interlock.", dev.id, destination);
+        return r;
+    }
+
+    // Consistent copy of the pre-encoded move settings
+    uint8_t data[3];
+    {
+        USMC_read_lock cache_lock(&dev.cache_lock);
+        memcpy(data, dev.goto_data, 3);
+    }
+
+    // USB call
+    return usmc_goto(dev, destination, data);
+}
+
+// Send the commands and read the state of several devices in one batch
+void USMC_impl::device_exchange(USMC_ExchangeSlot* slots, size_t n, USMC_TransferRequest* requests) {
+    size_t nreq = 0;
+    for(size_t i = 0; i < n; i++) {
+        USMC_ExchangeSlot& slot = slots[i];
+        USMC_DeviceRecord& dev = *slot.dev;
+        slot.state_result = ERR_SUCCESS;
+
+        // Configuration writes, sent before the command of the slot
+        if(slot.command != USMC_EXCHANGE_NONE)
+            slot.command_result = ERR_SUCCESS;
+        slot.config_result = ERR_SUCCESS;
+        if(slot.params && !check_parameters(*slot.params)) {
+            // Invalid parameters cancel the writes and the command of the slot
+            slot.config_result = ERR_INVALID_VALUE;
+            if(slot.command != USMC_EXCHANGE_NONE)
+                slot.command_result = ERR_INVALID_VALUE;
+        } else {
+            if(slot.mode) {
+                USMC_TransferRequest& req = requests[nreq++];
+                req.handle = dev.handle;
+                req.bRequestType = LIBUSB_ENDPOINT_OUT | LIBUSB_RECIPIENT_DEVICE | LIBUSB_REQUEST_TYPE_VENDOR;
+                req.bRequest = 0x81;
+                encode_mode(*slot.mode, slot.mode_packet, req.wValue, req.wIndex);
+                req.data = reinterpret_cast<uint8_t*>(&slot.mode_packet)+4;
+                req.wLength = 3;
+            }
+            if(slot.params) {
+                USMC_TransferRequest& req = requests[nreq++];
+                req.handle = dev.handle;
+                req.bRequestType = LIBUSB_ENDPOINT_OUT | LIBUSB_RECIPIENT_DEVICE | LIBUSB_REQUEST_TYPE_VENDOR;
+                req.bRequest = 0x83;
+                encode_parameters(dev, *slot.params, slot.params_packet, req.wValue, req.wIndex);
+                req.data = reinterpret_cast<uint8_t*>(&slot.params_packet)+4;
+                req.wLength = 0x0035;
+            }
+        }
+
+        // Command (not sent when cancelled)
+        bool send = slot.command_result == ERR_SUCCESS;
+        if(send && (slot.command == USMC_EXCHANGE_MOVE || slot.command == USMC_EXCHANGE_PACKET)) {
+            int r = _interlock.reserve(dev.id, slot.destination);
+            if(r < 0) {
+                _warn_logger("Move of device %d to %d rejected by interlock.", dev.id, slot.destination);
+                slot.command_result = r;
+            } else {
+                USMC_TransferRequest& req = requests[nreq++];
+                req.handle = dev.handle;
+                req.bRequestType = LIBUSB_ENDPOINT_OUT | LIBUSB_RECIPIENT_DEVICE | LIBUSB_REQUEST_TYPE_VENDOR;
+                req.bRequest = 0x80;
+                if(slot.command == USMC_EXCHANGE_MOVE) {
+                    uint8_t data[3];
+                    {
+                        USMC_read_lock cache_lock(&dev.cache_lock);
+                        memcpy(data, dev.goto_data, 3);
+                    }
+                    goto_setup(slot.go_to, slot.destination, data, req.wValue, req.wIndex);
+                } else {
+                    goto_words(slot.go_to, req.wValue, req.wIndex);
+                }
+                req.data = reinterpret_cast<uint8_t*>(&slot.go_to)+4;
+                req.wLength = 3;
+            }
+        } else if(send && slot.command == USMC_EXCHANGE_STOP) {
+            USMC_TransferRequest& req = requests[nreq++];
+            req.handle = dev.handle;
+            req.bRequestType = LIBUSB_ENDPOINT_OUT | LIBUSB_RECIPIENT_DEVICE | LIBUSB_REQUEST_TYPE_VENDOR;
+            req.bRequest = 0x07;
+            req.wValue = 0;
+            req.wIndex = 0;
+            req.data = NULL;
+            req.wLength = 0;
+        }
+
+        // State read
+        slot.seq = _interlock.snapshot(dev.id);
+        USMC_TransferRequest& req = requests[nreq++];
+        req.handle = dev.handle;
+        req.bRequestType = LIBUSB_ENDPOINT_IN | LIBUSB_RECIPIENT_DEVICE | LIBUSB_REQUEST_TYPE_VENDOR;
+        req.bRequest = 0x82;
+        req.wValue = 0;
+        req.wIndex = 0;
+        req.data = reinterpret_cast<uint8_t*>(&slot.state_packet);
+        req.wLength = sizeof(STATE_PACKET);
+    }
+
+    // Take the configuration locks of the slots that write the configuration,
+    // then the access locks, in device order and run the batch
+    for(size_t i = 0; i < n; i++) {
+        if(slots[i].config_result == ERR_SUCCESS && (slots[i].mode || slots[i].params))
+            slots[i].dev->config_lock.acquire();
+    }
+    for(size_t i = 0; i < n; i++)
+        slots[i].dev->lock.acquire();
+    _transport->control_transfers(requests, nreq, _timeout);
+    for(size_t i = n; i > 0; i--)
+        slots[i-1].dev->lock.release();
+
+    // Results
+    nreq = 0;
+    for(size_t i = 0; i < n; i++) {
+        USMC_ExchangeSlot& slot = slots[i];
+        USMC_DeviceRecord& dev = *slot.dev;
+        if(slot.config_result == ERR_SUCCESS && (slot.mode || slot.params)) {
+            int mode_res = slot.mode ? requests[nreq++].result : 0;
+            int params_res = slot.params ? requests[nreq++].result : 0;
+            if(mode_res < 0) {
+                _error_logger("Failed to set device mode. Error: %s", _transport->strerror(mode_res));
+                slot.config_result = mode_res;
+            }
+            if(params_res < 0) {
+                _error_logger("Failed to set device parameters. Error: %s", _transport->strerror(params_res));
+                if(slot.config_result == ERR_SUCCESS)
+                    slot.config_result = params_res;
+            }
+
+            // Store the written structures, like setMode() and setParameters()
+            {
+                USMC_write_lock cache_lock(&dev.cache_lock);
+                if(slot.mode && mode_res >= 0)
+                    memcpy((void*)&dev.mode, (const void*)slot.mode, sizeof(USMC_Mode));
+                if(slot.params && params_res >= 0)
+                    memcpy((void*)&dev.params, (const void*)slot.params, sizeof(USMC_Parameters));
+            }
+            dev.config_lock.release();
+        }
+        if(slot.command != USMC_EXCHANGE_NONE && slot.command_result == ERR_SUCCESS) {
+            int res = requests[nreq++].result;
+            if(res < 0) {
+                _error_logger("Failed to %s device. Error: %s", slot.command == USMC_EXCHANGE_STOP ? "stop" : "move", _transport->strerror(res));
+                slot.command_result = res;
+            }
+        }
+        int res = requests[nreq++].result;
+        if(res < 0) {
+            _error_logger("Failed to get device state. Error: %s", _transport->strerror(res));
+            slot.state_result = res;
+        } else if(res < int(sizeof(STATE_PACKET))) {
+            _error_logger("Failed to get device state. Short read (%d bytes).", res);
+            slot.state_result = ERR_USB_IO;
+        } else {
+            decode_state(dev, slot.state_packet, slot.state);
+            _interlock.update(dev.id, slot.seq, slot.state.CurPos, slot.state.RUN);
+        }
+    }
+}
+
+// Encode speed and start parameters of the goto command
+void USMC_impl::encode_goto(USMC_DeviceRecord& dev) {
+    GO_TO_PACKET goToData;
+    memset(&goToData, 0, sizeof(GO_TO_PACKET));
+    encode_payload(goToData, dev.speed, dev.start_params);
+    memcpy(dev.goto_data, reinterpret_cast<uint8_t*>(&goToData)+4, 3);
+}
+
+// Check the ranges of the parameters
+bool USMC_impl::check_parameters(const USMC_Parameters& params)const {
+    if(params.AccelT < 49.0 || params.AccelT > 1518.0)
+        return false;
+    if(params.DecelT < 49.0 || params.DecelT > 1518.0)
+        return false;
+
+    if(params.PTimeout < 1.0f || params.PTimeout > 9961.0f)
+        return false;
+    if(params.BTimeout1 < 1.0f || params.BTimeout1 > 9961.0f)
+        return false;
+    if(params.BTimeout2 < 1.0f || params.BTimeout2 > 9961.0f)
+        return false;
+    if(params.BTimeout3 < 1.0f || params.BTimeout3 > 9961.0f)
+        return false;
+    if(params.BTimeout4 < 1.0f || params.BTimeout4 > 9961.0f)
+        return false;
+    if(params.BTimeoutR < 1.0f || params.BTimeoutR > 9961.0f)
+        return false;
+    if(params.BTimeoutD < 1.0f || params.BTimeoutD > 9961.0f)
+        return false;
+
+    if(params.MaxLoft < 1 || params.MaxLoft > 1023)
+        return false;
+    if(params.RTDelta < 4 || params.RTDelta > 1023)
+        return false;
+    if(params.RTMinError < 4 || params.RTMinError > 1023)
+        return false;
+    if(params.MaxTemp < 0.0f || params.MaxTemp > 100.0f)
+        return false;
+
+    if(params.MinP < 2.0f || params.MinP > 625.0f)
+        return false;
+    if(params.BTO1P < 2.0f || params.BTO1P > 625.0f)
+        return false;
+    if(params.BTO2P < 2.0f || params.BTO2P > 625.0f)
+        return false;
+    if(params.BTO3P < 2.0f || params.BTO3P > 625.0f)
+        return false;
+    if(params.BTO4P < 2.0f || params.BTO4P > 625.0f)
+        return false;
+
+    if(params.LoftPeriod != 0 && (params.LoftPeriod < 16.0f || params.LoftPeriod > 5000.0f))
+        return false;
+
+    return true;
+}
+
+// Encode a mode packet and its setup words
+void USMC_impl::encode_mode(const USMC_Mode& mode, MODE_PACKET& packet, uint16_t& wValue, uint16_t& wIndex) {
+    // Byte 0:
+    packet.PMODE     = mode.PMode;
+    packet.REFINEN   = mode.PReg;
+    packet.RESETD    = mode.ResetD;
+    packet.EMRESET   = mode.EMReset;
+    packet.TR1T      = mode.Tr1T;
+    packet.TR2T      = mode.Tr2T;
+    packet.ROTTRT    = mode.RotTrT;
+    packet.TRSWAP    = mode.TrSwap;
+    // Byte 1:
+    packet.TR1EN     = mode.Tr1En;
+    packet.TR2EN     = mode.Tr2En;
+    packet.ROTTREN   = mode.RotTeEn;
+    packet.ROTTROP   = mode.RotTrOp;
+    packet.BUTT1T    = mode.Butt1T;
+    packet.BUTT2T    = mode.Butt2T;
+    /*packet.BUTSWAP = ...;*/
+    packet.RESETRT   = mode.ResetRT;
+    // Byte 2:
+    packet.SNCOUTEN  = mode.SyncOUTEn;
+    packet.SYNCOUTR  = mode.SyncOUTR;
+    packet.SYNCINOP  = mode.SyncINOp;
+    packet.SYNCOPOL  = mode.SyncInvert;
+    packet.ENCODER   = mode.EncoderEn;
+    packet.INVENC    = mode.EncoderInv;
+    packet.RESBENC   = mode.ResBEnc;
+    packet.RESENC    = mode.ResEnc;
+
+    packet.SYNCCOUNT = PACK_DWORD ( mode.SyncCount );
+
+    wValue        = FIRST_WORD_SWAPPED  ( reinterpret_cast<uint32_t*>(&packet) );
+    wIndex        = SECOND_WORD_SWAPPED ( reinterpret_cast<uint32_t*>(&packet) );
+}
+
+// Encode a parameters packet and its setup words
+void USMC_impl::encode_parameters(const USMC_DeviceRecord& dev, const USMC_Parameters& params, PARAMETERS_PACKET& packet, uint16_t& wValue, uint16_t& wIndex) {
+    /*=====================*/
+    /* ----Conversion:---- */
+    /*=====================*/
+    packet.DELAY1       = ( uint8_t ) clamp ( ( int ) ( params.AccelT / 98.0f + 0.5f ), 1, 15 );
+    packet.DELAY2       = ( uint8_t ) clamp ( ( int ) ( params.DecelT / 98.0f + 0.5f ), 1, 15 );
+    packet.RefINTimeout = ( uint16_t ) ( clamp ( params.PTimeout , 1.0f, 9961.0f ) / 0.152f + 0.5f );
+    packet.BTIMEOUT1    = PACK_WORD ( ( uint16_t ) ( clamp ( params.BTimeout1, 1.0f, 9961.0f ) / 0.152f + 0.5f ) );
+    packet.BTIMEOUT2    = PACK_WORD ( ( uint16_t ) ( clamp ( params.BTimeout2, 1.0f, 9961.0f ) / 0.152f + 0.5f ) );
+    packet.BTIMEOUT3    = PACK_WORD ( ( uint16_t ) ( clamp ( params.BTimeout3, 1.0f, 9961.0f ) / 0.152f + 0.5f ) );
+    packet.BTIMEOUT4    = PACK_WORD ( ( uint16_t ) ( clamp ( params.BTimeout4, 1.0f, 9961.0f ) / 0.152f + 0.5f ) );
+    packet.BTIMEOUTR    = PACK_WORD ( ( uint16_t ) ( clamp ( params.BTimeoutR, 1.0f, 9961.0f ) / 0.152f + 0.5f ) );
+    packet.BTIMEOUTD    = PACK_WORD ( ( uint16_t ) ( clamp ( params.BTimeoutD, 1.0f, 9961.0f ) / 0.152f + 0.5f ) );
+    packet.MINPERIOD    = PACK_WORD ( ( uint16_t ) ( 65536.0f - ( 125000.0f / clamp ( params.MinP , 2.0f, 625.0f ) ) + 0.5f ) );
+    packet.BTO1P        = PACK_WORD ( ( uint16_t ) ( 65536.0f - ( 125000.0f / clamp ( params.BTO1P, 2.0f, 625.0f ) ) + 0.5f ) );
+    packet.BTO2P        = PACK_WORD ( ( uint16_t ) ( 65536.0f - ( 125000.0f / clamp ( params.BTO2P, 2.0f, 625.0f ) ) + 0.5f ) );
+    packet.BTO3P        = PACK_WORD ( ( uint16_t ) ( 65536.0f - ( 125000.0f / clamp ( params.BTO3P, 2.0f, 625.0f ) ) + 0.5f ) );
+    packet.BTO4P        = PACK_WORD ( ( uint16_t ) ( 65536.0f - ( 125000.0f / clamp ( params.BTO4P, 2.0f, 625.0f ) ) + 0.5f ) );
+    packet.MAX_LOFT     = PACK_WORD ( ( uint16_t ) ( clamp ( params.MaxLoft, 1, 1023 ) * 64 ) );
+
+    if ( dev.version < 0x2407 ) {
+        packet.STARTPOS = 0x00000000L;
+    } else {
+        packet.STARTPOS = PACK_DWORD ( params.StartPos * 8 & 0xFFFFFF00 );
+    }
+
+    packet.RTDelta    = PACK_WORD ( ( uint16_t ) ( clamp ( params.RTDelta   , 4, 1023 ) * 64 ) );
+    packet.RTMinError = PACK_WORD ( ( uint16_t ) ( clamp ( params.RTMinError, 4, 1023 ) * 64 ) );
+
+    double t = ( double ) clamp ( params.MaxTemp, 0.0f, 100.0f );
+
+    if ( dev.version < 0x2400 )
+    {
+        t = 10.0 * exp ( 3950.0 * ( 1.0 / ( t + 273.0 ) - 1.0 / 298.0 ) );
+        t = ( ( 5 * t / ( 10 + t ) ) * 65536.0 / 3.3 + 0.5 );
+    }
+    else
+    {
+        t = ( t + 50.0 ) / 330.0 * 65536.0;
+        t = ( t + 0.5f );
+    }
+
+    packet.MaxTemp    = PACK_WORD ( ( uint16_t ) t );
+    packet.SynOUTP    = params.SynOUTP;
+    packet.LoftPeriod = params.LoftPeriod == 0.0f ? 0 : PACK_WORD ( ( uint16_t ) ( 65536.0f - ( 125000.0f / clamp ( params.LoftPeriod, 16.0f, 5000.0f ) ) + 0.5f ) );
+    packet.EncVSCP    = ( uint8_t ) ( params.EncMult * 4.0f + 0.5f );
+    //packet.EncVSCP = 1;
+
+    memset ( packet.Reserved, 0, 15 );
+
+    wValue        = FIRST_WORD_SWAPPED ( reinterpret_cast<uint32_t*>(&packet) );
+    wIndex        = SECOND_WORD        ( reinterpret_cast<uint32_t*>(&packet) );
+}
+
+// Encode a complete goto packet (speed <= 0 uses the device speed)
+void USMC_impl::encode_move(USMC_DeviceRecord& dev, int destination, float speed, GO_TO_PACKET& goToData) {
+    memset(&goToData, 0, sizeof(GO_TO_PACKET));
+    {
+        USMC_read_lock cache_lock(&dev.cache_lock);
+        if(speed > 0.0f)
+            encode_payload(goToData, speed, dev.start_params);
+        else
+            memcpy(reinterpret_cast<uint8_t*>(&goToData)+4, dev.goto_data, 3);
+    }
+    goToData.DestPos = ( uint32_t ) ( destination * 8 );
+}
+
+// Encode speed and start parameters in a goto packet
+void USMC_impl::encode_payload(GO_TO_PACKET& goToData, float speed, const USMC_StartParameters& start_params) {
+    /*=====================*/
+    /* ----Conversion:---- */
+    /*=====================*/
+    goToData.TimerPeriod = PACK_WORD ( ( uint16_t ) ( 65536.0f - ( 1000000.0f / clamp ( speed, 16.0f, 5000.0f ) ) + 0.5f ) );
+    switch (start_params.SDivisor) {
+        case 1:
+            goToData.M1 = goToData.M2 = 0;
+            break;
+        case 2:
+            goToData.M1 = 1;
+            goToData.M2 = 0;
+            break;
+        case 4:
+            goToData.M1 = 0;
+            goToData.M2 = 1;
+            break;
+        case 8:
+            goToData.M1 = 1;
+            goToData.M2 = 1;
+            break;
+    }
+    //goToData.M1          = params.SDivisor && 0x01;
+    //goToData.M2          = params.SDivisor && 0x02;
+    goToData.DEFDIR      = start_params.DefDir;
+    goToData.LOFTEN      = start_params.LoftEn;
+    goToData.SLSTRT      = start_params.SlStart;
+    goToData.WSYNCIN     = start_params.WSyncIN;
+    goToData.SYNCOUTR    = start_params.SyncOUTR;
+    goToData.FORCELOFT   = start_params.ForceLoft;
 }
 
 // USB call to get version
-int USMC_impl::usmc_get_version(int id, uint32_t& version) {
+int USMC_impl::usmc_get_version(USMC_DeviceRecord& dev, uint32_t& version) {
     uint8_t  bRequestType = LIBUSB_ENDPOINT_IN      |
                             LIBUSB_RECIPIENT_DEVICE |
                             LIBUSB_REQUEST_TYPE_STANDARD;
@@ -532,16 +912,16 @@ int USMC_impl::usmc_get_version(int id, uint32_t& version) {
     uint16_t wIndex = 0x0409;
     uint16_t wLength = 0x0006;
     uint8_t buffer[wLength+1];
-    buffer[wLength] = 0;
+    memset(buffer, 0, wLength+1);
 
     // Access lock
-    USMC_lock access_lock(_locks[id]);
+    USMC_lock access_lock(&dev.lock);
 
-    int res = libusb_control_transfer(_dev[id], bRequestType, bRequest, wValue, wIndex, buffer, wLength, _timeout);
+    int res = _transport->control_transfer(dev.handle, bRequestType, bRequest, wValue, wIndex, buffer, wLength, _timeout);
 
     if(res < 0) {
         // Call failed
-        _error_logger("Failed to get version. Error: %s", libusb_strerror(static_cast<libusb_error>(res)));
+        _error_logger("Failed to get version. Error: %s", _transport->strerror(res));
         return res;
 
     } else {
@@ -552,7 +932,7 @@ int USMC_impl::usmc_get_version(int id, uint32_t& version) {
 }
 
 // USB call to get serial number
-int USMC_impl::usmc_get_serial(int id, char* serial, size_t len) {
+int USMC_impl::usmc_get_serial(USMC_DeviceRecord& dev, char* serial, size_t len) {
     uint8_t  bRequestType = LIBUSB_ENDPOINT_IN      |
                             LIBUSB_RECIPIENT_DEVICE |
                             LIBUSB_REQUEST_TYPE_VENDOR;
@@ -561,15 +941,16 @@ int USMC_impl::usmc_get_serial(int id, char* serial, size_t len) {
     uint16_t wIndex = 0x0000;
     uint16_t wLength = 0x0010;
     uint8_t buffer[wLength];
+    memset(buffer, 0, wLength);
 
     // Access lock
-    USMC_lock access_lock(_locks[id]);
+    USMC_lock access_lock(&dev.lock);
 
-    int res = libusb_control_transfer(_dev[id], bRequestType, bRequest, wValue, wIndex, (uint8_t*)buffer, wLength, _timeout);
+    int res = _transport->control_transfer(dev.handle, bRequestType, bRequest, wValue, wIndex, (uint8_t*)buffer, wLength, _timeout);
 
     if(res < 0) {
         // Call failed
-        _error_logger("Failed to get serial number. Error: %s", libusb_strerror(static_cast<libusb_error>(res)));
+        _error_logger("Failed to get serial number. Error: %s", _transport->strerror(res));
         return res;
 
     } else {
@@ -581,7 +962,7 @@ int USMC_impl::usmc_get_serial(int id, char* serial, size_t len) {
 }
 
 // USB call to get encoder state
-int USMC_impl::usmc_get_encoder_state(int id, USMC_EncoderState& state) {
+int USMC_impl::usmc_get_encoder_state(USMC_DeviceRecord& dev, USMC_EncoderState& state) {
     uint8_t  bRequestType = LIBUSB_ENDPOINT_IN      |
                             LIBUSB_RECIPIENT_DEVICE |
                             LIBUSB_REQUEST_TYPE_VENDOR;
@@ -592,15 +973,20 @@ int USMC_impl::usmc_get_encoder_state(int id, USMC_EncoderState& state) {
     ENCODER_STATE_PACKET getEncoderStateData;
 
     // Access lock
-    USMC_lock access_lock(_locks[id]);
+    USMC_lock access_lock(&dev.lock);
 
-    int res = libusb_control_transfer(_dev[id], bRequestType, bRequest, wValue, wIndex, reinterpret_cast<uint8_t*>(&getEncoderStateData), wLength, _timeout);
+    int res = _transport->control_transfer(dev.handle, bRequestType, bRequest, wValue, wIndex, reinterpret_cast<uint8_t*>(&getEncoderStateData), wLength, _timeout);
 
     if(res < 0) {
         // Call failed
-        _error_logger("Failed to get encoder state. Error: %s", libusb_strerror(static_cast<libusb_error>(res)));
+        _error_logger("Failed to get encoder state. Error: %s", _transport->strerror(res));
         return res;
 
+    } else if(res < wLength) {
+        // Short read, packet is incomplete
+        _error_logger("Failed to get encoder state. Short read (%d bytes).", res);
+        return ERR_USB_IO;
+
     } else {
         state.ECurPos    = getEncoderStateData.ECurPos;
         state.EncoderPos = getEncoderStateData.EncPos;
@@ -610,7 +996,7 @@ int USMC_impl::usmc_get_encoder_state(int id, USMC_EncoderState& state) {
 }
 
 // USB call to get device state
-int USMC_impl::usmc_get_state(int id, USMC_State& state) {
+int USMC_impl::usmc_get_state(USMC_DeviceRecord& dev, USMC_State& state) {
     uint8_t  bRequestType = LIBUSB_ENDPOINT_IN      |
                             LIBUSB_RECIPIENT_DEVICE |
                             LIBUSB_REQUEST_TYPE_VENDOR;
@@ -621,60 +1007,70 @@ int USMC_impl::usmc_get_state(int id, USMC_State& state) {
     STATE_PACKET getStateData;
 
     // Access lock
-    USMC_lock access_lock(_locks[id]);
+    USMC_lock access_lock(&dev.lock);
 
-    int res = libusb_control_transfer(_dev[id], bRequestType, bRequest, wValue, wIndex, reinterpret_cast<uint8_t*>(&getStateData), wLength, _timeout);
+    int res = _transport->control_transfer(dev.handle, bRequestType, bRequest, wValue, wIndex, reinterpret_cast<uint8_t*>(&getStateData), wLength, _timeout);
 
     if(res < 0) {
         // Call failed
-        _error_logger("Failed to get device state. Error: %s", libusb_strerror(static_cast<libusb_error>(res)));
+        _error_logger("Failed to get device state. Error: %s", _transport->strerror(res));
         return res;
 
-    } else {
-        state.AReset    = getStateData.AFTRESET;
-        state.CurPos    = ( ( signed int ) getStateData.CurPos ) / 8;
-        state.CW_CCW    = getStateData.CW_CCW;
-        state.EmReset   = getStateData.EMRESET;
-        state.FullPower = getStateData.REFIN;
-        state.FullSpeed = getStateData.FULLSPEED;
-        state.Loft      = getStateData.LOFT;
-        state.Power     = getStateData.RESET;
-        state.RotTr     = getStateData.ROTTR;
-        state.RotTrErr  = getStateData.ROTTRERR;
-        state.RUN       = getStateData.RUN;
-        /* state.SDivisor= See below; */
-        state.SyncIN    = getStateData.SYNCIN;
-        state.SyncOUT   = getStateData.SYNCOUT;
-        /* state.Temp    = See below; */
-        state.Trailer1  = getStateData.TRAILER1;
-        state.Trailer2  = getStateData.TRAILER2;
-        /* state.Voltage = See below; */
-
-        state.SDivisor  = ( uint8_t ) ( 1 << ( getStateData.M2 << 1 | getStateData.M1 ) );
-        double t        = ( double ) getStateData.Temp;
-
-        if ( _version[id] < 0x2400 )
-        {
-            t = t * 3.3 / 65536.0;
-            t = t * 10.0 / ( 5.0 - t );
-            t = ( 1.0 / 298.0 ) + ( 1.0 / 3950.0 ) * log ( t / 10.0 );
-            t = 1.0 / t - 273.0;
-        }
-        else
-        {
-            t = ( ( t * 3.3 * 100.0 / 65536.0 ) - 50.0 );
-        }
+    } else if(res < wLength) {
+        // Short read, packet is incomplete
+        _error_logger("Failed to get device state. Short read (%d bytes).", res);
+        return ERR_USB_IO;
 
-        state.Temp    = ( float ) t;
-        state.Voltage = ( float ) ( ( ( double ) getStateData.Voltage ) / 65536.0 * 3.3 * 20.0 );
-        state.Voltage = state.Voltage < 5.0f ? 0.0f : state.Voltage;
+    } else {
+        decode_state(dev, getStateData, state);
     }
 
     return 0;
 }
 
-// USB call to move device
-int USMC_impl::usmc_goto(int id, int position, float speed, const USMC_StartParameters& params) {
+// Decode a state packet
+void USMC_impl::decode_state(const USMC_DeviceRecord& dev, const STATE_PACKET& packet, USMC_State& state) {
+    state.AReset    = packet.AFTRESET;
+    state.CurPos    = ( ( signed int ) packet.CurPos ) / 8;
+    state.CW_CCW    = packet.CW_CCW;
+    state.EmReset   = packet.EMRESET;
+    state.FullPower = packet.REFIN;
+    state.FullSpeed = packet.FULLSPEED;
+    state.Loft      = packet.LOFT;
+    state.Power     = packet.RESET;
+    state.RotTr     = packet.ROTTR;
+    state.RotTrErr  = packet.ROTTRERR;
+    state.RUN       = packet.RUN;
+    /* state.SDivisor= See below; */
+    state.SyncIN    = packet.SYNCIN;
+    state.SyncOUT   = packet.SYNCOUT;
+    /* state.Temp    = See below; */
+    state.Trailer1  = packet.TRAILER1;
+    state.Trailer2  = packet.TRAILER2;
+    /* state.Voltage = See below; */
+
+    state.SDivisor  = ( uint8_t ) ( 1 << ( packet.M2 << 1 | packet.M1 ) );
+    double t        = ( double ) packet.Temp;
+
+    if ( dev.version < 0x2400 )
+    {
+        t = t * 3.3 / 65536.0;
+        t = t * 10.0 / ( 5.0 - t );
+        t = ( 1.0 / 298.0 ) + ( 1.0 / 3950.0 ) * log ( t / 10.0 );
+        t = 1.0 / t - 273.0;
+    }
+    else
+    {
+        t = ( ( t * 3.3 * 100.0 / 65536.0 ) - 50.0 );
+    }
+
+    state.Temp    = ( float ) t;
+    state.Voltage = ( float ) ( ( ( double ) packet.Voltage ) / 65536.0 * 3.3 * 20.0 );
+    state.Voltage = state.Voltage < 5.0f ? 0.0f : state.Voltage;
+}
+
+// USB call to move device (data is the pre-encoded payload)
+int USMC_impl::usmc_goto(USMC_DeviceRecord& dev, int position, const uint8_t* data) {
     uint8_t  bRequestType = LIBUSB_ENDPOINT_OUT     |
                             LIBUSB_RECIPIENT_DEVICE |
                             LIBUSB_REQUEST_TYPE_VENDOR;
@@ -684,48 +1080,16 @@ int USMC_impl::usmc_goto(int id, int position, float speed, const USMC_StartPara
     uint16_t wLength = 3;
     GO_TO_PACKET goToData;
 
-    /*=====================*/
-    /* ----Conversion:---- */
-    /*=====================*/
-    goToData.DestPos     = ( uint32_t ) ( position * 8 );
-    goToData.TimerPeriod = PACK_WORD ( ( uint16_t ) ( 65536.0f - ( 1000000.0f / clamp ( speed, 16.0f, 5000.0f ) ) + 0.5f ) );
-    switch (params.SDivisor) {
-        case 1:
-            goToData.M1 = goToData.M2 = 0;
-            break;
-        case 2:
-            goToData.M1 = 1;
-            goToData.M2 = 0;
-            break;
-        case 4:
-            goToData.M1 = 0;
-            goToData.M2 = 1;
-            break;
-        case 8:
-            goToData.M1 = 1;
-            goToData.M2 = 1;
-            break;
-    }
-    //goToData.M1          = params.SDivisor && 0x01;
-    //goToData.M2          = params.SDivisor && 0x02;
-    goToData.DEFDIR      = params.DefDir;
-    goToData.LOFTEN      = params.LoftEn;
-    goToData.SLSTRT      = params.SlStart;
-    goToData.WSYNCIN     = params.WSyncIN;
-    goToData.SYNCOUTR    = params.SyncOUTR;
-    goToData.FORCELOFT   = params.ForceLoft;
-
-    wIndex   = FIRST_WORD  ( reinterpret_cast<uint32_t*>(&goToData) );
-    wValue   = SECOND_WORD ( reinterpret_cast<uint32_t*>(&goToData) );
+    goto_setup(goToData, position, data, wValue, wIndex);
 
     // Access lock
-    USMC_lock access_lock(_locks[id]);
+    USMC_lock access_lock(&dev.lock);
 
-    int res = libusb_control_transfer(_dev[id], bRequestType, bRequest, wValue, wIndex, reinterpret_cast<uint8_t*>(&goToData)+4, wLength, _timeout);
+    int res = _transport->control_transfer(dev.handle, bRequestType, bRequest, wValue, wIndex, reinterpret_cast<uint8_t*>(&goToData)+4, wLength, _timeout);
 
     if(res < 0) {
         // Call failed
-        _error_logger("Failed to move device. Error: %s", libusb_strerror(static_cast<libusb_error>(res)));
+        _error_logger("Failed to move device. Error: %s", _transport->strerror(res));
         return res;
     }
 
@@ -733,7 +1097,7 @@ int USMC_impl::usmc_goto(int id, int position, float speed, const USMC_StartPara
 }
 
 // USB call to move device
-int USMC_impl::usmc_set_mode(int id, const USMC_Mode& mode) {
+int USMC_impl::usmc_set_mode(USMC_DeviceRecord& dev, const USMC_Mode& mode) {
     uint8_t  bRequestType = LIBUSB_ENDPOINT_OUT     |
                             LIBUSB_RECIPIENT_DEVICE |
                             LIBUSB_REQUEST_TYPE_VENDOR;
@@ -743,47 +1107,16 @@ int USMC_impl::usmc_set_mode(int id, const USMC_Mode& mode) {
     uint16_t wLength = 3;
     MODE_PACKET setModeData;
 
-    // Byte 0:
-    setModeData.PMODE     = mode.PMode;
-    setModeData.REFINEN   = mode.PReg;
-    setModeData.RESETD    = mode.ResetD;
-    setModeData.EMRESET   = mode.EMReset;
-    setModeData.TR1T      = mode.Tr1T;
-    setModeData.TR2T      = mode.Tr2T;
-    setModeData.ROTTRT    = mode.RotTrT;
-    setModeData.TRSWAP    = mode.TrSwap;
-    // Byte 1:
-    setModeData.TR1EN     = mode.Tr1En;
-    setModeData.TR2EN     = mode.Tr2En;
-    setModeData.ROTTREN   = mode.RotTeEn;
-    setModeData.ROTTROP   = mode.RotTrOp;
-    setModeData.BUTT1T    = mode.Butt1T;
-    setModeData.BUTT2T    = mode.Butt2T;
-    /*setModeData.BUTSWAP = ...;*/
-    setModeData.RESETRT   = mode.ResetRT;
-    // Byte 2:
-    setModeData.SNCOUTEN  = mode.SyncOUTEn;
-    setModeData.SYNCOUTR  = mode.SyncOUTR;
-    setModeData.SYNCINOP  = mode.SyncINOp;
-    setModeData.SYNCOPOL  = mode.SyncInvert;
-    setModeData.ENCODER   = mode.EncoderEn;
-    setModeData.INVENC    = mode.EncoderInv;
-    setModeData.RESBENC   = mode.ResBEnc;
-    setModeData.RESENC    = mode.ResEnc;
-
-    setModeData.SYNCCOUNT = PACK_DWORD ( mode.SyncCount );
-
-    wValue        = FIRST_WORD_SWAPPED  ( reinterpret_cast<uint32_t*>(&setModeData) );
-    wIndex        = SECOND_WORD_SWAPPED ( reinterpret_cast<uint32_t*>(&setModeData) );
+    encode_mode(mode, setModeData, wValue, wIndex);
 
     // Access lock
-    USMC_lock access_lock(_locks[id]);
+    USMC_lock access_lock(&dev.lock);
 
-    int res = libusb_control_transfer(_dev[id], bRequestType, bRequest, wValue, wIndex, reinterpret_cast<uint8_t*>(&setModeData)+4, wLength, _timeout);
+    int res = _transport->control_transfer(dev.handle, bRequestType, bRequest, wValue, wIndex, reinterpret_cast<uint8_t*>(&setModeData)+4, wLength, _timeout);
 
     if(res < 0) {
         // Call failed
-        _error_logger("Failed to set device mode. Error: %s", libusb_strerror(static_cast<libusb_error>(res)));
+        _error_logger("Failed to set device mode. Error: %s", _transport->strerror(res));
         return res;
     }
 
@@ -791,7 +1124,7 @@ int USMC_impl::usmc_set_mode(int id, const USMC_Mode& mode) {
 }
 
 // USB call to set device parameters
-int USMC_impl::usmc_set_parameters(int id, const USMC_Parameters& params) {
+int USMC_impl::usmc_set_parameters(USMC_DeviceRecord& dev, const USMC_Parameters& params) {
     uint8_t  bRequestType = LIBUSB_ENDPOINT_OUT     |
                             LIBUSB_RECIPIENT_DEVICE |
                             LIBUSB_REQUEST_TYPE_VENDOR;
@@ -802,66 +1135,48 @@ int USMC_impl::usmc_set_parameters(int id, const USMC_Parameters& params) {
 
     PARAMETERS_PACKET setParametersData;
 
-    /*=====================*/
-    /* ----Conversion:---- */
-    /*=====================*/
-    setParametersData.DELAY1       = ( uint8_t ) clamp ( ( int ) ( params.AccelT / 98.0f + 0.5f ), 1, 15 );
-    setParametersData.DELAY2       = ( uint8_t ) clamp ( ( int ) ( params.DecelT / 98.0f + 0.5f ), 1, 15 );
-    setParametersData.RefINTimeout = ( uint16_t ) ( clamp ( params.PTimeout , 1.0f, 9961.0f ) / 0.152f + 0.5f );
-    setParametersData.BTIMEOUT1    = PACK_WORD ( ( uint16_t ) ( clamp ( params.BTimeout1, 1.0f, 9961.0f ) / 0.152f + 0.5f ) );
-    setParametersData.BTIMEOUT2    = PACK_WORD ( ( uint16_t ) ( clamp ( params.BTimeout2, 1.0f, 9961.0f ) / 0.152f + 0.5f ) );
-    setParametersData.BTIMEOUT3    = PACK_WORD ( ( uint16_t ) ( clamp ( params.BTimeout3, 1.0f, 9961.0f ) / 0.152f + 0.5f ) );
-    setParametersData.BTIMEOUT4    = PACK_WORD ( ( uint16_t ) ( clamp ( params.BTimeout4, 1.0f, 9961.0f ) / 0.152f + 0.5f ) );
-    setParametersData.BTIMEOUTR    = PACK_WORD ( ( uint16_t ) ( clamp ( params.BTimeoutR, 1.0f, 9961.0f ) / 0.152f + 0.5f ) );
-    setParametersData.BTIMEOUTD    = PACK_WORD ( ( uint16_t ) ( clamp ( params.BTimeoutD, 1.0f, 9961.0f ) / 0.152f + 0.5f ) );
-    setParametersData.MINPERIOD    = PACK_WORD ( ( uint16_t ) ( 65536.0f - ( 125000.0f / clamp ( params.MinP , 2.0f, 625.0f ) ) + 0.5f ) );
-    setParametersData.BTO1P        = PACK_WORD ( ( uint16_t ) ( 65536.0f - ( 125000.0f / clamp ( params.BTO1P, 2.0f, 625.0f ) ) + 0.5f ) );
-    setParametersData.BTO2P        = PACK_WORD ( ( uint16_t ) ( 65536.0f - ( 125000.0f / clamp ( params.BTO2P, 2.0f, 625.0f ) ) + 0.5f ) );
-    setParametersData.BTO3P        = PACK_WORD ( ( uint16_t ) ( 65536.0f - ( 125000.0f / clamp ( params.BTO3P, 2.0f, 625.0f ) ) + 0.5f ) );
-    setParametersData.BTO4P        = PACK_WORD ( ( uint16_t ) ( 65536.0f - ( 125000.0f / clamp ( params.BTO4P, 2.0f, 625.0f ) ) + 0.5f ) );
-    setParametersData.MAX_LOFT     = PACK_WORD ( ( uint16_t ) ( clamp ( params.MaxLoft, 1, 1023 ) * 64 ) );
-
-    if ( _version[id] < 0x2407 ) {
-        setParametersData.STARTPOS = 0x00000000L;
-    } else {
-        setParametersData.STARTPOS = PACK_DWORD ( params.StartPos * 8 & 0xFFFFFF00 );
-    }
+    encode_parameters(dev, params, setParametersData, wValue, wIndex);
 
-    setParametersData.RTDelta    = PACK_WORD ( ( uint16_t ) ( clamp ( params.RTDelta   , 4, 1023 ) * 64 ) );
-    setParametersData.RTMinError = PACK_WORD ( ( uint16_t ) ( clamp ( params.RTMinError, 4, 1023 ) * 64 ) );
+    // Access lock
+    USMC_lock access_lock(&dev.lock);
 
-    double t = ( double ) clamp ( params.MaxTemp, 0.0f, 100.0f );
+    int res = _transport->control_transfer(dev.handle, bRequestType, bRequest, wValue, wIndex, reinterpret_cast<uint8_t*>(&setParametersData)+4, wLength, _timeout);
 
-    if ( _version[id] < 0x2400 )
-    {
-        t = 10.0 * exp ( 3950.0 * ( 1.0 / ( t + 273.0 ) - 1.0 / 298.0 ) );
-        t = ( ( 5 * t / ( 10 + t ) ) * 65536.0 / 3.3 + 0.5 );
-    }
-    else
-    {
-        t = ( t + 50.0 ) / 330.0 * 65536.0;
-        t = ( t + 0.5f );
+    if(res < 0) {
+        // Call failed
+        _error_logger("Failed to set device parameters. Error: %s", _transport->strerror(res));
+        return res;
     }
 
-    setParametersData.MaxTemp    = PACK_WORD ( ( uint16_t ) t );
-    setParametersData.SynOUTP    = params.SynOUTP;
-    setParametersData.LoftPeriod = params.LoftPeriod == 0.0f ? 0 : PACK_WORD ( ( uint16_t ) ( 65536.0f - ( 125000.0f / clamp ( params.LoftPeriod, 16.0f, 5000.0f ) ) + 0.5f ) );
-    setParametersData.EncVSCP    = ( uint8_t ) ( params.EncMult * 4.0f + 0.5f );
-    //setParametersData.EncVSCP = 1;
+    return 0;
+}
+
+// USB call to set the serial number (stored in the EEPROM)
+int USMC_impl::usmc_set_serial(USMC_DeviceRecord& dev, const char* serial, const char* password) {
+    uint8_t  bRequestType = LIBUSB_ENDPOINT_OUT     |
+                            LIBUSB_RECIPIENT_DEVICE |
+                            LIBUSB_REQUEST_TYPE_VENDOR;
+    uint8_t  bRequest = 0xCA;
+    uint16_t wValue;
+    uint16_t wIndex;
+    uint16_t wLength = 0x001C;
+    SERIAL_PACKET setSerialData;
 
-    memset ( setParametersData.Reserved, 0, 15 );
+    memset(&setSerialData, 0, sizeof(SERIAL_PACKET));
+    strncpy((char*)setSerialData.Password, password, sizeof(setSerialData.Password));
+    strncpy((char*)setSerialData.SerialNumber, serial, sizeof(setSerialData.SerialNumber));
 
-    wValue        = FIRST_WORD_SWAPPED ( reinterpret_cast<uint32_t*>(&setParametersData) );
-    wIndex        = SECOND_WORD        ( reinterpret_cast<uint32_t*>(&setParametersData) );
+    wValue        = FIRST_WORD_SWAPPED  ( reinterpret_cast<uint32_t*>(&setSerialData) );
+    wIndex        = SECOND_WORD_SWAPPED ( reinterpret_cast<uint32_t*>(&setSerialData) );
 
     // Access lock
-    USMC_lock access_lock(_locks[id]);
+    USMC_lock access_lock(&dev.lock);
 
-    int res = libusb_control_transfer(_dev[id], bRequestType, bRequest, wValue, wIndex, reinterpret_cast<uint8_t*>(&setParametersData)+4, wLength, _timeout);
+    int res = _transport->control_transfer(dev.handle, bRequestType, bRequest, wValue, wIndex, reinterpret_cast<uint8_t*>(REST_DATA(&setSerialData)), wLength, _timeout);
 
     if(res < 0) {
         // Call failed
-        _error_logger("Failed to set device parameters. Error: %s", libusb_strerror(static_cast<libusb_error>(res)));
+        _error_logger("Failed to set serial number. Error: %s", _transport->strerror(res));
         return res;
     }
 
@@ -869,7 +1184,7 @@ int USMC_impl::usmc_set_parameters(int id, const USMC_Parameters& params) {
 }
 
 // USB call to set current position
-int USMC_impl::usmc_set_current_position(int id, int32_t position) {
+int USMC_impl::usmc_set_current_position(USMC_DeviceRecord& dev, int32_t position) {
     uint8_t  bRequestType = LIBUSB_ENDPOINT_OUT     |
                             LIBUSB_RECIPIENT_DEVICE |
                             LIBUSB_REQUEST_TYPE_VENDOR;
@@ -884,20 +1199,20 @@ int USMC_impl::usmc_set_current_position(int id, int32_t position) {
     wIndex        = FIRST_WORD  ( &position );
 
     // Access lock
-    USMC_lock access_lock(_locks[id]);
+    USMC_lock access_lock(&dev.lock);
 
-    int res = libusb_control_transfer(_dev[id], bRequestType, bRequest, wValue, wIndex, NULL, wLength, _timeout);
+    int res = _transport->control_transfer(dev.handle, bRequestType, bRequest, wValue, wIndex, NULL, wLength, _timeout);
 
     if(res < 0) {
         // Call failed
-        _error_logger("Failed to set device current position. Error: %s", libusb_strerror(static_cast<libusb_error>(res)));
+        _error_logger("Failed to set device current position. Error: %s", _transport->strerror(res));
         return res;
     }
 
     return 0;
 }
 
-int USMC_impl::usmc_stop(int id) {
+int USMC_impl::usmc_stop(USMC_DeviceRecord& dev) {
     uint8_t  bRequestType = LIBUSB_ENDPOINT_OUT     |
                             LIBUSB_RECIPIENT_DEVICE |
                             LIBUSB_REQUEST_TYPE_VENDOR;
@@ -907,20 +1222,20 @@ int USMC_impl::usmc_stop(int id) {
     uint16_t wLength = 0;
 
     // Access lock
-    USMC_lock access_lock(_locks[id]);
+    USMC_lock access_lock(&dev.lock);
 
-    int res = libusb_control_transfer(_dev[id], bRequestType, bRequest, wValue, wIndex, NULL, wLength, _timeout);
+    int res = _transport->control_transfer(dev.handle, bRequestType, bRequest, wValue, wIndex, NULL, wLength, _timeout);
 
     if(res < 0) {
         // Call failed
-        _error_logger("Failed to stop device. Error: %s", libusb_strerror(static_cast<libusb_error>(res)));
+        _error_logger("Failed to stop device. Error: %s", _transport->strerror(res));
         return res;
     }
 
     return 0;
 }
 
-int USMC_impl::usmc_save(int id) {
+int USMC_impl::usmc_save(USMC_DeviceRecord& dev) {
     uint8_t  bRequestType = LIBUSB_ENDPOINT_OUT     |
                             LIBUSB_RECIPIENT_DEVICE |
                             LIBUSB_REQUEST_TYPE_VENDOR;
@@ -930,62 +1245,65 @@ int USMC_impl::usmc_save(int id) {
     uint16_t wLength = 0;
 
     // Access lock
-    USMC_lock access_lock(_locks[id]);
+    USMC_lock access_lock(&dev.lock);
 
-    int res = libusb_control_transfer(_dev[id], bRequestType, bRequest, wValue, wIndex, NULL, wLength, _timeout);
+    int res = _transport->control_transfer(dev.handle, bRequestType, bRequest, wValue, wIndex, NULL, wLength, _timeout);
 
     if(res < 0) {
         // Call failed
-        _error_logger("Failed to save parameters to EEPROM. Error: %s", libusb_strerror(static_cast<libusb_error>(res)));
+        _error_logger("Failed to save parameters to EEPROM. Error: %s", _transport->strerror(res));
         return res;
     }
 
     return 0;
 }
 
-void USMC_impl::initDefaults(int id) {
+void USMC_impl::initDefaults(USMC_DeviceRecord& dev) {
     // Reset structures
-    memset(_mode[id], 0, sizeof(USMC_Mode));
-    memset(_params[id], 0, sizeof(USMC_Parameters));
-    memset(_start_params[id], 0, sizeof(USMC_StartParameters));
+    memset(&dev.mode, 0, sizeof(USMC_Mode));
+    memset(&dev.params, 0, sizeof(USMC_Parameters));
+    memset(&dev.start_params, 0, sizeof(USMC_StartParameters));
 
     // USMC_Mode defaults:
-    _mode[id]->PReg      = true;
-    _mode[id]->Tr1En     = true;
-    _mode[id]->Tr2En     = true;
-    _mode[id]->RotTrOp   = true;
-    _mode[id]->SyncOUTEn = true;
-    _mode[id]->SyncINOp  = true;
-    _mode[id]->SyncCount = 4;
+    dev.mode.PReg      = true;
+    dev.mode.Tr1En     = true;
+    dev.mode.Tr2En     = true;
+    dev.mode.RotTrOp   = true;
+    dev.mode.SyncOUTEn = true;
+    dev.mode.SyncINOp  = true;
+    dev.mode.SyncCount = 4;
 
     // USMC_Parameters defaults:
-    _params[id]->MaxTemp    = 70.0f;
-    _params[id]->AccelT     = 200.0f;
-    _params[id]->DecelT     = 200.0f;
-    _params[id]->PTimeout   = 500.0f;
-    _params[id]->BTimeout1  = 500.0f;
-    _params[id]->BTimeout2  = 500.0f;
-    _params[id]->BTimeout3  = 500.0f;
-    _params[id]->BTimeout4  = 500.0f;
-    _params[id]->BTimeoutR  = 500.0f;
-    _params[id]->BTimeoutD  = 500.0f;
-    _params[id]->BTO1P      = 200.0f;
-    _params[id]->BTO2P      = 300.0f;
-    _params[id]->BTO3P      = 400.0f;
-    _params[id]->BTO4P      = 500.0f;
-    _params[id]->MinP       = 500.0f;
-    _params[id]->BTimeoutR  = 500.0f;
-    _params[id]->LoftPeriod = 32.0f;
-    _params[id]->RTDelta    = 200;
-    _params[id]->RTMinError = 15;
-    _params[id]->EncMult    = 2.5f;
-    _params[id]->MaxLoft    = 32;
-    _params[id]->PTimeout   = 100.0f;
-    _params[id]->SynOUTP    = 1;
-    _params[id]->StartPos   = 0;
+    dev.params.MaxTemp    = 70.0f;
+    dev.params.AccelT     = 200.0f;
+    dev.params.DecelT     = 200.0f;
+    dev.params.PTimeout   = 500.0f;
+    dev.params.BTimeout1  = 500.0f;
+    dev.params.BTimeout2  = 500.0f;
+    dev.params.BTimeout3  = 500.0f;
+    dev.params.BTimeout4  = 500.0f;
+    dev.params.BTimeoutR  = 500.0f;
+    dev.params.BTimeoutD  = 500.0f;
+    dev.params.BTO1P      = 200.0f;
+    dev.params.BTO2P      = 300.0f;
+    dev.params.BTO3P      = 400.0f;
+    dev.params.BTO4P      = 500.0f;
+    dev.params.MinP       = 500.0f;
+    dev.params.BTimeoutR  = 500.0f;
+    dev.params.LoftPeriod = 32.0f;
+    dev.params.RTDelta    = 200;
+    dev.params.RTMinError = 15;
+    dev.params.EncMult    = 2.5f;
+    dev.params.MaxLoft    = 32;
+    dev.params.PTimeout   = 100.0f;
+    dev.params.SynOUTP    = 1;
+    dev.params.StartPos   = 0;
 
     // USMC_StartParameters defaults:
-    _start_params[id]->SDivisor = 8;
-    _start_params[id]->LoftEn   = true;
-    _start_params[id]->SlStart  = true;
+    dev.start_params.SDivisor = 8;
+    dev.start_params.LoftEn   = true;
+    dev.start_params.SlStart  = true;
+
+    // Goto command for the default speed and start parameters
+    encode_goto(dev);
 }
@@ -0,0 +1,178 @@
+#include <iostream>
+#include <cstdlib>
+#include <cstddef>
+#include <vector>
+#include <unistd.h>
+#include <libusmc.h>
+#include <usmc_device.h>
+#include <usmc_sim.h>
+
+using namespace std;
+
+// The test checks the allocations of the library code only: on the simulator
+// or, for the USB transport, through the shim with:
+//   LD_PRELOAD=lib/libusmc_usb_shim.so usmc_alloc_test -s 0
+// On real devices libusb itself allocates on every submitted transfer (the
+// usbfs backend allocates its URBs), so the test cannot pass on hardware.
+
+// glibc allocator entry points
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* ptr);
+}
+
+// Allocation counters (enabled only around the measured loop)
+static volatile bool counting = false;
+static volatile unsigned long allocations = 0;
+static volatile unsigned long allocated = 0;
+
+static inline void count(size_t size) {
+    if(counting) {
+        __sync_fetch_and_add(&allocations, 1);
+        __sync_fetch_and_add(&allocated, size);
+    }
+}
+
+// Malloc hook: the executable definitions take precedence over the libc ones
+extern "C" {
+
+void* malloc(size_t size) {
+    count(size);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size) {
+    count(n * size);
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    count(size);
+    return __libc_realloc(ptr, size);
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size) {
+    count(size);
+    *ptr = __libc_memalign(alignment, size);
+    return *ptr ? 0 : 12;
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+    count(size);
+    return __libc_memalign(alignment, size);
+}
+
+void free(void* ptr) {
+    __libc_free(ptr);
+}
+
+}
+
+static void usage(const char* name) {
+    cout << "Usage: " << name << " [options]" << endl;
+    cout << "  -n iterations   getState/moveTo iterations per device (default 100000)" << endl;
+    cout << "  -s axes         simulated axes, 0 for the USB devices (default 2)" << endl;
+}
+
+static void quiet_logger(const char* fmt, ...) {
+
+}
+
+// getState/moveTo loop through the USMC interface and through the device handles
+static int hot_loop(USMC* usmc, vector<USMC_Device>& devices, int iterations) {
+    int errors = 0;
+    USMC_State state;
+    for(int i = 0; i < iterations; i++) {
+        for(size_t d = 0; d < devices.size(); d++) {
+            int dest = (i & 1) ? 100 : -100;
+            if(usmc->getState(int(d), &state) < 0)
+                errors++;
+            if(usmc->moveTo(int(d), dest) < 0)
+                errors++;
+            if(devices[d].getState(&state) < 0)
+                errors++;
+            if(devices[d].moveTo(-dest) < 0)
+                errors++;
+        }
+    }
+    return errors;
+}
+
+int main(int argc, char** argv)
+{
+    int iterations = 100000;
+    int sim_axes = 2;
+    int c;
+    while((c = getopt(argc, argv, "n:s:h")) != -1) {
+        switch(c) {
+            case 'n': iterations = atoi(optarg); break;
+            case 's': sim_axes = atoi(optarg); break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if(iterations <= 0 || sim_axes < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    cout << "USMC hot path allocation test" << endl;
+
+    // Backend
+    USMC_Simulator* sim = NULL;
+    if(sim_axes > 0) {
+        sim = new USMC_Simulator();
+        for(int i = 0; i < sim_axes; i++) {
+            USMC_SimAxisConfig config;
+            USMC_Simulator::defaults(&config, i);
+            sim->addAxis(config);
+        }
+    }
+    USMC* usmc_driver = sim ? USMC::getInstance(sim) : USMC::getInstance();
+    usmc_driver->set_info_logger(quiet_logger);
+    usmc_driver->set_warn_logger(quiet_logger);
+    usmc_driver->set_error_logger(quiet_logger);
+
+    int ndev = usmc_driver->probeDevices();
+    if(ndev <= 0) {
+        cout << "No devices found" << endl;
+        return 1;
+    }
+
+    vector<USMC_Device> devices(ndev);
+    for(int i = 0; i < ndev; i++) {
+        if(usmc_driver->getDevice(i, &devices[i]) < 0) {
+            cout << "Failed to get handle of device " << i << endl;
+            return 1;
+        }
+    }
+
+    // Warm up (lazy initializations in libc and libusb), then measure
+    hot_loop(usmc_driver, devices, 100);
+    counting = true;
+    int errors = hot_loop(usmc_driver, devices, iterations);
+    counting = false;
+
+    unsigned long calls = (unsigned long)iterations * ndev * 4;
+    cout << "Devices: " << ndev << ", calls: " << calls << endl;
+    cout << " * Errors: " << errors << endl;
+    cout << " * Allocations: " << allocations << " (" << allocated << " bytes)" << endl;
+
+    USMC::shutdown();
+    delete sim;
+
+    if(allocations) {
+        cout << "FAILED: memory allocated on the hot path" << endl;
+        return 2;
+    }
+    if(errors) {
+        cout << "FAILED: errors on the hot path" << endl;
+        return 2;
+    }
+    cout << "PASSED" << endl;
+    return 0;
+}
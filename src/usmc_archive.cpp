@@ -0,0 +1,709 @@
+/***************************************************//**
+ * @file    usmc_archive.cpp
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <time.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <usmc_archive.h>
+#include <usmc_clock.h>
+
+
+// File layout (little endian):
+//   header   "USMCARC1" version(4) ndevices(4)
+//   block    magic(4) device(2) reserved(2) count(4) length(4) t_first(8) t_last(8) samples(length)
+//   ...
+//   index    magic(4) { offset(8) device(4) count(4) length(4) t_first(8) t_last(8) } ...
+//   footer   magic(4) nblocks(4) index_offset(8)
+#define ARCHIVE_MAGIC           "USMCARC1"
+#define ARCHIVE_VERSION         2
+#define ARCHIVE_HEADER_SIZE     16
+#define ARCHIVE_BLOCK_MAGIC     0x4B4C4255  // "UBLK"
+#define ARCHIVE_BLOCK_SIZE      32
+#define ARCHIVE_INDEX_MAGIC     0x58444955  // "UIDX"
+#define ARCHIVE_ENTRY_SIZE      36
+#define ARCHIVE_FOOTER_SIZE     16
+
+// Sample encoding: zigzag varint deltas of time and position, a mask of the
+// changed fields, then the changed fields (flags as a varint, divisor as a
+// byte, temperature and voltage as zigzag varint deltas)
+#define FIELD_FLAGS             0x01
+#define FIELD_DIVISOR           0x02
+#define FIELD_TEMP              0x04
+#define FIELD_VOLTAGE           0x08
+
+// Largest encoded sample
+#define ARCHIVE_MAX_SAMPLE      32
+
+// Longest time span of a block (us), so that data does not stay in memory
+// for long at low sample rates
+#define ARCHIVE_BLOCK_SPAN      60000000ULL
+
+// Writer thread polling period when the queue is empty (ns)
+#define ARCHIVE_POLL_NS         10000000L
+
+
+// Little endian helpers
+static inline void put32(uint8_t* p, uint32_t v) {
+    for(int i = 0; i < 4; i++)
+        p[i] = uint8_t(v >> (8 * i));
+}
+
+static inline void put64(uint8_t* p, uint64_t v) {
+    for(int i = 0; i < 8; i++)
+        p[i] = uint8_t(v >> (8 * i));
+}
+
+static inline uint32_t get32(const uint8_t* p) {
+    uint32_t v = 0;
+    for(int i = 0; i < 4; i++)
+        v |= uint32_t(p[i]) << (8 * i);
+    return v;
+}
+
+static inline uint64_t get64(const uint8_t* p) {
+    uint64_t v = 0;
+    for(int i = 0; i < 8; i++)
+        v |= uint64_t(p[i]) << (8 * i);
+    return v;
+}
+
+// Varint helpers
+static inline void put_varint(std::vector<uint8_t>& out, uint64_t v) {
+    while(v >= 0x80) {
+        out.push_back(uint8_t(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back(uint8_t(v));
+}
+
+static inline void put_svarint(std::vector<uint8_t>& out, int64_t v) {
+    put_varint(out, (uint64_t(v) << 1) ^ uint64_t(v >> 63));
+}
+
+static inline bool get_varint(const std::vector<uint8_t>& in, size_t& pos, uint64_t& v) {
+    v = 0;
+    for(int shift = 0; shift < 64; shift += 7) {
+        if(pos >= in.size())
+            return false;
+        uint8_t b = in[pos++];
+        v |= uint64_t(b & 0x7F) << shift;
+        if(!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+static inline bool get_svarint(const std::vector<uint8_t>& in, size_t& pos, int64_t& v) {
+    uint64_t u;
+    if(!get_varint(in, pos, u))
+        return false;
+    v = int64_t(u >> 1) ^ -int64_t(u & 1);
+    return true;
+}
+
+// State flags
+static uint32_t pack_flags(const USMC_State& s) {
+    return (s.Loft ? USMC_STATE_LOFT : 0) | (s.FullPower ? USMC_STATE_FULLPOWER : 0) |
+           (s.CW_CCW ? USMC_STATE_CW_CCW : 0) | (s.Power ? USMC_STATE_POWER : 0) |
+           (s.FullSpeed ? USMC_STATE_FULLSPEED : 0) | (s.AReset ? USMC_STATE_ARESET : 0) |
+           (s.RUN ? USMC_STATE_RUN : 0) | (s.SyncIN ? USMC_STATE_SYNCIN : 0) |
+           (s.SyncOUT ? USMC_STATE_SYNCOUT : 0) | (s.RotTr ? USMC_STATE_ROTTR : 0) |
+           (s.RotTrErr ? USMC_STATE_ROTTRERR : 0) | (s.EmReset ? USMC_STATE_EMRESET : 0) |
+           (s.Trailer1 ? USMC_STATE_TRAILER1 : 0) | (s.Trailer2 ? USMC_STATE_TRAILER2 : 0);
+}
+
+static void unpack_flags(uint32_t f, USMC_State& s) {
+    s.Loft      = f & USMC_STATE_LOFT;
+    s.FullPower = f & USMC_STATE_FULLPOWER;
+    s.CW_CCW    = f & USMC_STATE_CW_CCW;
+    s.Power     = f & USMC_STATE_POWER;
+    s.FullSpeed = f & USMC_STATE_FULLSPEED;
+    s.AReset    = f & USMC_STATE_ARESET;
+    s.RUN       = f & USMC_STATE_RUN;
+    s.SyncIN    = f & USMC_STATE_SYNCIN;
+    s.SyncOUT   = f & USMC_STATE_SYNCOUT;
+    s.RotTr     = f & USMC_STATE_ROTTR;
+    s.RotTrErr  = f & USMC_STATE_ROTTRERR;
+    s.EmReset   = f & USMC_STATE_EMRESET;
+    s.Trailer1  = f & USMC_STATE_TRAILER1;
+    s.Trailer2  = f & USMC_STATE_TRAILER2;
+}
+
+
+// Writer constructor
+USMC_ArchiveWriter::USMC_ArchiveWriter()
+    : _file(NULL), _ndevices(0), _block_samples(0), _result(ERR_SUCCESS), _head(0), _tail(0),
+      _anchored(false), _wall_offset(0), _offset(0), _started(false), _stop(false), _dropped(0)
+{
+    memset(&_stats, 0, sizeof(USMC_ArchiveStats));
+}
+
+// Writer destructor
+USMC_ArchiveWriter::~USMC_ArchiveWriter() {
+    close();
+}
+
+// Create the archive
+int USMC_ArchiveWriter::open(const char* filename, int ndevices, uint32_t block_samples, uint32_t queue) {
+    if(_started)
+        return ERR_USB_BUSY;
+    if(NULL == filename || ndevices < 1 || ndevices > 0xFFFF)
+        return ERR_INVALID_PARAM;
+    if(block_samples < 1 || queue < 2 || queue > 0x80000000U)
+        return ERR_INVALID_VALUE;
+
+    _file = fopen(filename, "wb");
+    if(NULL == _file)
+        return ERR_INVALID_PARAM;
+
+    uint8_t header[ARCHIVE_HEADER_SIZE];
+    memcpy(header, ARCHIVE_MAGIC, 8);
+    put32(header + 8, ARCHIVE_VERSION);
+    put32(header + 12, uint32_t(ndevices));
+    if(fwrite(header, ARCHIVE_HEADER_SIZE, 1, _file) != 1) {
+        fclose(_file);
+        _file = NULL;
+        return ERR_USB_IO;
+    }
+
+    // Queue size is a power of two so that the indexes can wrap
+    uint32_t size = 1;
+    while(size < queue)
+        size <<= 1;
+    _queue.assign(size, record());
+    _head = 0;
+    _tail = 0;
+    _last.assign(ndevices, 0);
+    _anchored = false;
+
+    _ndevices = ndevices;
+    _block_samples = block_samples;
+    _blocks.assign(ndevices, block());
+    for(int i = 0; i < ndevices; i++) {
+        _blocks[i].data.reserve(size_t(block_samples) * ARCHIVE_MAX_SAMPLE);
+        _blocks[i].count = 0;
+    }
+    _index.clear();
+    _offset = ARCHIVE_HEADER_SIZE;
+    _result = ERR_SUCCESS;
+    _dropped = 0;
+    memset(&_stats, 0, sizeof(USMC_ArchiveStats));
+    _stats.bytes = _offset;
+
+    _stop = false;
+    if(pthread_create(&_thread, NULL, USMC_ArchiveWriter::thread_main, this)) {
+        fclose(_file);
+        _file = NULL;
+        return ERR_USB_NO_MEM;
+    }
+    _started = true;
+    return ERR_SUCCESS;
+}
+
+// Close the archive
+int USMC_ArchiveWriter::close() {
+    if(!_started)
+        return _result;
+    _stop = true;
+    pthread_join(_thread, NULL);
+    _started = false;
+
+    // Block index and footer
+    if(_result == ERR_SUCCESS) {
+        std::vector<uint8_t> index(4 + _index.size() * ARCHIVE_ENTRY_SIZE + ARCHIVE_FOOTER_SIZE);
+        uint8_t* p = &index[0];
+        put32(p, ARCHIVE_INDEX_MAGIC);
+        p += 4;
+        for(size_t i = 0; i < _index.size(); i++, p += ARCHIVE_ENTRY_SIZE) {
+            put64(p, _index[i].offset);
+            put32(p + 8, uint32_t(_index[i].device));
+            put32(p + 12, _index[i].count);
+            put32(p + 16, _index[i].length);
+            put64(p + 20, _index[i].t_first);
+            put64(p + 28, _index[i].t_last);
+        }
+        put32(p, ARCHIVE_INDEX_MAGIC);
+        put32(p + 4, uint32_t(_index.size()));
+        put64(p + 8, _offset);
+        if(fwrite(&index[0], index.size(), 1, _file) != 1)
+            _result = ERR_USB_IO;
+    }
+    if(fclose(_file) != 0 && _result == ERR_SUCCESS)
+        _result = ERR_USB_IO;
+    _file = NULL;
+    return _result;
+}
+
+// Queue a sample
+int USMC_ArchiveWriter::add(int device, uint64_t time_us, const USMC_State& state) {
+    if(!_started)
+        return ERR_USB_NOT_FOUND;
+    if(device < 0 || device >= _ndevices)
+        return ERR_INVALID_ID;
+    if(time_us < _last[device])
+        return ERR_INVALID_VALUE;
+
+    uint32_t tail = _tail;
+    if(tail - __atomic_load_n(&_head, __ATOMIC_ACQUIRE) >= _queue.size()) {
+        __atomic_fetch_add(&_dropped, 1, __ATOMIC_RELAXED);
+        return ERR_USB_OVERFLOW;
+    }
+    record& r = _queue[tail & (_queue.size() - 1)];
+    r.time = time_us;
+    r.device = device;
+    r.position = state.CurPos;
+    r.flags = pack_flags(state);
+    r.temp = int32_t(floor(state.Temp * 100.0 + 0.5));
+    r.voltage = int32_t(floor(state.Voltage * 1000.0 + 0.5));
+    r.divisor = state.SDivisor;
+    __atomic_store_n(&_tail, tail + 1, __ATOMIC_RELEASE);
+    _last[device] = time_us;
+    return ERR_SUCCESS;
+}
+
+// Queue a sample from a cycle
+void USMC_ArchiveWriter::push(int device, uint64_t time_us, const USMC_State& state) {
+    if(!_anchored) {
+        _wall_offset = int64_t(usmc_wall_time_us(time_us)) - int64_t(time_us);
+        _anchored = true;
+    }
+    add(device, uint64_t(int64_t(time_us) + _wall_offset), state);
+}
+
+// Get statistics
+void USMC_ArchiveWriter::getStats(USMC_ArchiveStats* stats) {
+    if(NULL == stats)
+        return;
+    USMC_lock lock(&_lock);
+    *stats = _stats;
+    stats->dropped = __atomic_load_n(&_dropped, __ATOMIC_RELAXED);
+    if(_stats.samples > 0)
+        stats->bytes_sample = double(_stats.bytes - ARCHIVE_HEADER_SIZE) / double(_stats.samples);
+}
+
+// Thread entry point
+void* USMC_ArchiveWriter::thread_main(void* arg) {
+    USMC_ArchiveWriter* writer = reinterpret_cast<USMC_ArchiveWriter*>(arg);
+    writer->run();
+    return NULL;
+}
+
+// Writer loop
+void USMC_ArchiveWriter::run() {
+    for(;;) {
+        // Check the stop flag before draining, so that the samples queued
+        // before close() are always written
+        bool stop = _stop;
+        uint32_t head = _head;
+        uint32_t tail = __atomic_load_n(&_tail, __ATOMIC_ACQUIRE);
+        while(head != tail) {
+            encode(_queue[head & (_queue.size() - 1)]);
+            head++;
+            __atomic_store_n(&_head, head, __ATOMIC_RELEASE);
+        }
+        if(stop)
+            break;
+
+        // Real time sleep: the writer does not follow the library clock
+        struct timespec ts;
+        ts.tv_sec = 0;
+        ts.tv_nsec = ARCHIVE_POLL_NS;
+        while(nanosleep(&ts, &ts) == -1 && errno == EINTR);
+    }
+
+    // Write the open blocks
+    for(int i = 0; i < _ndevices; i++)
+        if(_blocks[i].count > 0)
+            write_block(i);
+}
+
+// Encode a sample
+void USMC_ArchiveWriter::encode(const record& r) {
+    block& b = _blocks[r.device];
+    if(b.count > 0 && r.time - b.t_first >= ARCHIVE_BLOCK_SPAN)
+        write_block(r.device);
+
+    // Blocks are independent: the first sample is a delta from zero
+    if(b.count == 0) {
+        memset(&b.last, 0, sizeof(record));
+        b.t_first = r.time;
+        b.data.clear();
+    }
+
+    uint8_t mask = 0;
+    if(r.flags != b.last.flags)
+        mask |= FIELD_FLAGS;
+    if(r.divisor != b.last.divisor)
+        mask |= FIELD_DIVISOR;
+    if(r.temp != b.last.temp)
+        mask |= FIELD_TEMP;
+    if(r.voltage != b.last.voltage)
+        mask |= FIELD_VOLTAGE;
+
+    put_svarint(b.data, int64_t(r.time - b.last.time));
+    put_svarint(b.data, int64_t(r.position) - int64_t(b.last.position));
+    b.data.push_back(mask);
+    if(mask & FIELD_FLAGS)
+        put_varint(b.data, r.flags);
+    if(mask & FIELD_DIVISOR)
+        b.data.push_back(r.divisor);
+    if(mask & FIELD_TEMP)
+        put_svarint(b.data, int64_t(r.temp) - int64_t(b.last.temp));
+    if(mask & FIELD_VOLTAGE)
+        put_svarint(b.data, int64_t(r.voltage) - int64_t(b.last.voltage));
+
+    b.last = r;
+    b.count++;
+    {
+        USMC_lock lock(&_lock);
+        _stats.samples++;
+    }
+    if(b.count >= _block_samples)
+        write_block(r.device);
+}
+
+// Write the block of a device
+void USMC_ArchiveWriter::write_block(int device) {
+    block& b = _blocks[device];
+    uint32_t count = b.count;
+    b.count = 0;
+    if(_result != ERR_SUCCESS)
+        return;
+
+    uint8_t header[ARCHIVE_BLOCK_SIZE];
+    put32(header, ARCHIVE_BLOCK_MAGIC);
+    header[4] = uint8_t(device);
+    header[5] = uint8_t(device >> 8);
+    header[6] = 0;
+    header[7] = 0;
+    put32(header + 8, count);
+    put32(header + 12, uint32_t(b.data.size()));
+    put64(header + 16, b.t_first);
+    put64(header + 24, b.last.time);
+
+    // Each block is flushed so that a crash loses at most the open blocks
+    if(fwrite(header, ARCHIVE_BLOCK_SIZE, 1, _file) != 1 ||
+       fwrite(&b.data[0], b.data.size(), 1, _file) != 1 ||
+       fflush(_file) != 0) {
+        _result = ERR_USB_IO;
+        return;
+    }
+
+    USMC_ArchiveBlock entry;
+    entry.offset = _offset;
+    entry.device = device;
+    entry.count = count;
+    entry.length = uint32_t(b.data.size());
+    entry.t_first = b.t_first;
+    entry.t_last = b.last.time;
+    _index.push_back(entry);
+    _offset += ARCHIVE_BLOCK_SIZE + b.data.size();
+
+    USMC_lock lock(&_lock);
+    _stats.blocks++;
+    _stats.bytes = _offset;
+}
+
+
+// Reader constructor
+USMC_ArchiveReader::USMC_ArchiveReader() : _file(NULL), _ndevices(0), _block(0), _pos(0), _left(0) {
+    memset(_prev, 0, sizeof(_prev));
+}
+
+// Reader destructor
+USMC_ArchiveReader::~USMC_ArchiveReader() {
+    close();
+}
+
+// Open an archive
+int USMC_ArchiveReader::open(const char* filename) {
+    close();
+    _file = fopen(filename, "rb");
+    if(NULL == _file)
+        return ERR_INVALID_PARAM;
+
+    uint8_t header[ARCHIVE_HEADER_SIZE];
+    if(fread(header, ARCHIVE_HEADER_SIZE, 1, _file) != 1 || memcmp(header, ARCHIVE_MAGIC, 8) != 0 || get32(header + 8) != ARCHIVE_VERSION) {
+        close();
+        return ERR_INVALID_VALUE;
+    }
+
+    // Block index from the footer
+    uint8_t footer[ARCHIVE_FOOTER_SIZE];
+    if(fseeko(_file, -ARCHIVE_FOOTER_SIZE, SEEK_END) == 0 && fread(footer, ARCHIVE_FOOTER_SIZE, 1, _file) == 1 && get32(footer) == ARCHIVE_INDEX_MAGIC &&
+       get64(footer + 8) + 4 + uint64_t(get32(footer + 4)) * ARCHIVE_ENTRY_SIZE + ARCHIVE_FOOTER_SIZE == uint64_t(ftello(_file))) {
+        uint32_t n = get32(footer + 4);
+        uint64_t offset = get64(footer + 8);
+        std::vector<uint8_t> index(4 + size_t(n) * ARCHIVE_ENTRY_SIZE);
+        if(fseeko(_file, off_t(offset), SEEK_SET) == 0 && fread(&index[0], index.size(), 1, _file) == 1 && get32(&index[0]) == ARCHIVE_INDEX_MAGIC) {
+            _index.resize(n);
+            const uint8_t* p = &index[4];
+            for(uint32_t i = 0; i < n; i++, p += ARCHIVE_ENTRY_SIZE) {
+                _index[i].offset = get64(p);
+                _index[i].device = int(get32(p + 8));
+                _index[i].count = get32(p + 12);
+                _index[i].length = get32(p + 16);
+                _index[i].t_first = get64(p + 20);
+                _index[i].t_last = get64(p + 28);
+            }
+            return build_time_index();
+        }
+    }
+
+    // No index: scan the block headers (a truncated last block is ignored)
+    uint64_t offset = ARCHIVE_HEADER_SIZE;
+    for(;;) {
+        uint8_t b[ARCHIVE_BLOCK_SIZE];
+        if(fseeko(_file, off_t(offset), SEEK_SET) != 0 || fread(b, ARCHIVE_BLOCK_SIZE, 1, _file) != 1 || get32(b) != ARCHIVE_BLOCK_MAGIC)
+            break;
+        USMC_ArchiveBlock entry;
+        entry.offset = offset;
+        entry.device = int(b[4]) | (int(b[5]) << 8);
+        entry.count = get32(b + 8);
+        entry.length = get32(b + 12);
+        entry.t_first = get64(b + 16);
+        entry.t_last = get64(b + 24);
+        if(entry.length > 0 && (fseeko(_file, off_t(offset + ARCHIVE_BLOCK_SIZE + entry.length - 1), SEEK_SET) != 0 || fgetc(_file) == EOF))
+            break;
+        _index.push_back(entry);
+        offset += ARCHIVE_BLOCK_SIZE + entry.length;
+    }
+    return build_time_index();
+}
+
+// Blocks of each device in time order
+int USMC_ArchiveReader::build_time_index() {
+    _ndevices = 0;
+    for(size_t i = 0; i < _index.size(); i++) {
+        if(_index[i].device < 0 || _index[i].device > 0xFFFF) {
+            close();
+            return ERR_INVALID_VALUE;
+        }
+        if(_index[i].device >= _ndevices)
+            _ndevices = _index[i].device + 1;
+    }
+    _devices.assign(_ndevices, std::vector<size_t>());
+    _starts.assign(_ndevices, std::vector<uint64_t>());
+    _ordered.assign(_ndevices, true);
+    for(size_t i = 0; i < _index.size(); i++) {
+        int d = _index[i].device;
+        if(_index[i].t_last < _index[i].t_first || (!_devices[d].empty() && _index[i].t_first < _index[_devices[d].back()].t_last))
+            _ordered[d] = false;
+        _devices[d].push_back(i);
+        _starts[d].push_back(_index[i].t_first);
+    }
+    rewind(0);
+    return ERR_SUCCESS;
+}
+
+// Close the archive
+void USMC_ArchiveReader::close() {
+    if(_file) {
+        fclose(_file);
+        _file = NULL;
+    }
+    _index.clear();
+    _devices.clear();
+    _starts.clear();
+    _ordered.clear();
+    _ndevices = 0;
+    _data.clear();
+    rewind(0);
+}
+
+// Restart the sequential decoding
+void USMC_ArchiveReader::rewind(size_t block) {
+    _block = block;
+    _left = 0;
+}
+
+// Load a block
+int USMC_ArchiveReader::load(size_t i) {
+    if(NULL == _file)
+        return ERR_USB_NOT_FOUND;
+    if(i >= _index.size())
+        return ERR_INVALID_PARAM;
+    const USMC_ArchiveBlock& b = _index[i];
+    _data.resize(b.length);
+    if(fseeko(_file, off_t(b.offset + ARCHIVE_BLOCK_SIZE), SEEK_SET) != 0 || (b.length > 0 && fread(&_data[0], b.length, 1, _file) != 1))
+        return ERR_USB_IO;
+    memset(_prev, 0, sizeof(_prev));
+    _block = i + 1;
+    _pos = 0;
+    _left = b.count;
+    return ERR_SUCCESS;
+}
+
+// Decode a sample of the loaded block
+int USMC_ArchiveReader::decode(USMC_ArchiveSample* sample) {
+    int64_t dt, dpos, dtemp = 0, dvolt = 0;
+    uint64_t flags = uint64_t(_prev[2]);
+    if(!get_svarint(_data, _pos, dt) || !get_svarint(_data, _pos, dpos) || _pos >= _data.size())
+        return ERR_INVALID_VALUE;
+    uint8_t mask = _data[_pos++];
+    if((mask & FIELD_FLAGS) && !get_varint(_data, _pos, flags))
+        return ERR_INVALID_VALUE;
+    if(mask & FIELD_DIVISOR) {
+        if(_pos >= _data.size())
+            return ERR_INVALID_VALUE;
+        _prev[5] = _data[_pos++];
+    }
+    if((mask & FIELD_TEMP) && !get_svarint(_data, _pos, dtemp))
+        return ERR_INVALID_VALUE;
+    if((mask & FIELD_VOLTAGE) && !get_svarint(_data, _pos, dvolt))
+        return ERR_INVALID_VALUE;
+
+    _prev[0] += dt;
+    _prev[1] += dpos;
+    _prev[2] = int64_t(flags);
+    _prev[3] += dtemp;
+    _prev[4] += dvolt;
+    _left--;
+
+    sample->time = uint64_t(_prev[0]);
+    sample->device = _index[_block - 1].device;
+    memset(&sample->state, 0, sizeof(USMC_State));
+    sample->state.CurPos = int(_prev[1]);
+    unpack_flags(uint32_t(_prev[2]), sample->state);
+    sample->state.Temp = float(double(_prev[3]) / 100.0);
+    sample->state.Voltage = float(double(_prev[4]) / 1000.0);
+    sample->state.SDivisor = uint8_t(_prev[5]);
+    return 1;
+}
+
+// Decode a block
+int USMC_ArchiveReader::readBlock(size_t i, std::vector<USMC_ArchiveSample>& samples) {
+    int r = load(i);
+    if(r < 0)
+        return r;
+    int n = 0;
+    USMC_ArchiveSample s;
+    while(_left > 0) {
+        r = decode(&s);
+        if(r < 0) {
+            _left = 0;
+            return r;
+        }
+        samples.push_back(s);
+        n++;
+    }
+    return n;
+}
+
+// Sequential decoding
+int USMC_ArchiveReader::next(USMC_ArchiveSample* sample) {
+    if(NULL == sample)
+        return ERR_INVALID_PARAM;
+    while(_left == 0) {
+        if(_block >= _index.size())
+            return 0;
+        int r = load(_block);
+        if(r < 0)
+            return r;
+    }
+    int r = decode(sample);
+    if(r < 0)
+        _left = 0;
+    return r;
+}
+
+// Append a sample to a vector
+static void append_sample(void* out, const USMC_ArchiveSample& s) {
+    reinterpret_cast<std::vector<USMC_ArchiveSample>*>(out)->push_back(s);
+}
+
+// Append a sample to a series
+static void append_series(void* out, const USMC_ArchiveSample& s) {
+    USMC_ArchiveSeries* series = reinterpret_cast<USMC_ArchiveSeries*>(out);
+    series->time.push_back(s.time);
+    series->position.push_back(s.state.CurPos);
+    series->flags.push_back(pack_flags(s.state));
+    series->divisor.push_back(s.state.SDivisor);
+    series->temp.push_back(s.state.Temp);
+    series->voltage.push_back(s.state.Voltage);
+}
+
+// Samples of a device in a time window
+int USMC_ArchiveReader::query(int device, uint64_t t0, uint64_t t1, std::vector<USMC_ArchiveSample>& samples) {
+    return range(device, t0, t1, append_sample, &samples);
+}
+
+// Samples of a device in a time window as arrays
+int USMC_ArchiveReader::query(int device, uint64_t t0, uint64_t t1, USMC_ArchiveSeries& series) {
+    return range(device, t0, t1, append_series, &series);
+}
+
+// Decode the samples of a device in a time window
+int USMC_ArchiveReader::range(int device, uint64_t t0, uint64_t t1, void (*append)(void*, const USMC_ArchiveSample&), void* out) {
+    if(NULL == _file)
+        return ERR_USB_NOT_FOUND;
+    if(device < 0)
+        return ERR_INVALID_ID;
+    if(device >= _ndevices || t1 <= t0)
+        return 0;
+
+    // The window starts in the last block starting at or before t0. Blocks
+    // out of order are all scanned.
+    const std::vector<size_t>& blocks = _devices[device];
+    const std::vector<uint64_t>& starts = _starts[device];
+    bool ordered = _ordered[device];
+    size_t k = 0;
+    if(ordered) {
+        k = std::upper_bound(starts.begin(), starts.end(), t0) - starts.begin();
+        if(k > 0)
+            k--;
+    }
+
+    int n = 0;
+    USMC_ArchiveSample s;
+    for(; k < blocks.size() && (!ordered || _index[blocks[k]].t_first < t1); k++) {
+        if(ordered && _index[blocks[k]].t_last < t0)
+            continue;
+        int r = load(blocks[k]);
+        if(r < 0)
+            return r;
+        while(_left > 0) {
+            r = decode(&s);
+            if(r < 0) {
+                _left = 0;
+                return r;
+            }
+            if(s.time >= t1 && ordered) {
+                _left = 0;
+                break;
+            }
+            if(s.time >= t0 && s.time < t1) {
+                append(out, s);
+                n++;
+            }
+        }
+    }
+    return n;
+}
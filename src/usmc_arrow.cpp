@@ -0,0 +1,583 @@
+/***************************************************//**
+ * @file    usmc_arrow.cpp
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#include <cstring>
+#include <algorithm>
+#include <usmc_arrow.h>
+#include <usmc_clock.h>
+
+
+// Arrow format constants (Schema.fbs and Message.fbs)
+#define ARROW_MAGIC             "ARROW1"
+#define ARROW_CONTINUATION      0xFFFFFFFF
+#define ARROW_METADATA_V5       4
+#define ARROW_HEADER_SCHEMA     1
+#define ARROW_HEADER_BATCH      3
+#define ARROW_TYPE_INT          2
+#define ARROW_TYPE_FLOAT        3
+#define ARROW_TYPE_TIMESTAMP    10
+#define ARROW_FLOAT_SINGLE      1
+#define ARROW_FLOAT_DOUBLE      2
+#define ARROW_UNIT_MICROSECOND  2
+
+// Column types
+enum {
+    COL_TIMESTAMP = 0,
+    COL_INT32,
+    COL_UINT32,
+    COL_UINT8,
+    COL_FLOAT32,
+    COL_FLOAT64
+};
+
+// Element size of the column types
+static const size_t col_size[] = { 8, 4, 4, 1, 4, 8 };
+
+// Schema kinds
+enum {
+    KIND_NONE = -1,
+    KIND_TELEMETRY = 0,
+    KIND_SCAN
+};
+
+// Elements generated at a time for the columns not stored in memory
+#define ARROW_CHUNK             512
+
+
+static inline size_t align8(size_t n) {
+    return (n + 7) & ~size_t(7);
+}
+
+
+// Minimal flatbuffer builder. Objects are laid out front to back: a table
+// is written before the objects it refers to, so that all the offsets
+// point forward as the format requires.
+class fb_builder {
+public:
+    // Create a table
+    int table() {
+        _nodes.push_back(node(N_TABLE));
+        return int(_nodes.size() - 1);
+    }
+
+    // Add a scalar field to a table
+    void scalar(int t, int id, int size, uint64_t value) {
+        field f = { id, size, value, -1 };
+        _nodes[t].fields.push_back(f);
+    }
+
+    // Add a reference field (table, string or vector) to a table
+    void ref(int t, int id, int child) {
+        field f = { id, 4, 0, child };
+        _nodes[t].fields.push_back(f);
+    }
+
+    // Create a string
+    int string(const std::string& s) {
+        _nodes.push_back(node(N_STRING));
+        _nodes.back().bytes.assign(s.begin(), s.end());
+        return int(_nodes.size() - 1);
+    }
+
+    // Create a vector of references
+    int vector(const std::vector<int>& items) {
+        _nodes.push_back(node(N_VECTOR));
+        _nodes.back().items = items;
+        return int(_nodes.size() - 1);
+    }
+
+    // Create a vector of structs (aligned to 8 bytes)
+    int structs(const void* data, size_t size, size_t count) {
+        _nodes.push_back(node(N_STRUCTS));
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+        _nodes.back().bytes.assign(p, p + size * count);
+        _nodes.back().count = count;
+        return int(_nodes.size() - 1);
+    }
+
+    // Serialize the buffer (padded to 8 bytes)
+    void finish(int root, std::vector<uint8_t>& out) {
+        _buf.clear();
+        put(4, 0);
+        patch(0, write(root));
+        while(_buf.size() % 8)
+            _buf.push_back(0);
+        out.swap(_buf);
+    }
+
+private:
+    enum { N_TABLE, N_STRING, N_VECTOR, N_STRUCTS };
+
+    typedef struct _field {
+        int id;
+        int size;
+        uint64_t value;
+        int child;
+    } field;
+
+    struct node {
+        node(int k) : kind(k), count(0) {}
+        int kind;
+        std::vector<field> fields;
+        std::vector<uint8_t> bytes;
+        std::vector<int> items;
+        size_t count;
+    };
+
+    static bool larger(const field& a, const field& b) { return a.size > b.size; }
+
+    void put(int size, uint64_t v) {
+        for(int i = 0; i < size; i++)
+            _buf.push_back(uint8_t(v >> (8 * i)));
+    }
+
+    void set(size_t pos, int size, uint64_t v) {
+        for(int i = 0; i < size; i++)
+            _buf[pos + i] = uint8_t(v >> (8 * i));
+    }
+
+    // Resolve a forward reference
+    void patch(size_t pos, size_t target) {
+        set(pos, 4, uint32_t(target - pos));
+    }
+
+    void pad(size_t align, size_t shift = 0) {
+        while((_buf.size() + shift) % align)
+            _buf.push_back(0);
+    }
+
+    // Write a node and its children, return its position
+    size_t write(int n) {
+        node& nd = _nodes[n];
+        size_t pos;
+        if(nd.kind == N_TABLE) {
+            // Field layout: largest fields first, after the vtable offset
+            std::vector<field> fields = nd.fields;
+            std::stable_sort(fields.begin(), fields.end(), larger);
+            std::vector<int> offsets(fields.size());
+            int size = 4, maxid = -1;
+            for(size_t i = 0; i < fields.size(); i++) {
+                size = (size + fields[i].size - 1) / fields[i].size * fields[i].size;
+                offsets[i] = size;
+                size += fields[i].size;
+                maxid = std::max(maxid, fields[i].id);
+            }
+
+            // Vtable, then the table aligned to 8 bytes
+            pad(2);
+            size_t vtable = _buf.size();
+            put(2, 4 + 2 * (maxid + 1));
+            put(2, size);
+            for(int id = 0; id <= maxid; id++) {
+                int off = 0;
+                for(size_t i = 0; i < fields.size(); i++)
+                    if(fields[i].id == id)
+                        off = offsets[i];
+                put(2, off);
+            }
+            pad(8);
+            pos = _buf.size();
+            put(4, uint32_t(pos - vtable));
+            _buf.resize(pos + size, 0);
+            for(size_t i = 0; i < fields.size(); i++)
+                if(fields[i].child < 0)
+                    set(pos + offsets[i], fields[i].size, fields[i].value);
+            for(size_t i = 0; i < fields.size(); i++)
+                if(fields[i].child >= 0)
+                    patch(pos + offsets[i], write(fields[i].child));
+
+        } else if(nd.kind == N_STRING) {
+            pad(4);
+            pos = _buf.size();
+            put(4, nd.bytes.size());
+            _buf.insert(_buf.end(), nd.bytes.begin(), nd.bytes.end());
+            _buf.push_back(0);
+
+        } else if(nd.kind == N_VECTOR) {
+            pad(4);
+            pos = _buf.size();
+            std::vector<int> items = nd.items;
+            put(4, items.size());
+            _buf.resize(pos + 4 + 4 * items.size(), 0);
+            for(size_t i = 0; i < items.size(); i++)
+                patch(pos + 4 + 4 * i, write(items[i]));
+
+        } else {
+            // Elements aligned to 8 bytes after the length
+            pad(8, 4);
+            pos = _buf.size();
+            put(4, nd.count);
+            _buf.insert(_buf.end(), nd.bytes.begin(), nd.bytes.end());
+        }
+        return pos;
+    }
+
+    std::vector<node> _nodes;
+    std::vector<uint8_t> _buf;
+};
+
+
+// Arrow type of a column
+static int arrow_type(fb_builder& fb, int type, int* type_type) {
+    int t = fb.table();
+    switch(type) {
+    case COL_TIMESTAMP:
+        *type_type = ARROW_TYPE_TIMESTAMP;
+        fb.scalar(t, 0, 2, ARROW_UNIT_MICROSECOND);
+        fb.ref(t, 1, fb.string("UTC"));
+        break;
+    case COL_FLOAT32:
+    case COL_FLOAT64:
+        *type_type = ARROW_TYPE_FLOAT;
+        fb.scalar(t, 0, 2, type == COL_FLOAT32 ? ARROW_FLOAT_SINGLE : ARROW_FLOAT_DOUBLE);
+        break;
+    default:
+        *type_type = ARROW_TYPE_INT;
+        fb.scalar(t, 0, 4, 8 * col_size[type]);
+        fb.scalar(t, 1, 1, type == COL_INT32 ? 1 : 0);
+        break;
+    }
+    return t;
+}
+
+// Arrow schema
+template<class C>
+static int arrow_schema(fb_builder& fb, const std::vector<C>& columns) {
+    std::vector<int> fields;
+    for(size_t i = 0; i < columns.size(); i++) {
+        int f = fb.table();
+        int type_type = 0;
+        int type = arrow_type(fb, columns[i].type, &type_type);
+        fb.ref(f, 0, fb.string(columns[i].name));
+        fb.scalar(f, 1, 1, 0);
+        fb.scalar(f, 2, 1, type_type);
+        fb.ref(f, 3, type);
+        fb.ref(f, 5, fb.vector(std::vector<int>()));
+        fields.push_back(f);
+    }
+    int schema = fb.table();
+    fb.scalar(schema, 0, 2, 0);
+    fb.ref(schema, 1, fb.vector(fields));
+    return schema;
+}
+
+// Arrow message
+static void arrow_message(fb_builder& fb, int header_type, int header, uint64_t body, std::vector<uint8_t>& out) {
+    int m = fb.table();
+    fb.scalar(m, 0, 2, ARROW_METADATA_V5);
+    fb.scalar(m, 1, 1, header_type);
+    fb.ref(m, 2, header);
+    fb.scalar(m, 3, 8, body);
+    fb.finish(m, out);
+}
+
+
+// Constructor
+USMC_ArrowWriter::USMC_ArrowWriter() : _file(NULL), _stream(false), _offset(0), _result(ERR_SUCCESS), _kind(KIND_NONE) {}
+
+// Destructor
+USMC_ArrowWriter::~USMC_ArrowWriter() {
+    close();
+}
+
+// Create the output file
+int USMC_ArrowWriter::open(const char* filename, bool stream) {
+    close();
+    if(NULL == filename)
+        return ERR_INVALID_PARAM;
+    _file = fopen(filename, "wb");
+    if(NULL == _file)
+        return ERR_INVALID_PARAM;
+    _stream = stream;
+    _offset = 0;
+    _result = ERR_SUCCESS;
+    _kind = KIND_NONE;
+    _schema.clear();
+    _batches.clear();
+    if(!_stream) {
+        static const uint8_t magic[8] = { 'A', 'R', 'R', 'O', 'W', '1', 0, 0 };
+        write(magic, 8);
+    }
+    return _result;
+}
+
+// Close the output file
+int USMC_ArrowWriter::close() {
+    if(NULL == _file)
+        return _result;
+
+    // A stream always starts with the schema, even without batches
+    if(_kind == KIND_NONE && _result == ERR_SUCCESS) {
+        fb_builder fb;
+        std::vector<uint8_t> metadata;
+        arrow_message(fb, ARROW_HEADER_SCHEMA, arrow_schema(fb, _schema), 0, metadata);
+        writeMessage(metadata, NULL);
+    }
+
+    // End of stream
+    uint32_t eos[2] = { ARROW_CONTINUATION, 0 };
+    write(eos, sizeof(eos));
+
+    // Footer of the file format
+    if(!_stream) {
+        fb_builder fb;
+        std::vector<uint8_t> blocks(24 * _batches.size(), 0);
+        for(size_t i = 0; i < _batches.size(); i++) {
+            uint8_t* p = &blocks[24 * i];
+            for(int k = 0; k < 8; k++) {
+                p[k] = uint8_t(uint64_t(_batches[i].offset) >> (8 * k));
+                p[16 + k] = uint8_t(uint64_t(_batches[i].body) >> (8 * k));
+            }
+            for(int k = 0; k < 4; k++)
+                p[8 + k] = uint8_t(uint32_t(_batches[i].metadata) >> (8 * k));
+        }
+        int footer = fb.table();
+        fb.scalar(footer, 0, 2, ARROW_METADATA_V5);
+        fb.ref(footer, 1, arrow_schema(fb, _schema));
+        fb.ref(footer, 2, fb.structs(NULL, 24, 0));
+        fb.ref(footer, 3, fb.structs(blocks.empty() ? NULL : &blocks[0], 24, _batches.size()));
+        std::vector<uint8_t> buffer;
+        fb.finish(footer, buffer);
+        int32_t length = int32_t(buffer.size());
+        write(&buffer[0], buffer.size());
+        write(&length, 4);
+        write(ARROW_MAGIC, 6);
+    }
+
+    if(fclose(_file) != 0 && _result == ERR_SUCCESS)
+        _result = ERR_USB_IO;
+    _file = NULL;
+    return _result;
+}
+
+// Write raw bytes
+int USMC_ArrowWriter::write(const void* data, size_t len) {
+    if(_result != ERR_SUCCESS)
+        return _result;
+    if(len > 0 && fwrite(data, len, 1, _file) != 1)
+        _result = ERR_USB_IO;
+    _offset += len;
+    return _result;
+}
+
+// Write an encapsulated message (metadata is padded to 8 bytes)
+int USMC_ArrowWriter::writeMessage(const std::vector<uint8_t>& metadata, block* b) {
+    if(b) {
+        b->offset = int64_t(_offset);
+        b->metadata = int32_t(8 + metadata.size());
+    }
+    uint32_t prefix[2] = { ARROW_CONTINUATION, uint32_t(metadata.size()) };
+    write(prefix, sizeof(prefix));
+    return write(&metadata[0], metadata.size());
+}
+
+// Write a column buffer
+int USMC_ArrowWriter::writeColumn(const column& c, size_t rows) {
+    size_t size = col_size[c.type];
+
+    if(c.data && c.shift == 0) {
+        // Straight from the library array
+        write(c.data, rows * size);
+
+    } else {
+        // Generated in chunks (constant columns and shifted timestamps)
+        int64_t chunk[ARROW_CHUNK];
+        int32_t* values = reinterpret_cast<int32_t*>(chunk);
+        for(size_t i = 0; i < rows; i += ARROW_CHUNK) {
+            size_t n = std::min(rows - i, size_t(ARROW_CHUNK));
+            for(size_t k = 0; k < n; k++) {
+                if(c.type == COL_TIMESTAMP)
+                    chunk[k] = int64_t(reinterpret_cast<const uint64_t*>(c.data)[i + k]) + c.shift;
+                else
+                    values[k] = c.constant;
+            }
+            write(chunk, n * size);
+        }
+    }
+
+    static const uint8_t zeros[8] = { 0 };
+    return write(zeros, align8(rows * size) - rows * size);
+}
+
+// Write a record batch
+int USMC_ArrowWriter::writeBatch(int kind, const std::vector<column>& columns, size_t rows) {
+    if(NULL == _file)
+        return ERR_USB_NOT_FOUND;
+    if(_result != ERR_SUCCESS)
+        return _result;
+
+    // The first batch sets the schema, the next ones must match it
+    if(_kind == KIND_NONE) {
+        _kind = kind;
+        _schema = columns;
+        fb_builder fb;
+        std::vector<uint8_t> metadata;
+        arrow_message(fb, ARROW_HEADER_SCHEMA, arrow_schema(fb, _schema), 0, metadata);
+        writeMessage(metadata, NULL);
+    } else {
+        if(kind != _kind || columns.size() != _schema.size())
+            return ERR_INVALID_PARAM;
+        for(size_t i = 0; i < columns.size(); i++)
+            if(columns[i].name != _schema[i].name || columns[i].type != _schema[i].type)
+                return ERR_INVALID_PARAM;
+    }
+
+    // Field nodes (no nulls) and buffers (empty validity bitmap and values)
+    std::vector<int64_t> nodes, buffers;
+    int64_t body = 0;
+    for(size_t i = 0; i < columns.size(); i++) {
+        int64_t length = int64_t(rows * col_size[columns[i].type]);
+        nodes.push_back(int64_t(rows));
+        nodes.push_back(0);
+        buffers.push_back(body);
+        buffers.push_back(0);
+        buffers.push_back(body);
+        buffers.push_back(length);
+        body += int64_t(align8(size_t(length)));
+    }
+
+    fb_builder fb;
+    int batch = fb.table();
+    fb.scalar(batch, 0, 8, rows);
+    fb.ref(batch, 1, fb.structs(&nodes[0], 16, columns.size()));
+    fb.ref(batch, 2, fb.structs(&buffers[0], 16, 2 * columns.size()));
+    std::vector<uint8_t> metadata;
+    arrow_message(fb, ARROW_HEADER_BATCH, batch, uint64_t(body), metadata);
+
+    block b;
+    writeMessage(metadata, &b);
+    b.body = body;
+    for(size_t i = 0; i < columns.size(); i++)
+        writeColumn(columns[i], rows);
+    if(_result == ERR_SUCCESS)
+        _batches.push_back(b);
+    return _result;
+}
+
+// Data pointer of an array
+template<class T>
+static const void* data_of(const std::vector<T>& v) {
+    return v.empty() ? NULL : &v[0];
+}
+
+// Write telemetry samples
+int USMC_ArrowWriter::writeTelemetry(int device, const USMC_ArchiveSeries& series) {
+    size_t rows = series.time.size();
+    if(series.position.size() != rows || series.flags.size() != rows || series.divisor.size() != rows ||
+       series.temp.size() != rows || series.voltage.size() != rows)
+        return ERR_INVALID_VALUE;
+
+    static const struct { const char* name; int type; } layout[] = {
+        { "time",     COL_TIMESTAMP },
+        { "device",   COL_INT32 },
+        { "position", COL_INT32 },
+        { "flags",    COL_UINT32 },
+        { "divisor",  COL_UINT8 },
+        { "temp",     COL_FLOAT32 },
+        { "voltage",  COL_FLOAT32 },
+    };
+    const void* data[] = { data_of(series.time), NULL, data_of(series.position), data_of(series.flags),
+                           data_of(series.divisor), data_of(series.temp), data_of(series.voltage) };
+
+    std::vector<column> columns(7);
+    for(size_t i = 0; i < columns.size(); i++) {
+        columns[i].name = layout[i].name;
+        columns[i].type = layout[i].type;
+        columns[i].data = data[i];
+        columns[i].constant = (i == 1) ? device : 0;
+        columns[i].shift = 0;
+    }
+    return writeBatch(KIND_TELEMETRY, columns, rows);
+}
+
+// Write a time window of an archive
+int USMC_ArrowWriter::writeArchive(USMC_ArchiveReader& reader, uint64_t t0, uint64_t t1) {
+    int total = 0;
+    for(int d = 0; d < reader.devices(); d++) {
+        USMC_ArchiveSeries series;
+        int r = reader.query(d, t0, t1, series);
+        if(r < 0)
+            return r;
+        if(r == 0)
+            continue;
+        r = writeTelemetry(d, series);
+        if(r < 0)
+            return r;
+        total += int(series.time.size());
+    }
+    return total;
+}
+
+// Write scan results
+int USMC_ArrowWriter::writeScan(const USMC_ScanData& data, int naxes) {
+    if(naxes < 1 || naxes > USMC_MAX_SCAN_AXES)
+        return ERR_INVALID_PARAM;
+    size_t rows = data.size();
+    if(data.time.size() != rows)
+        return ERR_INVALID_VALUE;
+    for(int k = 0; k < naxes; k++)
+        if(data.position[k].size() != rows)
+            return ERR_INVALID_VALUE;
+    bool encoder = (rows > 0 && data.encoder[0].size() == rows);
+
+    std::vector<column> columns;
+    column c;
+    c.constant = 0;
+    c.shift = 0;
+
+    // Library clock to wall-clock time
+    c.name = "time";
+    c.type = COL_TIMESTAMP;
+    c.data = data_of(data.time);
+    c.shift = int64_t(usmc_wall_time_us(0));
+    columns.push_back(c);
+    c.shift = 0;
+
+    char name[32];
+    for(int k = 0; k < naxes; k++) {
+        snprintf(name, sizeof(name), "position_%d", k);
+        c.name = name;
+        c.type = COL_INT32;
+        c.data = data_of(data.position[k]);
+        columns.push_back(c);
+    }
+    for(int k = 0; k < naxes && encoder; k++) {
+        if(data.encoder[k].size() != rows)
+            return ERR_INVALID_VALUE;
+        snprintf(name, sizeof(name), "encoder_%d", k);
+        c.name = name;
+        c.type = COL_INT32;
+        c.data = data_of(data.encoder[k]);
+        columns.push_back(c);
+    }
+    c.name = "value";
+    c.type = COL_FLOAT64;
+    c.data = data_of(data.value);
+    columns.push_back(c);
+
+    return writeBatch(KIND_SCAN, columns, rows);
+}
@@ -0,0 +1,233 @@
+/***************************************************//**
+ * @file    usmc_autotune.cpp
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#include <cstring>
+#include <cmath>
+#include <usmc_autotune.h>
+#include <usmc_motion.h>
+#include <usmc_clock.h>
+
+// Hardware granularity of AccelT and DecelT (ms)
+#define ACCEL_QUANTUM   98.0f
+
+
+// Tuner constructor
+USMC_Autotune::USMC_Autotune(USMC* usmc) : _usmc(usmc), _reference(NULL), _user(NULL), _encoder(false), _enc_mult(1.0f), _home(0), _strokes(0) {
+    memset(&_config, 0, sizeof(USMC_AutotuneConfig));
+}
+
+// Default configuration
+void USMC_Autotune::defaults(USMC_AutotuneConfig* config) {
+    memset(config, 0, sizeof(USMC_AutotuneConfig));
+    config->stroke = 2000;
+    config->start_speed = 200.0f;
+    config->max_speed = 5000.0f;
+    config->speed_factor = 1.25f;
+    config->repeats = 2;
+    config->tolerance = 1.0;
+    config->margin = 0.8f;
+    config->apply = false;
+    config->poll_us = 1000;
+    config->timeout_ms = 60000;
+}
+
+// Set external reference
+void USMC_Autotune::setReference(USMC_ReferenceFn reference, void* user) {
+    _reference = reference;
+    _user = user;
+}
+
+// Run tuning
+int USMC_Autotune::run(const USMC_AutotuneConfig& config, USMC_AutotuneResult* result) {
+    if(NULL == result)
+        return ERR_INVALID_PARAM;
+    if(config.device < 0 || config.device >= int(_usmc->countDevices()))
+        return ERR_INVALID_ID;
+    if(config.stroke == 0 || config.repeats < 1 || config.speed_factor <= 1.0f || config.margin <= 0.0f || config.margin > 1.0f)
+        return ERR_INVALID_VALUE;
+    if(config.start_speed < 16.0f || config.max_speed > 5000.0f || config.start_speed > config.max_speed)
+        return ERR_INVALID_VALUE;
+
+    _config = config;
+    _strokes = 0;
+    memset(result, 0, sizeof(USMC_AutotuneResult));
+    uint64_t start = usmc_time_us();
+
+    // Original settings
+    USMC_Mode mode;
+    USMC_Parameters params;
+    float speed;
+    int r;
+    if((r = _usmc->getMode(_config.device, &mode)) < 0)
+        return r;
+    if((r = _usmc->getParameters(_config.device, &params)) < 0)
+        return r;
+    if((r = _usmc->getSpeed(_config.device, speed)) < 0)
+        return r;
+
+    // Missed steps are detected with the encoder or with the external reference
+    _encoder = mode.EncoderEn && params.EncMult > 0.0f;
+    _enc_mult = params.EncMult;
+    if(!_encoder && NULL == _reference)
+        return ERR_INVALID_VALUE;
+
+    USMC_State state;
+    if((r = usmc_wait_idle(_usmc, _config.device, _config.poll_us, _config.timeout_ms, &state)) < 0)
+        return r;
+    _home = state.CurPos;
+
+    USMC_Parameters test_params = params;
+    double error, max_error = 0.0;
+
+    // Speed ramp with the original acceleration
+    float best_speed = 0.0f;
+    for(float s = _config.start_speed; ; s *= _config.speed_factor) {
+        if(s > _config.max_speed)
+            s = _config.max_speed;
+        if((r = _usmc->setSpeed(_config.device, s)) < 0)
+            break;
+        if((r = test(error)) < 0)
+            break;
+        if(error > _config.tolerance)
+            break;
+        best_speed = s;
+        if(error > max_error)
+            max_error = error;
+        if(s >= _config.max_speed)
+            break;
+    }
+
+    // Shorter acceleration and deceleration at the best speed
+    float best_accel = params.AccelT > params.DecelT ? params.AccelT : params.DecelT;
+    if(r >= 0 && best_speed > 0.0f) {
+        r = _usmc->setSpeed(_config.device, best_speed);
+        int k = int(best_accel / ACCEL_QUANTUM + 0.5f);
+        for(k = (k > 15 ? 15 : k) - 1; r >= 0 && k >= 1; k--) {
+            test_params.AccelT = test_params.DecelT = ACCEL_QUANTUM * k;
+            if((r = _usmc->setParameters(_config.device, &test_params)) < 0)
+                break;
+            if((r = test(error)) < 0)
+                break;
+            if(error > _config.tolerance)
+                break;
+            best_accel = ACCEL_QUANTUM * k;
+            if(error > max_error)
+                max_error = error;
+        }
+    }
+
+    // Recommendation with safety margin
+    result->max_speed = best_speed;
+    result->min_accel = best_accel;
+    result->speed = best_speed * _config.margin;
+    if(result->speed < 16.0f)
+        result->speed = 16.0f;
+    float accel = best_accel / _config.margin;
+    if(accel > 1518.0f)
+        accel = 1518.0f;
+    result->parameters = params;
+    result->parameters.AccelT = result->parameters.DecelT = accel;
+    result->max_error = max_error;
+    result->strokes = _strokes;
+
+    // Restore the original settings (or apply the recommended ones) and go home
+    int rr;
+    if(_config.apply && r >= 0 && best_speed > 0.0f) {
+        rr = _usmc->setParameters(_config.device, &(result->parameters));
+        if(rr >= 0)
+            rr = _usmc->setSpeed(_config.device, result->speed);
+    } else {
+        rr = _usmc->setParameters(_config.device, &params);
+        if(rr >= 0)
+            rr = _usmc->setSpeed(_config.device, speed);
+    }
+    if(rr >= 0 && (rr = _usmc->moveTo(_config.device, _home)) >= 0)
+        rr = usmc_wait_idle(_usmc, _config.device, _config.poll_us, _config.timeout_ms);
+
+    result->wall_time = double(usmc_time_us() - start) / 1e6;
+    if(r < 0)
+        return r;
+    if(rr < 0)
+        return rr;
+    if(best_speed <= 0.0f)
+        return ERR_INVALID_VALUE;
+    return ERR_SUCCESS;
+}
+
+// Read reference position
+int USMC_Autotune::readReference(double& position) {
+    if(_encoder) {
+        USMC_EncoderState es;
+        int r = _usmc->getEncoderState(_config.device, &es);
+        if(r < 0)
+            return r;
+        position = double(es.EncoderPos) / _enc_mult;
+        return ERR_SUCCESS;
+    }
+    return _reference(_user, &position);
+}
+
+// Run strokes for the current setting
+int USMC_Autotune::test(double& error) {
+    int r;
+    double p0, p1, p2;
+    error = 0.0;
+
+    for(int i = 0; i < _config.repeats; i++) {
+        if((r = readReference(p0)) < 0)
+            return r;
+
+        // Outbound stroke must measure the full length
+        if((r = _usmc->moveTo(_config.device, _home + _config.stroke)) < 0)
+            return r;
+        if((r = usmc_wait_idle(_usmc, _config.device, _config.poll_us, _config.timeout_ms)) < 0)
+            return r;
+        if((r = readReference(p1)) < 0)
+            return r;
+
+        // Return stroke must come back to the start
+        if((r = _usmc->moveTo(_config.device, _home)) < 0)
+            return r;
+        if((r = usmc_wait_idle(_usmc, _config.device, _config.poll_us, _config.timeout_ms)) < 0)
+            return r;
+        if((r = readReference(p2)) < 0)
+            return r;
+        _strokes += 2;
+
+        double e1 = fabs(fabs(p1 - p0) - fabs(double(_config.stroke)));
+        double e2 = fabs(p2 - p0);
+        if(e1 > error)
+            error = e1;
+        if(e2 > error)
+            error = e2;
+
+        // No need to repeat a failed setting
+        if(error > _config.tolerance)
+            break;
+    }
+    return ERR_SUCCESS;
+}
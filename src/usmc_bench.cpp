@@ -0,0 +1,208 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include <time.h>
+#include <vector>
+#include <libusmc.h>
+#include <usmc_device.h>
+
+using namespace std;
+
+// Run with: LD_PRELOAD=lib/libusmc_usb_shim.so usmc_bench [iterations] [max threads]
+
+static USMC* usmc_driver = NULL;
+static int ndev = 0;
+static USMC_Parameters bench_params;
+static USMC_Mode bench_mode;
+static std::vector<USMC_Device> handles;
+
+// Benchmarked calls
+typedef int (*bench_fn)(int device, long i);
+
+static int op_getVersion(int device, long i) {
+    uint32_t version;
+    return usmc_driver->getVersion(device, version);
+}
+static int op_getParameters(int device, long i) {
+    USMC_Parameters params;
+    return usmc_driver->getParameters(device, &params);
+}
+static int op_getState(int device, long i) {
+    USMC_State state;
+    return usmc_driver->getState(device, &state);
+}
+static int op_getEncoderState(int device, long i) {
+    USMC_EncoderState state;
+    return usmc_driver->getEncoderState(device, &state);
+}
+static int op_moveTo(int device, long i) {
+    return usmc_driver->moveTo(device, int(i & 0xFFF));
+}
+static int op_stop(int device, long i) {
+    return usmc_driver->stop(device);
+}
+static int op_setMode(int device, long i) {
+    return usmc_driver->setMode(device, &bench_mode);
+}
+static int op_setParameters(int device, long i) {
+    return usmc_driver->setParameters(device, &bench_params);
+}
+static int op_getSpeed(int device, long i) {
+    float speed;
+    return usmc_driver->getSpeed(device, speed);
+}
+
+// Same calls through the device handle
+static int op_dev_getVersion(int device, long i) {
+    return handles[device].version() ? 0 : -1;
+}
+static int op_dev_getSpeed(int device, long i) {
+    return handles[device].speed() > 0.0f ? 0 : -1;
+}
+static int op_dev_getParameters(int device, long i) {
+    USMC_Parameters params;
+    handles[device].getParameters(params);
+    return 0;
+}
+static int op_dev_getState(int device, long i) {
+    USMC_State state;
+    return handles[device].getState(&state);
+}
+static int op_dev_moveTo(int device, long i) {
+    return handles[device].moveTo(int(i & 0xFFF));
+}
+static int op_dev_stop(int device, long i) {
+    return handles[device].stop();
+}
+
+static struct {
+    const char* name;
+    bench_fn fn;
+} ops[] = {
+    { "getVersion",      op_getVersion },
+    { "getParameters",   op_getParameters },
+    { "getState",        op_getState },
+    { "getEncoderState", op_getEncoderState },
+    { "moveTo",          op_moveTo },
+    { "stop",            op_stop },
+    { "setMode",         op_setMode },
+    { "setParameters",   op_setParameters },
+    { "getSpeed",        op_getSpeed },
+    { "dev.version",     op_dev_getVersion },
+    { "dev.speed",       op_dev_getSpeed },
+    { "dev.getParams",   op_dev_getParameters },
+    { "dev.getState",    op_dev_getState },
+    { "dev.moveTo",      op_dev_moveTo },
+    { "dev.stop",        op_dev_stop },
+};
+
+// Worker thread
+typedef struct _worker {
+    pthread_t thread;
+    pthread_barrier_t* barrier;
+    bench_fn fn;
+    int device;
+    long iterations;
+    long errors;
+    uint64_t start;
+    uint64_t end;
+} worker;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ULL + uint64_t(ts.tv_nsec);
+}
+
+static void* worker_main(void* arg) {
+    worker* w = static_cast<worker*>(arg);
+    pthread_barrier_wait(w->barrier);
+    w->start = now_ns();
+    for(long i = 0; i < w->iterations; i++) {
+        if(w->fn(w->device, i) < 0)
+            w->errors++;
+    }
+    w->end = now_ns();
+    return NULL;
+}
+
+static void quiet_logger(const char* fmt, ...) {
+
+}
+
+int main(int argc, char** argv)
+{
+    long iterations = argc > 1 ? atol(argv[1]) : 200000;
+    int max_threads = argc > 2 ? atoi(argv[2]) : 64;
+
+    cout << "USMC library overhead benchmark" << endl;
+
+    usmc_driver = USMC::getInstance();
+    usmc_driver->set_info_logger(quiet_logger);
+    ndev = usmc_driver->probeDevices();
+    if(ndev <= 0) {
+        cout << "No devices found (is the libusb shim preloaded?)" << endl;
+        return 1;
+    }
+
+    // Never move real motors
+    std::string serial;
+    usmc_driver->getSerialNumber(0, serial);
+    if(serial.compare(0, 4, "SHIM") != 0) {
+        cout << "Real devices found, run with LD_PRELOAD=libusmc_usb_shim.so" << endl;
+        return 1;
+    }
+    usmc_driver->getParameters(0, &bench_params);
+    usmc_driver->getMode(0, &bench_mode);
+    handles.resize(ndev);
+    for(int d = 0; d < ndev; d++)
+        usmc_driver->getDevice(d, &handles[d]);
+
+    cout << "Devices: " << ndev << ", iterations per thread: " << iterations << endl;
+    cout << setw(16) << left << "call" << right << setw(8) << "threads" << setw(12) << "ns/call" << setw(14) << "Mcalls/s" << setw(10) << "errors" << endl;
+
+    for(size_t k = 0; k < sizeof(ops) / sizeof(ops[0]); k++) {
+        for(int nt = 1; nt <= max_threads; nt *= 2) {
+            worker* workers = new worker[nt];
+            pthread_barrier_t barrier;
+            pthread_barrier_init(&barrier, NULL, nt + 1);
+
+            for(int t = 0; t < nt; t++) {
+                workers[t].barrier = &barrier;
+                workers[t].fn = ops[k].fn;
+                workers[t].device = t % ndev;
+                workers[t].iterations = iterations;
+                workers[t].errors = 0;
+                pthread_create(&workers[t].thread, NULL, worker_main, &workers[t]);
+            }
+
+            // Start all the workers together
+            pthread_barrier_wait(&barrier);
+            long errors = 0;
+            uint64_t start = 0, end = 0;
+            for(int t = 0; t < nt; t++) {
+                pthread_join(workers[t].thread, NULL);
+                errors += workers[t].errors;
+                if(t == 0 || workers[t].start < start)
+                    start = workers[t].start;
+                if(workers[t].end > end)
+                    end = workers[t].end;
+            }
+            uint64_t elapsed = end - start;
+            pthread_barrier_destroy(&barrier);
+            delete[] workers;
+
+            // Latency seen by each thread and aggregate throughput
+            double calls = double(iterations) * nt;
+            cout << setw(16) << left << ops[k].name << right << setw(8) << nt;
+            cout << fixed << setprecision(1) << setw(12) << double(elapsed) / double(iterations);
+            cout << setprecision(3) << setw(14) << calls / double(elapsed) * 1000.0;
+            cout << setw(10) << errors << endl;
+        }
+    }
+
+    USMC::shutdown();
+    return 0;
+}
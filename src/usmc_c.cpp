@@ -0,0 +1,592 @@
+/***************************************************//**
+ * @file    usmc_c.cpp
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include <usmc_c.h>
+#include <libusmc.h>
+#include <libusmc_impl.h>
+#include <usmc_device.h>
+#include <usmc_sim.h>
+#include <usmc_record.h>
+
+
+// Library context
+struct usmc_ctx {
+    USMC* usmc;
+    USMC_Simulator* sim;
+    std::vector<USMC_Device> devices;
+    bool record;        // Calls go through the USMC interface, seen by the recorder.
+};
+
+// Open context (the library is a singleton)
+static usmc_ctx* open_ctx = NULL;
+
+
+// Silent logger
+static void usmc_log_none(const char* fmt, ...) {
+
+}
+
+
+// Device handle from index
+static inline USMC_Device* handle(usmc_ctx* ctx, int device) {
+    if(NULL == ctx || device < 0 || size_t(device) >= ctx->devices.size())
+        return NULL;
+    return &ctx->devices[device];
+}
+
+
+// Structure conversions
+static void convert_state(const USMC_State& in, usmc_state* out) {
+    out->cur_pos  = in.CurPos;
+    out->temp     = in.Temp;
+    out->voltage  = in.Voltage;
+    out->sdivisor = in.SDivisor;
+    out->flags    = (in.Loft      ? USMC_STATE_LOFT      : 0) |
+                    (in.FullPower ? USMC_STATE_FULLPOWER : 0) |
+                    (in.CW_CCW    ? USMC_STATE_CW_CCW    : 0) |
+                    (in.Power     ? USMC_STATE_POWER     : 0) |
+                    (in.FullSpeed ? USMC_STATE_FULLSPEED : 0) |
+                    (in.AReset    ? USMC_STATE_ARESET    : 0) |
+                    (in.RUN       ? USMC_STATE_RUN       : 0) |
+                    (in.SyncIN    ? USMC_STATE_SYNCIN    : 0) |
+                    (in.SyncOUT   ? USMC_STATE_SYNCOUT   : 0) |
+                    (in.RotTr     ? USMC_STATE_ROTTR     : 0) |
+                    (in.RotTrErr  ? USMC_STATE_ROTTRERR  : 0) |
+                    (in.EmReset   ? USMC_STATE_EMRESET   : 0) |
+                    (in.Trailer1  ? USMC_STATE_TRAILER1  : 0) |
+                    (in.Trailer2  ? USMC_STATE_TRAILER2  : 0);
+}
+
+static void convert_mode(const USMC_Mode& in, usmc_mode* out) {
+    out->pmode       = in.PMode;
+    out->preg        = in.PReg;
+    out->reset_d     = in.ResetD;
+    out->em_reset    = in.EMReset;
+    out->tr1t        = in.Tr1T;
+    out->tr2t        = in.Tr2T;
+    out->rot_trt     = in.RotTrT;
+    out->tr_swap     = in.TrSwap;
+    out->tr1_en      = in.Tr1En;
+    out->tr2_en      = in.Tr2En;
+    out->rot_tr_en   = in.RotTeEn;
+    out->rot_tr_op   = in.RotTrOp;
+    out->butt1t      = in.Butt1T;
+    out->butt2t      = in.Butt2T;
+    out->reset_rt    = in.ResetRT;
+    out->sync_out_en = in.SyncOUTEn;
+    out->sync_out_r  = in.SyncOUTR;
+    out->sync_in_op  = in.SyncINOp;
+    out->sync_invert = in.SyncInvert;
+    out->encoder_en  = in.EncoderEn;
+    out->encoder_inv = in.EncoderInv;
+    out->res_b_enc   = in.ResBEnc;
+    out->res_enc     = in.ResEnc;
+    out->reserved    = 0;
+    out->sync_count  = in.SyncCount;
+}
+
+static void convert_mode(const usmc_mode* in, USMC_Mode& out) {
+    out.PMode      = in->pmode != 0;
+    out.PReg       = in->preg != 0;
+    out.ResetD     = in->reset_d != 0;
+    out.EMReset    = in->em_reset != 0;
+    out.Tr1T       = in->tr1t != 0;
+    out.Tr2T       = in->tr2t != 0;
+    out.RotTrT     = in->rot_trt != 0;
+    out.TrSwap     = in->tr_swap != 0;
+    out.Tr1En      = in->tr1_en != 0;
+    out.Tr2En      = in->tr2_en != 0;
+    out.RotTeEn    = in->rot_tr_en != 0;
+    out.RotTrOp    = in->rot_tr_op != 0;
+    out.Butt1T     = in->butt1t != 0;
+    out.Butt2T     = in->butt2t != 0;
+    out.ResetRT    = in->reset_rt != 0;
+    out.SyncOUTEn  = in->sync_out_en != 0;
+    out.SyncOUTR   = in->sync_out_r != 0;
+    out.SyncINOp   = in->sync_in_op != 0;
+    out.SyncInvert = in->sync_invert != 0;
+    out.EncoderEn  = in->encoder_en != 0;
+    out.EncoderInv = in->encoder_inv != 0;
+    out.ResBEnc    = in->res_b_enc != 0;
+    out.ResEnc     = in->res_enc != 0;
+    out.SyncCount  = in->sync_count;
+}
+
+static void convert_parameters(const USMC_Parameters& in, usmc_parameters* out) {
+    out->accel_t      = in.AccelT;
+    out->decel_t      = in.DecelT;
+    out->p_timeout    = in.PTimeout;
+    out->b_timeout1   = in.BTimeout1;
+    out->b_timeout2   = in.BTimeout2;
+    out->b_timeout3   = in.BTimeout3;
+    out->b_timeout4   = in.BTimeout4;
+    out->b_timeout_r  = in.BTimeoutR;
+    out->b_timeout_d  = in.BTimeoutD;
+    out->min_p        = in.MinP;
+    out->bto1p        = in.BTO1P;
+    out->bto2p        = in.BTO2P;
+    out->bto3p        = in.BTO3P;
+    out->bto4p        = in.BTO4P;
+    out->max_temp     = in.MaxTemp;
+    out->loft_period  = in.LoftPeriod;
+    out->enc_mult     = in.EncMult;
+    out->start_pos    = in.StartPos;
+    out->max_loft     = in.MaxLoft;
+    out->rt_delta     = in.RTDelta;
+    out->rt_min_error = in.RTMinError;
+    out->syn_outp     = in.SynOUTP;
+}
+
+static void convert_parameters(const usmc_parameters* in, USMC_Parameters& out) {
+    out.AccelT     = in->accel_t;
+    out.DecelT     = in->decel_t;
+    out.PTimeout   = in->p_timeout;
+    out.BTimeout1  = in->b_timeout1;
+    out.BTimeout2  = in->b_timeout2;
+    out.BTimeout3  = in->b_timeout3;
+    out.BTimeout4  = in->b_timeout4;
+    out.BTimeoutR  = in->b_timeout_r;
+    out.BTimeoutD  = in->b_timeout_d;
+    out.MinP       = in->min_p;
+    out.BTO1P      = in->bto1p;
+    out.BTO2P      = in->bto2p;
+    out.BTO3P      = in->bto3p;
+    out.BTO4P      = in->bto4p;
+    out.MaxTemp    = in->max_temp;
+    out.LoftPeriod = in->loft_period;
+    out.EncMult    = in->enc_mult;
+    out.StartPos   = in->start_pos;
+    out.MaxLoft    = in->max_loft;
+    out.RTDelta    = in->rt_delta;
+    out.RTMinError = in->rt_min_error;
+    out.SynOUTP    = uint8_t(in->syn_outp);
+}
+
+static void convert_start(const USMC_StartParameters& in, usmc_start_parameters* out) {
+    out->sdivisor   = in.SDivisor;
+    out->def_dir    = in.DefDir;
+    out->loft_en    = in.LoftEn;
+    out->sl_start   = in.SlStart;
+    out->wsync_in   = in.WSyncIN;
+    out->sync_out_r = in.SyncOUTR;
+    out->force_loft = in.ForceLoft;
+    out->reserved   = 0;
+}
+
+static void convert_start(const usmc_start_parameters* in, USMC_StartParameters& out) {
+    out.SDivisor  = in->sdivisor;
+    out.DefDir    = in->def_dir != 0;
+    out.LoftEn    = in->loft_en != 0;
+    out.SlStart   = in->sl_start != 0;
+    out.WSyncIN   = in->wsync_in != 0;
+    out.SyncOUTR  = in->sync_out_r != 0;
+    out.ForceLoft = in->force_loft != 0;
+}
+
+
+// Open the library on a transport. An instance created through the C++
+// interface is rejected: it may use another transport and the context
+// would shut it down on close.
+static usmc_ctx* ctx_open(USMC_Simulator* sim) {
+    if(NULL != open_ctx || USMC::hasInstance()) {
+        delete sim;
+        return NULL;
+    }
+
+    usmc_ctx* ctx = new usmc_ctx;
+    ctx->sim = sim;
+    try {
+        ctx->usmc = sim ? USMC::getInstance(sim) : USMC::getInstance();
+    } catch(std::runtime_error& e) {
+        delete sim;
+        delete ctx;
+        return NULL;
+    }
+
+    if(ctx->usmc->probeDevices() < 0) {
+        USMC::shutdown();
+        delete sim;
+        delete ctx;
+        return NULL;
+    }
+
+    // Handle calls bypass a recorder (USMC_RECORD), so when recording the
+    // handles only check the indexes and the calls use the USMC interface
+    ctx->record = (NULL != dynamic_cast<USMC_recorder*>(ctx->usmc));
+    ctx->devices.resize(ctx->usmc->countDevices());
+    for(size_t i = 0; i < ctx->devices.size(); i++)
+        ctx->usmc->getDevice(int(i), &ctx->devices[i]);
+
+    open_ctx = ctx;
+    return ctx;
+}
+
+
+extern "C" {
+
+int usmc_abi_version(void) {
+    return USMC_C_ABI_VERSION;
+}
+
+const char* usmc_strerror(int error) {
+    switch(error) {
+        case ERR_SUCCESS:           return "Success";
+        case ERR_USB_IO:            return "Input/Output Error";
+        case ERR_USB_INVALID_PARAM: return "Invalid parameter";
+        case ERR_USB_ACCESS:        return "Access denied (insufficient permissions)";
+        case ERR_USB_NO_DEVICE:     return "No such device (it may have been disconnected)";
+        case ERR_USB_NOT_FOUND:     return "Entity not found";
+        case ERR_USB_BUSY:          return "Resource busy";
+        case ERR_USB_TIMEOUT:       return "Operation timed out";
+        case ERR_USB_OVERFLOW:      return "Overflow";
+        case ERR_USB_PIPE:          return "Pipe error";
+        case ERR_USB_INTERRUPTED:   return "System call interrupted (perhaps due to signal)";
+        case ERR_USB_NO_MEM:        return "Insufficient memory";
+        case ERR_USB_NOT_SUPPORTED: return "Operation not supported or unimplemented on this platform";
+        case ERR_INVALID_ID:        return "Invalid device";
+        case ERR_INVALID_PARAM:     return "Invalid parameter";
+        case ERR_INVALID_VALUE:     return "Value out of range";
+        case ERR_INTERLOCK:         return "Move rejected by the collision interlock";
+        case ERR_VERIFY:            return "Read back value differs from the written one";
+        default:                    return "Other error";
+    }
+}
+
+usmc_ctx* usmc_ctx_open(void) {
+    return ctx_open(NULL);
+}
+
+usmc_ctx* usmc_ctx_open_sim(int axes) {
+    if(axes < 1)
+        return NULL;
+    USMC_Simulator* sim = new USMC_Simulator();
+    for(int i = 0; i < axes; i++) {
+        USMC_SimAxisConfig config;
+        USMC_Simulator::defaults(&config, i);
+        sim->addAxis(config);
+    }
+    return ctx_open(sim);
+}
+
+void usmc_ctx_close(usmc_ctx* ctx) {
+    if(NULL == ctx || ctx != open_ctx)
+        return;
+    ctx->devices.clear();
+    USMC::shutdown();
+    delete ctx->sim;
+    delete ctx;
+    open_ctx = NULL;
+}
+
+void usmc_ctx_set_log_level(usmc_ctx* ctx, int level) {
+    if(NULL == ctx)
+        return;
+    ctx->usmc->set_error_logger(level >= USMC_LOG_ERROR ? usmc_log_error : usmc_log_none);
+    ctx->usmc->set_warn_logger(level >= USMC_LOG_WARN ? usmc_log_warn : usmc_log_none);
+    ctx->usmc->set_info_logger(level >= USMC_LOG_INFO ? usmc_log_info : usmc_log_none);
+    ctx->usmc->set_debug_logger(level >= USMC_LOG_DEBUG ? usmc_log_debug : usmc_log_none);
+    ctx->usmc->debug(level >= USMC_LOG_DEBUG);
+}
+
+int usmc_ctx_count(usmc_ctx* ctx) {
+    if(NULL == ctx)
+        return ERR_INVALID_PARAM;
+    return int(ctx->devices.size());
+}
+
+int usmc_ctx_find(usmc_ctx* ctx, const char* serial) {
+    if(NULL == ctx || NULL == serial)
+        return ERR_INVALID_PARAM;
+    int device = ctx->usmc->getDeviceID(std::string(serial));
+    return device < 0 ? ERR_INVALID_ID : device;
+}
+
+
+// Batch calls
+int usmc_ctx_poll_states(usmc_ctx* ctx, const int* devices, size_t n, usmc_state* states, int* results) {
+    if(NULL == ctx || (n && (NULL == devices || NULL == states)))
+        return ERR_INVALID_PARAM;
+    int first = ERR_SUCCESS;
+    for(size_t i = 0; i < n; i++) {
+        USMC_Device* dev = handle(ctx, devices[i]);
+        USMC_State state;
+        int r = dev ? (ctx->record ? ctx->usmc->getState(devices[i], &state) : dev->getState(&state)) : ERR_INVALID_ID;
+        if(r == ERR_SUCCESS)
+            convert_state(state, &states[i]);
+        else if(first == ERR_SUCCESS)
+            first = r;
+        if(results)
+            results[i] = r;
+    }
+    return first;
+}
+
+int usmc_ctx_poll_positions(usmc_ctx* ctx, const int* devices, size_t n, int32_t* positions, int* results) {
+    if(NULL == ctx || (n && (NULL == devices || NULL == positions)))
+        return ERR_INVALID_PARAM;
+    int first = ERR_SUCCESS;
+    for(size_t i = 0; i < n; i++) {
+        USMC_Device* dev = handle(ctx, devices[i]);
+        USMC_State state;
+        int r = dev ? (ctx->record ? ctx->usmc->getState(devices[i], &state) : dev->getState(&state)) : ERR_INVALID_ID;
+        if(r == ERR_SUCCESS)
+            positions[i] = state.CurPos;
+        else if(first == ERR_SUCCESS)
+            first = r;
+        if(results)
+            results[i] = r;
+    }
+    return first;
+}
+
+int usmc_ctx_poll_encoders(usmc_ctx* ctx, const int* devices, size_t n, usmc_encoder_state* states, int* results) {
+    if(NULL == ctx || (n && (NULL == devices || NULL == states)))
+        return ERR_INVALID_PARAM;
+    int first = ERR_SUCCESS;
+    for(size_t i = 0; i < n; i++) {
+        USMC_Device* dev = handle(ctx, devices[i]);
+        USMC_EncoderState state;
+        int r = dev ? (ctx->record ? ctx->usmc->getEncoderState(devices[i], &state) : dev->getEncoderState(&state)) : ERR_INVALID_ID;
+        if(r == ERR_SUCCESS) {
+            states[i].encoder_pos = state.EncoderPos;
+            states[i].ecur_pos = state.ECurPos;
+        } else if(first == ERR_SUCCESS) {
+            first = r;
+        }
+        if(results)
+            results[i] = r;
+    }
+    return first;
+}
+
+int usmc_ctx_move(usmc_ctx* ctx, const int* devices, size_t n, const int32_t* destinations, int* results) {
+    if(NULL == ctx || (n && (NULL == devices || NULL == destinations)))
+        return ERR_INVALID_PARAM;
+    int first = ERR_SUCCESS;
+    for(size_t i = 0; i < n; i++) {
+        USMC_Device* dev = handle(ctx, devices[i]);
+        int r = dev ? (ctx->record ? ctx->usmc->moveTo(devices[i], destinations[i]) : dev->moveTo(destinations[i])) : ERR_INVALID_ID;
+        if(r != ERR_SUCCESS && first == ERR_SUCCESS)
+            first = r;
+        if(results)
+            results[i] = r;
+    }
+    return first;
+}
+
+int usmc_ctx_stop(usmc_ctx* ctx, const int* devices, size_t n, int* results) {
+    if(NULL == ctx || (n && NULL == devices))
+        return ERR_INVALID_PARAM;
+    int first = ERR_SUCCESS;
+    for(size_t i = 0; i < n; i++) {
+        USMC_Device* dev = handle(ctx, devices[i]);
+        int r = dev ? (ctx->record ? ctx->usmc->stop(devices[i]) : dev->stop()) : ERR_INVALID_ID;
+        if(r != ERR_SUCCESS && first == ERR_SUCCESS)
+            first = r;
+        if(results)
+            results[i] = r;
+    }
+    return first;
+}
+
+int usmc_ctx_set_speeds(usmc_ctx* ctx, const int* devices, size_t n, const float* speeds, int* results) {
+    if(NULL == ctx || (n && (NULL == devices || NULL == speeds)))
+        return ERR_INVALID_PARAM;
+    int first = ERR_SUCCESS;
+    for(size_t i = 0; i < n; i++) {
+        USMC_Device* dev = handle(ctx, devices[i]);
+        int r = dev ? (ctx->record ? ctx->usmc->setSpeed(devices[i], speeds[i]) : dev->setSpeed(speeds[i])) : ERR_INVALID_ID;
+        if(r != ERR_SUCCESS && first == ERR_SUCCESS)
+            first = r;
+        if(results)
+            results[i] = r;
+    }
+    return first;
+}
+
+
+// Single device calls
+int usmc_dev_serial(usmc_ctx* ctx, int device, char* serial, size_t len) {
+    USMC_Device* dev = handle(ctx, device);
+    if(NULL == dev)
+        return ERR_INVALID_ID;
+    if(NULL == serial || 0 == len)
+        return ERR_INVALID_PARAM;
+    std::string s;
+    if(ctx->record) {
+        int r = ctx->usmc->getSerialNumber(device, s);
+        if(r < 0)
+            return r;
+    } else {
+        s = dev->serial();
+    }
+    memset(serial, 0, len);
+    strncpy(serial, s.c_str(), len - 1);
+    return ERR_SUCCESS;
+}
+
+int usmc_dev_version(usmc_ctx* ctx, int device, uint32_t* version) {
+    USMC_Device* dev = handle(ctx, device);
+    if(NULL == dev)
+        return ERR_INVALID_ID;
+    if(NULL == version)
+        return ERR_INVALID_PARAM;
+    if(ctx->record)
+        return ctx->usmc->getVersion(device, *version);
+    *version = dev->version();
+    return ERR_SUCCESS;
+}
+
+int usmc_dev_get_state(usmc_ctx* ctx, int device, usmc_state* state) {
+    return usmc_ctx_poll_states(ctx, &device, 1, state, NULL);
+}
+
+int usmc_dev_get_encoder_state(usmc_ctx* ctx, int device, usmc_encoder_state* state) {
+    return usmc_ctx_poll_encoders(ctx, &device, 1, state, NULL);
+}
+
+int usmc_dev_get_mode(usmc_ctx* ctx, int device, usmc_mode* mode) {
+    USMC_Device* dev = handle(ctx, device);
+    if(NULL == dev)
+        return ERR_INVALID_ID;
+    if(NULL == mode)
+        return ERR_INVALID_PARAM;
+    USMC_Mode m;
+    if(ctx->record) {
+        int r = ctx->usmc->getMode(device, &m);
+        if(r < 0)
+            return r;
+    } else {
+        dev->getMode(m);
+    }
+    convert_mode(m, mode);
+    return ERR_SUCCESS;
+}
+
+int usmc_dev_set_mode(usmc_ctx* ctx, int device, const usmc_mode* mode) {
+    if(NULL == handle(ctx, device))
+        return ERR_INVALID_ID;
+    if(NULL == mode)
+        return ERR_INVALID_PARAM;
+    USMC_Mode m;
+    convert_mode(mode, m);
+    return ctx->usmc->setMode(device, &m);
+}
+
+int usmc_dev_get_parameters(usmc_ctx* ctx, int device, usmc_parameters* parameters) {
+    USMC_Device* dev = handle(ctx, device);
+    if(NULL == dev)
+        return ERR_INVALID_ID;
+    if(NULL == parameters)
+        return ERR_INVALID_PARAM;
+    USMC_Parameters p;
+    if(ctx->record) {
+        int r = ctx->usmc->getParameters(device, &p);
+        if(r < 0)
+            return r;
+    } else {
+        dev->getParameters(p);
+    }
+    convert_parameters(p, parameters);
+    return ERR_SUCCESS;
+}
+
+int usmc_dev_set_parameters(usmc_ctx* ctx, int device, const usmc_parameters* parameters) {
+    if(NULL == handle(ctx, device))
+        return ERR_INVALID_ID;
+    if(NULL == parameters)
+        return ERR_INVALID_PARAM;
+    USMC_Parameters p;
+    convert_parameters(parameters, p);
+    return ctx->usmc->setParameters(device, &p);
+}
+
+int usmc_dev_get_start_parameters(usmc_ctx* ctx, int device, usmc_start_parameters* start_params) {
+    USMC_Device* dev = handle(ctx, device);
+    if(NULL == dev)
+        return ERR_INVALID_ID;
+    if(NULL == start_params)
+        return ERR_INVALID_PARAM;
+    USMC_StartParameters s;
+    if(ctx->record) {
+        int r = ctx->usmc->getStartParameters(device, &s);
+        if(r < 0)
+            return r;
+    } else {
+        dev->getStartParameters(s);
+    }
+    convert_start(s, start_params);
+    return ERR_SUCCESS;
+}
+
+int usmc_dev_set_start_parameters(usmc_ctx* ctx, int device, const usmc_start_parameters* start_params) {
+    USMC_Device* dev = handle(ctx, device);
+    if(NULL == dev)
+        return ERR_INVALID_ID;
+    if(NULL == start_params)
+        return ERR_INVALID_PARAM;
+    USMC_StartParameters s;
+    convert_start(start_params, s);
+    if(ctx->record)
+        return ctx->usmc->setStartParameters(device, &s);
+    return dev->setStartParameters(&s);
+}
+
+int usmc_dev_get_speed(usmc_ctx* ctx, int device, float* speed) {
+    USMC_Device* dev = handle(ctx, device);
+    if(NULL == dev)
+        return ERR_INVALID_ID;
+    if(NULL == speed)
+        return ERR_INVALID_PARAM;
+    if(ctx->record)
+        return ctx->usmc->getSpeed(device, *speed);
+    *speed = dev->speed();
+    return ERR_SUCCESS;
+}
+
+int usmc_dev_set_speed(usmc_ctx* ctx, int device, float speed) {
+    return usmc_ctx_set_speeds(ctx, &device, 1, &speed, NULL);
+}
+
+int usmc_dev_move(usmc_ctx* ctx, int device, int32_t destination) {
+    return usmc_ctx_move(ctx, &device, 1, &destination, NULL);
+}
+
+int usmc_dev_stop(usmc_ctx* ctx, int device) {
+    return usmc_ctx_stop(ctx, &device, 1, NULL);
+}
+
+int usmc_dev_set_position(usmc_ctx* ctx, int device, int32_t position) {
+    if(NULL == handle(ctx, device))
+        return ERR_INVALID_ID;
+    return ctx->usmc->setCurrentPosition(device, position);
+}
+
+}
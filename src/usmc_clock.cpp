@@ -0,0 +1,76 @@
+/***************************************************//**
+ * @file    usmc_clock.cpp
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#include <time.h>
+#include <errno.h>
+#include <usmc_clock.h>
+
+
+// Installed clock (NULL - system clock)
+static USMC_clock* _usmc_clock = NULL;
+
+
+// Install clock
+void usmc_set_clock(USMC_clock* clock) {
+    __atomic_store_n(&_usmc_clock, clock, __ATOMIC_RELEASE);
+}
+
+
+// Get monotonic time
+uint64_t usmc_time_us() {
+    USMC_clock* clock = __atomic_load_n(&_usmc_clock, __ATOMIC_ACQUIRE);
+    if(clock)
+        return clock->now_us();
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000ULL + uint64_t(ts.tv_nsec) / 1000ULL;
+}
+
+
+// Wall-clock time of a library time
+uint64_t usmc_wall_time_us(uint64_t time) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t wall = uint64_t(ts.tv_sec) * 1000000ULL + uint64_t(ts.tv_nsec) / 1000ULL;
+    return wall - usmc_time_us() + time;
+}
+
+
+// Sleep
+void usmc_sleep_us(uint64_t us) {
+    USMC_clock* clock = __atomic_load_n(&_usmc_clock, __ATOMIC_ACQUIRE);
+    if(clock) {
+        clock->sleep_us(us);
+        return;
+    }
+
+    struct timespec ts;
+    ts.tv_sec = us / 1000000ULL;
+    ts.tv_nsec = (us % 1000000ULL) * 1000ULL;
+    while(nanosleep(&ts, &ts) == -1 && errno == EINTR);
+}
@@ -0,0 +1,454 @@
+/***************************************************//**
+ * @file    usmc_cycle.cpp
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <usmc_cycle.h>
+#include <usmc_clock.h>
+#include <libusmc_impl.h>
+
+// Bytes on the bus of each request (setup packet and payload)
+#define CYCLE_SETUP_BYTES     8
+#define CYCLE_GOTO_BYTES      (CYCLE_SETUP_BYTES + 3)
+#define CYCLE_STOP_BYTES      CYCLE_SETUP_BYTES
+#define CYCLE_STATE_BYTES     (CYCLE_SETUP_BYTES + int(sizeof(STATE_PACKET)))
+#define CYCLE_MODE_BYTES      (CYCLE_SETUP_BYTES + 3)
+#define CYCLE_PARAMS_BYTES    (CYCLE_SETUP_BYTES + 0x35)
+
+
+// Constructor
+USMC_Cyclic::USMC_Cyclic(USMC* usmc) : _usmc(usmc), _slots(NULL), _requests(NULL), _cycle(0), _period(5000), _callback(NULL), _user(NULL), _started(false), _stop(false) {
+    resetStats();
+}
+
+// Destructor
+USMC_Cyclic::~USMC_Cyclic() {
+    stop();
+}
+
+// Slot of a device
+int USMC_Cyclic::slot(int device)const {
+    std::vector<int>::const_iterator it = std::lower_bound(_devices.begin(), _devices.end(), device);
+    if(it == _devices.end() || *it != device)
+        return -1;
+    return int(it - _devices.begin());
+}
+
+// Add a device
+int USMC_Cyclic::addDevice(int device) {
+    if(_started)
+        return ERR_USB_BUSY;
+    if(device < 0 || device >= int(_usmc->countDevices()))
+        return ERR_INVALID_ID;
+    if(slot(device) >= 0)
+        return ERR_SUCCESS;
+
+    USMC_Device handle;
+    int r = _usmc->getDevice(device, &handle);
+    if(r < 0)
+        return r;
+
+    // Keep the devices sorted, so the access locks are taken in order
+    std::vector<int>::iterator it = std::lower_bound(_devices.begin(), _devices.end(), device);
+    size_t i = it - _devices.begin();
+    _devices.insert(it, device);
+    _handles.insert(_handles.begin() + i, handle);
+
+    output o;
+    memset(&o, 0, sizeof(output));
+    o.command = USMC_EXCHANGE_NONE;
+    _pending.insert(_pending.begin() + i, o);
+    _active.insert(_active.begin() + i, o);
+
+    USMC_State state;
+    memset(&state, 0, sizeof(USMC_State));
+    _states.insert(_states.begin() + i, state);
+    _state_results.insert(_state_results.begin() + i, ERR_USB_NOT_FOUND);
+    _command_results.insert(_command_results.begin() + i, ERR_SUCCESS);
+    return ERR_SUCCESS;
+}
+
+// Set period
+int USMC_Cyclic::setPeriod(uint32_t us) {
+    if(_started)
+        return ERR_USB_BUSY;
+    if(us < 100)
+        return ERR_INVALID_VALUE;
+    _period = us;
+    return ERR_SUCCESS;
+}
+
+// Set callback
+int USMC_Cyclic::setCallback(USMC_CycleFn callback, void* user) {
+    if(_started)
+        return ERR_USB_BUSY;
+    _callback = callback;
+    _user = user;
+    return ERR_SUCCESS;
+}
+
+// Add a sink
+int USMC_Cyclic::addSink(USMC_CycleSink* sink) {
+    if(_started)
+        return ERR_USB_BUSY;
+    if(NULL == sink)
+        return ERR_INVALID_PARAM;
+    _sinks.push_back(sink);
+    return ERR_SUCCESS;
+}
+
+// Start the cycle
+int USMC_Cyclic::start() {
+    if(_started)
+        return ERR_USB_BUSY;
+    if(_devices.empty())
+        return ERR_INVALID_PARAM;
+
+    // Exchange buffers
+    size_t n = _devices.size();
+    _slots = new USMC_ExchangeSlot[n];
+    _requests = new USMC_TransferRequest[4 * n];
+    for(size_t i = 0; i < n; i++) {
+        memset(&_slots[i], 0, sizeof(USMC_ExchangeSlot));
+        _slots[i].dev = _handles[i]._dev;
+    }
+
+    {
+        USMC_write_lock image_lock(&_image_lock);
+        _cycle = 0;
+        for(size_t i = 0; i < n; i++) {
+            _state_results[i] = ERR_USB_NOT_FOUND;
+            _command_results[i] = ERR_SUCCESS;
+        }
+    }
+    resetStats();
+
+    _stop = false;
+    if(pthread_create(&_thread, NULL, USMC_Cyclic::thread_main, this)) {
+        delete[] _slots;
+        delete[] _requests;
+        _slots = NULL;
+        _requests = NULL;
+        return ERR_USB_NO_MEM;
+    }
+    _started = true;
+    return ERR_SUCCESS;
+}
+
+// Stop the cycle
+void USMC_Cyclic::stop() {
+    if(!_started)
+        return;
+    _stop = true;
+    pthread_join(_thread, NULL);
+    _started = false;
+
+    delete[] _slots;
+    delete[] _requests;
+    _slots = NULL;
+    _requests = NULL;
+
+    USMC_lock lock(&_lock);
+    for(size_t i = 0; i < _pending.size(); i++) {
+        memset(&_pending[i], 0, sizeof(output));
+        _pending[i].command = USMC_EXCHANGE_NONE;
+    }
+}
+
+// Read the process image
+int USMC_Cyclic::getState(int device, USMC_State* state, uint64_t* cycle) {
+    int i = slot(device);
+    if(i < 0)
+        return ERR_INVALID_ID;
+    if(NULL == state)
+        return ERR_INVALID_PARAM;
+    USMC_read_lock image_lock(&_image_lock);
+    *state = _states[i];
+    if(cycle)
+        *cycle = _cycle;
+    return _state_results[i];
+}
+
+// Result of the last commands
+int USMC_Cyclic::getCommandResult(int device) {
+    int i = slot(device);
+    if(i < 0)
+        return ERR_INVALID_ID;
+    USMC_read_lock image_lock(&_image_lock);
+    return _command_results[i];
+}
+
+// Queue a move
+int USMC_Cyclic::moveTo(int device, int destination) {
+    int i = slot(device);
+    if(i < 0)
+        return ERR_INVALID_ID;
+    USMC_lock lock(&_lock);
+    _pending[i].command = USMC_EXCHANGE_MOVE;
+    _pending[i].destination = destination;
+    return ERR_SUCCESS;
+}
+
+// Queue a stop
+int USMC_Cyclic::stopDevice(int device) {
+    int i = slot(device);
+    if(i < 0)
+        return ERR_INVALID_ID;
+    USMC_lock lock(&_lock);
+    _pending[i].command = USMC_EXCHANGE_STOP;
+    return ERR_SUCCESS;
+}
+
+// Queue a speed change
+int USMC_Cyclic::setSpeed(int device, float speed) {
+    int i = slot(device);
+    if(i < 0)
+        return ERR_INVALID_ID;
+    if(speed < 16.0f || speed > 5000.0f)
+        return ERR_INVALID_VALUE;
+    USMC_lock lock(&_lock);
+    _pending[i].speed_set = true;
+    _pending[i].speed = speed;
+    return ERR_SUCCESS;
+}
+
+// Queue a change of the start parameters
+int USMC_Cyclic::setStartParameters(int device, const USMC_StartParameters* start_params) {
+    int i = slot(device);
+    if(i < 0)
+        return ERR_INVALID_ID;
+    if(NULL == start_params)
+        return ERR_INVALID_PARAM;
+    USMC_lock lock(&_lock);
+    _pending[i].start_set = true;
+    _pending[i].start_params = *start_params;
+    return ERR_SUCCESS;
+}
+
+// Queue a change of the mode
+int USMC_Cyclic::setMode(int device, const USMC_Mode* mode) {
+    int i = slot(device);
+    if(i < 0)
+        return ERR_INVALID_ID;
+    if(NULL == mode)
+        return ERR_INVALID_PARAM;
+    USMC_lock lock(&_lock);
+    _pending[i].mode_set = true;
+    _pending[i].mode = *mode;
+    return ERR_SUCCESS;
+}
+
+// Queue a change of the parameters
+int USMC_Cyclic::setParameters(int device, const USMC_Parameters* parameters) {
+    int i = slot(device);
+    if(i < 0)
+        return ERR_INVALID_ID;
+    if(NULL == parameters)
+        return ERR_INVALID_PARAM;
+    USMC_lock lock(&_lock);
+    _pending[i].params_set = true;
+    _pending[i].params = *parameters;
+    return ERR_SUCCESS;
+}
+
+// Get statistics
+void USMC_Cyclic::getStats(USMC_CycleStats* stats) {
+    if(NULL == stats)
+        return;
+    USMC_lock stats_lock(&_stats_lock);
+    *stats = _stats;
+    stats->period = _period;
+    if(_stats.cycles > 0) {
+        double n = double(_stats.cycles);
+        stats->jitter = sqrt(_sum_jitter2 / n);
+        stats->mean_exchange = _sum_exchange / n;
+        stats->bus_load = stats->mean_exchange / double(_period);
+        stats->transfers = _sum_transfers / n;
+        stats->bytes = _sum_bytes / n;
+    }
+    if(_stats.cycles > 1)
+        stats->mean_period = double(_last_start - _first_start) / double(_stats.cycles - 1);
+}
+
+// Reset statistics
+void USMC_Cyclic::resetStats() {
+    USMC_lock stats_lock(&_stats_lock);
+    memset(&_stats, 0, sizeof(USMC_CycleStats));
+    _first_start = 0;
+    _last_start = 0;
+    _sum_jitter2 = 0.0;
+    _sum_exchange = 0.0;
+    _sum_transfers = 0.0;
+    _sum_bytes = 0.0;
+}
+
+// Thread entry point
+void* USMC_Cyclic::thread_main(void* arg) {
+    reinterpret_cast<USMC_Cyclic*>(arg)->run();
+    return NULL;
+}
+
+// Cycle loop
+void USMC_Cyclic::run() {
+    size_t n = _devices.size();
+    USMC_impl* impl = _handles[0]._impl;
+    uint64_t next = usmc_time_us();
+
+    while(!_stop) {
+        // Wait for the cycle start
+        uint64_t now = usmc_time_us();
+        if(now < next) {
+            usmc_sleep_us(next - now);
+            now = usmc_time_us();
+        }
+        uint64_t start = now;
+        double delay = now > next ? double(now - next) : 0.0;
+
+        // Latch the pending commands
+        {
+            USMC_lock lock(&_lock);
+            for(size_t i = 0; i < n; i++) {
+                _active[i] = _pending[i];
+                _pending[i].command = USMC_EXCHANGE_NONE;
+                _pending[i].speed_set = false;
+                _pending[i].start_set = false;
+                _pending[i].mode_set = false;
+                _pending[i].params_set = false;
+            }
+        }
+
+        // Local settings, then the pipelined configuration writes, commands
+        // and state reads
+        int transfers = 0;
+        int bytes = 0;
+        uint64_t errors = 0;
+        for(size_t i = 0; i < n; i++) {
+            output& o = _active[i];
+            int r = ERR_SUCCESS;
+            if(o.start_set)
+                r = _handles[i].setStartParameters(&o.start_params);
+            if(r == ERR_SUCCESS && o.speed_set)
+                r = _handles[i].setSpeed(o.speed);
+
+            bool ok = (r == ERR_SUCCESS);
+            _slots[i].mode = (ok && o.mode_set) ? &o.mode : NULL;
+            _slots[i].params = (ok && o.params_set) ? &o.params : NULL;
+            _slots[i].command = ok ? o.command : USMC_EXCHANGE_NONE;
+            _slots[i].destination = o.destination;
+            _slots[i].command_result = r;
+        }
+
+        uint64_t exchange_start = usmc_time_us();
+        impl->device_exchange(_slots, n, _requests);
+        uint64_t exchange_end = usmc_time_us();
+
+        // Publish the process image
+        uint64_t cycle;
+        {
+            USMC_write_lock image_lock(&_image_lock);
+            cycle = ++_cycle;
+            for(size_t i = 0; i < n; i++) {
+                USMC_ExchangeSlot& s = _slots[i];
+                // A failed configuration write takes precedence over the command
+                int result = s.config_result < 0 ? s.config_result : s.command_result;
+                if(s.command != USMC_EXCHANGE_NONE || _active[i].mode_set || _active[i].params_set || _active[i].start_set || _active[i].speed_set)
+                    _command_results[i] = result;
+                _state_results[i] = s.state_result;
+                if(s.state_result == ERR_SUCCESS)
+                    _states[i] = s.state;
+
+                if(result < 0)
+                    errors++;
+                if(s.state_result < 0)
+                    errors++;
+                // Invalid parameters leave only the state read on the bus
+                bool cancelled = (s.config_result == ERR_INVALID_VALUE);
+                if(!cancelled && s.mode) {
+                    transfers++;
+                    bytes += CYCLE_MODE_BYTES;
+                }
+                if(!cancelled && s.params) {
+                    transfers++;
+                    bytes += CYCLE_PARAMS_BYTES;
+                }
+                if(!cancelled && s.command == USMC_EXCHANGE_MOVE && s.command_result != ERR_INTERLOCK) {
+                    transfers++;
+                    bytes += CYCLE_GOTO_BYTES;
+                } else if(!cancelled && s.command == USMC_EXCHANGE_STOP) {
+                    transfers++;
+                    bytes += CYCLE_STOP_BYTES;
+                }
+                transfers++;
+                bytes += CYCLE_STATE_BYTES;
+            }
+        }
+
+        // Feed the sinks with the states read in this cycle
+        for(size_t j = 0; j < _sinks.size(); j++) {
+            for(size_t i = 0; i < n; i++) {
+                if(_slots[i].state_result == ERR_SUCCESS)
+                    _sinks[j]->push(_devices[i], exchange_end, _slots[i].state);
+            }
+        }
+
+        if(_callback)
+            _callback(_user, cycle);
+        uint64_t end = usmc_time_us();
+
+        // Schedule the next cycle, skipping the starts already passed
+        next += _period;
+        uint64_t missed = 0;
+        if(end > next) {
+            missed = (end - next) / _period + 1;
+            next += missed * _period;
+        }
+
+        // Statistics
+        {
+            USMC_lock stats_lock(&_stats_lock);
+            double exchange = double(exchange_end - exchange_start);
+            if(_stats.cycles == 0)
+                _first_start = start;
+            _last_start = start;
+            _stats.cycles++;
+            if(missed) {
+                _stats.overruns++;
+                _stats.missed += missed;
+            }
+            _stats.errors += errors;
+            _sum_jitter2 += delay * delay;
+            if(delay > _stats.max_jitter)
+                _stats.max_jitter = delay;
+            _sum_exchange += exchange;
+            if(exchange > _stats.max_exchange)
+                _stats.max_exchange = exchange;
+            _sum_transfers += transfers;
+            _sum_bytes += bytes;
+        }
+    }
+}
@@ -0,0 +1,74 @@
+/***************************************************//**
+ * @file    usmc_device.cpp
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#include <usmc_device.h>
+#include <libusmc_impl.h>
+
+
+// Set speed
+int USMC_Device::setSpeed(float speed) {
+    if(NULL == _dev)
+        return ERR_INVALID_ID;
+    return _impl->device_set_speed(*_dev, speed);
+}
+
+// Set move parameters
+int USMC_Device::setStartParameters(const USMC_StartParameters* start_params) {
+    if(NULL == _dev)
+        return ERR_INVALID_ID;
+    return _impl->device_set_start_parameters(*_dev, start_params);
+}
+
+// Get device state
+int USMC_Device::getState(USMC_State* state) {
+    if(NULL == _dev)
+        return ERR_INVALID_ID;
+    return _impl->device_get_state(*_dev, state);
+}
+
+// Get encoder state
+int USMC_Device::getEncoderState(USMC_EncoderState* state) {
+    if(NULL == _dev)
+        return ERR_INVALID_ID;
+    if(NULL == state)
+        return ERR_INVALID_PARAM;
+    return _impl->usmc_get_encoder_state(*_dev, *state);
+}
+
+// Move device to position
+int USMC_Device::moveTo(int destination) {
+    if(NULL == _dev)
+        return ERR_INVALID_ID;
+    return _impl->device_move(*_dev, destination);
+}
+
+// Stop device
+int USMC_Device::stop() {
+    if(NULL == _dev)
+        return ERR_INVALID_ID;
+    return _impl->usmc_stop(*_dev);
+}
@@ -0,0 +1,242 @@
+/***************************************************//**
+ * @file    usmc_fault.cpp
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#include <cstring>
+#include <libusmc.h>
+#include <usmc_clock.h>
+#include <usmc_fault.h>
+
+
+// Fault transport constructor
+USMC_fault_transport::USMC_fault_transport(USMC_transport* transport) : _transport(transport), _enabled(true) {
+    defaults(&_config);
+    _state = _config.seed;
+    memset(&_stats, 0, sizeof(USMC_FaultStats));
+}
+
+// Fault transport destructor
+USMC_fault_transport::~USMC_fault_transport() {
+    for(size_t i = 0; i < _devices.size(); i++)
+        delete _devices[i];
+    _devices.clear();
+}
+
+// Default configuration
+void USMC_fault_transport::defaults(USMC_FaultConfig* config) {
+    memset(config, 0, sizeof(USMC_FaultConfig));
+    config->request = -1;
+    config->seed = 0x2545F4914F6CDD1DULL;
+}
+
+// Configure faults
+void USMC_fault_transport::configure(const USMC_FaultConfig& config) {
+    USMC_lock l(&_lock);
+    _config = config;
+    if(_config.latency_max < _config.latency_min)
+        _config.latency_max = _config.latency_min;
+    _state = _config.seed ? _config.seed : 1;
+}
+
+// Enable fault injection
+void USMC_fault_transport::enable(bool en) {
+    USMC_lock l(&_lock);
+    _enabled = en;
+}
+
+// Disconnect device
+int USMC_fault_transport::disconnect(int device) {
+    USMC_lock l(&_lock);
+    if(device < 0 || device >= int(_devices.size()) || NULL == _devices[device])
+        return ERR_INVALID_ID;
+    if(!_devices[device]->gone)
+        _stats.disappeared++;
+    _devices[device]->gone = true;
+    _devices[device]->pending = false;
+    return ERR_SUCCESS;
+}
+
+// Reconnect device
+int USMC_fault_transport::reconnect(int device) {
+    USMC_lock l(&_lock);
+    if(device < 0 || device >= int(_devices.size()) || NULL == _devices[device])
+        return ERR_INVALID_ID;
+    _devices[device]->gone = false;
+    _devices[device]->pending = false;
+    return ERR_SUCCESS;
+}
+
+// Get counters
+void USMC_fault_transport::getStats(USMC_FaultStats* stats) {
+    USMC_lock l(&_lock);
+    memcpy(stats, &_stats, sizeof(USMC_FaultStats));
+}
+
+// Reset counters
+void USMC_fault_transport::resetStats() {
+    USMC_lock l(&_lock);
+    memset(&_stats, 0, sizeof(USMC_FaultStats));
+}
+
+// Random number (xorshift64*, called with the lock held)
+double USMC_fault_transport::random() {
+    _state ^= _state >> 12;
+    _state ^= _state << 25;
+    _state ^= _state >> 27;
+    return double((_state * 0x2545F4914F6CDD1DULL) >> 11) / 9007199254740992.0;
+}
+
+// Draw a fault (called with the lock held)
+bool USMC_fault_transport::happens(double probability) {
+    return probability > 0.0 && random() < probability;
+}
+
+// Open devices of the wrapped transport
+int USMC_fault_transport::open(std::vector<void*>& handles, void (*logger)(const char*, ...)) {
+    std::vector<void*> inner;
+    int r = _transport->open(inner, logger);
+    if(r < 0)
+        return r;
+
+    USMC_lock l(&_lock);
+    for(size_t i = 0; i < inner.size(); i++) {
+        device* dev = new device;
+        dev->handle = inner[i];
+        dev->gone = false;
+        dev->pending = false;
+        dev->gone_at = 0;
+        _devices.push_back(dev);
+        handles.push_back(dev);
+    }
+    return 0;
+}
+
+// Close device
+void USMC_fault_transport::close(void* handle) {
+    device* dev = static_cast<device*>(handle);
+    _transport->close(dev->handle);
+
+    // Keep the slot, so the indexes of the other devices do not change
+    USMC_lock l(&_lock);
+    for(size_t i = 0; i < _devices.size(); i++) {
+        if(_devices[i] == dev) {
+            _devices[i] = NULL;
+            break;
+        }
+    }
+    delete dev;
+}
+
+// Control transfer with faults
+int USMC_fault_transport::control_transfer(void* handle, uint8_t bRequestType, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, uint8_t* data, uint16_t wLength, unsigned int timeout) {
+    device* dev = static_cast<device*>(handle);
+    uint32_t latency = 0;
+    int fault = ERR_SUCCESS;
+    bool short_read = false;
+    bool disappear = false;
+
+    {
+        USMC_lock l(&_lock);
+        _stats.transfers++;
+
+        // Device already gone
+        if(dev->pending && usmc_time_us() >= dev->gone_at) {
+            dev->pending = false;
+            dev->gone = true;
+            _stats.disappeared++;
+        }
+        if(dev->gone) {
+            _stats.no_device++;
+            return ERR_USB_NO_DEVICE;
+        }
+
+        if(_enabled && (_config.request < 0 || _config.request == bRequest)) {
+            // Added latency
+            if(_config.latency_max > 0)
+                latency = _config.latency_min + uint32_t(random() * (_config.latency_max - _config.latency_min));
+            _stats.latency += latency;
+
+            // Errors
+            if(happens(_config.timeout)) {
+                fault = ERR_USB_TIMEOUT;
+                _stats.timeouts++;
+            } else if(happens(_config.no_device)) {
+                fault = ERR_USB_NO_DEVICE;
+                _stats.no_device++;
+            } else if(happens(_config.pipe)) {
+                fault = ERR_USB_PIPE;
+                _stats.pipe++;
+            } else if((bRequestType & USMC_ENDPOINT_IN) && happens(_config.short_read)) {
+                short_read = true;
+            }
+
+            // Device lost during the move
+            if(fault == ERR_SUCCESS && bRequest == 0x80 && !dev->pending)
+                disappear = happens(_config.disappear);
+        }
+    }
+
+    if(latency > 0)
+        usmc_sleep_us(latency);
+
+    // A timeout blocks the caller for the whole transfer timeout
+    if(fault == ERR_USB_TIMEOUT) {
+        usmc_sleep_us(uint64_t(timeout) * 1000);
+        return fault;
+    }
+    if(fault < 0)
+        return fault;
+
+    int res = _transport->control_transfer(dev->handle, bRequestType, bRequest, wValue, wIndex, data, wLength, timeout);
+
+    if(res > 0 && short_read) {
+        USMC_lock l(&_lock);
+        res = int(random() * res);
+        _stats.short_reads++;
+    }
+    if(res >= 0 && disappear) {
+        USMC_lock l(&_lock);
+        dev->pending = true;
+        dev->gone_at = usmc_time_us() + _config.disappear_delay;
+    }
+    return res;
+}
+
+// Error description
+const char* USMC_fault_transport::strerror(int error) {
+    return _transport->strerror(error);
+}
+
+// Location of the wrapped device
+std::string USMC_fault_transport::path(void* handle) {
+    device* dev = static_cast<device*>(handle);
+    return _transport->path(dev->handle);
+}
+
+// Clock of the wrapped transport
+USMC_clock* USMC_fault_transport::clock() {
+    return _transport->clock();
+}
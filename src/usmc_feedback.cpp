@@ -0,0 +1,293 @@
+/***************************************************//**
+ * @file    usmc_feedback.cpp
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#include <cstring>
+#include <cmath>
+#include <usmc_feedback.h>
+#include <usmc_clock.h>
+
+
+// Constructor
+USMC_FeedbackLoop::USMC_FeedbackLoop(USMC* usmc) : _usmc(usmc), _sensor(NULL), _user(NULL), _started(false), _stop(false) {
+    memset(&_config, 0, sizeof(USMC_FeedbackConfig));
+    memset(&_stats, 0, sizeof(USMC_FeedbackStats));
+}
+
+// Destructor
+USMC_FeedbackLoop::~USMC_FeedbackLoop() {
+    stop();
+}
+
+// Default configuration
+void USMC_FeedbackLoop::defaults(USMC_FeedbackConfig* config) {
+    memset(config, 0, sizeof(USMC_FeedbackConfig));
+    config->naxes = 1;
+    for(int i = 0; i < USMC_MAX_FB_AXES; i++) {
+        config->device[i] = i;
+        config->kp[i] = 1.0;
+        config->speed[i] = 1000.0f;
+    }
+    config->period_us = 10000;
+}
+
+// Start the loop
+int USMC_FeedbackLoop::start(const USMC_FeedbackConfig& config, USMC_SensorFn sensor, void* user) {
+    if(_started)
+        return ERR_USB_BUSY;
+    if(NULL == sensor)
+        return ERR_INVALID_PARAM;
+    if(config.naxes < 1 || config.naxes > USMC_MAX_FB_AXES || config.period_us < 100)
+        return ERR_INVALID_VALUE;
+    for(int k = 0; k < config.naxes; k++) {
+        if(config.device[k] < 0 || config.device[k] >= int(_usmc->countDevices()))
+            return ERR_INVALID_ID;
+        if(config.deadband[k] < 0.0 || config.integral_limit[k] < 0.0 || config.max_step[k] < 0)
+            return ERR_INVALID_VALUE;
+        if(config.speed[k] < 16.0f || config.speed[k] > 5000.0f)
+            return ERR_INVALID_VALUE;
+    }
+
+    // Handles, origin and correction speed
+    for(int k = 0; k < config.naxes; k++) {
+        int r = _usmc->getDevice(config.device[k], &_handles[k]);
+        if(r < 0)
+            return r;
+        USMC_State state;
+        r = _handles[k].getState(&state);
+        if(r < 0)
+            return r;
+        _origin[k] = state.CurPos;
+    }
+    for(int k = 0; k < config.naxes; k++) {
+        _saved_speed[k] = _handles[k].speed();
+        int r = _handles[k].setSpeed(config.speed[k]);
+        if(r < 0) {
+            for(int j = 0; j < k; j++)
+                _handles[j].setSpeed(_saved_speed[j]);
+            return r;
+        }
+    }
+
+    _config = config;
+    _sensor = sensor;
+    _user = user;
+    {
+        USMC_lock lock(&_lock);
+        memset(&_stats, 0, sizeof(USMC_FeedbackStats));
+        for(int k = 0; k < config.naxes; k++)
+            _stats.target[k] = _origin[k];
+        _stats.running = true;
+        _start_time = usmc_time_us();
+        _last_time = _start_time;
+        _sum_sensor = 0.0;
+        _sum_latency = 0.0;
+        _latency_count = 0;
+        memset(_sum_error2, 0, sizeof(_sum_error2));
+    }
+
+    _stop = false;
+    if(pthread_create(&_thread, NULL, USMC_FeedbackLoop::thread_main, this)) {
+        for(int k = 0; k < config.naxes; k++)
+            _handles[k].setSpeed(_saved_speed[k]);
+        USMC_lock lock(&_lock);
+        _stats.running = false;
+        return ERR_USB_NO_MEM;
+    }
+    _started = true;
+    return ERR_SUCCESS;
+}
+
+// Stop the loop
+int USMC_FeedbackLoop::stop() {
+    if(!_started) {
+        USMC_lock lock(&_lock);
+        return _stats.result;
+    }
+    _stop = true;
+    pthread_join(_thread, NULL);
+    _started = false;
+
+    // Stop the axes and restore their speed
+    for(int k = 0; k < _config.naxes; k++) {
+        _handles[k].stop();
+        _handles[k].setSpeed(_saved_speed[k]);
+    }
+
+    USMC_lock lock(&_lock);
+    return _stats.result;
+}
+
+// Get statistics
+void USMC_FeedbackLoop::getStats(USMC_FeedbackStats* stats) {
+    if(NULL == stats)
+        return;
+    USMC_lock lock(&_lock);
+    *stats = _stats;
+    if(_stats.iterations > 0) {
+        double n = double(_stats.iterations);
+        uint64_t elapsed = _last_time - _start_time;
+        if(elapsed > 0)
+            stats->rate = n * 1e6 / double(elapsed);
+        stats->mean_sensor = _sum_sensor / n;
+        uint64_t samples = _stats.iterations - _stats.no_data;
+        for(int k = 0; k < _config.naxes && samples > 0; k++)
+            stats->rms_error[k] = sqrt(_sum_error2[k] / double(samples));
+    }
+    if(_latency_count > 0)
+        stats->mean_latency = _sum_latency / double(_latency_count);
+}
+
+// Thread entry point
+void* USMC_FeedbackLoop::thread_main(void* arg) {
+    USMC_FeedbackLoop* loop = reinterpret_cast<USMC_FeedbackLoop*>(arg);
+    int r = loop->run();
+
+    USMC_lock lock(&(loop->_lock));
+    loop->_stats.result = r;
+    loop->_stats.running = false;
+    return NULL;
+}
+
+// Loop
+int USMC_FeedbackLoop::run() {
+    int n = _config.naxes;
+    double error[USMC_MAX_FB_AXES];
+    double integral[USMC_MAX_FB_AXES];
+    double previous[USMC_MAX_FB_AXES];
+    int target[USMC_MAX_FB_AXES];
+    for(int k = 0; k < n; k++) {
+        integral[k] = 0.0;
+        previous[k] = 0.0;
+        target[k] = _origin[k];
+    }
+    bool have_previous = false;
+    uint64_t last_sample = 0;
+    uint64_t next = usmc_time_us();
+
+    while(!_stop) {
+        // Wait for the next iteration
+        uint64_t now = usmc_time_us();
+        if(now < next) {
+            usmc_sleep_us(next - now);
+            now = usmc_time_us();
+        }
+
+        // Measure
+        memset(error, 0, sizeof(error));
+        int r = _sensor(_user, error, n);
+        uint64_t measured = usmc_time_us();
+        if(r < 0)
+            return r;
+
+        bool sample = (r == 0);
+        int moves = 0;
+        uint64_t deadband = 0;
+        if(sample) {
+            double dt = have_previous ? double(measured - last_sample) * 1e-6 : 0.0;
+            for(int k = 0; k < n; k++) {
+                double e = error[k];
+
+                // Inside the dead-band: no correction and no integration
+                if(fabs(e) < _config.deadband[k]) {
+                    previous[k] = e;
+                    deadband++;
+                    continue;
+                }
+
+                integral[k] += _config.ki[k] * e * dt;
+                double limit = _config.integral_limit[k];
+                if(limit > 0.0)
+                    integral[k] = integral[k] > limit ? limit : (integral[k] < -limit ? -limit : integral[k]);
+                double derivative = (have_previous && dt > 0.0) ? (e - previous[k]) / dt : 0.0;
+                previous[k] = e;
+
+                double u = _config.kp[k] * e + integral[k] + _config.kd[k] * derivative;
+                int desired = _origin[k] + int(floor(u + 0.5));
+
+                // Step and position limits
+                int step = _config.max_step[k];
+                if(step > 0) {
+                    if(desired > target[k] + step)
+                        desired = target[k] + step;
+                    else if(desired < target[k] - step)
+                        desired = target[k] - step;
+                }
+                if(_config.min[k] < _config.max[k])
+                    desired = desired > _config.max[k] ? _config.max[k] : (desired < _config.min[k] ? _config.min[k] : desired);
+
+                // Retarget the axis, even while it is still moving
+                if(desired != target[k]) {
+                    r = _handles[k].moveTo(desired);
+                    if(r < 0)
+                        return r;
+                    target[k] = desired;
+                    moves++;
+                }
+            }
+            have_previous = true;
+            last_sample = measured;
+        }
+        uint64_t sent = usmc_time_us();
+
+        // Schedule the next iteration, skipping the ones already passed
+        next += _config.period_us;
+        bool overrun = false;
+        if(sent > next) {
+            overrun = true;
+            next += ((sent - next) / _config.period_us + 1) * _config.period_us;
+        }
+
+        // Statistics
+        {
+            USMC_lock lock(&_lock);
+            _stats.iterations++;
+            _last_time = sent;
+            _sum_sensor += double(measured - now);
+            if(overrun)
+                _stats.overruns++;
+            if(!sample) {
+                _stats.no_data++;
+                continue;
+            }
+            _stats.deadband += deadband;
+            _stats.corrections += moves;
+            for(int k = 0; k < n; k++) {
+                _sum_error2[k] += error[k] * error[k];
+                _stats.last_error[k] = error[k];
+                _stats.target[k] = target[k];
+            }
+            if(moves) {
+                double latency = double(sent - measured);
+                _sum_latency += latency;
+                _latency_count++;
+                if(latency > _stats.max_latency)
+                    _stats.max_latency = latency;
+            }
+        }
+    }
+    return ERR_SUCCESS;
+}
@@ -0,0 +1,232 @@
+/***************************************************//**
+ * @file    usmc_interlock.cpp
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#include <libusmc.h>
+#include <usmc_interlock.h>
+
+
+// Interlock constructor
+USMC_interlock::USMC_interlock() {
+
+}
+
+
+// Interlock destructor
+USMC_interlock::~USMC_interlock() {
+    clear();
+}
+
+
+// Add tracking for a new axis
+void USMC_interlock::addAxis() {
+    USMC_write_lock config_lock(&_config);
+
+    axis* a = new axis;
+    a->known  = false;
+    a->lo     = 0;
+    a->hi     = 0;
+    a->target = 0;
+    a->seq    = 0;
+    a->nzones = 0;
+    _axes.push_back(a);
+}
+
+
+// Remove all axes and zones
+void USMC_interlock::clear() {
+    USMC_write_lock config_lock(&_config);
+
+    for(size_t i = 0; i < _axes.size(); i++)
+        delete _axes[i];
+    _axes.clear();
+    _zones.clear();
+}
+
+
+// Add an exclusion zone
+int USMC_interlock::addZone(int devA, int minA, int maxA, int devB, int minB, int maxB) {
+    USMC_write_lock config_lock(&_config);
+
+    if(devA < 0 || devA >= int(_axes.size()) || devB < 0 || devB >= int(_axes.size()) || devA == devB)
+        return ERR_INVALID_ID;
+    if(minA > maxA || minB > maxB)
+        return ERR_INVALID_VALUE;
+    if(_axes[devA]->nzones >= USMC_MAX_AXIS_ZONES || _axes[devB]->nzones >= USMC_MAX_AXIS_ZONES)
+        return ERR_INVALID_PARAM;
+
+    zone z;
+    z.dev[0] = devA;
+    z.min[0] = minA;
+    z.max[0] = maxA;
+    z.dev[1] = devB;
+    z.min[1] = minB;
+    z.max[1] = maxB;
+
+    int index = _zones.size();
+    _zones.push_back(z);
+    _axes[devA]->zones[_axes[devA]->nzones++] = index;
+    _axes[devB]->zones[_axes[devB]->nzones++] = index;
+    return index;
+}
+
+
+// Remove all exclusion zones
+void USMC_interlock::clearZones() {
+    USMC_write_lock config_lock(&_config);
+
+    for(size_t i = 0; i < _axes.size(); i++)
+        _axes[i]->nzones = 0;
+    _zones.clear();
+}
+
+
+// Check a move against the zones and reserve its path
+int USMC_interlock::reserve(int device, int destination) {
+    USMC_read_lock config_lock(&_config);
+
+    if(device < 0 || device >= int(_axes.size()))
+        return ERR_INVALID_ID;
+    axis* self = _axes[device];
+
+    // Collect the axes involved, sorted by index to keep a global lock order
+    int ids[USMC_MAX_AXIS_ZONES + 1];
+    int n = 0;
+    ids[n++] = device;
+    for(int i = 0; i < self->nzones; i++) {
+        const zone& z = _zones[self->zones[i]];
+        int other = (z.dev[0] == device) ? z.dev[1] : z.dev[0];
+        int j = n;
+        bool dup = false;
+        for(int k = 0; k < n; k++) {
+            if(ids[k] == other) {
+                dup = true;
+                break;
+            }
+        }
+        if(dup)
+            continue;
+        while(j > 0 && ids[j-1] > other) {
+            ids[j] = ids[j-1];
+            j--;
+        }
+        ids[j] = other;
+        n++;
+    }
+    for(int i = 0; i < n; i++)
+        _axes[ids[i]]->lock.acquire();
+
+    // The axis will sweep from anywhere in its current interval to the destination
+    int lo = (destination < self->lo) ? destination : self->lo;
+    int hi = (destination > self->hi) ? destination : self->hi;
+
+    int ret = ERR_SUCCESS;
+    for(int i = 0; i < self->nzones; i++) {
+        const zone& z = _zones[self->zones[i]];
+        int s = (z.dev[0] == device) ? 0 : 1;
+        axis* other = _axes[z.dev[1-s]];
+
+        // Without a measured position we cannot prove the move is safe
+        if(!self->known || !other->known) {
+            ret = ERR_INTERLOCK;
+            break;
+        }
+        if(overlap(lo, hi, z.min[s], z.max[s]) && overlap(other->lo, other->hi, z.min[1-s], z.max[1-s])) {
+            ret = ERR_INTERLOCK;
+            break;
+        }
+    }
+
+    if(ret == ERR_SUCCESS) {
+        self->lo = lo;
+        self->hi = hi;
+        self->target = destination;
+        self->seq++;
+    }
+
+    for(int i = n - 1; i >= 0; i--)
+        _axes[ids[i]]->lock.release();
+    return ret;
+}
+
+
+// Take a snapshot of the command sequence
+uint32_t USMC_interlock::snapshot(int device) {
+    USMC_read_lock config_lock(&_config);
+
+    if(device < 0 || device >= int(_axes.size()))
+        return 0;
+    USMC_lock axis_lock(&(_axes[device]->lock));
+    return _axes[device]->seq;
+}
+
+
+// Update the axis interval with a measured position
+void USMC_interlock::update(int device, uint32_t seq, int position, bool running) {
+    USMC_read_lock config_lock(&_config);
+
+    if(device < 0 || device >= int(_axes.size()))
+        return;
+    axis* self = _axes[device];
+    USMC_lock axis_lock(&(self->lock));
+
+    // A move was commanded after the state was read: keep its reservation
+    if(seq != self->seq)
+        return;
+
+    if(!running) {
+        // Axis at rest
+        self->lo = self->hi = self->target = position;
+        self->known = true;
+
+    } else if(self->known) {
+        // Axis moving towards the last target
+        self->lo = (position < self->target) ? position : self->target;
+        self->hi = (position > self->target) ? position : self->target;
+    }
+}
+
+
+// Forget the axis position
+void USMC_interlock::invalidate(int device) {
+    USMC_read_lock config_lock(&_config);
+
+    if(device < 0 || device >= int(_axes.size()))
+        return;
+    USMC_lock axis_lock(&(_axes[device]->lock));
+    _axes[device]->known = false;
+    _axes[device]->seq++;
+}
+
+
+// Check if the axis takes part in any exclusion zone
+bool USMC_interlock::involved(int device) {
+    USMC_read_lock config_lock(&_config);
+
+    if(device < 0 || device >= int(_axes.size()))
+        return false;
+    return _axes[device]->nzones > 0;
+}
@@ -0,0 +1,108 @@
+/***************************************************//**
+ * @file    usmc_motion.cpp
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#include <cmath>
+#include <usmc_motion.h>
+#include <usmc_clock.h>
+
+
+// Model constructor
+USMC_MotionModel::USMC_MotionModel() : _speed(200.0f), _accel(200.0f), _decel(200.0f), _slow_start(true), _overhead(0.0) {
+
+}
+
+// Load parameters from device
+int USMC_MotionModel::load(USMC* usmc, int device) {
+    float speed;
+    USMC_Parameters params;
+    USMC_StartParameters start;
+
+    int r = usmc->getSpeed(device, speed);
+    if(r < 0)
+        return r;
+    r = usmc->getParameters(device, &params);
+    if(r < 0)
+        return r;
+    r = usmc->getStartParameters(device, &start);
+    if(r < 0)
+        return r;
+
+    set(speed, params.AccelT, params.DecelT, start.SlStart);
+    return ERR_SUCCESS;
+}
+
+// Set parameters
+void USMC_MotionModel::set(float speed, float accel, float decel, bool slow_start) {
+    _speed = speed;
+    _accel = accel;
+    _decel = decel;
+    _slow_start = slow_start;
+}
+
+// Estimate move duration
+double USMC_MotionModel::moveTime(int distance)const {
+    double d = fabs(double(distance));
+    if(d == 0.0)
+        return 0.0;
+    double v = _speed;
+    if(!_slow_start)
+        return _overhead + d / v;
+
+    // Ramp times and distances
+    double ta = _accel / 1000.0;
+    double td = _decel / 1000.0;
+    double ramp = v * (ta + td) / 2.0;
+
+    if(d >= ramp) {
+        // Trapezoidal profile
+        return _overhead + ta + td + (d - ramp) / v;
+    } else {
+        // Triangular profile, peak speed not reached
+        double peak = sqrt(2.0 * d * v / (ta + td));
+        return _overhead + (ta + td) * peak / v;
+    }
+}
+
+
+// Wait for device to stop
+int usmc_wait_idle(USMC* usmc, int device, uint32_t poll_us, int timeout_ms, USMC_State* state) {
+    uint64_t start = usmc_time_us();
+    USMC_State st;
+    while(true) {
+        int r = usmc->getState(device, &st);
+        if(r < 0)
+            return r;
+        if(!st.RUN)
+            break;
+        if(timeout_ms > 0 && usmc_time_us() - start >= uint64_t(timeout_ms) * 1000ULL)
+            return ERR_USB_TIMEOUT;
+        usmc_sleep_us(poll_us);
+    }
+    if(state)
+        *state = st;
+    return ERR_SUCCESS;
+}
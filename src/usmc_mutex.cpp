@@ -27,11 +27,20 @@
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  *******************************************************/
 
+#include <time.h>
 #include <usmc_mutex.h>
 
 
+// Monotonic time in ns
+static uint64_t mutex_time_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ULL + uint64_t(ts.tv_nsec);
+}
+
+
 // Mutex constructor
-USMC_mutex::USMC_mutex() {
+USMC_mutex::USMC_mutex() : _acquisitions(0), _contended(0), _wait_ns(0), _locked(false) {
     pthread_mutex_init(&_mutex, NULL);
 }
 
@@ -42,11 +51,20 @@ USMC_mutex::~USMC_mutex() {
 
 // Mutex acquire method
 void USMC_mutex::acquire() {
-    pthread_mutex_lock(&_mutex);
+    if(pthread_mutex_trylock(&_mutex) != 0) {
+        // Busy, measure the wait only in this case
+        uint64_t start = mutex_time_ns();
+        pthread_mutex_lock(&_mutex);
+        __atomic_store_n(&_contended, _contended + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&_wait_ns, _wait_ns + (mutex_time_ns() - start), __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&_acquisitions, _acquisitions + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&_locked, true, __ATOMIC_RELAXED);
 }
 
 // Mutex release method
 void USMC_mutex::release() {
+    __atomic_store_n(&_locked, false, __ATOMIC_RELAXED);
     pthread_mutex_unlock(&_mutex);
 }
 
@@ -60,3 +78,50 @@ USMC_lock::USMC_lock(USMC_mutex* mutex) {
 USMC_lock::~USMC_lock() {
     _mutex->release();
 }
+
+// Read/write mutex constructor
+USMC_rwmutex::USMC_rwmutex() {
+    pthread_rwlock_init(&_rwlock, NULL);
+}
+
+// Read/write mutex destructor
+USMC_rwmutex::~USMC_rwmutex() {
+    pthread_rwlock_destroy(&_rwlock);
+}
+
+// Read/write mutex shared acquire method
+void USMC_rwmutex::acquire_read() {
+    pthread_rwlock_rdlock(&_rwlock);
+}
+
+// Read/write mutex exclusive acquire method
+void USMC_rwmutex::acquire_write() {
+    pthread_rwlock_wrlock(&_rwlock);
+}
+
+// Read/write mutex release method
+void USMC_rwmutex::release() {
+    pthread_rwlock_unlock(&_rwlock);
+}
+
+// Read lock constructor
+USMC_read_lock::USMC_read_lock(USMC_rwmutex* mutex) {
+    _mutex = mutex;
+    _mutex->acquire_read();
+}
+
+// Read lock destructor
+USMC_read_lock::~USMC_read_lock() {
+    _mutex->release();
+}
+
+// Write lock constructor
+USMC_write_lock::USMC_write_lock(USMC_rwmutex* mutex) {
+    _mutex = mutex;
+    _mutex->acquire_write();
+}
+
+// Write lock destructor
+USMC_write_lock::~USMC_write_lock() {
+    _mutex->release();
+}
@@ -0,0 +1,482 @@
+/***************************************************//**
+ * @file    usmc_nexus.cpp
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#include <cstring>
+#include <cstdio>
+#include <time.h>
+#include <errno.h>
+#include <hdf5.h>
+#include <usmc_nexus.h>
+#include <usmc_clock.h>
+
+
+// Buffered record kinds
+enum {
+    REC_BEGIN = 0,      // position: devices, encoder[0]: read_encoder, value: mode
+    REC_POINT,
+    REC_END             // value: scan result
+};
+
+// Writer thread polling period when the queue is empty (ns)
+#define NEXUS_POLL_NS       10000000L
+
+// Polling periods end() waits for room in the queue (1 s)
+#define NEXUS_END_RETRIES   100
+
+
+// Real time (dataset write statistics do not follow the library clock)
+static uint64_t real_time_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000ULL + uint64_t(ts.tv_nsec) / 1000ULL;
+}
+
+// ISO 8601 time
+static void iso_time(uint64_t wall_us, char* buffer, size_t len) {
+    time_t t = time_t(wall_us / 1000000ULL);
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(buffer, len, "%Y-%m-%dT%H:%M:%SZ", &tm);
+}
+
+// String attribute
+static herr_t set_attribute(hid_t obj, const char* name, const char* value) {
+    hid_t type = H5Tcopy(H5T_C_S1);
+    H5Tset_size(type, strlen(value) + 1);
+    H5Tset_strpad(type, H5T_STR_NULLTERM);
+    hid_t space = H5Screate(H5S_SCALAR);
+    hid_t attr = H5Acreate2(obj, name, type, space, H5P_DEFAULT, H5P_DEFAULT);
+    herr_t r = (attr < 0) ? -1 : H5Awrite(attr, type, value);
+    if(attr >= 0)
+        H5Aclose(attr);
+    H5Sclose(space);
+    H5Tclose(type);
+    return r;
+}
+
+// Integer attribute (scalar or array)
+static herr_t set_attribute(hid_t obj, const char* name, const int* values, hsize_t n) {
+    hid_t space = (n == 1) ? H5Screate(H5S_SCALAR) : H5Screate_simple(1, &n, NULL);
+    hid_t attr = H5Acreate2(obj, name, H5T_STD_I32LE, space, H5P_DEFAULT, H5P_DEFAULT);
+    herr_t r = (attr < 0) ? -1 : H5Awrite(attr, H5T_NATIVE_INT, values);
+    if(attr >= 0)
+        H5Aclose(attr);
+    H5Sclose(space);
+    return r;
+}
+
+// Group with a NeXus class
+static hid_t create_group(hid_t parent, const char* name, const char* nx_class) {
+    hid_t group = H5Gcreate2(parent, name, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    if(group >= 0 && set_attribute(group, "NX_class", nx_class) < 0) {
+        H5Gclose(group);
+        return -1;
+    }
+    return group;
+}
+
+// Extensible chunked 1-D dataset
+static hid_t create_dataset(hid_t group, const char* name, hid_t type, hsize_t chunk, const char* units) {
+    hsize_t dims = 0, maxdims = H5S_UNLIMITED;
+    hid_t space = H5Screate_simple(1, &dims, &maxdims);
+    hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+    H5Pset_chunk(dcpl, 1, &chunk);
+    hid_t dset = H5Dcreate2(group, name, type, space, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+    H5Pclose(dcpl);
+    H5Sclose(space);
+    if(dset >= 0 && units && set_attribute(dset, "units", units) < 0) {
+        H5Dclose(dset);
+        return -1;
+    }
+    return dset;
+}
+
+// Append points to a dataset
+static herr_t append(hid_t dset, hid_t memtype, const void* data, hsize_t offset, hsize_t n) {
+    hsize_t size = offset + n;
+    if(H5Dset_extent(dset, &size) < 0)
+        return -1;
+    hid_t fspace = H5Dget_space(dset);
+    hid_t mspace = H5Screate_simple(1, &n, NULL);
+    herr_t r = H5Sselect_hyperslab(fspace, H5S_SELECT_SET, &offset, NULL, &n, NULL);
+    if(r >= 0)
+        r = H5Dwrite(dset, memtype, mspace, fspace, H5P_DEFAULT, data);
+    H5Sclose(mspace);
+    H5Sclose(fspace);
+    return r;
+}
+
+
+// Constructor
+USMC_NexusSink::USMC_NexusSink()
+    : _file(-1), _entry(-1), _ndatasets(0), _chunk(USMC_NEXUS_CHUNK), _scan(0), _ndetectors(0),
+      _head(0), _tail(0), _max_queued(0), _result(ERR_SUCCESS), _staged_points(0), _written(0),
+      _wall_offset(0), _naxes(0), _read_encoder(false), _started(false), _stop(false)
+{
+    memset(_staged, 0, sizeof(_staged));
+    memset(&_stats, 0, sizeof(USMC_NexusStats));
+}
+
+// Destructor
+USMC_NexusSink::~USMC_NexusSink() {
+    close();
+}
+
+// Set the detector channels
+int USMC_NexusSink::setDetectors(int n, const char* const* names) {
+    if(_started)
+        return ERR_USB_BUSY;
+    if(n < 0 || n > USMC_MAX_DETECTORS || (n > 0 && NULL == names))
+        return ERR_INVALID_PARAM;
+    _names.clear();
+    for(int i = 0; i < n; i++) {
+        if(NULL == names[i] || names[i][0] == '\0')
+            return ERR_INVALID_PARAM;
+        _names.push_back(names[i]);
+    }
+    _ndetectors = n;
+    return ERR_SUCCESS;
+}
+
+// Stage a detector value
+void USMC_NexusSink::detector(int i, double value) {
+    if(i >= 0 && i < _ndetectors)
+        _staged[i] = value;
+}
+
+// Create the file
+int USMC_NexusSink::open(const char* filename, uint32_t chunk, uint32_t buffer) {
+    if(_started)
+        return ERR_USB_BUSY;
+    if(NULL == filename)
+        return ERR_INVALID_PARAM;
+    if(chunk < 1 || buffer < 2 || buffer > 0x80000000U)
+        return ERR_INVALID_VALUE;
+
+    _file = H5Fcreate(filename, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    if(_file < 0)
+        return ERR_INVALID_PARAM;
+    set_attribute(_file, "creator", "libusmc");
+
+    // Queue size is a power of two so that the indexes can wrap
+    uint32_t size = 1;
+    while(size < buffer)
+        size <<= 1;
+    _queue.assign(size, record());
+    _head = 0;
+    _tail = 0;
+    _max_queued = 0;
+
+    // Staging buffers of one chunk
+    _chunk = chunk;
+    _time.resize(chunk);
+    _value.resize(chunk);
+    for(int k = 0; k < USMC_MAX_SCAN_AXES; k++) {
+        _position[k].resize(chunk);
+        _encoder[k].resize(chunk);
+    }
+    for(int i = 0; i < _ndetectors; i++)
+        _detector[i].resize(chunk);
+    _staged_points = 0;
+    _entry = -1;
+    _scan = 0;
+    _result = ERR_SUCCESS;
+    memset(&_stats, 0, sizeof(USMC_NexusStats));
+
+    _stop = false;
+    if(pthread_create(&_thread, NULL, USMC_NexusSink::thread_main, this)) {
+        H5Fclose(_file);
+        _file = -1;
+        return ERR_USB_NO_MEM;
+    }
+    _started = true;
+    return ERR_SUCCESS;
+}
+
+// Close the file
+int USMC_NexusSink::close() {
+    if(!_started)
+        return _result;
+    _stop = true;
+    pthread_join(_thread, NULL);
+    _started = false;
+    if(H5Fclose(_file) < 0 && _result == ERR_SUCCESS)
+        __atomic_store_n(&_result, ERR_USB_IO, __ATOMIC_RELAXED);
+    _file = -1;
+    return _result;
+}
+
+// Get statistics
+void USMC_NexusSink::getStats(USMC_NexusStats* stats) {
+    if(NULL == stats)
+        return;
+    USMC_lock lock(&_lock);
+    *stats = _stats;
+    stats->max_queued = __atomic_load_n(&_max_queued, __ATOMIC_RELAXED);
+    stats->result = __atomic_load_n(&_result, __ATOMIC_RELAXED);
+}
+
+// Queue a record
+int USMC_NexusSink::enqueue(const record& r) {
+    if(!_started)
+        return ERR_USB_NOT_FOUND;
+    int result = __atomic_load_n(&_result, __ATOMIC_RELAXED);
+    if(result < 0)
+        return result;
+    uint32_t tail = _tail;
+    uint32_t queued = tail - __atomic_load_n(&_head, __ATOMIC_ACQUIRE);
+    if(queued >= _queue.size())
+        return ERR_USB_OVERFLOW;
+    _queue[tail & (_queue.size() - 1)] = r;
+    __atomic_store_n(&_tail, tail + 1, __ATOMIC_RELEASE);
+    if(queued + 1 > _max_queued)
+        __atomic_store_n(&_max_queued, queued + 1, __ATOMIC_RELAXED);
+    return ERR_SUCCESS;
+}
+
+// Start of a scan
+int USMC_NexusSink::begin(const USMC_ScanConfig& config) {
+    record r;
+    memset(&r, 0, sizeof(record));
+    r.kind = REC_BEGIN;
+    r.naxes = config.naxes;
+    r.time = usmc_time_us();
+    for(int k = 0; k < config.naxes && k < USMC_MAX_SCAN_AXES; k++)
+        r.position[k] = config.device[k];
+    r.encoder[0] = config.read_encoder ? 1 : 0;
+    r.value = config.mode;
+    memset(_staged, 0, sizeof(_staged));
+    return enqueue(r);
+}
+
+// Scan point
+int USMC_NexusSink::point(uint64_t time, const int* position, const int* encoder, double value) {
+    record r;
+    r.kind = REC_POINT;
+    r.naxes = 0;
+    r.time = time;
+    for(int k = 0; k < USMC_MAX_SCAN_AXES; k++) {
+        r.position[k] = position[k];
+        r.encoder[k] = encoder[k];
+    }
+    r.value = value;
+    memcpy(r.detector, _staged, sizeof(_staged));
+    return enqueue(r);
+}
+
+// End of a scan
+void USMC_NexusSink::end(int result) {
+    record r;
+    memset(&r, 0, sizeof(record));
+    r.kind = REC_END;
+    r.time = usmc_time_us();
+    r.value = result;
+
+    // The scan is over, so wait for the writer to make room (e.g. after an overflow)
+    for(int i = 0; i < NEXUS_END_RETRIES; i++) {
+        if(enqueue(r) != ERR_USB_OVERFLOW)
+            break;
+        struct timespec ts;
+        ts.tv_sec = 0;
+        ts.tv_nsec = NEXUS_POLL_NS;
+        while(nanosleep(&ts, &ts) == -1 && errno == EINTR);
+    }
+}
+
+// Thread entry point
+void* USMC_NexusSink::thread_main(void* arg) {
+    USMC_NexusSink* sink = reinterpret_cast<USMC_NexusSink*>(arg);
+    sink->run();
+    return NULL;
+}
+
+// Writer loop
+void USMC_NexusSink::run() {
+    for(;;) {
+        bool stop = _stop;
+        uint32_t head = _head;
+        uint32_t tail = __atomic_load_n(&_tail, __ATOMIC_ACQUIRE);
+        while(head != tail) {
+            const record& r = _queue[head & (_queue.size() - 1)];
+            if(r.kind == REC_BEGIN) {
+                closeEntry(0);
+                // One wall-clock offset per entry, so the times of its points
+                // follow the monotonic clock even if the system clock is set
+                _wall_offset = int64_t(usmc_wall_time_us(r.time)) - int64_t(r.time);
+                createEntry(r);
+            } else if(r.kind == REC_POINT) {
+                if(_entry >= 0) {
+                    size_t i = _staged_points++;
+                    _time[i] = uint64_t(int64_t(r.time) + _wall_offset);
+                    _value[i] = r.value;
+                    for(int k = 0; k < _naxes; k++) {
+                        _position[k][i] = r.position[k];
+                        _encoder[k][i] = r.encoder[k];
+                    }
+                    for(int d = 0; d < _ndetectors; d++)
+                        _detector[d][i] = r.detector[d];
+                    if(_staged_points == _chunk)
+                        flush();
+                }
+            } else {
+                closeEntry(int(r.value));
+            }
+            head++;
+            __atomic_store_n(&_head, head, __ATOMIC_RELEASE);
+        }
+
+        // Write what is staged while the scan is idle or slow
+        flush();
+        if(stop)
+            break;
+
+        struct timespec ts;
+        ts.tv_sec = 0;
+        ts.tv_nsec = NEXUS_POLL_NS;
+        while(nanosleep(&ts, &ts) == -1 && errno == EINTR);
+    }
+
+    // A scan still running when the file is closed has no result
+    if(_entry >= 0) {
+        for(int i = 0; i < _ndatasets; i++)
+            H5Dclose(_datasets[i]);
+        H5Gclose(_entry);
+        _entry = -1;
+        _ndatasets = 0;
+    }
+}
+
+// Create the groups and datasets of a scan
+void USMC_NexusSink::createEntry(const record& r) {
+    if(_result != ERR_SUCCESS)
+        return;
+
+    char name[32], value[64];
+    snprintf(name, sizeof(name), "entry%d", ++_scan);
+    _entry = create_group(_file, name, "NXentry");
+    if(_entry < 0) {
+        __atomic_store_n(&_result, ERR_USB_IO, __ATOMIC_RELAXED);
+        return;
+    }
+    iso_time(uint64_t(int64_t(r.time) + _wall_offset), value, sizeof(value));
+    set_attribute(_entry, "start_time", value);
+    set_attribute(_entry, "devices", r.position, hsize_t(r.naxes));
+    set_attribute(_entry, "mode", int(r.value) == USMC_SCAN_ADAPTIVE ? "adaptive" : "grid");
+
+    // Points are listed in the order they were measured: every coordinate
+    // is indexed by the same dimension as the signal
+    hid_t data = create_group(_entry, "data", "NXdata");
+    if(data < 0) {
+        __atomic_store_n(&_result, ERR_USB_IO, __ATOMIC_RELAXED);
+        return;
+    }
+    set_attribute(data, "signal", "value");
+    set_attribute(data, "axes", "position_0");
+
+    _naxes = r.naxes;
+    _read_encoder = (r.encoder[0] != 0);
+    _ndatasets = 0;
+    _written = 0;
+    _staged_points = 0;
+    int zero = 0;
+    _datasets[_ndatasets++] = create_dataset(data, "time", H5T_STD_U64LE, _chunk, "us");
+    for(int k = 0; k < _naxes; k++) {
+        snprintf(name, sizeof(name), "position_%d", k);
+        _datasets[_ndatasets++] = create_dataset(data, name, H5T_STD_I32LE, _chunk, "steps");
+        snprintf(name, sizeof(name), "position_%d_indices", k);
+        set_attribute(data, name, &zero, 1);
+    }
+    for(int k = 0; k < _naxes && _read_encoder; k++) {
+        snprintf(name, sizeof(name), "encoder_%d", k);
+        _datasets[_ndatasets++] = create_dataset(data, name, H5T_STD_I32LE, _chunk, "counts");
+    }
+    _datasets[_ndatasets++] = create_dataset(data, "value", H5T_IEEE_F64LE, _chunk, NULL);
+    for(int d = 0; d < _ndetectors; d++)
+        _datasets[_ndatasets++] = create_dataset(data, _names[d].c_str(), H5T_IEEE_F64LE, _chunk, NULL);
+    H5Gclose(data);
+
+    for(int i = 0; i < _ndatasets; i++)
+        if(_datasets[i] < 0)
+            __atomic_store_n(&_result, ERR_USB_IO, __ATOMIC_RELAXED);
+
+    USMC_lock lock(&_lock);
+    _stats.scans++;
+}
+
+// Close the current scan
+void USMC_NexusSink::closeEntry(int result) {
+    if(_entry < 0)
+        return;
+    flush();
+    if(_result == ERR_SUCCESS) {
+        char value[64];
+        iso_time(uint64_t(int64_t(usmc_time_us()) + _wall_offset), value, sizeof(value));
+        set_attribute(_entry, "end_time", value);
+        set_attribute(_entry, "result", &result, 1);
+    }
+    for(int i = 0; i < _ndatasets; i++)
+        if(_datasets[i] >= 0)
+            H5Dclose(_datasets[i]);
+    H5Gclose(_entry);
+    H5Fflush(_file, H5F_SCOPE_GLOBAL);
+    _entry = -1;
+    _ndatasets = 0;
+}
+
+// Append the staged points to the datasets
+void USMC_NexusSink::flush() {
+    if(_staged_points == 0)
+        return;
+    hsize_t n = _staged_points;
+    _staged_points = 0;
+    if(_result != ERR_SUCCESS || _entry < 0)
+        return;
+
+    uint64_t start = real_time_us();
+    int i = 0;
+    herr_t r = append(_datasets[i++], H5T_NATIVE_UINT64, &_time[0], _written, n);
+    for(int k = 0; k < _naxes && r >= 0; k++)
+        r = append(_datasets[i++], H5T_NATIVE_INT, &_position[k][0], _written, n);
+    for(int k = 0; k < _naxes && _read_encoder && r >= 0; k++)
+        r = append(_datasets[i++], H5T_NATIVE_INT, &_encoder[k][0], _written, n);
+    if(r >= 0)
+        r = append(_datasets[i++], H5T_NATIVE_DOUBLE, &_value[0], _written, n);
+    for(int d = 0; d < _ndetectors && r >= 0; d++)
+        r = append(_datasets[i++], H5T_NATIVE_DOUBLE, &_detector[d][0], _written, n);
+    if(r < 0) {
+        __atomic_store_n(&_result, ERR_USB_IO, __ATOMIC_RELAXED);
+        return;
+    }
+    _written += n;
+    double elapsed = double(real_time_us() - start);
+
+    USMC_lock lock(&_lock);
+    _stats.points += n;
+    _stats.writes++;
+    if(elapsed > _stats.max_write)
+        _stats.max_write = elapsed;
+}
@@ -0,0 +1,301 @@
+/***************************************************//**
+ * @file    usmc_optimize.cpp
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <usmc_optimize.h>
+#include <usmc_clock.h>
+
+// Inverse of the golden ratio
+#define INV_PHI     0.6180339887498949
+
+
+// Optimizer constructor
+USMC_Optimizer::USMC_Optimizer(USMC* usmc) : _usmc(usmc), _measure(NULL), _user(NULL) {
+    memset(&_config, 0, sizeof(USMC_OptimizeConfig));
+    memset(&_result, 0, sizeof(USMC_OptimizeResult));
+}
+
+// Default configuration
+void USMC_Optimizer::defaults(USMC_OptimizeConfig* config) {
+    memset(config, 0, sizeof(USMC_OptimizeConfig));
+    config->naxes = 1;
+    for(int i = 0; i < USMC_MAX_OPT_AXES; i++)
+        config->tolerance[i] = 1;
+    config->method = USMC_OPT_PARABOLIC;
+    config->backlash = 0;
+    config->approach_positive = true;
+    config->max_sweeps = 4;
+    config->max_evaluations = 0;
+    config->poll_us = 1000;
+    config->timeout_ms = 0;
+}
+
+// Run optimization
+int USMC_Optimizer::run(const USMC_OptimizeConfig& config, USMC_MeasureFn measure, void* user, USMC_OptimizeResult* result) {
+    if(NULL == measure || NULL == result)
+        return ERR_INVALID_PARAM;
+    if(config.naxes < 1 || config.naxes > USMC_MAX_OPT_AXES || config.max_sweeps < 1 || config.backlash < 0)
+        return ERR_INVALID_VALUE;
+    if(config.method != USMC_OPT_GOLDEN && config.method != USMC_OPT_PARABOLIC)
+        return ERR_INVALID_VALUE;
+    for(int k = 0; k < config.naxes; k++) {
+        if(config.device[k] < 0 || config.device[k] >= int(_usmc->countDevices()))
+            return ERR_INVALID_ID;
+        if(config.min[k] > config.max[k] || config.tolerance[k] < 1)
+            return ERR_INVALID_VALUE;
+    }
+
+    _config = config;
+    _measure = measure;
+    _user = user;
+    memset(&_result, 0, sizeof(USMC_OptimizeResult));
+    uint64_t start = usmc_time_us();
+
+    // Starting point and motion models
+    int best[USMC_MAX_OPT_AXES];
+    for(int k = 0; k < _config.naxes; k++) {
+        int r = _model[k].load(_usmc, _config.device[k]);
+        if(r < 0)
+            return r;
+        USMC_State state;
+        r = _usmc->getState(_config.device[k], &state);
+        if(r < 0)
+            return r;
+        _pos[k] = state.CurPos;
+        best[k] = _pos[k] < _config.min[k] ? _config.min[k] : (_pos[k] > _config.max[k] ? _config.max[k] : _pos[k]);
+    }
+
+    double fbest = 0.0;
+    for(int sweep = 0; sweep < _config.max_sweeps; sweep++) {
+        bool moved = false;
+
+        for(int k = 0; k < _config.naxes; k++) {
+            // Full range on the first pass, then shrinking brackets around the best point
+            int lo = _config.min[k];
+            int hi = _config.max[k];
+            if(sweep > 0) {
+                int64_t w = (int64_t(hi) - lo) >> (2 * sweep);
+                if(w < 4 * _config.tolerance[k])
+                    w = 4 * _config.tolerance[k];
+                lo = int64_t(best[k]) - w / 2 < _config.min[k] ? _config.min[k] : int(best[k] - w / 2);
+                hi = int64_t(best[k]) + w / 2 > _config.max[k] ? _config.max[k] : int(best[k] + w / 2);
+            }
+
+            int x;
+            double f;
+            int r = search(k, lo, hi, x, f);
+            if(r < 0)
+                return r;
+            if(abs(x - best[k]) > _config.tolerance[k])
+                moved = true;
+            best[k] = x;
+            fbest = f;
+
+            // Leave the axis on its best point for the next ones
+            r = moveAxis(k, x);
+            if(r < 0)
+                return r;
+
+            if(exhausted())
+                break;
+        }
+
+        if(_config.naxes == 1 || !moved || exhausted())
+            break;
+    }
+
+    for(int k = 0; k < _config.naxes; k++)
+        _result.position[k] = best[k];
+    _result.value = fbest;
+    _result.wall_time = double(usmc_time_us() - start) / 1e6;
+    *result = _result;
+    return ERR_SUCCESS;
+}
+
+// Line search
+int USMC_Optimizer::search(int axis, int lo, int hi, int& best, double& fbest) {
+    int r;
+    _samples.clear();
+
+    if(hi - lo < 3) {
+        // Too narrow for a bracket, just sample every point
+        for(int x = lo; x <= hi; x++) {
+            double f;
+            if((r = evaluate(axis, x, f)) < 0)
+                return r;
+        }
+
+    } else {
+        int a = lo;
+        int b = hi;
+        int c = b - int(INV_PHI * (b - a) + 0.5);
+        int d = a + int(INV_PHI * (b - a) + 0.5);
+        double fc, fd;
+
+        // Evaluate the first two interior points in the cheapest order
+        double t_cd = approachTime(axis, _pos[axis], c) + approachTime(axis, c, d);
+        double t_dc = approachTime(axis, _pos[axis], d) + approachTime(axis, d, c);
+        if(t_cd <= t_dc) {
+            if((r = evaluate(axis, c, fc)) < 0 || (r = evaluate(axis, d, fd)) < 0)
+                return r;
+        } else {
+            if((r = evaluate(axis, d, fd)) < 0 || (r = evaluate(axis, c, fc)) < 0)
+                return r;
+        }
+
+        // Golden-section narrowing
+        int stop = _config.tolerance[axis] * (_config.method == USMC_OPT_PARABOLIC ? 3 : 1);
+        while(b - a > stop && !exhausted()) {
+            if(fc >= fd) {
+                b = d;
+                d = c;
+                fd = fc;
+                c = b - int(INV_PHI * (b - a) + 0.5);
+                if(c >= d)
+                    c = d - 1;
+                if(c <= a)
+                    break;
+                if((r = evaluate(axis, c, fc)) < 0)
+                    return r;
+            } else {
+                a = c;
+                c = d;
+                fc = fd;
+                d = a + int(INV_PHI * (b - a) + 0.5);
+                if(d <= c)
+                    d = c + 1;
+                if(d >= b)
+                    break;
+                if((r = evaluate(axis, d, fd)) < 0)
+                    return r;
+            }
+        }
+    }
+
+    // Best sample
+    size_t ib = 0;
+    for(size_t i = 1; i < _samples.size(); i++)
+        if(_samples[i].f > _samples[ib].f)
+            ib = i;
+
+    // Parabolic interpolation through the best sample and its closest neighbours
+    if(_config.method == USMC_OPT_PARABOLIC && !exhausted()) {
+        const sample& sb = _samples[ib];
+        int il = -1, ir = -1;
+        for(size_t i = 0; i < _samples.size(); i++) {
+            if(_samples[i].x < sb.x && (il < 0 || _samples[i].x > _samples[il].x))
+                il = int(i);
+            if(_samples[i].x > sb.x && (ir < 0 || _samples[i].x < _samples[ir].x))
+                ir = int(i);
+        }
+        if(il >= 0 && ir >= 0) {
+            double xl = _samples[il].x, fl = _samples[il].f;
+            double xr = _samples[ir].x, fr = _samples[ir].f;
+            double xb = sb.x, fb = sb.f;
+            double num = (xb - xl) * (xb - xl) * (fb - fr) - (xb - xr) * (xb - xr) * (fb - fl);
+            double den = (xb - xl) * (fb - fr) - (xb - xr) * (fb - fl);
+            if(den != 0.0) {
+                int xv = int(floor(xb - 0.5 * num / den + 0.5));
+                bool known = false;
+                for(size_t i = 0; i < _samples.size(); i++)
+                    if(_samples[i].x == xv)
+                        known = true;
+                if(!known && xv > xl && xv < xr) {
+                    double f;
+                    if((r = evaluate(axis, xv, f)) < 0)
+                        return r;
+                    if(f > _samples[ib].f)
+                        ib = _samples.size() - 1;
+                }
+            }
+        }
+    }
+
+    best = _samples[ib].x;
+    fbest = _samples[ib].f;
+    return ERR_SUCCESS;
+}
+
+// Estimate approach time
+double USMC_Optimizer::approachTime(int axis, int from, int to)const {
+    int dir = _config.approach_positive ? 1 : -1;
+    if(_config.backlash > 0 && (to - from) * dir < 0) {
+        int pre = to - dir * _config.backlash;
+        return _model[axis].moveTime(from, pre) + _model[axis].moveTime(pre, to);
+    }
+    return _model[axis].moveTime(from, to);
+}
+
+// Move one axis
+int USMC_Optimizer::moveAxis(int axis, int position) {
+    int device = _config.device[axis];
+    int dir = _config.approach_positive ? 1 : -1;
+    int r;
+
+    if(position == _pos[axis])
+        return ERR_SUCCESS;
+
+    // Overshoot first if the last leg would run against the approach direction
+    if(_config.backlash > 0 && (position - _pos[axis]) * dir < 0) {
+        int pre = position - dir * _config.backlash;
+        _result.model_time += _model[axis].moveTime(_pos[axis], pre);
+        _result.moves++;
+        if((r = _usmc->moveTo(device, pre)) < 0)
+            return r;
+        if((r = usmc_wait_idle(_usmc, device, _config.poll_us, _config.timeout_ms)) < 0)
+            return r;
+        _pos[axis] = pre;
+    }
+
+    _result.model_time += _model[axis].moveTime(_pos[axis], position);
+    _result.moves++;
+    if((r = _usmc->moveTo(device, position)) < 0)
+        return r;
+    if((r = usmc_wait_idle(_usmc, device, _config.poll_us, _config.timeout_ms)) < 0)
+        return r;
+    _pos[axis] = position;
+    return ERR_SUCCESS;
+}
+
+// Move and measure
+int USMC_Optimizer::evaluate(int axis, int position, double& value) {
+    int r = moveAxis(axis, position);
+    if(r < 0)
+        return r;
+    r = _measure(_user, &value);
+    if(r < 0)
+        return r;
+
+    sample s;
+    s.x = position;
+    s.f = value;
+    _samples.push_back(s);
+    _result.evaluations++;
+    return ERR_SUCCESS;
+}
@@ -0,0 +1,546 @@
+/***************************************************//**
+ * @file    usmc_path.cpp
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <usmc_path.h>
+#include <usmc_clock.h>
+#include <libusmc_impl.h>
+
+
+// File layout (little endian):
+//   header   "USMCPTH1" version(4) naxes(4) fields(4) stride(4) points(8)
+//   points   { position(4) x naxes [speed(4, float)] [flags(4)] } x points
+// A file not closed by the writer has points = 0 and its length gives the
+// number of complete points.
+#define PATH_MAGIC          "USMCPTH1"
+#define PATH_VERSION        1
+#define PATH_HEADER_SIZE    32
+
+typedef struct _path_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t naxes;
+    uint32_t fields;
+    uint32_t stride;
+    uint64_t points;
+} path_header;
+
+
+// Size of a point record
+static uint32_t path_stride(int naxes, uint32_t fields) {
+    uint32_t stride = uint32_t(naxes) * 4;
+    if(fields & USMC_PATH_SPEED)
+        stride += 4;
+    if(fields & USMC_PATH_FLAGS)
+        stride += 4;
+    return stride;
+}
+
+
+// Writer constructor
+USMC_PathWriter::USMC_PathWriter() : _file(NULL), _naxes(0), _fields(0), _points(0), _result(ERR_SUCCESS) {}
+
+// Writer destructor
+USMC_PathWriter::~USMC_PathWriter() {
+    close();
+}
+
+// Create a path file
+int USMC_PathWriter::open(const char* filename, int naxes, uint32_t fields) {
+    if(_file)
+        return ERR_USB_BUSY;
+    if(NULL == filename)
+        return ERR_INVALID_PARAM;
+    if(naxes < 1 || naxes > USMC_MAX_PATH_AXES || (fields & ~uint32_t(USMC_PATH_SPEED | USMC_PATH_FLAGS)))
+        return ERR_INVALID_VALUE;
+
+    _file = fopen(filename, "wb");
+    if(NULL == _file)
+        return ERR_INVALID_PARAM;
+
+    _naxes = naxes;
+    _fields = fields;
+    _points = 0;
+    _result = ERR_SUCCESS;
+
+    path_header header;
+    memset(&header, 0, sizeof(path_header));
+    memcpy(header.magic, PATH_MAGIC, 8);
+    header.version = PATH_VERSION;
+    header.naxes = uint32_t(naxes);
+    header.fields = fields;
+    header.stride = path_stride(naxes, fields);
+    if(fwrite(&header, sizeof(path_header), 1, _file) != 1)
+        _result = ERR_USB_IO;
+    return _result;
+}
+
+// Append a point
+int USMC_PathWriter::add(const int* position, float speed, uint32_t flags) {
+    if(NULL == _file)
+        return ERR_USB_NOT_FOUND;
+    if(NULL == position)
+        return ERR_INVALID_PARAM;
+    if(_result < 0)
+        return _result;
+    if(speed != 0.0f && (!(_fields & USMC_PATH_SPEED) || speed < 16.0f || speed > 5000.0f))
+        return ERR_INVALID_VALUE;
+    if(flags != 0 && !(_fields & USMC_PATH_FLAGS))
+        return ERR_INVALID_VALUE;
+
+    int32_t record[USMC_MAX_PATH_AXES + 2];
+    int n = 0;
+    for(int k = 0; k < _naxes; k++)
+        record[n++] = position[k];
+    if(_fields & USMC_PATH_SPEED)
+        memcpy(&record[n++], &speed, 4);
+    if(_fields & USMC_PATH_FLAGS)
+        record[n++] = int32_t(flags);
+
+    if(fwrite(record, 4, size_t(n), _file) != size_t(n)) {
+        _result = ERR_USB_IO;
+        return _result;
+    }
+    _points++;
+    return ERR_SUCCESS;
+}
+
+// Close the file
+int USMC_PathWriter::close() {
+    if(NULL == _file)
+        return _result;
+
+    // Write the number of points in the header
+    if(_result == ERR_SUCCESS) {
+        if(fflush(_file) != 0 || fseeko(_file, offsetof(path_header, points), SEEK_SET) != 0 || fwrite(&_points, 8, 1, _file) != 1)
+            _result = ERR_USB_IO;
+    }
+    if(fclose(_file) != 0 && _result == ERR_SUCCESS)
+        _result = ERR_USB_IO;
+    _file = NULL;
+    return _result;
+}
+
+
+// Path constructor
+USMC_Path::USMC_Path() : _fd(-1), _base(NULL), _length(0), _data(NULL), _points(0), _naxes(0), _fields(0), _stride(0) {}
+
+// Path destructor
+USMC_Path::~USMC_Path() {
+    close();
+}
+
+// Map a path file
+int USMC_Path::open(const char* filename) {
+    close();
+    if(NULL == filename)
+        return ERR_INVALID_PARAM;
+
+    int fd = ::open(filename, O_RDONLY);
+    if(fd < 0)
+        return ERR_INVALID_PARAM;
+
+    struct stat st;
+    path_header header;
+    if(fstat(fd, &st) < 0 || pread(fd, &header, sizeof(path_header), 0) != ssize_t(sizeof(path_header))) {
+        ::close(fd);
+        return ERR_INVALID_VALUE;
+    }
+
+    // Check the header
+    bool valid = (memcmp(header.magic, PATH_MAGIC, 8) == 0 && header.version == PATH_VERSION);
+    valid = valid && header.naxes >= 1 && header.naxes <= USMC_MAX_PATH_AXES;
+    valid = valid && !(header.fields & ~uint32_t(USMC_PATH_SPEED | USMC_PATH_FLAGS));
+    valid = valid && header.stride == path_stride(int(header.naxes), header.fields);
+    uint64_t available = valid ? (uint64_t(st.st_size) - PATH_HEADER_SIZE) / header.stride : 0;
+    if(valid && header.points == 0)
+        header.points = available;
+    if(!valid || header.points > available) {
+        ::close(fd);
+        return ERR_INVALID_VALUE;
+    }
+
+    void* base = mmap(NULL, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    if(base == MAP_FAILED) {
+        ::close(fd);
+        return ERR_USB_NO_MEM;
+    }
+    madvise(base, size_t(st.st_size), MADV_SEQUENTIAL);
+
+    _fd = fd;
+    _base = base;
+    _length = size_t(st.st_size);
+    _data = reinterpret_cast<const uint8_t*>(base) + PATH_HEADER_SIZE;
+    _points = header.points;
+    _naxes = int(header.naxes);
+    _fields = header.fields;
+    _stride = header.stride;
+    return ERR_SUCCESS;
+}
+
+// Unmap the file
+void USMC_Path::close() {
+    if(_base) {
+        munmap(_base, _length);
+        _base = NULL;
+        _length = 0;
+        _data = NULL;
+    }
+    if(_fd >= 0) {
+        ::close(_fd);
+        _fd = -1;
+    }
+    _points = 0;
+    _naxes = 0;
+    _fields = 0;
+    _stride = 0;
+}
+
+// Speed of a point
+float USMC_Path::speed(uint64_t point)const {
+    if(!(_fields & USMC_PATH_SPEED))
+        return 0.0f;
+    float speed;
+    memcpy(&speed, record(point) + _naxes, 4);
+    return speed;
+}
+
+// Flags of a point
+uint32_t USMC_Path::flags(uint64_t point)const {
+    if(!(_fields & USMC_PATH_FLAGS))
+        return 0;
+    return uint32_t(record(point)[_naxes + ((_fields & USMC_PATH_SPEED) ? 1 : 0)]);
+}
+
+// Read ahead
+void USMC_Path::prefetch(uint64_t first, uint64_t last)const {
+    advise(first, last, MADV_WILLNEED);
+}
+
+// Drop used pages
+void USMC_Path::release(uint64_t first, uint64_t last)const {
+    advise(first, last, MADV_DONTNEED);
+}
+
+// Advise the kernel on the pages of a range of points
+void USMC_Path::advise(uint64_t first, uint64_t last, int advice)const {
+    if(NULL == _base || first >= last || last > _points)
+        return;
+    uint64_t page = uint64_t(sysconf(_SC_PAGESIZE));
+    uint64_t begin = PATH_HEADER_SIZE + first * _stride;
+    uint64_t end = PATH_HEADER_SIZE + last * _stride;
+
+    // Read the pages touched by the range, drop only those fully inside it
+    if(advice == MADV_DONTNEED) {
+        begin = (begin + page - 1) / page * page;
+        end = end / page * page;
+    } else {
+        begin = begin / page * page;
+        end = std::min(uint64_t(_length), (end + page - 1) / page * page);
+    }
+    if(begin < end)
+        madvise(reinterpret_cast<uint8_t*>(_base) + begin, size_t(end - begin), advice);
+}
+
+
+// Executor constructor
+USMC_PathExecutor::USMC_PathExecutor(USMC* usmc) : _usmc(usmc), _path(NULL), _naxes(0), _ring(NULL), _flags(NULL), _window(USMC_PATH_WINDOW), _encoded(0),
+      _poll_slots(NULL), _requests(NULL), _callback(NULL), _user(NULL), _poll(1000), _timeout(0), _started(false), _abort(false) {
+    memset(&_status, 0, sizeof(USMC_PathStatus));
+}
+
+// Executor destructor
+USMC_PathExecutor::~USMC_PathExecutor() {
+    abort();
+    release();
+}
+
+// Set callback
+int USMC_PathExecutor::setCallback(USMC_PathFn callback, void* user) {
+    USMC_lock status_lock(&_lock);
+    if(_status.running)
+        return ERR_USB_BUSY;
+    _callback = callback;
+    _user = user;
+    return ERR_SUCCESS;
+}
+
+// Set window
+int USMC_PathExecutor::setWindow(uint32_t points) {
+    USMC_lock status_lock(&_lock);
+    if(_status.running)
+        return ERR_USB_BUSY;
+    if(points < 2)
+        return ERR_INVALID_VALUE;
+    _window = points;
+    return ERR_SUCCESS;
+}
+
+// Start path
+int USMC_PathExecutor::start(const USMC_Path& path, const int* devices) {
+    if(path.naxes() == 0 || NULL == devices)
+        return ERR_INVALID_PARAM;
+
+    // Check devices
+    int naxes = path.naxes();
+    for(int k = 0; k < naxes; k++) {
+        if(devices[k] < 0 || devices[k] >= int(_usmc->countDevices()))
+            return ERR_INVALID_ID;
+        for(int j = 0; j < k; j++) {
+            if(devices[j] == devices[k])
+                return ERR_INVALID_PARAM;
+        }
+    }
+
+    {
+        USMC_lock status_lock(&_lock);
+        if(_status.running)
+            return ERR_USB_BUSY;
+    }
+
+    // Join previous run
+    if(_started) {
+        pthread_join(_thread, NULL);
+        _started = false;
+    }
+
+    // Axes sorted by device index
+    std::vector<std::pair<int, int> > order;
+    for(int k = 0; k < naxes; k++)
+        order.push_back(std::make_pair(devices[k], k));
+    std::sort(order.begin(), order.end());
+    for(int i = 0; i < naxes; i++) {
+        _axis[i] = order[i].second;
+        int r = _usmc->getDevice(order[i].first, &_handles[i]);
+        if(r < 0)
+            return r;
+    }
+
+    // Encoding ring and exchange buffers
+    release();
+    _naxes = naxes;
+    _ring = new USMC_ExchangeSlot[size_t(_window) * naxes];
+    _flags = new uint32_t[_window];
+    _poll_slots = new USMC_ExchangeSlot[naxes];
+    _requests = new USMC_TransferRequest[2 * naxes];
+    memset(_ring, 0, sizeof(USMC_ExchangeSlot) * _window * naxes);
+    memset(_poll_slots, 0, sizeof(USMC_ExchangeSlot) * naxes);
+    for(uint32_t p = 0; p < _window; p++) {
+        for(int i = 0; i < naxes; i++)
+            _ring[p * naxes + i].dev = _handles[i]._dev;
+    }
+    for(int i = 0; i < naxes; i++) {
+        _poll_slots[i].dev = _handles[i]._dev;
+        _poll_slots[i].command = USMC_EXCHANGE_NONE;
+    }
+
+    _path = &path;
+    _encoded = 0;
+    _abort = false;
+    {
+        USMC_lock status_lock(&_lock);
+        memset(&_status, 0, sizeof(USMC_PathStatus));
+        _status.points = path.size();
+        _status.running = true;
+    }
+
+    if(pthread_create(&_thread, NULL, USMC_PathExecutor::thread_main, this)) {
+        USMC_lock status_lock(&_lock);
+        _status.running = false;
+        return ERR_USB_NO_MEM;
+    }
+    _started = true;
+    return ERR_SUCCESS;
+}
+
+// Abort path
+void USMC_PathExecutor::abort() {
+    if(!_started)
+        return;
+    _abort = true;
+    pthread_join(_thread, NULL);
+    _started = false;
+
+    // Stop the axes if the path was interrupted
+    if(_status.result == ERR_USB_INTERRUPTED) {
+        for(int i = 0; i < _naxes; i++)
+            _handles[i].stop();
+    }
+}
+
+// Wait for path to finish
+int USMC_PathExecutor::wait() {
+    if(_started) {
+        pthread_join(_thread, NULL);
+        _started = false;
+    }
+    USMC_lock status_lock(&_lock);
+    return _status.result;
+}
+
+// Get status
+void USMC_PathExecutor::getStatus(USMC_PathStatus* status) {
+    if(NULL == status)
+        return;
+    USMC_lock status_lock(&_lock);
+    memcpy((void*)status, (void*)&_status, sizeof(USMC_PathStatus));
+}
+
+// Release the buffers
+void USMC_PathExecutor::release() {
+    delete[] _ring;
+    delete[] _flags;
+    delete[] _poll_slots;
+    delete[] _requests;
+    _ring = NULL;
+    _flags = NULL;
+    _poll_slots = NULL;
+    _requests = NULL;
+}
+
+// Thread entry point
+void* USMC_PathExecutor::thread_main(void* arg) {
+    USMC_PathExecutor* executor = reinterpret_cast<USMC_PathExecutor*>(arg);
+    int r = executor->run();
+
+    USMC_lock status_lock(&(executor->_lock));
+    executor->_status.result = r;
+    executor->_status.running = false;
+    return NULL;
+}
+
+// Encode the points up to the end of the window
+void USMC_PathExecutor::encode(uint64_t cursor) {
+    USMC_impl* impl = _handles[0]._impl;
+    uint64_t last = std::min(_path->size(), cursor + _window);
+    for(; _encoded < last; _encoded++) {
+        uint64_t p = _encoded;
+        USMC_ExchangeSlot* slots = &_ring[(p % _window) * _naxes];
+        float speed = _path->speed(p);
+        for(int i = 0; i < _naxes; i++) {
+            USMC_ExchangeSlot& slot = slots[i];
+            int position = _path->position(p, _axis[i]);
+
+            // Axes already at the position are not commanded
+            if(p > 0 && position == _last[i]) {
+                slot.command = USMC_EXCHANGE_NONE;
+                continue;
+            }
+            slot.command = USMC_EXCHANGE_PACKET;
+            slot.destination = position;
+            impl->encode_move(*slot.dev, position, speed, slot.go_to);
+            _last[i] = position;
+        }
+        _flags[p % _window] = _path->flags(p);
+    }
+}
+
+// Wait for the axes to stop
+int USMC_PathExecutor::waitIdle() {
+    USMC_impl* impl = _handles[0]._impl;
+    uint64_t start = usmc_time_us();
+    while(!_abort) {
+        if(_timeout > 0 && usmc_time_us() - start >= uint64_t(_timeout) * 1000ULL)
+            return ERR_USB_TIMEOUT;
+        usmc_sleep_us(_poll);
+
+        impl->device_exchange(_poll_slots, size_t(_naxes), _requests);
+        bool running = false;
+        for(int i = 0; i < _naxes; i++) {
+            if(_poll_slots[i].state_result < 0)
+                return _poll_slots[i].state_result;
+            running = running || _poll_slots[i].state.RUN;
+        }
+        if(!running)
+            return ERR_SUCCESS;
+    }
+    return ERR_USB_INTERRUPTED;
+}
+
+// Executor loop
+int USMC_PathExecutor::run() {
+    USMC_impl* impl = _handles[0]._impl;
+    uint64_t n = _path->size();
+    uint64_t released = 0;
+
+    for(uint64_t p = 0; p < n; p++) {
+        if(_abort)
+            return ERR_USB_INTERRUPTED;
+
+        // Refill the window in bulk when half of it was executed, read the
+        // next window ahead and drop the pages already executed
+        if(_encoded < n && _encoded - p < _window / 2) {
+            encode(p);
+            _path->prefetch(_encoded, std::min(n, _encoded + _window));
+            _path->release(released, p);
+            released = p;
+        }
+
+        // Move the axes of the point in one batch
+        USMC_ExchangeSlot* slots = &_ring[(p % _window) * _naxes];
+        impl->device_exchange(slots, size_t(_naxes), _requests);
+
+        int moves = 0;
+        bool running = false;
+        for(int i = 0; i < _naxes; i++) {
+            if(slots[i].command != USMC_EXCHANGE_NONE) {
+                if(slots[i].command_result < 0)
+                    return slots[i].command_result;
+                moves++;
+            }
+            if(slots[i].state_result < 0)
+                return slots[i].state_result;
+            running = running || slots[i].state.RUN;
+        }
+        {
+            USMC_lock status_lock(&_lock);
+            _status.point = p;
+            _status.moves += moves;
+            _status.encoded = _encoded;
+        }
+
+        uint32_t flags = _flags[p % _window];
+        if(!(flags & USMC_POINT_NOWAIT) && running) {
+            int r = waitIdle();
+            if(r < 0)
+                return r;
+        }
+        if((flags & USMC_POINT_CALLBACK) && _callback) {
+            int r = _callback(_user, p);
+            if(r < 0)
+                return r;
+        }
+    }
+    return ERR_SUCCESS;
+}
@@ -0,0 +1,192 @@
+/***************************************************//**
+ * @file    usmc_pattern.cpp
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#include <cmath>
+#include <algorithm>
+#include <usmc_pattern.h>
+
+// Newton iterations inverting the spiral length (converged to double precision)
+#define SPIRAL_ITERATIONS   6
+
+
+// Pattern constructor
+USMC_Pattern::USMC_Pattern() : _cursor(0) {
+    _scale[0] = _scale[1] = 1.0;
+    _origin[0] = _origin[1] = 0.0;
+}
+
+// Set scale
+void USMC_Pattern::setScale(double x, double y) {
+    _scale[0] = x;
+    _scale[1] = y;
+}
+
+// Set origin
+void USMC_Pattern::setOrigin(double x, double y) {
+    _origin[0] = x;
+    _origin[1] = y;
+}
+
+// Get a point
+int USMC_Pattern::point(uint64_t i, int* position)const {
+    if(NULL == position)
+        return ERR_INVALID_PARAM;
+    if(i >= size())
+        return ERR_INVALID_VALUE;
+    double x, y;
+    locate(i, x, y);
+    position[0] = int(lround((_origin[0] + x) * _scale[0]));
+    position[1] = int(lround((_origin[1] + y) * _scale[1]));
+    return ERR_SUCCESS;
+}
+
+// Next point
+bool USMC_Pattern::next(int* position) {
+    if(_cursor >= size() || point(_cursor, position) < 0)
+        return false;
+    _cursor++;
+    return true;
+}
+
+// Estimate the pattern time
+double USMC_Pattern::estimateTime(const USMC_MotionModel* models, double dwell)const {
+    uint64_t n = size();
+    if(NULL == models || n == 0)
+        return 0.0;
+
+    int last[2];
+    point(0, last);
+    double t = dwell;
+    for(uint64_t i = 1; i < n; i++) {
+        int p[2];
+        point(i, p);
+        t += std::max(models[0].moveTime(last[0], p[0]), models[1].moveTime(last[1], p[1])) + dwell;
+        last[0] = p[0];
+        last[1] = p[1];
+    }
+    return t;
+}
+
+// Append to a path
+int USMC_Pattern::write(USMC_PathWriter& writer, float speed, uint32_t flags)const {
+    uint64_t n = size();
+    for(uint64_t i = 0; i < n; i++) {
+        int p[2];
+        point(i, p);
+        int r = writer.add(p, speed, flags);
+        if(r < 0)
+            return r;
+    }
+    return ERR_SUCCESS;
+}
+
+
+// Serpentine constructor
+USMC_SerpentinePattern::USMC_SerpentinePattern(uint32_t nx, uint32_t ny, double dx, double dy) : _nx(nx), _ny(ny), _dx(dx), _dy(dy) {
+
+}
+
+// Serpentine point
+void USMC_SerpentinePattern::locate(uint64_t i, double& x, double& y)const {
+    uint64_t row = i / _nx;
+    uint64_t col = i % _nx;
+    if(row & 1)
+        col = _nx - 1 - col;
+    x = double(col) * _dx;
+    y = double(row) * _dy;
+}
+
+
+// Spiral constructor
+USMC_SpiralPattern::USMC_SpiralPattern(double radius, double pitch, double spacing) : _b(pitch / (2.0 * M_PI)), _spacing(spacing), _points(0) {
+    if(radius >= 0.0 && pitch > 0.0 && spacing > 0.0)
+        _points = uint64_t(floor(length(radius / _b) / spacing)) + 1;
+}
+
+// Length of the spiral r = b theta up to theta
+double USMC_SpiralPattern::length(double theta)const {
+    return _b / 2.0 * (theta * sqrt(1.0 + theta * theta) + asinh(theta));
+}
+
+// Spiral point
+void USMC_SpiralPattern::locate(uint64_t i, double& x, double& y)const {
+    double s = double(i) * _spacing;
+
+    // Invert the length (convex in theta, so Newton converges from above)
+    double theta = sqrt(2.0 * s / _b);
+    for(int k = 0; k < SPIRAL_ITERATIONS && theta > 0.0; k++)
+        theta -= (length(theta) - s) / (_b * sqrt(1.0 + theta * theta));
+
+    double r = _b * theta;
+    x = r * cos(theta);
+    y = r * sin(theta);
+}
+
+
+// Lissajous constructor
+USMC_LissajousPattern::USMC_LissajousPattern(double ax, double ay, double fx, double fy, double phase, uint64_t n) : _ax(ax), _ay(ay), _fx(fx), _fy(fy), _phase(phase), _n(n) {
+
+}
+
+// Lissajous point
+void USMC_LissajousPattern::locate(uint64_t i, double& x, double& y)const {
+    double t = 2.0 * M_PI * double(i) / double(_n);
+    x = _ax * sin(_fx * t + _phase);
+    y = _ay * sin(_fy * t);
+}
+
+
+// Rings constructor
+USMC_RingsPattern::USMC_RingsPattern(double radius, double ring_spacing, double spacing) : _ring_spacing(ring_spacing), _per_ring(1), _points(0) {
+    if(radius >= 0.0 && ring_spacing > 0.0 && spacing > 0.0) {
+        // Ring k has k times the points of the first one
+        _per_ring = std::max(int64_t(1), int64_t(llround(2.0 * M_PI * ring_spacing / spacing)));
+        uint64_t rings = uint64_t(floor(radius / ring_spacing + 1e-9));
+        _points = before(rings + 1);
+    }
+}
+
+// Rings point
+void USMC_RingsPattern::locate(uint64_t i, double& x, double& y)const {
+    if(i == 0) {
+        x = y = 0.0;
+        return;
+    }
+
+    // Ring of the point from the inverse of before(), then fix the rounding
+    uint64_t k = uint64_t(floor((1.0 + sqrt(1.0 + 8.0 * double(i - 1) / double(_per_ring))) / 2.0));
+    k = std::max(k, uint64_t(1));
+    while(k > 1 && before(k) > i)
+        k--;
+    while(before(k + 1) <= i)
+        k++;
+
+    double angle = 2.0 * M_PI * double(i - before(k)) / double(_per_ring * k);
+    double r = double(k) * _ring_spacing;
+    x = r * cos(angle);
+    y = r * sin(angle);
+}
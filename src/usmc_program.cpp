@@ -0,0 +1,472 @@
+/***************************************************//**
+ * @file    usmc_program.cpp
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#include <cstring>
+#include <usmc_program.h>
+#include <usmc_clock.h>
+
+
+// Program constructor
+USMC_Program::USMC_Program() : _compiled(false) {
+
+}
+
+// Append an instruction
+int USMC_Program::append(uint8_t opcode, int device, int32_t arg) {
+    USMC_Instruction ins;
+    memset(&ins, 0, sizeof(USMC_Instruction));
+    ins.opcode = opcode;
+    ins.device = device;
+    ins.arg = arg;
+    ins.target = -1;
+    _code.push_back(ins);
+    _compiled = false;
+    return int(_code.size()) - 1;
+}
+
+// Builder methods
+int USMC_Program::move(int device, int position) {
+    return append(USMC_OP_MOVE, device, position);
+}
+
+int USMC_Program::moveBy(int device, int distance) {
+    return append(USMC_OP_MOVE_BY, device, distance);
+}
+
+int USMC_Program::stop(int device) {
+    return append(USMC_OP_STOP, device, 0);
+}
+
+int USMC_Program::setSpeed(int device, float speed) {
+    int i = append(USMC_OP_SET_SPEED, device, 0);
+    _code[i].speed = speed;
+    return i;
+}
+
+int USMC_Program::waitIdle(int device, int timeout_ms) {
+    return append(USMC_OP_WAIT_IDLE, device, timeout_ms);
+}
+
+int USMC_Program::waitTime(int us) {
+    return append(USMC_OP_WAIT_TIME, -1, us);
+}
+
+int USMC_Program::waitFlag(int device, int flag, bool value, int timeout_ms) {
+    int i = append(USMC_OP_WAIT_FLAG, device, timeout_ms);
+    _code[i].flag = uint8_t(flag);
+    _code[i].value = value;
+    return i;
+}
+
+int USMC_Program::pulseSync(int device) {
+    return append(USMC_OP_PULSE_SYNC, device, 0);
+}
+
+int USMC_Program::loop(int count) {
+    return append(USMC_OP_LOOP, -1, count);
+}
+
+int USMC_Program::endLoop() {
+    return append(USMC_OP_END_LOOP, -1, 0);
+}
+
+int USMC_Program::branch(int device, int flag, bool value, int target) {
+    int i = append(USMC_OP_BRANCH, device, 0);
+    _code[i].flag = uint8_t(flag);
+    _code[i].value = value;
+    _code[i].target = target;
+    return i;
+}
+
+int USMC_Program::jump(int target) {
+    int i = append(USMC_OP_JUMP, -1, 0);
+    _code[i].target = target;
+    return i;
+}
+
+int USMC_Program::end() {
+    return append(USMC_OP_END, -1, 0);
+}
+
+// Change a jump target
+int USMC_Program::patch(int instruction, int target) {
+    if(instruction < 0 || instruction >= int(_code.size()))
+        return ERR_INVALID_PARAM;
+    if(_code[instruction].opcode != USMC_OP_BRANCH && _code[instruction].opcode != USMC_OP_JUMP)
+        return ERR_INVALID_PARAM;
+    _code[instruction].target = target;
+    _compiled = false;
+    return ERR_SUCCESS;
+}
+
+// Validate program and resolve loops
+int USMC_Program::compile() {
+    _compiled = false;
+
+    // Terminate program
+    if(_code.empty() || _code.back().opcode != USMC_OP_END)
+        end();
+
+    // Resolve loops and compute the loop scope of each instruction
+    std::vector<int> scope(_code.size(), -1);
+    int stack[USMC_MAX_LOOP_DEPTH];
+    int depth = 0;
+    for(size_t i = 0; i < _code.size(); i++) {
+        USMC_Instruction& ins = _code[i];
+        scope[i] = depth > 0 ? stack[depth-1] : -1;
+
+        switch(ins.opcode) {
+            case USMC_OP_LOOP:
+                if(depth >= USMC_MAX_LOOP_DEPTH)
+                    return ERR_INVALID_VALUE;
+                stack[depth++] = int(i);
+                break;
+
+            case USMC_OP_END_LOOP:
+                if(depth == 0)
+                    return ERR_INVALID_VALUE;
+                depth--;
+                ins.target = stack[depth];
+                _code[stack[depth]].target = int(i) + 1;
+                break;
+
+            case USMC_OP_SET_SPEED:
+                if(ins.speed < 16.0f || ins.speed > 5000.0f)
+                    return ERR_INVALID_VALUE;
+                break;
+
+            case USMC_OP_WAIT_FLAG:
+            case USMC_OP_BRANCH:
+                if(ins.flag > USMC_FLAG_LOFT)
+                    return ERR_INVALID_VALUE;
+                break;
+
+            case USMC_OP_WAIT_TIME:
+            case USMC_OP_WAIT_IDLE:
+                if(ins.arg < 0)
+                    return ERR_INVALID_VALUE;
+                break;
+
+            case USMC_OP_END:
+            case USMC_OP_MOVE:
+            case USMC_OP_MOVE_BY:
+            case USMC_OP_STOP:
+            case USMC_OP_PULSE_SYNC:
+            case USMC_OP_JUMP:
+                break;
+
+            default:
+                return ERR_INVALID_VALUE;
+        }
+    }
+    if(depth != 0)
+        return ERR_INVALID_VALUE;
+
+    // Jumps must stay inside the same loop (a jump to END_LOOP continues the loop)
+    for(size_t i = 0; i < _code.size(); i++) {
+        const USMC_Instruction& ins = _code[i];
+        if(ins.opcode != USMC_OP_BRANCH && ins.opcode != USMC_OP_JUMP)
+            continue;
+        if(ins.target < 0 || ins.target >= int(_code.size()))
+            return ERR_INVALID_VALUE;
+        if(scope[ins.target] != scope[i])
+            return ERR_INVALID_VALUE;
+    }
+
+    _compiled = true;
+    return ERR_SUCCESS;
+}
+
+
+// Runner constructor
+USMC_ProgramRunner::USMC_ProgramRunner(USMC* usmc) : _usmc(usmc), _started(false), _abort(false), _poll(1000) {
+    memset(&_status, 0, sizeof(USMC_ProgramStatus));
+}
+
+// Runner destructor
+USMC_ProgramRunner::~USMC_ProgramRunner() {
+    abort();
+}
+
+// Start program
+int USMC_ProgramRunner::start(const USMC_Program& program) {
+    if(!program.compiled())
+        return ERR_INVALID_PARAM;
+
+    // Check devices
+    const std::vector<USMC_Instruction>& code = program.code();
+    for(size_t i = 0; i < code.size(); i++) {
+        switch(code[i].opcode) {
+            case USMC_OP_MOVE:
+            case USMC_OP_MOVE_BY:
+            case USMC_OP_STOP:
+            case USMC_OP_SET_SPEED:
+            case USMC_OP_WAIT_IDLE:
+            case USMC_OP_WAIT_FLAG:
+            case USMC_OP_PULSE_SYNC:
+            case USMC_OP_BRANCH:
+                if(code[i].device < 0 || code[i].device >= int(_usmc->countDevices()))
+                    return ERR_INVALID_ID;
+                break;
+        }
+    }
+
+    {
+        USMC_lock status_lock(&_lock);
+        if(_status.running)
+            return ERR_USB_BUSY;
+    }
+
+    // Join previous run
+    if(_started) {
+        pthread_join(_thread, NULL);
+        _started = false;
+    }
+
+    _code = code;
+    _abort = false;
+    {
+        USMC_lock status_lock(&_lock);
+        memset(&_status, 0, sizeof(USMC_ProgramStatus));
+        _status.running = true;
+    }
+
+    if(pthread_create(&_thread, NULL, USMC_ProgramRunner::thread_main, this)) {
+        USMC_lock status_lock(&_lock);
+        _status.running = false;
+        return ERR_USB_NO_MEM;
+    }
+    _started = true;
+    return ERR_SUCCESS;
+}
+
+// Abort program
+void USMC_ProgramRunner::abort() {
+    if(!_started)
+        return;
+    _abort = true;
+    pthread_join(_thread, NULL);
+    _started = false;
+
+    // Stop the devices if the program was interrupted
+    if(_status.result == ERR_USB_INTERRUPTED) {
+        std::vector<bool> stopped(_usmc->countDevices(), false);
+        for(size_t i = 0; i < _code.size(); i++) {
+            int dev = _code[i].device;
+            if(dev >= 0 && dev < int(stopped.size()) && !stopped[dev]) {
+                _usmc->stop(dev);
+                stopped[dev] = true;
+            }
+        }
+    }
+}
+
+// Wait for program to finish
+int USMC_ProgramRunner::wait() {
+    if(_started) {
+        pthread_join(_thread, NULL);
+        _started = false;
+    }
+    USMC_lock status_lock(&_lock);
+    return _status.result;
+}
+
+// Set polling period
+void USMC_ProgramRunner::setPollPeriod(uint32_t us) {
+    _poll = us;
+}
+
+// Get status
+void USMC_ProgramRunner::getStatus(USMC_ProgramStatus* status) {
+    if(NULL == status)
+        return;
+    USMC_lock status_lock(&_lock);
+    memcpy((void*)status, (void*)&_status, sizeof(USMC_ProgramStatus));
+}
+
+// Get a flag from the device state
+bool USMC_ProgramRunner::getFlag(const USMC_State& state, int flag) {
+    switch(flag) {
+        case USMC_FLAG_RUN:       return state.RUN;
+        case USMC_FLAG_POWER:     return state.Power;
+        case USMC_FLAG_FULLSPEED: return state.FullSpeed;
+        case USMC_FLAG_SYNCIN:    return state.SyncIN;
+        case USMC_FLAG_SYNCOUT:   return state.SyncOUT;
+        case USMC_FLAG_ROTTR:     return state.RotTr;
+        case USMC_FLAG_ROTTRERR:  return state.RotTrErr;
+        case USMC_FLAG_EMRESET:   return state.EmReset;
+        case USMC_FLAG_TRAILER1:  return state.Trailer1;
+        case USMC_FLAG_TRAILER2:  return state.Trailer2;
+        case USMC_FLAG_LOFT:      return state.Loft;
+        default:                  return false;
+    }
+}
+
+// Thread entry point
+void* USMC_ProgramRunner::thread_main(void* arg) {
+    USMC_ProgramRunner* runner = reinterpret_cast<USMC_ProgramRunner*>(arg);
+    int r = runner->run();
+
+    USMC_lock status_lock(&(runner->_lock));
+    runner->_status.result = r;
+    runner->_status.running = false;
+    return NULL;
+}
+
+// Poll a device flag
+int USMC_ProgramRunner::waitCondition(int device, int flag, bool value, int timeout_ms) {
+    uint64_t start = usmc_time_us();
+    while(!_abort) {
+        USMC_State state;
+        int r = _usmc->getState(device, &state);
+        if(r < 0)
+            return r;
+        if(getFlag(state, flag) == value)
+            return ERR_SUCCESS;
+        if(timeout_ms > 0 && usmc_time_us() - start >= uint64_t(timeout_ms) * 1000ULL)
+            return ERR_USB_TIMEOUT;
+        usmc_sleep_us(_poll);
+    }
+    return ERR_USB_INTERRUPTED;
+}
+
+// Interpreter
+int USMC_ProgramRunner::run() {
+    int counters[USMC_MAX_LOOP_DEPTH];
+    int depth = 0;
+    int pc = 0;
+    int r = ERR_SUCCESS;
+
+    while(!_abort && pc >= 0 && pc < int(_code.size())) {
+        const USMC_Instruction& ins = _code[pc];
+        int next = pc + 1;
+        bool iteration = false;
+
+        {
+            USMC_lock status_lock(&_lock);
+            _status.pc = pc;
+        }
+
+        switch(ins.opcode) {
+            case USMC_OP_END:
+                next = int(_code.size());
+                break;
+
+            case USMC_OP_MOVE:
+                r = _usmc->moveTo(ins.device, ins.arg);
+                break;
+
+            case USMC_OP_MOVE_BY: {
+                USMC_State state;
+                r = _usmc->getState(ins.device, &state);
+                if(r == ERR_SUCCESS)
+                    r = _usmc->moveTo(ins.device, state.CurPos + ins.arg);
+                break;
+            }
+
+            case USMC_OP_STOP:
+                r = _usmc->stop(ins.device);
+                break;
+
+            case USMC_OP_SET_SPEED:
+                r = _usmc->setSpeed(ins.device, ins.speed);
+                break;
+
+            case USMC_OP_WAIT_IDLE:
+                r = waitCondition(ins.device, USMC_FLAG_RUN, false, ins.arg);
+                break;
+
+            case USMC_OP_WAIT_TIME: {
+                uint64_t deadline = usmc_time_us() + uint64_t(ins.arg);
+                uint64_t now;
+                while(!_abort && (now = usmc_time_us()) < deadline)
+                    usmc_sleep_us((deadline - now) < _poll ? (deadline - now) : _poll);
+                break;
+            }
+
+            case USMC_OP_WAIT_FLAG:
+                r = waitCondition(ins.device, ins.flag, ins.value, ins.arg);
+                break;
+
+            case USMC_OP_PULSE_SYNC: {
+                USMC_Mode mode;
+                r = _usmc->getMode(ins.device, &mode);
+                if(r < 0)
+                    break;
+                mode.SyncInvert = !mode.SyncInvert;
+                r = _usmc->setMode(ins.device, &mode);
+                if(r < 0)
+                    break;
+                mode.SyncInvert = !mode.SyncInvert;
+                r = _usmc->setMode(ins.device, &mode);
+                break;
+            }
+
+            case USMC_OP_LOOP:
+                if(ins.arg <= 0)
+                    next = ins.target;
+                else
+                    counters[depth++] = ins.arg;
+                break;
+
+            case USMC_OP_END_LOOP:
+                iteration = true;
+                if(--counters[depth-1] > 0)
+                    next = ins.target + 1;
+                else
+                    depth--;
+                break;
+
+            case USMC_OP_BRANCH: {
+                USMC_State state;
+                r = _usmc->getState(ins.device, &state);
+                if(r == ERR_SUCCESS && getFlag(state, ins.flag) == ins.value)
+                    next = ins.target;
+                break;
+            }
+
+            case USMC_OP_JUMP:
+                next = ins.target;
+                break;
+        }
+
+        if(r < 0)
+            break;
+
+        {
+            USMC_lock status_lock(&_lock);
+            _status.executed++;
+            if(iteration)
+                _status.iterations++;
+        }
+        pc = next;
+    }
+
+    if(_abort && r == ERR_SUCCESS && pc < int(_code.size()))
+        r = ERR_USB_INTERRUPTED;
+    return r;
+}
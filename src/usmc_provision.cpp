@@ -0,0 +1,210 @@
+/***************************************************//**
+ * @file    usmc_provision.cpp
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+
+#include <cstring>
+#include <libusmc_impl.h>
+#include <usmc_device.h>
+#include <usmc_clock.h>
+#include <usmc_provision.h>
+
+
+// Constructor
+USMC_Provisioner::USMC_Provisioner(USMC* usmc) : _usmc(usmc), _set_mode(false), _set_params(false), _save(true), _threads(0), _results(NULL), _next(0) {
+    memset(&_mode, 0, sizeof(USMC_Mode));
+    memset(&_params, 0, sizeof(USMC_Parameters));
+}
+
+// Destructor
+USMC_Provisioner::~USMC_Provisioner() {
+
+}
+
+// Set password
+int USMC_Provisioner::setPassword(const std::string& password) {
+    if(password.size() > USMC_SERIAL_LENGTH)
+        return ERR_INVALID_VALUE;
+    _password = password;
+    return ERR_SUCCESS;
+}
+
+// Set mode
+void USMC_Provisioner::setMode(const USMC_Mode* mode) {
+    _set_mode = (NULL != mode);
+    if(_set_mode)
+        _mode = *mode;
+}
+
+// Set parameters
+void USMC_Provisioner::setParameters(const USMC_Parameters* parameters) {
+    _set_params = (NULL != parameters);
+    if(_set_params)
+        _params = *parameters;
+}
+
+// Add a device
+int USMC_Provisioner::addDevice(int device, const std::string& serial) {
+    if(device < 0 || size_t(device) >= _usmc->countDevices())
+        return ERR_INVALID_ID;
+    if(serial.size() > USMC_SERIAL_LENGTH || serial.find('\0') != std::string::npos)
+        return ERR_INVALID_VALUE;
+    for(size_t i = 0; i < _jobs.size(); i++) {
+        if(_jobs[i].device == device)
+            return ERR_INVALID_PARAM;
+        if(!serial.empty() && _jobs[i].serial == serial)
+            return ERR_INVALID_VALUE;
+    }
+    job j;
+    j.device = device;
+    j.serial = serial;
+    _jobs.push_back(j);
+    return ERR_SUCCESS;
+}
+
+// Run the batch
+int USMC_Provisioner::run(std::vector<USMC_ProvisionResult>& results) {
+    results.resize(_jobs.size());
+    for(size_t i = 0; i < _jobs.size(); i++) {
+        memset(&results[i], 0, sizeof(USMC_ProvisionResult));
+        results[i].device = _jobs[i].device;
+    }
+    if(_jobs.empty())
+        return ERR_SUCCESS;
+
+    _results = &results;
+    _next = 0;
+
+    size_t nthreads = (_threads > 0 && size_t(_threads) < _jobs.size()) ? size_t(_threads) : _jobs.size();
+    std::vector<pthread_t> threads(nthreads);
+    size_t started = 0;
+    for(; started < nthreads; started++) {
+        if(pthread_create(&threads[started], NULL, USMC_Provisioner::thread_main, this))
+            break;
+    }
+    // With no thread at all the batch runs on the caller
+    if(started == 0)
+        thread_main(this);
+    for(size_t i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    _results = NULL;
+
+    for(size_t i = 0; i < results.size(); i++) {
+        if(results[i].result < 0)
+            return results[i].result;
+    }
+    return ERR_SUCCESS;
+}
+
+// Thread entry point
+void* USMC_Provisioner::thread_main(void* arg) {
+    USMC_Provisioner* self = static_cast<USMC_Provisioner*>(arg);
+    while(true) {
+        size_t i = __atomic_fetch_add(&self->_next, 1, __ATOMIC_RELAXED);
+        if(i >= self->_jobs.size())
+            break;
+        self->provision(self->_jobs[i], (*self->_results)[i]);
+    }
+    return NULL;
+}
+
+// Provision one device
+void USMC_Provisioner::provision(const job& j, USMC_ProvisionResult& result) {
+    uint64_t t0 = usmc_time_us();
+
+    USMC_Device handle;
+    result.step = USMC_PROVISION_DEVICE;
+    result.result = _usmc->getDevice(j.device, &handle);
+    if(result.result == 0) {
+        strncpy(result.old_serial, handle.serial().c_str(), USMC_SERIAL_LENGTH);
+        result.result = steps(j, handle, result);
+        if(result.result == 0)
+            result.step = 0;
+    }
+    result.time = double(usmc_time_us() - t0) / 1e6;
+}
+
+// Provisioning steps (result.step is left at the step that failed)
+int USMC_Provisioner::steps(const job& j, USMC_Device& handle, USMC_ProvisionResult& result) {
+    USMC_impl* impl = handle._impl;
+    USMC_DeviceRecord* dev = handle._dev;
+    int r;
+
+    // Serial number
+    if(!j.serial.empty()) {
+        result.step = USMC_PROVISION_SERIAL;
+        r = impl->usmc_set_serial(*dev, j.serial.c_str(), _password.c_str());
+        if(r < 0)
+            return r;
+    }
+
+    // Profile
+    if(_set_mode) {
+        result.step = USMC_PROVISION_MODE;
+        r = _usmc->setMode(j.device, &_mode);
+        if(r < 0)
+            return r;
+    }
+    if(_set_params) {
+        result.step = USMC_PROVISION_PARAMETERS;
+        r = _usmc->setParameters(j.device, &_params);
+        if(r < 0)
+            return r;
+    }
+
+    // EEPROM
+    if(_save) {
+        result.step = USMC_PROVISION_SAVE;
+        r = impl->usmc_save(*dev);
+        if(r < 0)
+            return r;
+    }
+
+    // Read back the serial number
+    result.step = USMC_PROVISION_VERIFY;
+    char serial[USMC_SERIAL_LENGTH*2];
+    r = impl->usmc_get_serial(*dev, serial, sizeof(serial));
+    if(r < 0)
+        return r;
+    strncpy(result.serial, serial, USMC_SERIAL_LENGTH);
+    {
+        // Keep the device record consistent with the controller
+        USMC_write_lock cache_lock(&dev->cache_lock);
+        dev->serial = serial;
+    }
+    if(!j.serial.empty() && j.serial != serial)
+        return ERR_VERIFY;
+
+    // Check that the controller answers with the power state of the mode
+    USMC_State state;
+    r = handle.getState(&state);
+    if(r < 0)
+        return r;
+    if(_set_mode && state.Power != !(_mode.ResetD || _mode.EMReset))
+        return ERR_VERIFY;
+
+    return ERR_SUCCESS;
+}
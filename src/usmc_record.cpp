@@ -0,0 +1,778 @@
+/***************************************************//**
+ * @file    usmc_record.cpp
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <stdexcept>
+#include <pthread.h>
+#include <usmc_record.h>
+#include <usmc_device.h>
+#include <usmc_clock.h>
+
+// Session file header
+#define RECORD_HEADER   "# libusmc session v1"
+
+// Maximum length of a record
+#define RECORD_MAXLEN   1024
+
+// Maximum number of arguments of a record
+#define RECORD_MAXARGS  32
+
+
+// Recorded methods (the order must match the method table)
+enum {
+    M_PROBEDEVICES = 0,
+    M_COUNTDEVICES,
+    M_GETDEVICEID,
+    M_GETDEVICE,
+    M_DEBUG,
+    M_SET_ERROR_LOGGER,
+    M_SET_WARN_LOGGER,
+    M_SET_INFO_LOGGER,
+    M_SET_DEBUG_LOGGER,
+    M_GETSERIALNUMBER,
+    M_GETBUSPATH,
+    M_GETVERSION,
+    M_GETSTATE,
+    M_GETMODE,
+    M_SETMODE,
+    M_GETPARAMETERS,
+    M_SETPARAMETERS,
+    M_GETSTARTPARAMETERS,
+    M_SETSTARTPARAMETERS,
+    M_GETSPEED,
+    M_SETSPEED,
+    M_MOVETO,
+    M_STOP,
+    M_SETCURRENTPOSITION,
+    M_GETENCODERSTATE,
+    M_ADDEXCLUSIONZONE,
+    M_CLEAREXCLUSIONZONES,
+    M_GETLOCKSTATS,
+    M_COUNT
+};
+
+// Method table: name, number of numeric arguments (-1 for the quoted
+// serial string) and whether the call is re-issued by the replayer
+static const struct {
+    const char* name;
+    int nargs;
+    bool replay;
+} methods[M_COUNT] = {
+    { "probeDevices",        0,  false },
+    { "countDevices",        0,  true },
+    { "getDeviceID",        -1,  true },
+    { "getDevice",           1,  true },
+    { "debug",               1,  false },
+    { "set_error_logger",    0,  false },
+    { "set_warn_logger",     0,  false },
+    { "set_info_logger",     0,  false },
+    { "set_debug_logger",    0,  false },
+    { "getSerialNumber",     1,  true },
+    { "getBusPath",          1,  true },
+    { "getVersion",          1,  true },
+    { "getState",            1,  true },
+    { "getMode",             1,  true },
+    { "setMode",             25, true },
+    { "getParameters",       1,  true },
+    { "setParameters",       23, true },
+    { "getStartParameters",  1,  true },
+    { "setStartParameters",  8,  true },
+    { "getSpeed",            1,  true },
+    { "setSpeed",            2,  true },
+    { "moveTo",              2,  true },
+    { "stop",                1,  true },
+    { "setCurrentPosition",  2,  true },
+    { "getEncoderState",     1,  true },
+    { "addExclusionZone",    6,  true },
+    { "clearExclusionZones", 0,  true },
+    { "getLockStats",        1,  true },
+};
+
+
+// Quote a serial number: '"' and '\\' are escaped with a backslash and the
+// bytes outside the printable range (space included) written as \xHH, so the
+// record keeps its fields separated by single spaces even for empty serials
+static std::string quote_serial(const std::string& serial) {
+    std::string out("\"");
+    for(size_t i = 0; i < serial.size(); i++) {
+        unsigned char ch = (unsigned char)serial[i];
+        if(ch == '"' || ch == '\\') {
+            out += '\\';
+            out += char(ch);
+        } else if(ch <= ' ' || ch >= 0x7F) {
+            char hex[8];
+            snprintf(hex, sizeof(hex), "\\x%02X", ch);
+            out += hex;
+        } else {
+            out += char(ch);
+        }
+    }
+    out += '"';
+    return out;
+}
+
+// Parse a quoted serial number
+static bool unquote_serial(const char* p, std::string& serial) {
+    while(*p == ' ')
+        p++;
+    if(*p++ != '"')
+        return false;
+    serial.clear();
+    for(; *p && *p != '"'; p++) {
+        if(*p != '\\') {
+            serial += *p;
+            continue;
+        }
+        p++;
+        if(*p == 'x') {
+            unsigned int ch = 0;
+            if(!isxdigit((unsigned char)p[1]) || !isxdigit((unsigned char)p[2]) || sscanf(p + 1, "%2x", &ch) != 1)
+                return false;
+            serial += char(ch);
+            p += 2;
+        } else if(*p == '"' || *p == '\\') {
+            serial += *p;
+        } else {
+            return false;
+        }
+    }
+    return *p == '"';
+}
+
+
+// Small per-thread id used in the records
+static __thread int record_thread = -1;
+static int record_threads = 0;
+
+static int thread_id() {
+    if(record_thread < 0)
+        record_thread = __atomic_fetch_add(&record_threads, 1, __ATOMIC_RELAXED);
+    return record_thread;
+}
+
+
+// Format structure arguments
+static void format_mode(char* buffer, size_t len, int device, const USMC_Mode* m) {
+    snprintf(buffer, len, "%d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %u %d %d %d %d %d",
+             device, m->PMode, m->PReg, m->ResetD, m->EMReset, m->Tr1T, m->Tr2T, m->RotTrT, m->TrSwap,
+             m->Tr1En, m->Tr2En, m->RotTeEn, m->RotTrOp, m->Butt1T, m->Butt2T, m->ResetRT, m->SyncOUTEn,
+             m->SyncOUTR, m->SyncINOp, m->SyncCount, m->SyncInvert, m->EncoderEn, m->EncoderInv,
+             m->ResBEnc, m->ResEnc);
+}
+
+static void format_params(char* buffer, size_t len, int device, const USMC_Parameters* p) {
+    snprintf(buffer, len, "%d %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %u %u %u %u %.9g %u %.9g %.9g",
+             device, p->AccelT, p->DecelT, p->PTimeout, p->BTimeout1, p->BTimeout2, p->BTimeout3,
+             p->BTimeout4, p->BTimeoutR, p->BTimeoutD, p->MinP, p->BTO1P, p->BTO2P, p->BTO3P, p->BTO4P,
+             p->MaxLoft, p->StartPos, p->RTDelta, p->RTMinError, p->MaxTemp, p->SynOUTP,
+             p->LoftPeriod, p->EncMult);
+}
+
+static void format_start(char* buffer, size_t len, int device, const USMC_StartParameters* s) {
+    snprintf(buffer, len, "%d %u %d %d %d %d %d %d", device, s->SDivisor, s->DefDir, s->LoftEn,
+             s->SlStart, s->WSyncIN, s->SyncOUTR, s->ForceLoft);
+}
+
+
+// Recorder constructor
+USMC_recorder::USMC_recorder(USMC* usmc, const char* filename, bool own)
+    : _usmc(usmc), _own(own), _file(NULL)
+{
+    _file = fopen(filename, "w");
+    if(NULL == _file)
+        throw std::runtime_error("Failed to create session file");
+    fprintf(_file, "%s\n", RECORD_HEADER);
+    fprintf(_file, "# start_us thread duration_us method result arguments\n");
+    _t0 = usmc_time_us();
+}
+
+
+// Recorder destructor
+USMC_recorder::~USMC_recorder() {
+    fclose(_file);
+    if(_own)
+        delete _usmc;
+}
+
+
+// Flush records
+void USMC_recorder::flush() {
+    USMC_lock lock(&_lock);
+    fflush(_file);
+}
+
+
+// Write a record
+void USMC_recorder::record(uint64_t start, const char* method, int result, const char* args)const {
+    uint64_t end = usmc_time_us();
+    int thread = thread_id();
+    USMC_lock lock(&_lock);
+    fprintf(_file, "%llu %d %llu %s %d%s%s\n", (unsigned long long)(start - _t0), thread,
+            (unsigned long long)(end - start), method, result, args ? " " : "", args ? args : "");
+}
+
+
+// Recorded calls
+int USMC_recorder::probeDevices() {
+    uint64_t t = usmc_time_us();
+    int res = _usmc->probeDevices();
+    record(t, methods[M_PROBEDEVICES].name, res, NULL);
+    return res;
+}
+
+size_t USMC_recorder::countDevices()const {
+    uint64_t t = usmc_time_us();
+    size_t res = _usmc->countDevices();
+    record(t, methods[M_COUNTDEVICES].name, int(res), NULL);
+    return res;
+}
+
+int USMC_recorder::getDeviceID(const std::string& serial)const {
+    uint64_t t = usmc_time_us();
+    int res = _usmc->getDeviceID(serial);
+    record(t, methods[M_GETDEVICEID].name, res, quote_serial(serial).c_str());
+    return res;
+}
+
+int USMC_recorder::getDevice(int device, USMC_Device* handle) {
+    char args[16];
+    snprintf(args, sizeof(args), "%d", device);
+    uint64_t t = usmc_time_us();
+    int res = _usmc->getDevice(device, handle);
+    record(t, methods[M_GETDEVICE].name, res, args);
+    return res;
+}
+
+void USMC_recorder::debug(bool en) {
+    uint64_t t = usmc_time_us();
+    _usmc->debug(en);
+    record(t, methods[M_DEBUG].name, 0, en ? "1" : "0");
+}
+
+void USMC_recorder::set_error_logger(void (*logger)(const char*, ...)) {
+    uint64_t t = usmc_time_us();
+    _usmc->set_error_logger(logger);
+    record(t, methods[M_SET_ERROR_LOGGER].name, 0, NULL);
+}
+
+void USMC_recorder::set_warn_logger(void (*logger)(const char*, ...)) {
+    uint64_t t = usmc_time_us();
+    _usmc->set_warn_logger(logger);
+    record(t, methods[M_SET_WARN_LOGGER].name, 0, NULL);
+}
+
+void USMC_recorder::set_info_logger(void (*logger)(const char*, ...)) {
+    uint64_t t = usmc_time_us();
+    _usmc->set_info_logger(logger);
+    record(t, methods[M_SET_INFO_LOGGER].name, 0, NULL);
+}
+
+void USMC_recorder::set_debug_logger(void (*logger)(const char*, ...)) {
+    uint64_t t = usmc_time_us();
+    _usmc->set_debug_logger(logger);
+    record(t, methods[M_SET_DEBUG_LOGGER].name, 0, NULL);
+}
+
+int USMC_recorder::getSerialNumber(int device, std::string& serial)const {
+    char args[16];
+    snprintf(args, sizeof(args), "%d", device);
+    uint64_t t = usmc_time_us();
+    int res = _usmc->getSerialNumber(device, serial);
+    record(t, methods[M_GETSERIALNUMBER].name, res, args);
+    return res;
+}
+
+int USMC_recorder::getBusPath(int device, std::string& path)const {
+    char args[16];
+    snprintf(args, sizeof(args), "%d", device);
+    uint64_t t = usmc_time_us();
+    int res = _usmc->getBusPath(device, path);
+    record(t, methods[M_GETBUSPATH].name, res, args);
+    return res;
+}
+
+int USMC_recorder::getVersion(int device, uint32_t& version)const {
+    char args[16];
+    snprintf(args, sizeof(args), "%d", device);
+    uint64_t t = usmc_time_us();
+    int res = _usmc->getVersion(device, version);
+    record(t, methods[M_GETVERSION].name, res, args);
+    return res;
+}
+
+int USMC_recorder::getState(int device, USMC_State *state) {
+    char args[16];
+    snprintf(args, sizeof(args), "%d", device);
+    uint64_t t = usmc_time_us();
+    int res = _usmc->getState(device, state);
+    record(t, methods[M_GETSTATE].name, res, args);
+    return res;
+}
+
+int USMC_recorder::getMode(int device, USMC_Mode* mode)const {
+    char args[16];
+    snprintf(args, sizeof(args), "%d", device);
+    uint64_t t = usmc_time_us();
+    int res = _usmc->getMode(device, mode);
+    record(t, methods[M_GETMODE].name, res, args);
+    return res;
+}
+
+int USMC_recorder::setMode(int device, const USMC_Mode* mode) {
+    char args[RECORD_MAXLEN / 2];
+    if(mode)
+        format_mode(args, sizeof(args), device, mode);
+    uint64_t t = usmc_time_us();
+    int res = _usmc->setMode(device, mode);
+    // A NULL structure cannot be replayed and is not recorded
+    if(mode)
+        record(t, methods[M_SETMODE].name, res, args);
+    return res;
+}
+
+int USMC_recorder::getParameters(int device, USMC_Parameters* parameters)const {
+    char args[16];
+    snprintf(args, sizeof(args), "%d", device);
+    uint64_t t = usmc_time_us();
+    int res = _usmc->getParameters(device, parameters);
+    record(t, methods[M_GETPARAMETERS].name, res, args);
+    return res;
+}
+
+int USMC_recorder::setParameters(int device, const USMC_Parameters* parameters) {
+    char args[RECORD_MAXLEN / 2];
+    if(parameters)
+        format_params(args, sizeof(args), device, parameters);
+    uint64_t t = usmc_time_us();
+    int res = _usmc->setParameters(device, parameters);
+    if(parameters)
+        record(t, methods[M_SETPARAMETERS].name, res, args);
+    return res;
+}
+
+int USMC_recorder::getStartParameters(int device, USMC_StartParameters* start_params)const {
+    char args[16];
+    snprintf(args, sizeof(args), "%d", device);
+    uint64_t t = usmc_time_us();
+    int res = _usmc->getStartParameters(device, start_params);
+    record(t, methods[M_GETSTARTPARAMETERS].name, res, args);
+    return res;
+}
+
+int USMC_recorder::setStartParameters(int device, const USMC_StartParameters* start_params) {
+    char args[128];
+    if(start_params)
+        format_start(args, sizeof(args), device, start_params);
+    uint64_t t = usmc_time_us();
+    int res = _usmc->setStartParameters(device, start_params);
+    if(start_params)
+        record(t, methods[M_SETSTARTPARAMETERS].name, res, args);
+    return res;
+}
+
+int USMC_recorder::getSpeed(int device, float& speed)const {
+    char args[16];
+    snprintf(args, sizeof(args), "%d", device);
+    uint64_t t = usmc_time_us();
+    int res = _usmc->getSpeed(device, speed);
+    record(t, methods[M_GETSPEED].name, res, args);
+    return res;
+}
+
+int USMC_recorder::setSpeed(int device, float speed) {
+    char args[48];
+    snprintf(args, sizeof(args), "%d %.9g", device, speed);
+    uint64_t t = usmc_time_us();
+    int res = _usmc->setSpeed(device, speed);
+    record(t, methods[M_SETSPEED].name, res, args);
+    return res;
+}
+
+int USMC_recorder::moveTo(int device, int destination) {
+    char args[32];
+    snprintf(args, sizeof(args), "%d %d", device, destination);
+    uint64_t t = usmc_time_us();
+    int res = _usmc->moveTo(device, destination);
+    record(t, methods[M_MOVETO].name, res, args);
+    return res;
+}
+
+int USMC_recorder::stop(int device) {
+    char args[16];
+    snprintf(args, sizeof(args), "%d", device);
+    uint64_t t = usmc_time_us();
+    int res = _usmc->stop(device);
+    record(t, methods[M_STOP].name, res, args);
+    return res;
+}
+
+int USMC_recorder::setCurrentPosition(int device, int position) {
+    char args[32];
+    snprintf(args, sizeof(args), "%d %d", device, position);
+    uint64_t t = usmc_time_us();
+    int res = _usmc->setCurrentPosition(device, position);
+    record(t, methods[M_SETCURRENTPOSITION].name, res, args);
+    return res;
+}
+
+int USMC_recorder::getEncoderState(int device, USMC_EncoderState* state) {
+    char args[16];
+    snprintf(args, sizeof(args), "%d", device);
+    uint64_t t = usmc_time_us();
+    int res = _usmc->getEncoderState(device, state);
+    record(t, methods[M_GETENCODERSTATE].name, res, args);
+    return res;
+}
+
+int USMC_recorder::addExclusionZone(int deviceA, int minA, int maxA, int deviceB, int minB, int maxB) {
+    char args[96];
+    snprintf(args, sizeof(args), "%d %d %d %d %d %d", deviceA, minA, maxA, deviceB, minB, maxB);
+    uint64_t t = usmc_time_us();
+    int res = _usmc->addExclusionZone(deviceA, minA, maxA, deviceB, minB, maxB);
+    record(t, methods[M_ADDEXCLUSIONZONE].name, res, args);
+    return res;
+}
+
+void USMC_recorder::clearExclusionZones() {
+    uint64_t t = usmc_time_us();
+    _usmc->clearExclusionZones();
+    record(t, methods[M_CLEAREXCLUSIONZONES].name, 0, NULL);
+}
+
+int USMC_recorder::getLockStats(int device, USMC_LockStats* stats)const {
+    char args[16];
+    snprintf(args, sizeof(args), "%d", device);
+    uint64_t t = usmc_time_us();
+    int res = _usmc->getLockStats(device, stats);
+    record(t, methods[M_GETLOCKSTATS].name, res, args);
+    return res;
+}
+
+
+// Replayer constructor
+USMC_replayer::USMC_replayer(USMC* usmc)
+    : _usmc(usmc)
+{
+
+}
+
+
+// Parse a record
+bool USMC_replayer::parse(const char* line, call& c) {
+    unsigned long long time, duration;
+    char method[32];
+    int n = 0;
+    if(sscanf(line, "%llu %d %llu %31s %d%n", &time, &c.thread, &duration, method, &c.result, &n) != 5)
+        return false;
+    if(c.thread < 0)
+        return false;
+    c.time = time;
+    c.duration = uint32_t(duration);
+
+    c.method = -1;
+    for(int i = 0; i < M_COUNT; i++) {
+        if(strcmp(method, methods[i].name) == 0) {
+            c.method = i;
+            break;
+        }
+    }
+    if(c.method < 0)
+        return false;
+
+    const char* p = line + n;
+    if(methods[c.method].nargs < 0) {
+        // Serial number
+        return unquote_serial(p, c.serial);
+    }
+
+    // Numeric arguments
+    double v[RECORD_MAXARGS];
+    int nargs = 0;
+    while(nargs < RECORD_MAXARGS) {
+        char* end = NULL;
+        double val = strtod(p, &end);
+        if(end == p)
+            break;
+        v[nargs++] = val;
+        p = end;
+    }
+    if(nargs != methods[c.method].nargs)
+        return false;
+
+    for(int i = 0; i < nargs && i < 6; i++)
+        c.args[i] = int(v[i]);
+
+    switch(c.method) {
+        case M_SETMODE: {
+            USMC_Mode& m = c.mode;
+            m.PMode = v[1] != 0; m.PReg = v[2] != 0; m.ResetD = v[3] != 0; m.EMReset = v[4] != 0;
+            m.Tr1T = v[5] != 0; m.Tr2T = v[6] != 0; m.RotTrT = v[7] != 0; m.TrSwap = v[8] != 0;
+            m.Tr1En = v[9] != 0; m.Tr2En = v[10] != 0; m.RotTeEn = v[11] != 0; m.RotTrOp = v[12] != 0;
+            m.Butt1T = v[13] != 0; m.Butt2T = v[14] != 0; m.ResetRT = v[15] != 0; m.SyncOUTEn = v[16] != 0;
+            m.SyncOUTR = v[17] != 0; m.SyncINOp = v[18] != 0; m.SyncCount = uint32_t(v[19]);
+            m.SyncInvert = v[20] != 0; m.EncoderEn = v[21] != 0; m.EncoderInv = v[22] != 0;
+            m.ResBEnc = v[23] != 0; m.ResEnc = v[24] != 0;
+            break;
+        }
+        case M_SETPARAMETERS: {
+            USMC_Parameters& p = c.params;
+            p.AccelT = float(v[1]); p.DecelT = float(v[2]); p.PTimeout = float(v[3]);
+            p.BTimeout1 = float(v[4]); p.BTimeout2 = float(v[5]); p.BTimeout3 = float(v[6]);
+            p.BTimeout4 = float(v[7]); p.BTimeoutR = float(v[8]); p.BTimeoutD = float(v[9]);
+            p.MinP = float(v[10]); p.BTO1P = float(v[11]); p.BTO2P = float(v[12]);
+            p.BTO3P = float(v[13]); p.BTO4P = float(v[14]); p.MaxLoft = uint16_t(v[15]);
+            p.StartPos = uint32_t(v[16]); p.RTDelta = uint16_t(v[17]); p.RTMinError = uint16_t(v[18]);
+            p.MaxTemp = float(v[19]); p.SynOUTP = uint8_t(v[20]); p.LoftPeriod = float(v[21]);
+            p.EncMult = float(v[22]);
+            break;
+        }
+        case M_SETSTARTPARAMETERS: {
+            USMC_StartParameters& s = c.start;
+            s.SDivisor = uint8_t(v[1]); s.DefDir = v[2] != 0; s.LoftEn = v[3] != 0;
+            s.SlStart = v[4] != 0; s.WSyncIN = v[5] != 0; s.SyncOUTR = v[6] != 0;
+            s.ForceLoft = v[7] != 0;
+            break;
+        }
+        case M_SETSPEED:
+            c.speed = float(v[1]);
+            break;
+        default:
+            break;
+    }
+    return true;
+}
+
+
+// Load a session file
+int USMC_replayer::load(const char* filename) {
+    FILE* fp = fopen(filename, "r");
+    if(NULL == fp)
+        return ERR_INVALID_PARAM;
+
+    std::vector<call> calls;
+    char line[RECORD_MAXLEN];
+    bool header = false;
+    while(fgets(line, sizeof(line), fp)) {
+        if(!header) {
+            if(strncmp(line, RECORD_HEADER, strlen(RECORD_HEADER)) != 0)
+                break;
+            header = true;
+            continue;
+        }
+        if(line[0] == '#' || line[0] == '\n')
+            continue;
+        call c;
+        memset(c.args, 0, sizeof(c.args));
+        if(!parse(line, c)) {
+            fclose(fp);
+            return ERR_INVALID_VALUE;
+        }
+        calls.push_back(c);
+    }
+    fclose(fp);
+    if(!header)
+        return ERR_INVALID_VALUE;
+
+    _calls.swap(calls);
+    return int(_calls.size());
+}
+
+
+// Issue a call
+int USMC_replayer::issue(const call& c) {
+    switch(c.method) {
+        case M_COUNTDEVICES:
+            return int(_usmc->countDevices());
+        case M_GETDEVICEID:
+            return _usmc->getDeviceID(c.serial);
+        case M_GETDEVICE: {
+            USMC_Device handle;
+            return _usmc->getDevice(c.args[0], &handle);
+        }
+        case M_GETSERIALNUMBER: {
+            std::string serial;
+            return _usmc->getSerialNumber(c.args[0], serial);
+        }
+        case M_GETBUSPATH: {
+            std::string path;
+            return _usmc->getBusPath(c.args[0], path);
+        }
+        case M_GETVERSION: {
+            uint32_t version;
+            return _usmc->getVersion(c.args[0], version);
+        }
+        case M_GETSTATE: {
+            USMC_State state;
+            return _usmc->getState(c.args[0], &state);
+        }
+        case M_GETMODE: {
+            USMC_Mode mode;
+            return _usmc->getMode(c.args[0], &mode);
+        }
+        case M_SETMODE:
+            return _usmc->setMode(c.args[0], &c.mode);
+        case M_GETPARAMETERS: {
+            USMC_Parameters params;
+            return _usmc->getParameters(c.args[0], &params);
+        }
+        case M_SETPARAMETERS:
+            return _usmc->setParameters(c.args[0], &c.params);
+        case M_GETSTARTPARAMETERS: {
+            USMC_StartParameters start;
+            return _usmc->getStartParameters(c.args[0], &start);
+        }
+        case M_SETSTARTPARAMETERS:
+            return _usmc->setStartParameters(c.args[0], &c.start);
+        case M_GETSPEED: {
+            float speed;
+            return _usmc->getSpeed(c.args[0], speed);
+        }
+        case M_SETSPEED:
+            return _usmc->setSpeed(c.args[0], c.speed);
+        case M_MOVETO:
+            return _usmc->moveTo(c.args[0], c.args[1]);
+        case M_STOP:
+            return _usmc->stop(c.args[0]);
+        case M_SETCURRENTPOSITION:
+            return _usmc->setCurrentPosition(c.args[0], c.args[1]);
+        case M_GETENCODERSTATE: {
+            USMC_EncoderState state;
+            return _usmc->getEncoderState(c.args[0], &state);
+        }
+        case M_ADDEXCLUSIONZONE:
+            return _usmc->addExclusionZone(c.args[0], c.args[1], c.args[2], c.args[3], c.args[4], c.args[5]);
+        case M_CLEAREXCLUSIONZONES:
+            _usmc->clearExclusionZones();
+            return ERR_SUCCESS;
+        case M_GETLOCKSTATS: {
+            USMC_LockStats stats;
+            return _usmc->getLockStats(c.args[0], &stats);
+        }
+        default:
+            return ERR_SUCCESS;
+    }
+}
+
+
+// Replay thread
+void* USMC_replayer::player_main(void* arg) {
+    player* p = static_cast<player*>(arg);
+    USMC_replayer* r = p->replayer;
+    uint64_t t0 = r->_calls.size() ? r->_calls[0].time : 0;
+
+    for(size_t i = 0; i < p->calls.size(); i++) {
+        const call& c = r->_calls[p->calls[i]];
+        if(p->realtime) {
+            // Keep the recorded start time relative to the first call
+            uint64_t target = p->start + (c.time - t0);
+            uint64_t now = usmc_time_us();
+            if(target > now)
+                usmc_sleep_us(target - now);
+        }
+        uint64_t t = usmc_time_us();
+        int res = r->issue(c);
+        uint64_t lat = usmc_time_us() - t;
+
+        p->latency += lat;
+        if(lat > p->max_latency)
+            p->max_latency = lat;
+        if(res < 0)
+            p->errors++;
+        if((res < 0) != (c.result < 0))
+            p->mismatches++;
+    }
+    return NULL;
+}
+
+
+// Replay the session
+int USMC_replayer::run(bool realtime, USMC_ReplayStats* stats) {
+    if(NULL == stats)
+        return ERR_INVALID_PARAM;
+    memset(stats, 0, sizeof(USMC_ReplayStats));
+    if(_calls.size() == 0)
+        return ERR_SUCCESS;
+
+    // One player for each recorded thread
+    std::vector<player> players;
+    uint64_t t0 = _calls[0].time, t1 = 0, recorded = 0;
+    for(size_t i = 0; i < _calls.size(); i++) {
+        const call& c = _calls[i];
+        if(c.time + c.duration > t1)
+            t1 = c.time + c.duration;
+        if(!methods[c.method].replay)
+            continue;
+        if(size_t(c.thread) >= players.size()) {
+            player p;
+            memset(&p.thread, 0, sizeof(pthread_t));
+            p.replayer = this;
+            p.realtime = realtime;
+            p.errors = p.mismatches = p.latency = p.max_latency = 0;
+            players.resize(c.thread + 1, p);
+        }
+        players[c.thread].calls.push_back(i);
+        recorded += c.duration;
+        stats->calls++;
+    }
+
+    uint64_t start = usmc_time_us();
+    int res = ERR_SUCCESS;
+    std::vector<bool> started(players.size(), false);
+    for(size_t i = 0; i < players.size(); i++) {
+        if(players[i].calls.size() == 0)
+            continue;
+        players[i].start = start;
+        if(pthread_create(&players[i].thread, NULL, player_main, &players[i]) != 0) {
+            res = ERR_USB_NO_MEM;
+            break;
+        }
+        started[i] = true;
+        stats->threads++;
+    }
+
+    uint64_t latency = 0;
+    for(size_t i = 0; i < players.size(); i++) {
+        if(!started[i])
+            continue;
+        pthread_join(players[i].thread, NULL);
+        stats->errors += players[i].errors;
+        stats->mismatches += players[i].mismatches;
+        latency += players[i].latency;
+        if(double(players[i].max_latency) > stats->max_latency)
+            stats->max_latency = double(players[i].max_latency);
+    }
+
+    stats->wall_time = double(usmc_time_us() - start) / 1e6;
+    stats->recorded_time = double(t1 - t0) / 1e6;
+    if(stats->calls) {
+        stats->mean_latency = double(latency) / double(stats->calls);
+        stats->recorded_latency = double(recorded) / double(stats->calls);
+    }
+    return res;
+}
@@ -0,0 +1,115 @@
+/***************************************************//**
+ * @file    usmc_replay.cpp
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <unistd.h>
+#include <libusmc.h>
+#include <usmc_record.h>
+#include <usmc_sim.h>
+
+using namespace std;
+
+// Record a session with: USMC_RECORD=session.txt <application>
+
+static void usage(const char* name) {
+    cout << "Usage: " << name << " [options] session" << endl;
+    cout << "  -f              issue the calls as fast as possible instead of keeping the recorded timing" << endl;
+    cout << "  -s axes         replay against simulated axes instead of the USB devices" << endl;
+    cout << "WARNING: on real devices the replay moves the motors and rewrites their parameters." << endl;
+}
+
+static void quiet_logger(const char* fmt, ...) {
+
+}
+
+int main(int argc, char** argv)
+{
+    bool realtime = true;
+    int sim_axes = 0;
+    int c;
+    while((c = getopt(argc, argv, "fs:h")) != -1) {
+        switch(c) {
+            case 'f': realtime = false; break;
+            case 's': sim_axes = atoi(optarg); break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if(optind != argc - 1 || sim_axes < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    cout << "USMC session replay" << endl;
+
+    // Backend
+    USMC_Simulator* sim = NULL;
+    if(sim_axes > 0) {
+        sim = new USMC_Simulator();
+        for(int i = 0; i < sim_axes; i++) {
+            USMC_SimAxisConfig config;
+            USMC_Simulator::defaults(&config, i);
+            sim->addAxis(config);
+        }
+    }
+    USMC* usmc_driver = sim ? USMC::getInstance(sim) : USMC::getInstance();
+    usmc_driver->set_info_logger(quiet_logger);
+    usmc_driver->set_error_logger(quiet_logger);
+
+    int ndev = usmc_driver->probeDevices();
+    if(ndev <= 0) {
+        cout << "No devices found" << endl;
+        return 1;
+    }
+
+    USMC_replayer replayer(usmc_driver);
+    int n = replayer.load(argv[optind]);
+    if(n < 0) {
+        cout << "Failed to load session " << argv[optind] << " (error " << n << ")" << endl;
+        return 1;
+    }
+    cout << "Devices: " << ndev << ", calls: " << n << ", timing: " << (realtime ? "recorded" : "as fast as possible") << endl;
+
+    USMC_ReplayStats stats;
+    int res = replayer.run(realtime, &stats);
+    if(res < 0)
+        cout << "Replay failed (error " << res << ")" << endl;
+
+    cout << fixed << setprecision(3);
+    cout << " * Calls: " << stats.calls << " on " << stats.threads << " threads" << endl;
+    cout << " * Errors: " << stats.errors << ", results differing from the recording: " << stats.mismatches << endl;
+    cout << " * Duration: " << stats.wall_time << " s (recorded " << stats.recorded_time << " s)" << endl;
+    cout << setprecision(1);
+    cout << " * Call latency: " << stats.mean_latency << " us mean, " << stats.max_latency << " us max (recorded " << stats.recorded_latency << " us mean)" << endl;
+
+    USMC::shutdown();
+    delete sim;
+    return (res < 0 || stats.mismatches) ? 2 : 0;
+}
@@ -0,0 +1,468 @@
+/***************************************************//**
+ * @file    usmc_scan.cpp
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <set>
+#include <usmc_scan.h>
+#include <usmc_clock.h>
+
+
+// Sort cells by decreasing score
+static bool cell_score_greater(const std::pair<double, size_t>& a, const std::pair<double, size_t>& b) {
+    return a.first > b.first;
+}
+
+// Grid coordinate
+static int grid_coord(int min, int max, int points, int i) {
+    if(points <= 1)
+        return min;
+    return min + int(floor((double(max) - double(min)) * i / (points - 1) + 0.5));
+}
+
+
+// Clear data
+void USMC_ScanData::clear() {
+    time.clear();
+    value.clear();
+    for(int i = 0; i < USMC_MAX_SCAN_AXES; i++) {
+        position[i].clear();
+        encoder[i].clear();
+    }
+}
+
+// Reserve memory
+void USMC_ScanData::reserve(size_t n) {
+    time.reserve(n);
+    value.reserve(n);
+    for(int i = 0; i < USMC_MAX_SCAN_AXES; i++) {
+        position[i].reserve(n);
+        encoder[i].reserve(n);
+    }
+}
+
+
+// Scan constructor
+USMC_Scan::USMC_Scan(USMC* usmc) : _usmc(usmc), _measure(NULL), _user(NULL), _data(NULL), _sink(NULL), _moves(0), _model_time(0.0) {
+    memset(&_config, 0, sizeof(USMC_ScanConfig));
+}
+
+// Default configuration
+void USMC_Scan::defaults(USMC_ScanConfig* config) {
+    memset(config, 0, sizeof(USMC_ScanConfig));
+    config->naxes = 1;
+    config->mode = USMC_SCAN_GRID;
+    config->threshold = 0.1;
+    for(int i = 0; i < USMC_MAX_SCAN_AXES; i++) {
+        config->points[i] = 11;
+        config->min_step[i] = 1;
+    }
+    config->max_points = 0;
+    config->max_passes = 8;
+    config->read_encoder = false;
+    config->poll_us = 1000;
+    config->timeout_ms = 0;
+}
+
+// Run scan
+int USMC_Scan::run(const USMC_ScanConfig& config, USMC_MeasureFn measure, void* user, USMC_ScanData* data) {
+    if(NULL == measure || NULL == data)
+        return ERR_INVALID_PARAM;
+    if(config.naxes < 1 || config.naxes > USMC_MAX_SCAN_AXES)
+        return ERR_INVALID_VALUE;
+    if(config.mode != USMC_SCAN_GRID && config.mode != USMC_SCAN_ADAPTIVE)
+        return ERR_INVALID_VALUE;
+    for(int k = 0; k < config.naxes; k++) {
+        if(config.device[k] < 0 || config.device[k] >= int(_usmc->countDevices()))
+            return ERR_INVALID_ID;
+        if(config.points[k] < 1 || config.min_step[k] < 1)
+            return ERR_INVALID_VALUE;
+        if(config.mode == USMC_SCAN_ADAPTIVE && (config.points[k] < 2 || config.min[k] >= config.max[k]))
+            return ERR_INVALID_VALUE;
+    }
+
+    _config = config;
+    _measure = measure;
+    _user = user;
+    _data = data;
+    _values.clear();
+    _moves = 0;
+    _model_time = 0.0;
+
+    // Current positions and motion models
+    _pos[0] = _pos[1] = 0;
+    for(int k = 0; k < _config.naxes; k++) {
+        int r = _model[k].load(_usmc, _config.device[k]);
+        if(r < 0)
+            return r;
+        USMC_State state;
+        r = _usmc->getState(_config.device[k], &state);
+        if(r < 0)
+            return r;
+        _pos[k] = state.CurPos;
+    }
+
+    if(_sink) {
+        int r = _sink->begin(_config);
+        if(r < 0)
+            return r;
+    }
+
+    int result;
+    if(_config.mode == USMC_SCAN_GRID)
+        result = runGrid();
+    else if(_config.naxes == 1)
+        result = runAdaptive1D();
+    else
+        result = runAdaptive2D();
+
+    if(_sink)
+        _sink->end(result);
+    return result;
+}
+
+// Uniform grid
+int USMC_Scan::runGrid() {
+    int nx = _config.points[0];
+    int ny = _config.naxes > 1 ? _config.points[1] : 1;
+    _data->reserve(_data->size() + size_t(nx) * ny);
+
+    for(int j = 0; j < ny; j++) {
+        int y = _config.naxes > 1 ? grid_coord(_config.min[1], _config.max[1], ny, j) : 0;
+        for(int i = 0; i < nx; i++) {
+            // Serpentine order
+            int ii = (j % 2) ? (nx - 1 - i) : i;
+            point p(grid_coord(_config.min[0], _config.max[0], nx, ii), y);
+            if(exhausted())
+                return ERR_SUCCESS;
+            int r = visit(p);
+            if(r < 0)
+                return r;
+        }
+    }
+    return ERR_SUCCESS;
+}
+
+// Adaptive 1-D scan
+int USMC_Scan::runAdaptive1D() {
+    // Coarse grid
+    std::vector<point> batch;
+    for(int i = 0; i < _config.points[0]; i++)
+        batch.push_back(point(grid_coord(_config.min[0], _config.max[0], _config.points[0], i), 0));
+    int r = visitBatch(batch);
+    if(r < 0)
+        return r;
+
+    for(int pass = 0; pass < _config.max_passes && !exhausted(); pass++) {
+        double R = range();
+        if(R <= 0.0)
+            break;
+
+        // Sampled points in ascending order
+        std::vector<int> xs;
+        std::vector<double> fs;
+        for(std::map<point, double>::const_iterator it = _values.begin(); it != _values.end(); ++it) {
+            xs.push_back(it->first.first);
+            fs.push_back(it->second);
+        }
+
+        // Normalized curvature at every sample (second difference on a non-uniform grid)
+        std::vector<double> curv(xs.size(), 0.0);
+        for(size_t i = 1; i + 1 < xs.size(); i++) {
+            double h0 = xs[i] - xs[i-1];
+            double h1 = xs[i+1] - xs[i];
+            double d2 = 2.0 * (h0 * fs[i+1] - (h0 + h1) * fs[i] + h1 * fs[i-1]) / (h0 + h1);
+            curv[i] = fabs(d2) / R;
+        }
+
+        // Score intervals by value change and by curvature at their ends
+        std::vector<std::pair<double, size_t> > candidates;
+        for(size_t i = 0; i + 1 < xs.size(); i++) {
+            if(xs[i+1] - xs[i] < 2 * _config.min_step[0])
+                continue;
+            double score = fabs(fs[i+1] - fs[i]) / R;
+            score = std::max(score, std::max(curv[i], curv[i+1]));
+            if(score > _config.threshold)
+                candidates.push_back(std::make_pair(score, i));
+        }
+        if(candidates.empty())
+            break;
+
+        // Refine the strongest intervals first within the point budget
+        std::stable_sort(candidates.begin(), candidates.end(), cell_score_greater);
+        batch.clear();
+        for(size_t c = 0; c < candidates.size() && !exhausted(batch.size()); c++) {
+            size_t i = candidates[c].second;
+            batch.push_back(point(xs[i] + (xs[i+1] - xs[i]) / 2, 0));
+        }
+        r = visitBatch(batch);
+        if(r < 0)
+            return r;
+    }
+    return ERR_SUCCESS;
+}
+
+// Adaptive 2-D scan
+int USMC_Scan::runAdaptive2D() {
+    int nx = _config.points[0];
+    int ny = _config.points[1];
+
+    // Coarse grid
+    std::vector<int> gx, gy;
+    for(int i = 0; i < nx; i++)
+        gx.push_back(grid_coord(_config.min[0], _config.max[0], nx, i));
+    for(int j = 0; j < ny; j++)
+        gy.push_back(grid_coord(_config.min[1], _config.max[1], ny, j));
+
+    std::vector<point> batch;
+    for(int j = 0; j < ny; j++)
+        for(int i = 0; i < nx; i++)
+            batch.push_back(point(gx[(j % 2) ? (nx - 1 - i) : i], gy[j]));
+    int r = visitBatch(batch);
+    if(r < 0)
+        return r;
+
+    // Coarse cells
+    std::vector<cell> active;
+    for(int j = 0; j + 1 < ny; j++) {
+        for(int i = 0; i + 1 < nx; i++) {
+            cell c;
+            c.x0 = gx[i];
+            c.x1 = gx[i+1];
+            c.y0 = gy[j];
+            c.y1 = gy[j+1];
+            c.score = 0.0;
+            active.push_back(c);
+        }
+    }
+
+    for(int pass = 0; pass < _config.max_passes && !exhausted() && !active.empty(); pass++) {
+        double R = range();
+        if(R <= 0.0)
+            break;
+
+        // Score cells by the spread of their corner values
+        std::vector<std::pair<double, size_t> > candidates;
+        for(size_t c = 0; c < active.size(); c++) {
+            cell& cl = active[c];
+            bool wide_x = (cl.x1 - cl.x0) >= 2 * _config.min_step[0];
+            bool wide_y = (cl.y1 - cl.y0) >= 2 * _config.min_step[1];
+            if(!wide_x && !wide_y)
+                continue;
+            double v[4];
+            v[0] = _values[point(cl.x0, cl.y0)];
+            v[1] = _values[point(cl.x1, cl.y0)];
+            v[2] = _values[point(cl.x0, cl.y1)];
+            v[3] = _values[point(cl.x1, cl.y1)];
+            double vmin = v[0], vmax = v[0];
+            for(int k = 1; k < 4; k++) {
+                vmin = std::min(vmin, v[k]);
+                vmax = std::max(vmax, v[k]);
+            }
+            cl.score = (vmax - vmin) / R;
+            if(cl.score > _config.threshold)
+                candidates.push_back(std::make_pair(cl.score, c));
+        }
+        if(candidates.empty())
+            break;
+        std::stable_sort(candidates.begin(), candidates.end(), cell_score_greater);
+
+        // Split the strongest cells within the point budget
+        std::vector<cell> next;
+        std::set<point> pending;
+        batch.clear();
+        for(size_t c = 0; c < candidates.size(); c++) {
+            const cell& cl = active[candidates[c].second];
+            int xs[3], ys[3];
+            int nxs = 0, nys = 0;
+            xs[nxs++] = cl.x0;
+            if((cl.x1 - cl.x0) >= 2 * _config.min_step[0])
+                xs[nxs++] = cl.x0 + (cl.x1 - cl.x0) / 2;
+            xs[nxs++] = cl.x1;
+            ys[nys++] = cl.y0;
+            if((cl.y1 - cl.y0) >= 2 * _config.min_step[1])
+                ys[nys++] = cl.y0 + (cl.y1 - cl.y0) / 2;
+            ys[nys++] = cl.y1;
+
+            // New points of this cell
+            std::vector<point> add;
+            for(int j = 0; j < nys; j++) {
+                for(int i = 0; i < nxs; i++) {
+                    point p(xs[i], ys[j]);
+                    if(_values.find(p) == _values.end() && pending.find(p) == pending.end())
+                        add.push_back(p);
+                }
+            }
+            if(_config.max_points > 0 && _values.size() + batch.size() + add.size() > size_t(_config.max_points))
+                break;
+            for(size_t k = 0; k < add.size(); k++) {
+                pending.insert(add[k]);
+                batch.push_back(add[k]);
+            }
+
+            // Children cells
+            for(int j = 0; j + 1 < nys; j++) {
+                for(int i = 0; i + 1 < nxs; i++) {
+                    cell ch;
+                    ch.x0 = xs[i];
+                    ch.x1 = xs[i+1];
+                    ch.y0 = ys[j];
+                    ch.y1 = ys[j+1];
+                    ch.score = 0.0;
+                    next.push_back(ch);
+                }
+            }
+        }
+        if(batch.empty())
+            break;
+
+        r = visitBatch(batch);
+        if(r < 0)
+            return r;
+        active.swap(next);
+    }
+    return ERR_SUCCESS;
+}
+
+// Visit a batch of points
+int USMC_Scan::visitBatch(std::vector<point>& batch) {
+    order(batch);
+    _data->reserve(_data->size() + batch.size());
+    for(size_t i = 0; i < batch.size(); i++) {
+        if(exhausted())
+            break;
+        int r = visit(batch[i]);
+        if(r < 0)
+            return r;
+    }
+    return ERR_SUCCESS;
+}
+
+// Sort a batch to reduce travel time
+void USMC_Scan::order(std::vector<point>& batch)const {
+    if(batch.size() < 2)
+        return;
+
+    if(_config.naxes == 1) {
+        // Sweep from the closest end
+        std::sort(batch.begin(), batch.end());
+        point here(_pos[0], 0);
+        if(travelTime(here, batch.back()) < travelTime(here, batch.front()))
+            std::reverse(batch.begin(), batch.end());
+        return;
+    }
+
+    // Nearest neighbour tour using the motion model
+    point here(_pos[0], _pos[1]);
+    for(size_t i = 0; i < batch.size(); i++) {
+        size_t best = i;
+        double tbest = travelTime(here, batch[i]);
+        for(size_t j = i + 1; j < batch.size(); j++) {
+            double t = travelTime(here, batch[j]);
+            if(t < tbest) {
+                tbest = t;
+                best = j;
+            }
+        }
+        std::swap(batch[i], batch[best]);
+        here = batch[i];
+    }
+}
+
+// Estimated travel time
+double USMC_Scan::travelTime(const point& from, const point& to)const {
+    double tx = _model[0].moveTime(from.first, to.first);
+    if(_config.naxes == 1)
+        return tx;
+    double ty = _model[1].moveTime(from.second, to.second);
+    return tx > ty ? tx : ty;
+}
+
+// Move, measure and record
+int USMC_Scan::visit(const point& p) {
+    int target[USMC_MAX_SCAN_AXES] = { p.first, p.second };
+    point here(_pos[0], _pos[1]);
+    int r;
+
+    // Start all axes together, then wait for them
+    _model_time += travelTime(here, p);
+    for(int k = 0; k < _config.naxes; k++) {
+        if(target[k] == _pos[k])
+            continue;
+        if((r = _usmc->moveTo(_config.device[k], target[k])) < 0)
+            return r;
+        _moves++;
+    }
+    for(int k = 0; k < _config.naxes; k++) {
+        if(target[k] == _pos[k])
+            continue;
+        if((r = usmc_wait_idle(_usmc, _config.device[k], _config.poll_us, _config.timeout_ms)) < 0)
+            return r;
+        _pos[k] = target[k];
+    }
+
+    double value;
+    if((r = _measure(_user, &value)) < 0)
+        return r;
+    uint64_t t = usmc_time_us();
+
+    int enc[USMC_MAX_SCAN_AXES] = { 0, 0 };
+    if(_config.read_encoder) {
+        for(int k = 0; k < _config.naxes; k++) {
+            USMC_EncoderState es;
+            if((r = _usmc->getEncoderState(_config.device[k], &es)) < 0)
+                return r;
+            enc[k] = es.EncoderPos;
+        }
+    }
+
+    // Record
+    _values[p] = value;
+    _data->time.push_back(t);
+    _data->value.push_back(value);
+    for(int k = 0; k < USMC_MAX_SCAN_AXES; k++) {
+        _data->position[k].push_back(target[k]);
+        _data->encoder[k].push_back(enc[k]);
+    }
+    if(_sink)
+        return _sink->point(t, target, enc, value);
+    return ERR_SUCCESS;
+}
+
+// Signal range
+double USMC_Scan::range()const {
+    if(_values.empty())
+        return 0.0;
+    std::map<point, double>::const_iterator it = _values.begin();
+    double vmin = it->second, vmax = it->second;
+    for(++it; it != _values.end(); ++it) {
+        vmin = std::min(vmin, it->second);
+        vmax = std::max(vmax, it->second);
+    }
+    return vmax - vmin;
+}
@@ -0,0 +1,557 @@
+/***************************************************//**
+ * @file    usmc_sim.cpp
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <libusmc.h>
+#include <usmctypes.h>
+#include <usmc_sim.h>
+
+// Swap the bytes of a word (inverse of PACK_WORD)
+#define UNPACK_WORD(w)    ((uint16_t)((((w)&0x00ff)<<8)|(((w)&0xff00)>>8)))
+
+// Driver current when idle with current reduction enabled (fraction of full current)
+#define REDUCED_CURRENT   0.25
+
+
+// Virtual clock constructor
+USMC_sim_clock::USMC_sim_clock() : _now(0) {
+
+}
+
+// Current virtual time
+uint64_t USMC_sim_clock::now_us() {
+    USMC_lock l(&_mutex);
+    return _now;
+}
+
+// Sleep: jump forward
+void USMC_sim_clock::sleep_us(uint64_t us) {
+    advance(us);
+}
+
+// Advance virtual time
+void USMC_sim_clock::advance(uint64_t us) {
+    USMC_lock l(&_mutex);
+    _now += us;
+}
+
+
+// Simulator constructor
+USMC_Simulator::USMC_Simulator() : _latency(1000), _transfers(0) {
+
+}
+
+// Simulator destructor
+USMC_Simulator::~USMC_Simulator() {
+    for(size_t i = 0; i < _axes.size(); i++)
+        delete _axes[i];
+    _axes.clear();
+}
+
+// Default axis configuration
+void USMC_Simulator::defaults(USMC_SimAxisConfig* config, int index) {
+    memset(config, 0, sizeof(USMC_SimAxisConfig));
+    snprintf(config->serial, sizeof(config->serial), "SIM%05d", index);
+    config->version = 0x2504;
+    config->position = 0.0;
+    config->limit_min = -1000000.0;
+    config->limit_max = 1000000.0;
+    config->voltage = 24.0f;
+    config->ambient = 25.0f;
+    config->drift = 0.0f;
+    config->heating = 15.0f;
+    config->time_constant = 600.0f;
+}
+
+// Add simulated controller
+int USMC_Simulator::addAxis(const USMC_SimAxisConfig& config) {
+    axis* ax = new axis;
+    ax->config = config;
+    ax->config.serial[16] = '\0';
+    ax->open = false;
+
+    // Controller defaults (overwritten by the library at probe)
+    ax->accel_t = ax->decel_t = 0.196;
+    ax->tr1_en = ax->tr2_en = true;
+    ax->tr_swap = false;
+    ax->current_reduction = true;
+    ax->power = true;
+    ax->sync_en = false;
+    ax->sync_pol = false;
+    ax->sync_count = 4;
+    ax->sync_width = 0.5;
+    ax->enc_inv = false;
+    ax->enc_mult = 1.0;
+    ax->divisor = 3;
+
+    ax->running = false;
+    ax->t0 = 0;
+    ax->x0 = config.position;
+    ax->dir = 1;
+    ax->dist = 0.0;
+    ax->v0 = ax->vp = ax->a = ax->d = 0.0;
+    ax->ta = ax->tc = ax->td = 0.0;
+    ax->vmax = 0.0;
+
+    ax->t_eval = _clock.now_us();
+    ax->pos = config.position;
+    ax->origin = 0.0;
+    ax->enc_zero = 0.0;
+    ax->temp = config.ambient + config.drift * double(ax->t_eval) / 3.6e9;
+    ax->travelled = 0.0;
+    ax->pulses = 0;
+    ax->after_reset = true;
+
+    USMC_lock l(&_lock);
+    _axes.push_back(ax);
+    return int(_axes.size()) - 1;
+}
+
+// Set transfer latency
+void USMC_Simulator::setLatency(uint32_t us) {
+    _latency = us;
+}
+
+// Physical position
+double USMC_Simulator::position(int axis) {
+    if(axis < 0 || axis >= int(_axes.size()))
+        return 0.0;
+    USMC_lock l(&(_axes[axis]->lock));
+    evaluate(_axes[axis], _clock.now_us());
+    return _axes[axis]->pos;
+}
+
+// SyncOUT pulse count
+uint64_t USMC_Simulator::syncPulses(int axis) {
+    if(axis < 0 || axis >= int(_axes.size()))
+        return 0;
+    USMC_lock l(&(_axes[axis]->lock));
+    evaluate(_axes[axis], _clock.now_us());
+    return _axes[axis]->pulses;
+}
+
+// Transfer count
+uint64_t USMC_Simulator::transfers() {
+    USMC_lock l(&_lock);
+    return _transfers;
+}
+
+// Open all the simulated controllers
+int USMC_Simulator::open(std::vector<void*>& handles, void (*logger)(const char*, ...)) {
+    USMC_lock l(&_lock);
+    for(size_t i = 0; i < _axes.size(); i++) {
+        if(!_axes[i]->open) {
+            _axes[i]->open = true;
+            handles.push_back(_axes[i]);
+        }
+    }
+    return 0;
+}
+
+// Close simulated controller
+void USMC_Simulator::close(void* handle) {
+    axis* ax = static_cast<axis*>(handle);
+    USMC_lock l(&(ax->lock));
+    ax->open = false;
+}
+
+// Location of a simulated controller
+std::string USMC_Simulator::path(void* handle) {
+    axis* ax = static_cast<axis*>(handle);
+    return std::string("sim:") + ax->config.serial;
+}
+
+// Control transfer
+int USMC_Simulator::control_transfer(void* handle, uint8_t bRequestType, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, uint8_t* data, uint16_t wLength, unsigned int timeout) {
+    axis* ax = static_cast<axis*>(handle);
+    if(NULL == ax)
+        return ERR_USB_INVALID_PARAM;
+
+    // Each transfer takes some bus time
+    {
+        USMC_lock l(&_lock);
+        _transfers++;
+    }
+    _clock.advance(_latency);
+
+    USMC_lock l(&(ax->lock));
+    if(!ax->open)
+        return ERR_USB_NO_DEVICE;
+    evaluate(ax, _clock.now_us());
+
+    switch(bRequest) {
+        case 0x06:
+            // Version string descriptor
+            if(!(bRequestType & USMC_ENDPOINT_IN) || NULL == data)
+                return ERR_USB_PIPE;
+            {
+                uint8_t buffer[6];
+                char version[8];
+                snprintf(version, sizeof(version), "%04X", ax->config.version & 0xFFFF);
+                buffer[0] = 6;
+                buffer[1] = 0x03;
+                memcpy(buffer+2, version, 4);
+                uint16_t n = wLength < 6 ? wLength : 6;
+                memcpy(data, buffer, n);
+                return n;
+            }
+
+        case 0xC9:
+            // Serial number
+            if(!(bRequestType & USMC_ENDPOINT_IN) || NULL == data)
+                return ERR_USB_PIPE;
+            {
+                uint16_t n = wLength < 16 ? wLength : 16;
+                memset(data, 0, wLength);
+                memcpy(data, ax->config.serial, n);
+                return n;
+            }
+
+        case 0xCA:
+            // Set serial number (the password is not checked)
+            if((bRequestType & USMC_ENDPOINT_IN) || NULL == data || wLength < 0x1C)
+                return ERR_USB_PIPE;
+            {
+                // The serial number follows the 16 bytes of the password,
+                // the first 4 of which are in wValue and wIndex
+                memset(ax->config.serial, 0, sizeof(ax->config.serial));
+                memcpy(ax->config.serial, data + 12, 16);
+                return 0;
+            }
+
+        case 0x82:
+            return getState(ax, data, wLength);
+        case 0x85:
+            return getEncoderState(ax, data, wLength);
+        case 0x80:
+            return goTo(ax, wValue, wIndex, data, wLength);
+        case 0x81:
+            return setMode(ax, wValue, wIndex, data, wLength);
+        case 0x83:
+            return setParameters(ax, wValue, wIndex, data, wLength);
+        case 0x01:
+            return setPosition(ax, wValue, wIndex);
+        case 0x07:
+            return stop(ax);
+        case 0x84:
+            // Save to EEPROM: nothing to do
+            return 0;
+        default:
+            return ERR_USB_PIPE;
+    }
+}
+
+// Distance travelled along the segment after s seconds
+double USMC_Simulator::distance(const axis* ax, double s)const {
+    if(s < ax->ta)
+        return ax->v0 * s + 0.5 * ax->a * s * s;
+    double x = ax->v0 * ax->ta + 0.5 * ax->a * ax->ta * ax->ta;
+    s -= ax->ta;
+    if(s < ax->tc)
+        return x + ax->vp * s;
+    x += ax->vp * ax->tc;
+    s -= ax->tc;
+    if(s < ax->td)
+        return x + ax->vp * s - 0.5 * ax->d * s * s;
+    return ax->dist;
+}
+
+// Velocity along the segment after s seconds
+double USMC_Simulator::velocity(const axis* ax, double s)const {
+    if(s < ax->ta)
+        return ax->v0 + ax->a * s;
+    s -= ax->ta;
+    if(s < ax->tc)
+        return ax->vp;
+    s -= ax->tc;
+    if(s < ax->td)
+        return ax->vp - ax->d * s;
+    return 0.0;
+}
+
+// Plan a trapezoidal (or triangular) move starting now from the current position
+void USMC_Simulator::plan(axis* ax, double target, double v0, double vmax, bool slow) {
+    ax->t0 = ax->t_eval;
+    ax->x0 = ax->pos;
+    ax->dist = fabs(target - ax->pos);
+    ax->dir = target >= ax->pos ? 1 : -1;
+    ax->vmax = vmax;
+    if(ax->dist <= 0.0 || vmax <= 0.0) {
+        ax->running = false;
+        return;
+    }
+
+    if(!slow) {
+        // Full speed from the first step
+        ax->v0 = ax->vp = vmax;
+        ax->a = ax->d = 0.0;
+        ax->ta = ax->td = 0.0;
+        ax->tc = ax->dist / vmax;
+
+    } else {
+        ax->a = vmax / ax->accel_t;
+        ax->d = vmax / ax->decel_t;
+        ax->v0 = v0 > vmax ? vmax : v0;
+
+        // Peak speed reachable in the available distance
+        double vp2 = (2.0 * ax->a * ax->d * ax->dist + ax->d * ax->v0 * ax->v0) / (ax->a + ax->d);
+        ax->vp = sqrt(vp2);
+        if(ax->vp > vmax)
+            ax->vp = vmax;
+        if(ax->vp < ax->v0) {
+            // Too short to decelerate normally: brake harder
+            ax->vp = ax->v0;
+            ax->d = ax->v0 * ax->v0 / (2.0 * ax->dist);
+        }
+        ax->ta = (ax->vp - ax->v0) / ax->a;
+        double da = (ax->vp * ax->vp - ax->v0 * ax->v0) / (2.0 * ax->a);
+        double dd = ax->vp * ax->vp / (2.0 * ax->d);
+        ax->tc = (ax->dist - da - dd) / ax->vp;
+        if(ax->tc < 0.0)
+            ax->tc = 0.0;
+        ax->td = ax->vp / ax->d;
+    }
+    ax->running = true;
+}
+
+// Advance the axis model
+void USMC_Simulator::evaluate(axis* ax, uint64_t t) {
+    if(t < ax->t_eval)
+        t = ax->t_eval;
+    double dt = double(t - ax->t_eval) / 1e6;
+    bool was_running = ax->running;
+
+    // Motion
+    if(ax->running) {
+        double s = double(t - ax->t0) / 1e6;
+        double x;
+        if(s >= ax->ta + ax->tc + ax->td) {
+            x = ax->x0 + ax->dir * ax->dist;
+            ax->running = false;
+        } else {
+            x = ax->x0 + ax->dir * distance(ax, s);
+        }
+
+        // Limit switches stop the motion
+        if(ax->tr1_en && ax->dir < 0 && x <= ax->config.limit_min) {
+            x = ax->pos < ax->config.limit_min ? ax->pos : ax->config.limit_min;
+            ax->running = false;
+        }
+        if(ax->tr2_en && ax->dir > 0 && x >= ax->config.limit_max) {
+            x = ax->pos > ax->config.limit_max ? ax->pos : ax->config.limit_max;
+            ax->running = false;
+        }
+
+        // SyncOUT pulses every sync_count steps
+        if(ax->sync_en && ax->sync_count > 0) {
+            double before = floor(ax->travelled / ax->sync_count);
+            ax->travelled += fabs(x - ax->pos);
+            double after = floor(ax->travelled / ax->sync_count);
+            ax->pulses += uint64_t(after - before);
+        }
+        ax->pos = x;
+    }
+
+    // Driver temperature (first order response to the dissipated power)
+    if(dt > 0.0) {
+        double ambient = ax->config.ambient + ax->config.drift * double(t) / 3.6e9;
+        double current = 0.0;
+        if(ax->power)
+            current = (was_running || !ax->current_reduction) ? 1.0 : REDUCED_CURRENT;
+        double target = ambient + ax->config.heating * current * current;
+        if(ax->config.time_constant > 0.0f)
+            ax->temp += (target - ax->temp) * (1.0 - exp(-dt / ax->config.time_constant));
+        else
+            ax->temp = target;
+    }
+    ax->t_eval = t;
+}
+
+// Get state request
+int USMC_Simulator::getState(axis* ax, uint8_t* data, uint16_t wLength) {
+    if(NULL == data || wLength < sizeof(STATE_PACKET))
+        return ERR_USB_OVERFLOW;
+
+    STATE_PACKET st;
+    memset(&st, 0, sizeof(STATE_PACKET));
+    double s = double(ax->t_eval - ax->t0) / 1e6;
+
+    st.CurPos    = uint32_t(int32_t(floor((ax->pos - ax->origin) * 8.0 + 0.5)));
+    st.Temp      = uint16_t((ax->temp + 50.0) / 330.0 * 65536.0 + 0.5);
+    st.M1        = ax->divisor & 0x01;
+    st.M2        = (ax->divisor >> 1) & 0x01;
+    st.REFIN     = ax->running || !ax->current_reduction;
+    st.CW_CCW    = ax->dir > 0;
+    st.RESET     = ax->power;
+    st.FULLSPEED = ax->running && velocity(ax, s) >= ax->vmax;
+    st.AFTRESET  = ax->after_reset;
+    st.RUN       = ax->running;
+
+    // SyncOUT is high for sync_width steps after each pulse
+    bool sync = false;
+    if(ax->sync_en && ax->sync_count > 0 && ax->travelled >= ax->sync_count)
+        sync = fmod(ax->travelled, ax->sync_count) < ax->sync_width;
+    st.SYNCOUT   = sync != ax->sync_pol;
+
+    bool tr1 = ax->pos <= ax->config.limit_min;
+    bool tr2 = ax->pos >= ax->config.limit_max;
+    st.TRAILER1  = ax->tr_swap ? tr2 : tr1;
+    st.TRAILER2  = ax->tr_swap ? tr1 : tr2;
+    st.Working   = 1;
+    st.Voltage   = uint16_t(ax->config.voltage / (3.3 * 20.0) * 65536.0 + 0.5);
+
+    memcpy(data, &st, sizeof(STATE_PACKET));
+    return sizeof(STATE_PACKET);
+}
+
+// Get encoder state request
+int USMC_Simulator::getEncoderState(axis* ax, uint8_t* data, uint16_t wLength) {
+    if(NULL == data || wLength < sizeof(ENCODER_STATE_PACKET))
+        return ERR_USB_OVERFLOW;
+
+    ENCODER_STATE_PACKET es;
+    double e = (ax->pos - ax->enc_zero) * ax->enc_mult;
+    es.ECurPos = uint32_t(int32_t(floor(e + 0.5)));
+    es.EncPos  = uint32_t(int32_t(floor((ax->enc_inv ? -e : e) + 0.5)));
+    memcpy(data, &es, sizeof(ENCODER_STATE_PACKET));
+    return sizeof(ENCODER_STATE_PACKET);
+}
+
+// Go to request
+int USMC_Simulator::goTo(axis* ax, uint16_t wValue, uint16_t wIndex, const uint8_t* data, uint16_t wLength) {
+    if(NULL == data || wLength < 3)
+        return ERR_USB_PIPE;
+
+    // Rebuild packet
+    uint8_t buffer[sizeof(GO_TO_PACKET)];
+    buffer[0] = wIndex & 0xff;
+    buffer[1] = wIndex >> 8;
+    buffer[2] = wValue & 0xff;
+    buffer[3] = wValue >> 8;
+    memcpy(buffer+4, data, 3);
+    GO_TO_PACKET packet;
+    memcpy(&packet, buffer, sizeof(GO_TO_PACKET));
+
+    double target = double(int32_t(packet.DestPos)) / 8.0 + ax->origin;
+    double speed = 1000000.0 / (65536.0 - double(UNPACK_WORD(packet.TimerPeriod)));
+    ax->divisor = packet.M1 | (packet.M2 << 1);
+    if(packet.SYNCOUTR)
+        ax->travelled = 0.0;
+    if(!ax->power)
+        return 3;
+
+    // Keep the current speed if moving on in the same direction
+    double v0 = 0.0;
+    if(ax->running && (target >= ax->pos) == (ax->dir > 0))
+        v0 = velocity(ax, double(ax->t_eval - ax->t0) / 1e6);
+    plan(ax, target, v0, speed, packet.SLSTRT);
+    return 3;
+}
+
+// Set mode request
+int USMC_Simulator::setMode(axis* ax, uint16_t wValue, uint16_t wIndex, const uint8_t* data, uint16_t wLength) {
+    if(NULL == data || wLength < 3)
+        return ERR_USB_PIPE;
+
+    // Rebuild packet
+    uint8_t buffer[sizeof(MODE_PACKET)];
+    buffer[0] = wValue >> 8;
+    buffer[1] = wValue & 0xff;
+    buffer[2] = wIndex >> 8;
+    buffer[3] = wIndex & 0xff;
+    memcpy(buffer+4, data, 3);
+    MODE_PACKET packet;
+    memcpy(&packet, buffer, sizeof(MODE_PACKET));
+
+    ax->current_reduction = packet.REFINEN;
+    ax->tr_swap = packet.TRSWAP;
+    ax->tr1_en = packet.TR1EN;
+    ax->tr2_en = packet.TR2EN;
+    ax->sync_en = packet.SNCOUTEN;
+    ax->sync_pol = packet.SYNCOPOL;
+    ax->sync_count = (uint32_t(buffer[3]) << 24) | (uint32_t(buffer[4]) << 16) | (uint32_t(buffer[5]) << 8) | uint32_t(buffer[6]);
+    ax->enc_inv = packet.INVENC;
+    if(packet.SYNCOUTR)
+        ax->travelled = 0.0;
+    if(packet.RESBENC)
+        ax->enc_zero = ax->pos;
+
+    // Power off stops the motor where it is
+    ax->power = !(packet.RESETD || packet.EMRESET);
+    if(!ax->power)
+        ax->running = false;
+    return 3;
+}
+
+// Set parameters request
+int USMC_Simulator::setParameters(axis* ax, uint16_t wValue, uint16_t wIndex, const uint8_t* data, uint16_t wLength) {
+    if(NULL == data || wLength < sizeof(PARAMETERS_PACKET) - 4)
+        return ERR_USB_PIPE;
+
+    // Rebuild packet
+    uint8_t buffer[sizeof(PARAMETERS_PACKET)];
+    buffer[0] = wValue >> 8;
+    buffer[1] = wValue & 0xff;
+    buffer[2] = wIndex & 0xff;
+    buffer[3] = wIndex >> 8;
+    memcpy(buffer+4, data, sizeof(PARAMETERS_PACKET) - 4);
+    PARAMETERS_PACKET packet;
+    memcpy(&packet, buffer, sizeof(PARAMETERS_PACKET));
+
+    ax->accel_t = packet.DELAY1 * 0.098;
+    ax->decel_t = packet.DELAY2 * 0.098;
+    ax->sync_width = packet.SynOUTP > 0 ? packet.SynOUTP - 0.5 : 0.5;
+    ax->enc_mult = packet.EncVSCP / 4.0;
+    return sizeof(PARAMETERS_PACKET) - 4;
+}
+
+// Set current position request
+int USMC_Simulator::setPosition(axis* ax, uint16_t wValue, uint16_t wIndex) {
+    int32_t raw = int32_t((uint32_t(wValue) << 16) | uint32_t(wIndex));
+    ax->origin = ax->pos - double(raw) / 8.0;
+    ax->after_reset = false;
+    return 0;
+}
+
+// Stop request
+int USMC_Simulator::stop(axis* ax) {
+    if(!ax->running)
+        return 0;
+
+    double v = velocity(ax, double(ax->t_eval - ax->t0) / 1e6);
+    if(ax->td > 0.0 && ax->d > 0.0 && v > 0.0) {
+        // Decelerate to rest with the deceleration of the move
+        double d = ax->vmax / ax->decel_t;
+        double target = ax->pos + ax->dir * v * v / (2.0 * d);
+        plan(ax, target, v, v, true);
+    } else {
+        ax->running = false;
+    }
+    return 0;
+}
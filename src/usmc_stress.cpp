@@ -0,0 +1,500 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <libusmc.h>
+#include <usmc_mutex.h>
+#include <usmc_transport.h>
+#include <usmc_sim.h>
+#include <usmc_fault.h>
+
+using namespace std;
+
+// Operations
+#define OP_POLL      0
+#define OP_MOVE      1
+#define OP_CONFIG    2
+#define OP_STOP      3
+#define OP_COUNT     4
+
+// Latency histogram: 8 buckets per power of two of ns
+#define HIST_SUB     8
+#define HIST_SIZE    (64 * HIST_SUB)
+
+static const char* op_names[OP_COUNT] = { "poll", "move", "config", "stop" };
+
+// Options
+static int n_threads = 4;
+static int duration = 60;
+static double rate = 100.0;
+static int interval = 10;
+static int sim_axes = 0;
+static double fault = 0.0;
+static int move_range = 100;
+static int weights[OP_COUNT] = { 70, 10, 15, 5 };
+static int stuck_threshold = 30;
+
+// Library
+static USMC* usmc_driver = NULL;
+static int ndev = 0;
+static std::vector<int> home;
+static std::vector<USMC_Parameters> base_params;
+static std::vector<USMC_Mode> base_mode;
+static volatile bool running = true;
+
+// Invariant violations
+static uint64_t torn_configs = 0;
+static uint64_t stuck_locks = 0;
+static uint64_t stuck_threads = 0;
+
+
+// Statistics of one thread (or aggregate)
+typedef struct _stats {
+    uint64_t count[OP_COUNT];
+    uint64_t errors[OP_COUNT];
+    uint64_t max_ns[OP_COUNT];
+    uint64_t hist[OP_COUNT][HIST_SIZE];
+} stats;
+
+// Worker thread
+typedef struct _worker {
+    pthread_t thread;
+    int index;
+    uint64_t rng;
+    USMC_mutex lock;
+    stats st;
+    uint64_t heartbeat;
+} worker;
+
+static worker* workers = NULL;
+
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ULL + uint64_t(ts.tv_nsec);
+}
+
+static uint64_t next_random(uint64_t& state) {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545F4914F6CDD1DULL;
+}
+
+static int hist_bucket(uint64_t ns) {
+    if(ns < HIST_SUB)
+        return int(ns);
+    int msb = 63 - __builtin_clzll(ns);
+    int sub = int((ns >> (msb - 3)) & (HIST_SUB - 1));
+    return (msb - 2) * HIST_SUB + sub;
+}
+
+static uint64_t hist_value(int bucket) {
+    if(bucket < HIST_SUB)
+        return uint64_t(bucket);
+    int msb = bucket / HIST_SUB + 2;
+    uint64_t sub = uint64_t(bucket % HIST_SUB);
+    return (uint64_t(1) << msb) | (sub << (msb - 3));
+}
+
+static uint64_t percentile(const stats& st, int op, double p) {
+    uint64_t target = uint64_t(p * double(st.count[op]));
+    uint64_t acc = 0;
+    for(int b = 0; b < HIST_SIZE; b++) {
+        acc += st.hist[op][b];
+        if(acc > target)
+            return hist_value(b);
+    }
+    return st.max_ns[op];
+}
+
+static void merge(stats& dst, const stats& src) {
+    for(int op = 0; op < OP_COUNT; op++) {
+        dst.count[op] += src.count[op];
+        dst.errors[op] += src.errors[op];
+        if(src.max_ns[op] > dst.max_ns[op])
+            dst.max_ns[op] = src.max_ns[op];
+        for(int b = 0; b < HIST_SIZE; b++)
+            dst.hist[op][b] += src.hist[op][b];
+    }
+}
+
+// Parameters written by the config operation. All the varying fields are
+// derived from k, so a torn copy is detected by checkParameters().
+static void makeParameters(USMC_Parameters& p, int device, int k) {
+    p = base_params[device];
+    p.AccelT = p.DecelT = 98.0f * k;
+    p.BTimeout1 = p.BTimeout2 = p.BTimeout3 = p.BTimeout4 = 100.0f * k;
+}
+
+static bool checkParameters(const USMC_Parameters& p) {
+    if(p.AccelT != p.DecelT || p.BTimeout1 != p.BTimeout4 || p.BTimeout2 != p.BTimeout3 || p.BTimeout1 != p.BTimeout2)
+        return false;
+    // Initial configuration or one written by makeParameters()
+    if(p.BTimeout1 == 100.0f * (p.AccelT / 98.0f))
+        return true;
+    return false;
+}
+
+// Run one operation
+static int run_op(worker* w, int op, int device) {
+    int r = 0;
+    switch(op) {
+        case OP_POLL: {
+            USMC_State state;
+            USMC_Parameters params;
+            r = usmc_driver->getState(device, &state);
+            usmc_driver->getParameters(device, &params);
+            if(!checkParameters(params))
+                __atomic_add_fetch(&torn_configs, 1, __ATOMIC_RELAXED);
+            break;
+        }
+        case OP_MOVE: {
+            int offset = int(next_random(w->rng) % uint64_t(2 * move_range + 1)) - move_range;
+            r = usmc_driver->moveTo(device, home[device] + offset);
+            break;
+        }
+        case OP_CONFIG: {
+            int k = int(next_random(w->rng) % 15) + 1;
+            if(next_random(w->rng) & 1) {
+                USMC_Parameters params;
+                makeParameters(params, device, k);
+                r = usmc_driver->setParameters(device, &params);
+            } else {
+                USMC_Mode mode = base_mode[device];
+                mode.SyncCount = k;
+                r = usmc_driver->setMode(device, &mode);
+            }
+            break;
+        }
+        case OP_STOP:
+            r = usmc_driver->stop(device);
+            break;
+    }
+    return r;
+}
+
+static void* worker_main(void* arg) {
+    worker* w = static_cast<worker*>(arg);
+    int total = 0;
+    for(int op = 0; op < OP_COUNT; op++)
+        total += weights[op];
+    uint64_t period = rate > 0.0 ? uint64_t(1e9 / rate) : 0;
+    uint64_t next = now_ns();
+
+    while(running) {
+        // Pick operation and device
+        int x = int(next_random(w->rng) % uint64_t(total));
+        int op = 0;
+        while(x >= weights[op]) {
+            x -= weights[op];
+            op++;
+        }
+        int device = int(next_random(w->rng) % uint64_t(ndev));
+
+        uint64_t start = now_ns();
+        int r = run_op(w, op, device);
+        uint64_t elapsed = now_ns() - start;
+
+        {
+            USMC_lock l(&(w->lock));
+            w->st.count[op]++;
+            if(r < 0)
+                w->st.errors[op]++;
+            if(elapsed > w->st.max_ns[op])
+                w->st.max_ns[op] = elapsed;
+            w->st.hist[op][hist_bucket(elapsed)]++;
+        }
+        __atomic_add_fetch(&(w->heartbeat), 1, __ATOMIC_RELAXED);
+
+        // Pace to the target rate
+        if(period) {
+            next += period;
+            uint64_t now = now_ns();
+            if(next > now) {
+                struct timespec ts;
+                ts.tv_sec = next / 1000000000ULL;
+                ts.tv_nsec = next % 1000000000ULL;
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+            } else {
+                next = now;
+            }
+        }
+    }
+    return NULL;
+}
+
+// Watchdog: a lock held without new acquisitions, or a thread without
+// progress, for longer than the threshold is reported as stuck
+static void* watchdog_main(void* arg) {
+    std::vector<uint64_t> acq(ndev, 0), beat(n_threads, 0);
+    std::vector<int> lock_age(ndev, 0), thread_age(n_threads, 0);
+
+    while(running) {
+        sleep(1);
+        for(int d = 0; d < ndev; d++) {
+            USMC_LockStats ls;
+            usmc_driver->getLockStats(d, &ls);
+            if(ls.Locked && ls.Acquisitions == acq[d]) {
+                if(++lock_age[d] == stuck_threshold) {
+                    cout << "!! Lock of device " << d << " held for more than " << stuck_threshold << " s" << endl;
+                    __atomic_add_fetch(&stuck_locks, 1, __ATOMIC_RELAXED);
+                }
+            } else {
+                lock_age[d] = 0;
+            }
+            acq[d] = ls.Acquisitions;
+        }
+        for(int t = 0; t < n_threads; t++) {
+            uint64_t hb = __atomic_load_n(&(workers[t].heartbeat), __ATOMIC_RELAXED);
+            if(hb == beat[t]) {
+                if(++thread_age[t] == stuck_threshold) {
+                    cout << "!! Thread " << t << " without progress for more than " << stuck_threshold << " s" << endl;
+                    __atomic_add_fetch(&stuck_threads, 1, __ATOMIC_RELAXED);
+                }
+            } else {
+                thread_age[t] = 0;
+            }
+            beat[t] = hb;
+        }
+    }
+    return NULL;
+}
+
+static void report(const char* title, const stats& st, double seconds, const std::vector<USMC_LockStats>& locks) {
+    uint64_t total = 0;
+    for(int op = 0; op < OP_COUNT; op++)
+        total += st.count[op];
+
+    cout << "== " << title << ": " << fixed << setprecision(0) << seconds << " s, " << setprecision(1) << double(total) / seconds << " ops/s" << endl;
+    cout << setw(8) << "op" << setw(12) << "count" << setw(10) << "errors" << setw(12) << "p50 us" << setw(12) << "p99 us" << setw(12) << "p99.9 us" << setw(12) << "max us" << endl;
+    for(int op = 0; op < OP_COUNT; op++) {
+        if(st.count[op] == 0)
+            continue;
+        cout << setw(8) << op_names[op] << setw(12) << st.count[op] << setw(10) << st.errors[op] << setprecision(1);
+        cout << setw(12) << percentile(st, op, 0.5) / 1e3 << setw(12) << percentile(st, op, 0.99) / 1e3;
+        cout << setw(12) << percentile(st, op, 0.999) / 1e3 << setw(12) << st.max_ns[op] / 1e3 << endl;
+    }
+    for(int d = 0; d < ndev; d++) {
+        double pct = locks[d].Acquisitions ? 100.0 * double(locks[d].Contended) / double(locks[d].Acquisitions) : 0.0;
+        double wait = locks[d].Contended ? double(locks[d].WaitTime) / double(locks[d].Contended) / 1e3 : 0.0;
+        cout << "   device " << d << " lock: " << locks[d].Acquisitions << " acquisitions, " << setprecision(1) << pct << "% contended, " << wait << " us average wait" << endl;
+    }
+    cout << "   torn configs: " << __atomic_load_n(&torn_configs, __ATOMIC_RELAXED);
+    cout << ", stuck locks: " << __atomic_load_n(&stuck_locks, __ATOMIC_RELAXED);
+    cout << ", stuck threads: " << __atomic_load_n(&stuck_threads, __ATOMIC_RELAXED) << endl;
+}
+
+static void usage(const char* name) {
+    cout << "Usage: " << name << " [options]" << endl;
+    cout << "  -t threads      worker threads (default 4)" << endl;
+    cout << "  -d seconds      test duration (default 60)" << endl;
+    cout << "  -r rate         operations per second per thread, 0 for no pacing (default 100)" << endl;
+    cout << "  -i seconds      report interval (default 10)" << endl;
+    cout << "  -s axes         use simulated axes instead of the USB devices" << endl;
+    cout << "  -f probability  inject PIPE errors and short reads" << endl;
+    cout << "  -R steps        move range around the starting position (default 100)" << endl;
+    cout << "  -m p,m,c,s      weights of polls, moves, config writes and stops (default 70,10,15,5)" << endl;
+    cout << "  -w seconds      stuck lock threshold (default 30)" << endl;
+    cout << "WARNING: on real devices the test moves the motors and rewrites their parameters." << endl;
+}
+
+static void quiet_logger(const char* fmt, ...) {
+
+}
+
+int main(int argc, char** argv)
+{
+    int c;
+    while((c = getopt(argc, argv, "t:d:r:i:s:f:R:m:w:h")) != -1) {
+        switch(c) {
+            case 't': n_threads = atoi(optarg); break;
+            case 'd': duration = atoi(optarg); break;
+            case 'r': rate = atof(optarg); break;
+            case 'i': interval = atoi(optarg); break;
+            case 's': sim_axes = atoi(optarg); break;
+            case 'f': fault = atof(optarg); break;
+            case 'R': move_range = atoi(optarg); break;
+            case 'm':
+                if(sscanf(optarg, "%d,%d,%d,%d", &weights[0], &weights[1], &weights[2], &weights[3]) != 4) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'w': stuck_threshold = atoi(optarg); break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if(n_threads < 1 || duration < 1 || interval < 1 || move_range < 0 || stuck_threshold < 1 || weights[0] + weights[1] + weights[2] + weights[3] <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    cout << "USMC stress test" << endl;
+
+    // Backend
+    USMC_Simulator* sim = NULL;
+    USMC_usb_transport* usb = NULL;
+    USMC_fault_transport* faults = NULL;
+    USMC_transport* transport = NULL;
+    if(sim_axes > 0) {
+        sim = new USMC_Simulator();
+        for(int i = 0; i < sim_axes; i++) {
+            USMC_SimAxisConfig config;
+            USMC_Simulator::defaults(&config, i);
+            sim->addAxis(config);
+        }
+        transport = sim;
+    }
+    if(fault > 0.0) {
+        if(NULL == transport) {
+            usb = new USMC_usb_transport();
+            transport = usb;
+        }
+        faults = new USMC_fault_transport(transport);
+        USMC_FaultConfig fc;
+        USMC_fault_transport::defaults(&fc);
+        fc.pipe = fault;
+        fc.short_read = fault;
+        faults->configure(fc);
+        faults->enable(false);
+        transport = faults;
+    }
+    usmc_driver = transport ? USMC::getInstance(transport) : USMC::getInstance();
+    usmc_driver->set_info_logger(quiet_logger);
+    if(fault > 0.0)
+        usmc_driver->set_error_logger(quiet_logger);
+
+    ndev = usmc_driver->probeDevices();
+    if(ndev <= 0) {
+        cout << "No devices found" << endl;
+        return 1;
+    }
+    cout << "Devices: " << ndev << ", threads: " << n_threads << ", rate: " << rate << " ops/s/thread, duration: " << duration << " s" << endl;
+
+    // Starting point
+    home.resize(ndev);
+    base_params.resize(ndev);
+    base_mode.resize(ndev);
+    for(int d = 0; d < ndev; d++) {
+        USMC_State state;
+        usmc_driver->getState(d, &state);
+        home[d] = state.CurPos;
+        usmc_driver->getMode(d, &base_mode[d]);
+        usmc_driver->getParameters(d, &base_params[d]);
+        USMC_Parameters p;
+        makeParameters(p, d, 2);
+        if(usmc_driver->setParameters(d, &p) < 0) {
+            cout << "Failed to initialize parameters of device " << d << endl;
+            return 1;
+        }
+    }
+    if(faults)
+        faults->enable(true);
+
+    // Start workers and watchdog
+    workers = new worker[n_threads];
+    for(int t = 0; t < n_threads; t++) {
+        workers[t].index = t;
+        workers[t].rng = 0x9E3779B97F4A7C15ULL * uint64_t(t + 1);
+        memset(&(workers[t].st), 0, sizeof(stats));
+        workers[t].heartbeat = 0;
+    }
+    for(int t = 0; t < n_threads; t++)
+        pthread_create(&workers[t].thread, NULL, worker_main, &workers[t]);
+    pthread_t watchdog;
+    pthread_create(&watchdog, NULL, watchdog_main, NULL);
+
+    // Periodic reports
+    stats* total = new stats;
+    stats* last = new stats;
+    stats* cur = new stats;
+    memset(last, 0, sizeof(stats));
+    std::vector<USMC_LockStats> locks_start(ndev), locks_last(ndev), locks_now(ndev), locks_delta(ndev);
+    for(int d = 0; d < ndev; d++) {
+        usmc_driver->getLockStats(d, &locks_start[d]);
+        locks_last[d] = locks_start[d];
+    }
+    uint64_t t_start = now_ns(), t_last = t_start;
+
+    for(int elapsed = 0; elapsed < duration; ) {
+        int step = (duration - elapsed) < interval ? (duration - elapsed) : interval;
+        sleep(step);
+        elapsed += step;
+
+        memset(cur, 0, sizeof(stats));
+        for(int t = 0; t < n_threads; t++) {
+            USMC_lock l(&(workers[t].lock));
+            merge(*cur, workers[t].st);
+        }
+
+        // Interval statistics (histograms are cumulative, subtract the previous ones)
+        stats* delta = new stats;
+        memcpy(delta, cur, sizeof(stats));
+        for(int op = 0; op < OP_COUNT; op++) {
+            delta->count[op] -= last->count[op];
+            delta->errors[op] -= last->errors[op];
+            for(int b = 0; b < HIST_SIZE; b++)
+                delta->hist[op][b] -= last->hist[op][b];
+        }
+        for(int d = 0; d < ndev; d++) {
+            usmc_driver->getLockStats(d, &locks_now[d]);
+            locks_delta[d].Acquisitions = locks_now[d].Acquisitions - locks_last[d].Acquisitions;
+            locks_delta[d].Contended = locks_now[d].Contended - locks_last[d].Contended;
+            locks_delta[d].WaitTime = locks_now[d].WaitTime - locks_last[d].WaitTime;
+            locks_last[d] = locks_now[d];
+        }
+        uint64_t t_now = now_ns();
+        report("interval", *delta, double(t_now - t_last) / 1e9, locks_delta);
+        t_last = t_now;
+        memcpy(last, cur, sizeof(stats));
+        delete delta;
+    }
+
+    // Stop and final report
+    running = false;
+    for(int t = 0; t < n_threads; t++)
+        pthread_join(workers[t].thread, NULL);
+    pthread_join(watchdog, NULL);
+
+    memset(total, 0, sizeof(stats));
+    for(int t = 0; t < n_threads; t++)
+        merge(*total, workers[t].st);
+    for(int d = 0; d < ndev; d++) {
+        usmc_driver->getLockStats(d, &locks_now[d]);
+        locks_delta[d].Acquisitions = locks_now[d].Acquisitions - locks_start[d].Acquisitions;
+        locks_delta[d].Contended = locks_now[d].Contended - locks_start[d].Contended;
+        locks_delta[d].WaitTime = locks_now[d].WaitTime - locks_start[d].WaitTime;
+    }
+    report("total", *total, double(now_ns() - t_start) / 1e9, locks_delta);
+
+    // Restore the initial parameters and stop the motors
+    if(faults)
+        faults->enable(false);
+    for(int d = 0; d < ndev; d++) {
+        usmc_driver->stop(d);
+        usmc_driver->setParameters(d, &base_params[d]);
+        usmc_driver->setMode(d, &base_mode[d]);
+    }
+
+    bool failed = torn_configs > 0 || stuck_locks > 0 || stuck_threads > 0;
+    delete total;
+    delete last;
+    delete cur;
+    delete[] workers;
+    USMC::shutdown();
+    if(faults)
+        delete faults;
+    if(usb)
+        delete usb;
+    if(sim)
+        delete sim;
+    return failed ? 2 : 0;
+}
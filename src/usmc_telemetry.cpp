@@ -0,0 +1,306 @@
+/***************************************************//**
+ * @file    usmc_telemetry.cpp
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <usmc_telemetry.h>
+#include <usmc_clock.h>
+
+
+// File header (padded to 64 bytes, the rings follow)
+#define TLM_MAGIC           "USMCTLM1"
+#define TLM_VERSION         1
+#define TLM_HEADER_SIZE     64
+
+// Reads of a bucket before giving up on a writer
+#define TLM_MAX_RETRIES     10000
+
+typedef struct _tlm_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t ndevices;
+    uint32_t sizes[USMC_TLM_LEVELS];
+    uint32_t bucket_size;
+} tlm_header;
+
+// Bucket spans (us)
+static const uint64_t tlm_spans[USMC_TLM_LEVELS] = { 1000000ULL, 60000000ULL, 3600000000ULL };
+
+// Default ring sizes
+static const uint32_t tlm_default_sizes[USMC_TLM_LEVELS] = { USMC_TLM_SECONDS, USMC_TLM_MINUTES, USMC_TLM_HOURS };
+
+
+// Update a channel with a value
+static inline void tlm_update(USMC_TelemetryChannel& ch, double v, bool first) {
+    if(first) {
+        ch.min = v;
+        ch.max = v;
+        ch.sum = v;
+    } else {
+        if(v < ch.min)
+            ch.min = v;
+        if(v > ch.max)
+            ch.max = v;
+        ch.sum += v;
+    }
+    ch.last = v;
+}
+
+
+// Constructor
+USMC_TelemetryStore::USMC_TelemetryStore() : _fd(-1), _base(NULL), _length(0), _readonly(false), _anchored(false), _wall_offset(0) {}
+
+// Destructor
+USMC_TelemetryStore::~USMC_TelemetryStore() {
+    close();
+}
+
+// Open a store
+int USMC_TelemetryStore::open(const char* filename, int ndevices, const uint32_t* sizes) {
+    if(NULL == filename || ndevices < 1)
+        return ERR_INVALID_PARAM;
+    if(NULL == sizes)
+        sizes = tlm_default_sizes;
+    for(int l = 0; l < USMC_TLM_LEVELS; l++)
+        if(sizes[l] == 0)
+            return ERR_INVALID_VALUE;
+    return map(filename, ndevices, sizes, true);
+}
+
+// Open a store for queries
+int USMC_TelemetryStore::openReadOnly(const char* filename) {
+    if(NULL == filename)
+        return ERR_INVALID_PARAM;
+    return map(filename, 0, NULL, false);
+}
+
+// Map the file
+int USMC_TelemetryStore::map(const char* filename, int ndevices, const uint32_t* sizes, bool create) {
+    close();
+    _anchored = false;
+
+    int fd = create ? ::open(filename, O_RDWR | O_CREAT, 0644) : ::open(filename, O_RDONLY);
+    if(fd < 0)
+        return ERR_INVALID_PARAM;
+
+    struct stat st;
+    if(fstat(fd, &st) < 0) {
+        ::close(fd);
+        return ERR_INVALID_PARAM;
+    }
+
+    tlm_header header;
+    if(st.st_size == 0 && create) {
+        // New store: write the header and size the file once
+        memset(&header, 0, sizeof(tlm_header));
+        memcpy(header.magic, TLM_MAGIC, 8);
+        header.version = TLM_VERSION;
+        header.ndevices = uint32_t(ndevices);
+        for(int l = 0; l < USMC_TLM_LEVELS; l++)
+            header.sizes[l] = sizes[l];
+        header.bucket_size = sizeof(USMC_TelemetryBucket);
+
+        uint64_t buckets = uint64_t(sizes[0]) + sizes[1] + sizes[2];
+        off_t length = off_t(TLM_HEADER_SIZE + uint64_t(ndevices) * buckets * sizeof(USMC_TelemetryBucket));
+        if(ftruncate(fd, length) < 0 || pwrite(fd, &header, sizeof(tlm_header), 0) != ssize_t(sizeof(tlm_header))) {
+            ::close(fd);
+            return ERR_INVALID_PARAM;
+        }
+        st.st_size = length;
+
+    } else {
+        // Existing store: check the header
+        if(pread(fd, &header, sizeof(tlm_header), 0) != ssize_t(sizeof(tlm_header))) {
+            ::close(fd);
+            return ERR_INVALID_VALUE;
+        }
+        bool valid = (memcmp(header.magic, TLM_MAGIC, 8) == 0 && header.version == TLM_VERSION && header.ndevices > 0 && header.bucket_size == sizeof(USMC_TelemetryBucket));
+        uint64_t buckets = uint64_t(header.sizes[0]) + header.sizes[1] + header.sizes[2];
+        if(valid && uint64_t(st.st_size) != TLM_HEADER_SIZE + uint64_t(header.ndevices) * buckets * sizeof(USMC_TelemetryBucket))
+            valid = false;
+        if(valid && create) {
+            valid = (header.ndevices == uint32_t(ndevices));
+            for(int l = 0; l < USMC_TLM_LEVELS; l++)
+                valid = valid && (header.sizes[l] == sizes[l]);
+        }
+        if(!valid) {
+            ::close(fd);
+            return ERR_INVALID_VALUE;
+        }
+    }
+
+    void* base = mmap(NULL, size_t(st.st_size), create ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+    if(base == MAP_FAILED) {
+        ::close(fd);
+        return ERR_USB_NO_MEM;
+    }
+
+    _fd = fd;
+    _base = base;
+    _length = size_t(st.st_size);
+    _readonly = !create;
+    return ERR_SUCCESS;
+}
+
+// Close the store
+void USMC_TelemetryStore::close() {
+    if(_base) {
+        if(!_readonly)
+            msync(_base, _length, MS_SYNC);
+        munmap(_base, _length);
+        _base = NULL;
+        _length = 0;
+    }
+    if(_fd >= 0) {
+        ::close(_fd);
+        _fd = -1;
+    }
+}
+
+// Flush to disk
+void USMC_TelemetryStore::sync() {
+    if(_base && !_readonly)
+        msync(_base, _length, MS_ASYNC);
+}
+
+// Number of devices
+int USMC_TelemetryStore::devices()const {
+    if(NULL == _base)
+        return 0;
+    return int(reinterpret_cast<const tlm_header*>(_base)->ndevices);
+}
+
+// Bucket span
+uint64_t USMC_TelemetryStore::span(int level) {
+    if(level < 0 || level >= USMC_TLM_LEVELS)
+        return 0;
+    return tlm_spans[level];
+}
+
+// Ring of a device and level
+USMC_TelemetryBucket* USMC_TelemetryStore::ring(int device, int level)const {
+    const tlm_header* header = reinterpret_cast<const tlm_header*>(_base);
+    uint64_t offset = uint64_t(device) * (uint64_t(header->sizes[0]) + header->sizes[1] + header->sizes[2]);
+    for(int l = 0; l < level; l++)
+        offset += header->sizes[l];
+    return reinterpret_cast<USMC_TelemetryBucket*>(reinterpret_cast<char*>(_base) + TLM_HEADER_SIZE) + offset;
+}
+
+// Add a sample
+int USMC_TelemetryStore::add(int device, uint64_t time_us, const USMC_State& state) {
+    if(NULL == _base || _readonly)
+        return ERR_USB_NOT_FOUND;
+    const tlm_header* header = reinterpret_cast<const tlm_header*>(_base);
+    if(device < 0 || uint32_t(device) >= header->ndevices)
+        return ERR_INVALID_ID;
+
+    for(int l = 0; l < USMC_TLM_LEVELS; l++) {
+        uint64_t index = time_us / tlm_spans[l];
+        USMC_TelemetryBucket* b = ring(device, l) + (index % header->sizes[l]);
+        uint64_t start = index * tlm_spans[l];
+
+        // Samples older than the bucket in the slot are dropped
+        if(b->count > 0 && b->start > start)
+            continue;
+
+        // Odd sequence while the bucket is being written
+        uint32_t seq = b->seq;
+        __atomic_store_n(&b->seq, seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+
+        bool first = (b->count == 0 || b->start != start);
+        if(first) {
+            b->start = start;
+            b->count = 0;
+        }
+        tlm_update(b->position, double(state.CurPos), first);
+        tlm_update(b->temp, double(state.Temp), first);
+        tlm_update(b->voltage, double(state.Voltage), first);
+        b->count++;
+
+        __atomic_store_n(&b->seq, seq + 2, __ATOMIC_RELEASE);
+    }
+    return ERR_SUCCESS;
+}
+
+// Add a sample from a cycle
+void USMC_TelemetryStore::push(int device, uint64_t time_us, const USMC_State& state) {
+    // One offset for the whole feed, so the samples follow the monotonic
+    // clock even if the system clock is set
+    if(!_anchored) {
+        _wall_offset = int64_t(usmc_wall_time_us(time_us)) - int64_t(time_us);
+        _anchored = true;
+    }
+    add(device, uint64_t(int64_t(time_us) + _wall_offset), state);
+}
+
+// Query a time window
+int USMC_TelemetryStore::query(int device, int level, uint64_t t0, uint64_t t1, USMC_TelemetryBucket* buckets, size_t max)const {
+    if(NULL == _base)
+        return ERR_USB_NOT_FOUND;
+    const tlm_header* header = reinterpret_cast<const tlm_header*>(_base);
+    if(device < 0 || uint32_t(device) >= header->ndevices)
+        return ERR_INVALID_ID;
+    if(level < 0 || level >= USMC_TLM_LEVELS || NULL == buckets)
+        return ERR_INVALID_PARAM;
+    if(t1 <= t0 || max == 0)
+        return 0;
+
+    // Only the part of the window still covered by the ring can be present
+    uint64_t size = header->sizes[level];
+    uint64_t first = t0 / tlm_spans[level];
+    uint64_t last = (t1 - 1) / tlm_spans[level];
+    if(last - first >= size)
+        first = last - size + 1;
+
+    const USMC_TelemetryBucket* r = ring(device, level);
+    size_t n = 0;
+    for(uint64_t index = first; index <= last && n < max; index++) {
+        const USMC_TelemetryBucket* b = r + (index % size);
+        uint64_t start = index * tlm_spans[level];
+
+        // Consistent copy of the bucket (retry while the writer updates it,
+        // a bucket left half-written by a dead writer is skipped)
+        USMC_TelemetryBucket copy;
+        bool valid = false;
+        for(int retry = 0; retry < TLM_MAX_RETRIES && !valid; retry++) {
+            uint32_t seq = __atomic_load_n(&b->seq, __ATOMIC_ACQUIRE);
+            if(seq & 1)
+                continue;
+            memcpy(&copy, b, sizeof(USMC_TelemetryBucket));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            valid = (__atomic_load_n(&b->seq, __ATOMIC_RELAXED) == seq);
+        }
+        if(!valid || copy.count == 0 || copy.start != start)
+            continue;
+        buckets[n++] = copy;
+    }
+    return int(n);
+}
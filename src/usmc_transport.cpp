@@ -0,0 +1,299 @@
+/***************************************************//**
+ * @file    usmc_transport.cpp
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <libusb.h>
+#include <libusmc.h>
+#include <usmc_transport.h>
+
+
+// Error description
+const char* USMC_transport::strerror(int error) {
+    switch(error) {
+        case ERR_SUCCESS:           return "Success";
+        case ERR_USB_IO:            return "Input/Output Error";
+        case ERR_USB_INVALID_PARAM: return "Invalid parameter";
+        case ERR_USB_ACCESS:        return "Access denied (insufficient permissions)";
+        case ERR_USB_NO_DEVICE:     return "No such device (it may have been disconnected)";
+        case ERR_USB_NOT_FOUND:     return "Entity not found";
+        case ERR_USB_BUSY:          return "Resource busy";
+        case ERR_USB_TIMEOUT:       return "Operation timed out";
+        case ERR_USB_OVERFLOW:      return "Overflow";
+        case ERR_USB_PIPE:          return "Pipe error";
+        case ERR_USB_INTERRUPTED:   return "System call interrupted (perhaps due to signal)";
+        case ERR_USB_NO_MEM:        return "Insufficient memory";
+        case ERR_USB_NOT_SUPPORTED: return "Operation not supported or unimplemented on this platform";
+        default:                    return "Other error";
+    }
+}
+
+
+// Default batch: one transfer after the other
+void USMC_transport::control_transfers(USMC_TransferRequest* requests, size_t n, unsigned int timeout) {
+    for(size_t i = 0; i < n; i++) {
+        USMC_TransferRequest& req = requests[i];
+        req.result = control_transfer(req.handle, req.bRequestType, req.bRequest, req.wValue, req.wIndex, req.data, req.wLength, timeout);
+    }
+}
+
+
+// Largest payload of a preallocated transfer (controller packets are smaller)
+#define USB_MAX_PAYLOAD    64
+
+// Open device with its preallocated transfer
+struct usb_device {
+    libusb_device_handle* handle;
+    libusb_transfer* transfer;
+    volatile int completed;
+    uint8_t* data;                      // Destination of an IN transfer.
+    USMC_TransferRequest* request;      // Batch request in flight.
+    unsigned char buffer[LIBUSB_CONTROL_SETUP_SIZE + USB_MAX_PAYLOAD];
+};
+
+// Transfer completion callback
+static void LIBUSB_CALL usb_transfer_done(libusb_transfer* transfer) {
+    *static_cast<volatile int*>(transfer->user_data) = 1;
+}
+
+
+// USB transport constructor
+USMC_usb_transport::USMC_usb_transport() : _usb_ctx(NULL) {
+    libusb_context* ctx = NULL;
+    int ret = libusb_init(&ctx);
+    if(ret)
+        throw std::runtime_error("Failed to initialize libusb");
+    _usb_ctx = ctx;
+}
+
+
+// USB transport destructor
+USMC_usb_transport::~USMC_usb_transport() {
+    if(_usb_ctx) {
+        libusb_exit(static_cast<libusb_context*>(_usb_ctx));
+        _usb_ctx = NULL;
+    }
+}
+
+
+// Open all the controllers
+int USMC_usb_transport::open(std::vector<void*>& handles, void (*logger)(const char*, ...)) {
+    // Get device list
+    libusb_device **devs;
+    ssize_t cnt = libusb_get_device_list(static_cast<libusb_context*>(_usb_ctx), &devs);
+    if (cnt < 0){
+        // Failed to get device list
+        logger("Failed to get device list. Error: %s", libusb_strerror(static_cast<libusb_error>(cnt)));
+        return cnt;
+    }
+
+    // Traverse device list
+    libusb_device *dev = NULL;
+    int i = 0;
+    while ((dev = devs[i++]) != NULL) {
+
+        // Get device descriptor
+        struct libusb_device_descriptor desc;
+        int r = libusb_get_device_descriptor(dev, &desc);
+        if (r < 0) {
+            logger("Failed to get device descriptor. Error: %s", libusb_strerror(static_cast<libusb_error>(r)));
+            continue;
+        }
+
+        if(desc.idVendor == USMC_VENDOR_ID && desc.idProduct == USMC_PRODUCT_ID) {
+            // Found an USMC device, try to open it!
+            libusb_device_handle* dev_h = NULL;
+            r = libusb_open(dev, &dev_h);
+            if(r < 0) {
+                logger("Failed to open device. Error: %s", libusb_strerror(static_cast<libusb_error>(r)));
+                continue;
+            }
+
+            // Preallocate the transfer used by all the control requests
+            libusb_transfer* transfer = libusb_alloc_transfer(0);
+            if(NULL == transfer) {
+                logger("Failed to allocate transfer.");
+                libusb_close(dev_h);
+                continue;
+            }
+            usb_device* usb_dev = new usb_device;
+            usb_dev->handle = dev_h;
+            usb_dev->transfer = transfer;
+            usb_dev->completed = 1;
+            usb_dev->data = NULL;
+            usb_dev->request = NULL;
+            memset(usb_dev->buffer, 0, sizeof(usb_dev->buffer));
+            handles.push_back(usb_dev);
+        }
+    }
+
+    // Free device list
+    libusb_free_device_list(devs, 1);
+    return 0;
+}
+
+
+// Close device
+void USMC_usb_transport::close(void* handle) {
+    usb_device* usb_dev = static_cast<usb_device*>(handle);
+    if(usb_dev) {
+        libusb_free_transfer(usb_dev->transfer);
+        libusb_close(usb_dev->handle);
+        delete usb_dev;
+    }
+}
+
+
+// Submit a control request on the preallocated transfer. The library does
+// not allocate here, but libusb does (the usbfs backend allocates the URBs
+// of every submitted transfer).
+static int usb_submit(usb_device* usb_dev, uint8_t bRequestType, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, uint8_t* data, uint16_t wLength, unsigned int timeout) {
+    libusb_fill_control_setup(usb_dev->buffer, bRequestType, bRequest, wValue, wIndex, wLength);
+    if(!(bRequestType & LIBUSB_ENDPOINT_IN) && wLength > 0)
+        memcpy(usb_dev->buffer + LIBUSB_CONTROL_SETUP_SIZE, data, wLength);
+    usb_dev->data = (bRequestType & LIBUSB_ENDPOINT_IN) ? data : NULL;
+    usb_dev->completed = 0;
+    libusb_fill_control_transfer(usb_dev->transfer, usb_dev->handle, usb_dev->buffer, usb_transfer_done, const_cast<int*>(&usb_dev->completed), timeout);
+
+    int r = libusb_submit_transfer(usb_dev->transfer);
+    if(r < 0)
+        usb_dev->completed = 1;
+    return r;
+}
+
+
+// Wait for the submitted transfer (same sequence as libusb_control_transfer())
+static int usb_complete(libusb_context* ctx, usb_device* usb_dev) {
+    libusb_transfer* transfer = usb_dev->transfer;
+    while(!usb_dev->completed) {
+        int r = libusb_handle_events_completed(ctx, const_cast<int*>(&usb_dev->completed));
+        if(r < 0) {
+            if(r == LIBUSB_ERROR_INTERRUPTED)
+                continue;
+            libusb_cancel_transfer(transfer);
+            while(!usb_dev->completed)
+                if(libusb_handle_events_completed(ctx, const_cast<int*>(&usb_dev->completed)) < 0)
+                    break;
+            return r;
+        }
+    }
+
+    switch(transfer->status) {
+        case LIBUSB_TRANSFER_COMPLETED:
+            if(usb_dev->data && transfer->actual_length > 0)
+                memcpy(usb_dev->data, libusb_control_transfer_get_data(transfer), transfer->actual_length);
+            return transfer->actual_length;
+        case LIBUSB_TRANSFER_TIMED_OUT:
+            return LIBUSB_ERROR_TIMEOUT;
+        case LIBUSB_TRANSFER_STALL:
+            return LIBUSB_ERROR_PIPE;
+        case LIBUSB_TRANSFER_NO_DEVICE:
+            return LIBUSB_ERROR_NO_DEVICE;
+        case LIBUSB_TRANSFER_OVERFLOW:
+            return LIBUSB_ERROR_OVERFLOW;
+        default:
+            return LIBUSB_ERROR_IO;
+    }
+}
+
+
+// Control transfer
+int USMC_usb_transport::control_transfer(void* handle, uint8_t bRequestType, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, uint8_t* data, uint16_t wLength, unsigned int timeout) {
+    usb_device* usb_dev = static_cast<usb_device*>(handle);
+    if(NULL == usb_dev)
+        return ERR_USB_INVALID_PARAM;
+
+    // Oversized requests go through the allocating synchronous call
+    if(wLength > USB_MAX_PAYLOAD)
+        return libusb_control_transfer(usb_dev->handle, bRequestType, bRequest, wValue, wIndex, data, wLength, timeout);
+
+    int r = usb_submit(usb_dev, bRequestType, bRequest, wValue, wIndex, data, wLength, timeout);
+    if(r < 0)
+        return r;
+    return usb_complete(static_cast<libusb_context*>(_usb_ctx), usb_dev);
+}
+
+
+// Pipelined control transfers: every device has one transfer in flight
+void USMC_usb_transport::control_transfers(USMC_TransferRequest* requests, size_t n, unsigned int timeout) {
+    libusb_context* ctx = static_cast<libusb_context*>(_usb_ctx);
+
+    for(size_t i = 0; i < n; i++) {
+        USMC_TransferRequest& req = requests[i];
+        usb_device* usb_dev = static_cast<usb_device*>(req.handle);
+        if(NULL == usb_dev) {
+            req.result = ERR_USB_INVALID_PARAM;
+            continue;
+        }
+
+        // Complete the previous request to the same device
+        if(usb_dev->request) {
+            usb_dev->request->result = usb_complete(ctx, usb_dev);
+            usb_dev->request = NULL;
+        }
+
+        if(req.wLength > USB_MAX_PAYLOAD) {
+            req.result = libusb_control_transfer(usb_dev->handle, req.bRequestType, req.bRequest, req.wValue, req.wIndex, req.data, req.wLength, timeout);
+            continue;
+        }
+        req.result = usb_submit(usb_dev, req.bRequestType, req.bRequest, req.wValue, req.wIndex, req.data, req.wLength, timeout);
+        if(req.result == 0)
+            usb_dev->request = &req;
+    }
+
+    // Complete the transfers still in flight
+    for(size_t i = 0; i < n; i++) {
+        usb_device* usb_dev = static_cast<usb_device*>(requests[i].handle);
+        if(usb_dev && usb_dev->request == &requests[i]) {
+            requests[i].result = usb_complete(ctx, usb_dev);
+            usb_dev->request = NULL;
+        }
+    }
+}
+
+
+// Error description
+const char* USMC_usb_transport::strerror(int error) {
+    return libusb_strerror(static_cast<libusb_error>(error));
+}
+
+
+// Bus path (same format as sysfs, e.g. 1-2.3)
+std::string USMC_usb_transport::path(void* handle) {
+    if(NULL == handle)
+        return std::string("");
+    libusb_device* dev = libusb_get_device(static_cast<usb_device*>(handle)->handle);
+    char buffer[64];
+    int len = snprintf(buffer, sizeof(buffer), "%u", unsigned(libusb_get_bus_number(dev)));
+
+    uint8_t ports[8];
+    int n = libusb_get_port_numbers(dev, ports, 8);
+    for(int i = 0; i < n && len < int(sizeof(buffer)); i++)
+        len += snprintf(buffer + len, sizeof(buffer) - len, "%c%u", i ? '.' : '-', unsigned(ports[i]));
+    return std::string(buffer);
+}
@@ -0,0 +1,203 @@
+/***************************************************//**
+ * @file    usmc_usb_shim.cpp
+ * @date    May 2020
+ * @author  Michele Devetta
+ *
+ * libusb replacement for benchmarks, to be loaded with LD_PRELOAD. Exposes
+ * a number of fake 8SMC1 controllers (USMC_SHIM_DEVICES, default 4) that
+ * answer every control transfer instantly with canned data, so only the
+ * library overhead is measured. Both the synchronous and the asynchronous
+ * control transfers are supported.
+ *
+ * LICENSE:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *******************************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <libusb.h>
+#include <usmctypes.h>
+#include <usmc_transport.h>
+
+// Maximum number of fake devices
+#define SHIM_MAX_DEVICES    64
+
+
+// Fake device (opaque to libusb users)
+struct libusb_device {
+    int index;
+};
+
+struct libusb_device_handle {
+    libusb_device* dev;
+};
+
+// Fake context
+struct libusb_context {
+    int dummy;
+};
+
+static libusb_context shim_context;
+static libusb_device shim_devices[SHIM_MAX_DEVICES];
+static libusb_device_handle shim_handles[SHIM_MAX_DEVICES];
+
+
+// Number of fake devices
+static int shim_count() {
+    const char* env = getenv("USMC_SHIM_DEVICES");
+    int n = env ? atoi(env) : 4;
+    return n < 0 ? 0 : (n > SHIM_MAX_DEVICES ? SHIM_MAX_DEVICES : n);
+}
+
+
+extern "C" {
+
+int LIBUSB_CALL libusb_init(libusb_context** ctx) {
+    if(ctx)
+        *ctx = &shim_context;
+    return LIBUSB_SUCCESS;
+}
+
+void LIBUSB_CALL libusb_exit(libusb_context* ctx) {
+
+}
+
+ssize_t LIBUSB_CALL libusb_get_device_list(libusb_context* ctx, libusb_device*** list) {
+    int n = shim_count();
+    libusb_device** devs = static_cast<libusb_device**>(malloc(sizeof(libusb_device*) * (n + 1)));
+    if(NULL == devs)
+        return LIBUSB_ERROR_NO_MEM;
+    for(int i = 0; i < n; i++) {
+        shim_devices[i].index = i;
+        devs[i] = &shim_devices[i];
+    }
+    devs[n] = NULL;
+    *list = devs;
+    return n;
+}
+
+void LIBUSB_CALL libusb_free_device_list(libusb_device** list, int unref_devices) {
+    free(list);
+}
+
+int LIBUSB_CALL libusb_get_device_descriptor(libusb_device* dev, struct libusb_device_descriptor* desc) {
+    memset(desc, 0, sizeof(struct libusb_device_descriptor));
+    desc->bLength = LIBUSB_DT_DEVICE_SIZE;
+    desc->bDescriptorType = LIBUSB_DT_DEVICE;
+    desc->idVendor = USMC_VENDOR_ID;
+    desc->idProduct = USMC_PRODUCT_ID;
+    return LIBUSB_SUCCESS;
+}
+
+int LIBUSB_CALL libusb_open(libusb_device* dev, libusb_device_handle** dev_handle) {
+    shim_handles[dev->index].dev = dev;
+    *dev_handle = &shim_handles[dev->index];
+    return LIBUSB_SUCCESS;
+}
+
+void LIBUSB_CALL libusb_close(libusb_device_handle* dev_handle) {
+
+}
+
+libusb_device* LIBUSB_CALL libusb_get_device(libusb_device_handle* dev_handle) {
+    return dev_handle->dev;
+}
+
+uint8_t LIBUSB_CALL libusb_get_bus_number(libusb_device* dev) {
+    return 1;
+}
+
+int LIBUSB_CALL libusb_get_port_numbers(libusb_device* dev, uint8_t* port_numbers, int port_numbers_len) {
+    if(port_numbers_len < 1)
+        return LIBUSB_ERROR_OVERFLOW;
+    port_numbers[0] = uint8_t(dev->index + 1);
+    return 1;
+}
+
+int LIBUSB_CALL libusb_control_transfer(libusb_device_handle* dev_handle, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char* data, uint16_t wLength, unsigned int timeout) {
+    if(!(request_type & LIBUSB_ENDPOINT_IN))
+        return wLength;
+
+    switch(bRequest) {
+        case 0x06: {
+            // Version string
+            const unsigned char version[6] = { 6, 3, '2', '5', '0', '4' };
+            uint16_t n = wLength < 6 ? wLength : 6;
+            memcpy(data, version, n);
+            return n;
+        }
+        case 0xC9:
+            // Serial number
+            memset(data, 0, wLength);
+            snprintf(reinterpret_cast<char*>(data), wLength, "SHIM%04d", dev_handle->dev->index);
+            return wLength;
+        case 0x82: {
+            // Idle at position 0, 25 degC, 24 V
+            STATE_PACKET state;
+            memset(&state, 0, sizeof(STATE_PACKET));
+            state.Temp = uint16_t(75.0 / 330.0 * 65536.0);
+            state.RESET = 1;
+            state.AFTRESET = 1;
+            state.Working = 1;
+            state.Voltage = uint16_t(24.0 / 66.0 * 65536.0);
+            uint16_t n = wLength < sizeof(STATE_PACKET) ? wLength : sizeof(STATE_PACKET);
+            memcpy(data, &state, n);
+            return n;
+        }
+        default:
+            memset(data, 0, wLength);
+            return wLength;
+    }
+}
+
+// Asynchronous transfers complete immediately: the callback runs in libusb_submit_transfer()
+struct libusb_transfer* LIBUSB_CALL libusb_alloc_transfer(int iso_packets) {
+    size_t len = sizeof(struct libusb_transfer) + sizeof(struct libusb_iso_packet_descriptor) * iso_packets;
+    return static_cast<struct libusb_transfer*>(calloc(1, len));
+}
+
+void LIBUSB_CALL libusb_free_transfer(struct libusb_transfer* transfer) {
+    free(transfer);
+}
+
+int LIBUSB_CALL libusb_submit_transfer(struct libusb_transfer* transfer) {
+    struct libusb_control_setup* setup = reinterpret_cast<struct libusb_control_setup*>(transfer->buffer);
+    int r = libusb_control_transfer(transfer->dev_handle, setup->bmRequestType, setup->bRequest, setup->wValue, setup->wIndex, transfer->buffer + LIBUSB_CONTROL_SETUP_SIZE, setup->wLength, transfer->timeout);
+    transfer->status = LIBUSB_TRANSFER_COMPLETED;
+    transfer->actual_length = r;
+    transfer->callback(transfer);
+    return LIBUSB_SUCCESS;
+}
+
+int LIBUSB_CALL libusb_cancel_transfer(struct libusb_transfer* transfer) {
+    return LIBUSB_ERROR_NOT_FOUND;
+}
+
+int LIBUSB_CALL libusb_handle_events_completed(libusb_context* ctx, int* completed) {
+    return LIBUSB_SUCCESS;
+}
+
+const char* LIBUSB_CALL libusb_strerror(int errcode) {
+    return "libusb shim error";
+}
+
+}
@@ -0,0 +1,809 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <cstddef>
+#include <strings.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <libusmc.h>
+#include <usmc_clock.h>
+#include <usmc_motion.h>
+#include <usmc_provision.h>
+#include <usmc_sim.h>
+
+using namespace std;
+
+// Script syntax: one command per line, '#' starts a comment. Commands on
+// different devices run concurrently (one worker per device, keeping the
+// order of each device), 'sync' and 'list' wait for all the previous
+// commands. Example:
+//
+//   speed 0 2000
+//   speed 1 2000
+//   move 0 10000
+//   move 1 -5000
+//   wait all
+//   params 0 AccelT=200 DecelT=200
+//   sync
+//   move 0 0
+//
+// 'provision' writes a serial number, a mode and parameter profile and saves
+// them to the EEPROM of every device at once. A run of '%' in the serial
+// number is replaced by the zero-padded device index, '-' keeps the serial
+// numbers. The profile starts from the configuration of device 0; besides
+// the mode and parameter fields it takes password=, threads= and save=0|1:
+//
+//   provision RACK1-%% ResetD=0 AccelT=200 DecelT=200
+
+static USMC* usmc_driver = NULL;
+static bool quiet = false;
+
+
+// Field of a configuration structure
+enum { F_BOOL, F_U8, F_U16, F_U32, F_FLOAT };
+typedef struct _field {
+    const char* name;
+    int type;
+    size_t offset;
+} field;
+
+#define FIELD(s, n, t) { #n, t, offsetof(s, n) }
+
+static const field mode_fields[] = {
+    FIELD(USMC_Mode, PMode, F_BOOL),
+    FIELD(USMC_Mode, PReg, F_BOOL),
+    FIELD(USMC_Mode, ResetD, F_BOOL),
+    FIELD(USMC_Mode, EMReset, F_BOOL),
+    FIELD(USMC_Mode, Tr1T, F_BOOL),
+    FIELD(USMC_Mode, Tr2T, F_BOOL),
+    FIELD(USMC_Mode, RotTrT, F_BOOL),
+    FIELD(USMC_Mode, TrSwap, F_BOOL),
+    FIELD(USMC_Mode, Tr1En, F_BOOL),
+    FIELD(USMC_Mode, Tr2En, F_BOOL),
+    FIELD(USMC_Mode, RotTeEn, F_BOOL),
+    FIELD(USMC_Mode, RotTrOp, F_BOOL),
+    FIELD(USMC_Mode, Butt1T, F_BOOL),
+    FIELD(USMC_Mode, Butt2T, F_BOOL),
+    FIELD(USMC_Mode, ResetRT, F_BOOL),
+    FIELD(USMC_Mode, SyncOUTEn, F_BOOL),
+    FIELD(USMC_Mode, SyncOUTR, F_BOOL),
+    FIELD(USMC_Mode, SyncINOp, F_BOOL),
+    FIELD(USMC_Mode, SyncCount, F_U32),
+    FIELD(USMC_Mode, SyncInvert, F_BOOL),
+    FIELD(USMC_Mode, EncoderEn, F_BOOL),
+    FIELD(USMC_Mode, EncoderInv, F_BOOL),
+    FIELD(USMC_Mode, ResBEnc, F_BOOL),
+    FIELD(USMC_Mode, ResEnc, F_BOOL),
+    { NULL, 0, 0 }
+};
+
+static const field params_fields[] = {
+    FIELD(USMC_Parameters, AccelT, F_FLOAT),
+    FIELD(USMC_Parameters, DecelT, F_FLOAT),
+    FIELD(USMC_Parameters, PTimeout, F_FLOAT),
+    FIELD(USMC_Parameters, BTimeout1, F_FLOAT),
+    FIELD(USMC_Parameters, BTimeout2, F_FLOAT),
+    FIELD(USMC_Parameters, BTimeout3, F_FLOAT),
+    FIELD(USMC_Parameters, BTimeout4, F_FLOAT),
+    FIELD(USMC_Parameters, BTimeoutR, F_FLOAT),
+    FIELD(USMC_Parameters, BTimeoutD, F_FLOAT),
+    FIELD(USMC_Parameters, MinP, F_FLOAT),
+    FIELD(USMC_Parameters, BTO1P, F_FLOAT),
+    FIELD(USMC_Parameters, BTO2P, F_FLOAT),
+    FIELD(USMC_Parameters, BTO3P, F_FLOAT),
+    FIELD(USMC_Parameters, BTO4P, F_FLOAT),
+    FIELD(USMC_Parameters, MaxLoft, F_U16),
+    FIELD(USMC_Parameters, StartPos, F_U32),
+    FIELD(USMC_Parameters, RTDelta, F_U16),
+    FIELD(USMC_Parameters, RTMinError, F_U16),
+    FIELD(USMC_Parameters, MaxTemp, F_FLOAT),
+    FIELD(USMC_Parameters, SynOUTP, F_U8),
+    FIELD(USMC_Parameters, LoftPeriod, F_FLOAT),
+    FIELD(USMC_Parameters, EncMult, F_FLOAT),
+    { NULL, 0, 0 }
+};
+
+static const field start_fields[] = {
+    FIELD(USMC_StartParameters, SDivisor, F_U8),
+    FIELD(USMC_StartParameters, DefDir, F_BOOL),
+    FIELD(USMC_StartParameters, LoftEn, F_BOOL),
+    FIELD(USMC_StartParameters, SlStart, F_BOOL),
+    FIELD(USMC_StartParameters, WSyncIN, F_BOOL),
+    FIELD(USMC_StartParameters, SyncOUTR, F_BOOL),
+    FIELD(USMC_StartParameters, ForceLoft, F_BOOL),
+    { NULL, 0, 0 }
+};
+
+static void print_fields(ostream& out, const void* data, const field* fields) {
+    const char* base = (const char*)data;
+    for(const field* f = fields; f->name; f++) {
+        out << "  " << setw(12) << left << f->name << right << " ";
+        switch(f->type) {
+            case F_BOOL:  out << (*(const bool*)(base + f->offset) ? 1 : 0); break;
+            case F_U8:    out << (unsigned int)*(const uint8_t*)(base + f->offset); break;
+            case F_U16:   out << *(const uint16_t*)(base + f->offset); break;
+            case F_U32:   out << *(const uint32_t*)(base + f->offset); break;
+            case F_FLOAT: out << *(const float*)(base + f->offset); break;
+        }
+        out << endl;
+    }
+}
+
+// Set a field given an assignment 'name=value'
+static bool set_field(void* data, const field* fields, const string& assignment) {
+    size_t eq = assignment.find('=');
+    if(eq == string::npos || eq == 0 || eq == assignment.size() - 1)
+        return false;
+    string name = assignment.substr(0, eq);
+    const char* value = assignment.c_str() + eq + 1;
+    const field* f = fields;
+    for(; f->name; f++)
+        if(strcasecmp(f->name, name.c_str()) == 0)
+            break;
+    if(!f->name)
+        return false;
+
+    char* end = NULL;
+    char* base = (char*)data;
+    if(f->type == F_FLOAT) {
+        double v = strtod(value, &end);
+        if(*end)
+            return false;
+        *(float*)(base + f->offset) = (float)v;
+        return true;
+    }
+    long long v = strtoll(value, &end, 0);
+    if(*end || v < 0)
+        return false;
+    switch(f->type) {
+        case F_BOOL:
+            if(v > 1) return false;
+            *(bool*)(base + f->offset) = (v != 0);
+            break;
+        case F_U8:
+            if(v > 0xFF) return false;
+            *(uint8_t*)(base + f->offset) = (uint8_t)v;
+            break;
+        case F_U16:
+            if(v > 0xFFFF) return false;
+            *(uint16_t*)(base + f->offset) = (uint16_t)v;
+            break;
+        case F_U32:
+            if(v > 0xFFFFFFFFLL) return false;
+            *(uint32_t*)(base + f->offset) = (uint32_t)v;
+            break;
+    }
+    return true;
+}
+
+static bool parse_int(const string& s, int& value) {
+    char* end = NULL;
+    long v = strtol(s.c_str(), &end, 0);
+    if(s.empty() || *end)
+        return false;
+    value = (int)v;
+    return true;
+}
+
+static bool parse_float(const string& s, float& value) {
+    char* end = NULL;
+    double v = strtod(s.c_str(), &end);
+    if(s.empty() || *end)
+        return false;
+    value = (float)v;
+    return true;
+}
+
+
+// Commands
+typedef struct _command_def {
+    const char* name;
+    int min_args;       // Arguments after the command name
+    int max_args;       // -1 for any number
+    bool device;        // First argument is a device ('all' expands to every device)
+    bool barrier;       // Waits for all the previous commands
+    const char* help;
+} command_def;
+
+static const command_def commands[] = {
+    { "list",   0,  0, false, true,  "list                          list devices with serial, version and bus path" },
+    { "state",  1,  1, true,  false, "state <dev>                   print the device state" },
+    { "mode",   1, -1, true,  false, "mode <dev> [field=value ...]  print or change the mode" },
+    { "params", 1, -1, true,  false, "params <dev> [field=value ...] print or change the parameters" },
+    { "start",  1, -1, true,  false, "start <dev> [field=value ...] print or change the start parameters" },
+    { "speed",  1,  2, true,  false, "speed <dev> [steps/s]         print or change the speed" },
+    { "move",   2,  2, true,  false, "move <dev> <pos>              start a move" },
+    { "stop",   1,  1, true,  false, "stop <dev>                    stop the motor" },
+    { "setpos", 2,  2, true,  false, "setpos <dev> <pos>            set the current position" },
+    { "wait",   1,  2, true,  false, "wait <dev> [timeout ms]       wait for the motor to stop" },
+    { "provision", 1, -1, false, true, "provision <serial> [f=v ...]  commission all the devices in parallel" },
+    { "sync",   0,  0, false, true,  "sync                          wait for all the previous commands (scripts only)" },
+    { "script", 1,  1, false, true,  "script <file|->               run a batch script" },
+    { NULL, 0, 0, false, false, NULL }
+};
+
+typedef struct _command {
+    int line;                   // Script line (0 on the command line)
+    const command_def* def;
+    int device;                 // Device index (-1 if none)
+    vector<string> args;        // Arguments (device excluded)
+    string output;
+    int result;
+    bool skipped;               // Not run after a previous error on the same device
+} command;
+
+static const command_def* find_command(const string& name) {
+    for(const command_def* d = commands; d->name; d++)
+        if(name == d->name)
+            return d;
+    return NULL;
+}
+
+// Resolve a device reference: serial number first, then index
+static int resolve_device(const string& ref) {
+    int id = usmc_driver->getDeviceID(ref);
+    if(id >= 0)
+        return id;
+    int index = 0;
+    if(parse_int(ref, index) && index >= 0 && (size_t)index < usmc_driver->countDevices())
+        return index;
+    return -1;
+}
+
+// Serial number of a device from a pattern
+static string serial_for(const string& pattern, int device) {
+    size_t p = pattern.find('%');
+    if(p == string::npos)
+        return pattern;
+    size_t n = pattern.find_first_not_of('%', p);
+    if(n == string::npos)
+        n = pattern.size();
+    ostringstream ss;
+    ss << setw(n - p) << setfill('0') << device;
+    return pattern.substr(0, p) + ss.str() + pattern.substr(n);
+}
+
+// Apply a provisioning option (password=, threads=, save=) or a mode or
+// parameters field of the profile
+static bool provision_option(const string& a, USMC_Provisioner& provisioner, USMC_Mode& mode, bool& set_mode,
+                             USMC_Parameters& params, bool& set_params) {
+    size_t eq = a.find('=');
+    string key = a.substr(0, eq);
+    string value = (eq == string::npos) ? string() : a.substr(eq + 1);
+    int v = 0;
+    if(strcasecmp(key.c_str(), "password") == 0)
+        return provisioner.setPassword(value) == 0;
+    if(strcasecmp(key.c_str(), "threads") == 0) {
+        if(!parse_int(value, v) || v < 0)
+            return false;
+        provisioner.setThreads(v);
+        return true;
+    }
+    if(strcasecmp(key.c_str(), "save") == 0) {
+        if(!parse_int(value, v) || v < 0 || v > 1)
+            return false;
+        provisioner.setSave(v != 0);
+        return true;
+    }
+    if(set_field(&mode, mode_fields, a))
+        return set_mode = true;
+    if(set_field(&params, params_fields, a))
+        return set_params = true;
+    return false;
+}
+
+// Check the arguments of a command, so that a script with a wrong value
+// fails before any of its commands runs. Returns an error message on failure
+static string check_arguments(const command_def* def, const vector<string>& args) {
+    const string name(def->name);
+    if(name == "mode" || name == "params" || name == "start") {
+        USMC_Mode mode;
+        USMC_Parameters params;
+        USMC_StartParameters start;
+        for(size_t i = 0; i < args.size(); i++) {
+            bool ok;
+            if(name == "mode")
+                ok = set_field(&mode, mode_fields, args[i]);
+            else if(name == "params")
+                ok = set_field(&params, params_fields, args[i]);
+            else
+                ok = set_field(&start, start_fields, args[i]);
+            if(!ok)
+                return "invalid assignment '" + args[i] + "'";
+        }
+        return "";
+    }
+    int v = 0;
+    float f = 0;
+    if(name == "speed" && !args.empty() && !parse_float(args[0], f))
+        return "invalid speed '" + args[0] + "'";
+    if((name == "move" || name == "setpos") && !parse_int(args[0], v))
+        return "invalid position '" + args[0] + "'";
+    if(name == "wait" && !args.empty() && (!parse_int(args[0], v) || v < 0))
+        return "invalid timeout '" + args[0] + "'";
+    if(name == "provision") {
+        int ndev = (int)usmc_driver->countDevices();
+        if(args[0] != "-") {
+            if(serial_for(args[0], ndev - 1).size() > USMC_SERIAL_LENGTH)
+                return "serial number '" + args[0] + "' too long";
+            if(ndev > 1 && args[0].find('%') == string::npos)
+                return "serial number '" + args[0] + "' needs a '%' for the device index";
+        }
+        USMC_Provisioner provisioner(usmc_driver);
+        USMC_Mode mode;
+        USMC_Parameters params;
+        bool set_mode = false;
+        bool set_params = false;
+        for(size_t i = 1; i < args.size(); i++)
+            if(!provision_option(args[i], provisioner, mode, set_mode, params, set_params))
+                return "invalid assignment '" + args[i] + "'";
+    }
+    return "";
+}
+
+// Parse a tokenized command, expanding 'all'. Returns an error message on failure
+static string parse_command(const vector<string>& tokens, int line, vector<command>& out) {
+    const command_def* def = find_command(tokens[0]);
+    if(!def)
+        return "unknown command '" + tokens[0] + "'";
+    int nargs = (int)tokens.size() - 1;
+    if(nargs < def->min_args || (def->max_args >= 0 && nargs > def->max_args))
+        return string("wrong number of arguments, usage: ") + def->help;
+    if(line > 0 && !strcmp(def->name, "script"))
+        return "nested scripts are not supported";
+    vector<string> args(tokens.begin() + (def->device ? 2 : 1), tokens.end());
+    string err = check_arguments(def, args);
+    if(!err.empty())
+        return err;
+
+    command c;
+    c.line = line;
+    c.def = def;
+    c.device = -1;
+    c.result = 0;
+    c.skipped = false;
+    c.args = args;
+    if(!def->device) {
+        out.push_back(c);
+        return "";
+    }
+    if(tokens[1] == "all") {
+        for(size_t i = 0; i < usmc_driver->countDevices(); i++) {
+            c.device = (int)i;
+            out.push_back(c);
+        }
+        return "";
+    }
+    c.device = resolve_device(tokens[1]);
+    if(c.device < 0)
+        return "unknown device '" + tokens[1] + "'";
+    out.push_back(c);
+    return "";
+}
+
+static int report(ostream& out, const string& what, int res) {
+    if(res < 0)
+        out << "error: " << what << " failed (error " << res << ")" << endl;
+    return res;
+}
+
+static int cmd_list(ostream& out) {
+    out << setw(3) << "#" << "  " << setw(16) << left << "Serial" << setw(10) << "Version" << setw(12) << "Path" << right << setw(12) << "Position" << setw(8) << "Temp" << setw(8) << "Voltage" << endl;
+    int res = 0;
+    for(size_t i = 0; i < usmc_driver->countDevices(); i++) {
+        string serial, path;
+        uint32_t version = 0;
+        USMC_State state;
+        usmc_driver->getSerialNumber(i, serial);
+        usmc_driver->getBusPath(i, path);
+        usmc_driver->getVersion(i, version);
+        int r = usmc_driver->getState(i, &state);
+        ostringstream ver;
+        ver << "0x" << hex << version;
+        out << setw(3) << i << "  " << setw(16) << left << serial << setw(10) << ver.str() << setw(12) << (path.empty() ? "-" : path) << right;
+        if(r < 0) {
+            out << "  error " << r << endl;
+            res = r;
+            continue;
+        }
+        out << setw(12) << state.CurPos << fixed << setprecision(1) << setw(8) << state.Temp << setw(8) << state.Voltage << endl;
+        out.unsetf(ios::floatfield);
+    }
+    return res;
+}
+
+static void print_state(ostream& out, const USMC_State& s) {
+    out << "  CurPos       " << s.CurPos << endl;
+    out << "  Temp         " << s.Temp << endl;
+    out << "  Voltage      " << s.Voltage << endl;
+    out << "  SDivisor     " << (unsigned int)s.SDivisor << endl;
+    out << "  Flags       ";
+    if(s.Power) out << " POWER";
+    if(s.RUN) out << " RUN";
+    if(s.FullPower) out << " FULLPOWER";
+    if(s.FullSpeed) out << " FULLSPEED";
+    if(s.CW_CCW) out << " CW_CCW";
+    if(s.Loft) out << " LOFT";
+    if(s.AReset) out << " ARESET";
+    if(s.SyncIN) out << " SYNCIN";
+    if(s.SyncOUT) out << " SYNCOUT";
+    if(s.RotTr) out << " ROTTR";
+    if(s.RotTrErr) out << " ROTTRERR";
+    if(s.EmReset) out << " EMRESET";
+    if(s.Trailer1) out << " TRAILER1";
+    if(s.Trailer2) out << " TRAILER2";
+    out << endl;
+}
+
+// Read-modify-write of a configuration structure
+template<typename T>
+static int cmd_config(ostream& out, const command& c, const field* fields, const char* what,
+                      int (USMC::*get)(int, T*)const, int (USMC::*set)(int, const T*)) {
+    T data;
+    int res = (usmc_driver->*get)(c.device, &data);
+    if(res < 0)
+        return report(out, string("reading ") + what, res);
+    if(c.args.empty()) {
+        print_fields(out, &data, fields);
+        return 0;
+    }
+    for(size_t i = 0; i < c.args.size(); i++) {
+        if(!set_field(&data, fields, c.args[i])) {
+            out << "error: invalid assignment '" << c.args[i] << "'" << endl;
+            return ERR_INVALID_PARAM;
+        }
+    }
+    return report(out, string("writing ") + what, (usmc_driver->*set)(c.device, &data));
+}
+
+static const char* provision_steps[] = { "", "device", "serial", "mode", "parameters", "save", "verify" };
+
+// Commission all the devices
+static int cmd_provision(ostream& out, const command& c) {
+    USMC_Provisioner provisioner(usmc_driver);
+    USMC_Mode mode;
+    USMC_Parameters params;
+    bool set_mode = false;
+    bool set_params = false;
+    int res = usmc_driver->getMode(0, &mode);
+    if(res >= 0)
+        res = usmc_driver->getParameters(0, &params);
+    if(res < 0)
+        return report(out, "reading the profile", res);
+
+    for(size_t i = 1; i < c.args.size(); i++) {
+        if(!provision_option(c.args[i], provisioner, mode, set_mode, params, set_params)) {
+            out << "error: invalid assignment '" << c.args[i] << "'" << endl;
+            return ERR_INVALID_PARAM;
+        }
+    }
+    if(set_mode)
+        provisioner.setMode(&mode);
+    if(set_params)
+        provisioner.setParameters(&params);
+
+    size_t ndev = usmc_driver->countDevices();
+    for(size_t i = 0; i < ndev; i++) {
+        string serial = (c.args[0] == "-") ? string() : serial_for(c.args[0], (int)i);
+        res = provisioner.addDevice((int)i, serial);
+        if(res < 0) {
+            out << "error: invalid or duplicate serial number '" << serial << "'" << endl;
+            return res;
+        }
+    }
+
+    vector<USMC_ProvisionResult> results;
+    uint64_t t0 = usmc_time_us();
+    res = provisioner.run(results);
+    double elapsed = double(usmc_time_us() - t0) / 1e6;
+
+    int failed = 0;
+    out << setw(3) << "#" << "  " << left << setw(18) << "Old serial" << setw(18) << "Serial" << right << setw(8) << "Time" << "  Result" << endl;
+    for(size_t i = 0; i < results.size(); i++) {
+        const USMC_ProvisionResult& r = results[i];
+        out << setw(3) << r.device << "  " << left << setw(18) << r.old_serial << setw(18) << r.serial << right
+            << fixed << setprecision(3) << setw(8) << r.time << "  ";
+        out.unsetf(ios::floatfield);
+        if(r.result < 0) {
+            out << "failed at " << provision_steps[r.step] << " (error " << r.result << ")" << endl;
+            failed++;
+        } else {
+            out << "ok" << endl;
+        }
+    }
+    out << (results.size() - failed) << " of " << results.size() << " devices provisioned in " << fixed << setprecision(3) << elapsed << " s" << endl;
+    out.unsetf(ios::floatfield);
+    return res;
+}
+
+// Execute a command, writing its output to the given stream
+static int execute(command& c, ostream& out) {
+    const string name(c.def->name);
+    if(c.device >= 0 && !quiet) {
+        string serial;
+        usmc_driver->getSerialNumber(c.device, serial);
+        out << "[" << c.device << ":" << serial << "] " << name;
+        for(size_t i = 0; i < c.args.size(); i++)
+            out << " " << c.args[i];
+        out << endl;
+    }
+
+    if(name == "list")
+        return cmd_list(out);
+    if(name == "sync")
+        return 0;
+    if(name == "provision")
+        return cmd_provision(out, c);
+    if(name == "state") {
+        USMC_State state;
+        int res = usmc_driver->getState(c.device, &state);
+        if(res < 0)
+            return report(out, "reading state", res);
+        print_state(out, state);
+        return 0;
+    }
+    if(name == "mode")
+        return cmd_config<USMC_Mode>(out, c, mode_fields, "mode", &USMC::getMode, &USMC::setMode);
+    if(name == "params")
+        return cmd_config<USMC_Parameters>(out, c, params_fields, "parameters", &USMC::getParameters, &USMC::setParameters);
+    if(name == "start")
+        return cmd_config<USMC_StartParameters>(out, c, start_fields, "start parameters", &USMC::getStartParameters, &USMC::setStartParameters);
+    if(name == "speed") {
+        if(c.args.empty()) {
+            float speed = 0;
+            int res = usmc_driver->getSpeed(c.device, speed);
+            if(res < 0)
+                return report(out, "reading speed", res);
+            out << "  Speed        " << speed << endl;
+            return 0;
+        }
+        float speed = 0;
+        if(!parse_float(c.args[0], speed)) {
+            out << "error: invalid speed '" << c.args[0] << "'" << endl;
+            return ERR_INVALID_PARAM;
+        }
+        return report(out, "setting speed", usmc_driver->setSpeed(c.device, speed));
+    }
+    if(name == "move" || name == "setpos") {
+        int pos = 0;
+        if(!parse_int(c.args[0], pos)) {
+            out << "error: invalid position '" << c.args[0] << "'" << endl;
+            return ERR_INVALID_PARAM;
+        }
+        if(name == "move")
+            return report(out, "move", usmc_driver->moveTo(c.device, pos));
+        return report(out, "setting position", usmc_driver->setCurrentPosition(c.device, pos));
+    }
+    if(name == "stop")
+        return report(out, "stop", usmc_driver->stop(c.device));
+    if(name == "wait") {
+        int timeout = 0;
+        if(c.args.size() > 0 && (!parse_int(c.args[0], timeout) || timeout < 0)) {
+            out << "error: invalid timeout '" << c.args[0] << "'" << endl;
+            return ERR_INVALID_PARAM;
+        }
+        USMC_State state;
+        int res = usmc_wait_idle(usmc_driver, c.device, 10000, timeout, &state);
+        if(res < 0)
+            return report(out, "wait", res);
+        if(!quiet)
+            out << "  CurPos       " << state.CurPos << endl;
+        return 0;
+    }
+    out << "error: command '" << name << "' not allowed here" << endl;
+    return ERR_INVALID_PARAM;
+}
+
+
+// Worker running the queue of one device
+typedef struct _worker {
+    pthread_t thread;
+    vector<command*> queue;
+} worker;
+
+static void* worker_thread(void* arg) {
+    worker* w = (worker*)arg;
+    for(size_t i = 0; i < w->queue.size(); i++) {
+        command* c = w->queue[i];
+        ostringstream out;
+        c->result = execute(*c, out);
+        c->output = out.str();
+        if(c->result < 0) {
+            // Skip the rest of the queue of this device
+            for(size_t j = i + 1; j < w->queue.size(); j++)
+                w->queue[j]->skipped = true;
+            break;
+        }
+    }
+    return NULL;
+}
+
+// Run a list of commands: commands between two barriers are dispatched to
+// one worker per device and their output is printed in order at the end of
+// the phase. Returns the number of failed commands.
+static int run(vector<command>& cmds) {
+    size_t ndev = usmc_driver->countDevices();
+    int errors = 0;
+    size_t begin = 0;
+    while(begin < cmds.size()) {
+        if(cmds[begin].def->barrier) {
+            command& c = cmds[begin];
+            c.result = execute(c, cout);
+            if(c.result < 0) {
+                if(c.line > 0)
+                    cerr << "line " << c.line << ": " << c.def->name << " failed" << endl;
+                return errors + 1;
+            }
+            begin++;
+            continue;
+        }
+
+        // Collect the phase
+        size_t end = begin;
+        vector<worker> workers(ndev);
+        while(end < cmds.size() && !cmds[end].def->barrier) {
+            workers[cmds[end].device].queue.push_back(&cmds[end]);
+            end++;
+        }
+
+        // Run a single queue inline, otherwise one thread per device
+        vector<worker*> active;
+        for(size_t i = 0; i < ndev; i++)
+            if(!workers[i].queue.empty())
+                active.push_back(&workers[i]);
+        if(active.size() == 1) {
+            worker_thread(active[0]);
+        } else {
+            for(size_t i = 0; i < active.size(); i++) {
+                if(pthread_create(&active[i]->thread, NULL, worker_thread, active[i]) != 0) {
+                    cerr << "error: cannot start worker thread" << endl;
+                    for(size_t j = 0; j < i; j++)
+                        pthread_join(active[j]->thread, NULL);
+                    return errors + 1;
+                }
+            }
+            for(size_t i = 0; i < active.size(); i++)
+                pthread_join(active[i]->thread, NULL);
+        }
+
+        // Output in order
+        for(size_t i = begin; i < end; i++) {
+            cout << cmds[i].output;
+            if(cmds[i].skipped) {
+                if(cmds[i].line > 0)
+                    cerr << "line " << cmds[i].line << ": " << cmds[i].def->name << " skipped after a previous error" << endl;
+            } else if(cmds[i].result < 0) {
+                errors++;
+                if(cmds[i].line > 0)
+                    cerr << "line " << cmds[i].line << ": " << cmds[i].def->name << " failed" << endl;
+            }
+        }
+        if(errors)
+            return errors;
+        begin = end;
+    }
+    return errors;
+}
+
+// Load and check a whole script before running anything
+static int load_script(const char* filename, vector<command>& cmds) {
+    ifstream file;
+    istream* in = &cin;
+    if(strcmp(filename, "-")) {
+        file.open(filename);
+        if(!file.is_open()) {
+            cerr << "error: cannot open script " << filename << endl;
+            return -1;
+        }
+        in = &file;
+    }
+
+    int errors = 0;
+    string text;
+    for(int line = 1; getline(*in, text); line++) {
+        size_t hash = text.find('#');
+        if(hash != string::npos)
+            text.erase(hash);
+        istringstream ss(text);
+        vector<string> tokens;
+        string tok;
+        while(ss >> tok)
+            tokens.push_back(tok);
+        if(tokens.empty())
+            continue;
+        string err = parse_command(tokens, line, cmds);
+        if(!err.empty()) {
+            cerr << filename << ":" << line << ": " << err << endl;
+            errors++;
+        }
+    }
+    return errors ? -1 : 0;
+}
+
+static void usage(const char* name) {
+    cout << "Usage: " << name << " [options] <command> [arguments]" << endl;
+    cout << "Options:" << endl;
+    cout << "  -s axes   use simulated axes instead of the USB devices" << endl;
+    cout << "  -q        print only the command results" << endl;
+    cout << "  -v        print the library log" << endl;
+    cout << "Commands (<dev> is a serial number, an index or 'all'):" << endl;
+    for(const command_def* d = commands; d->name; d++)
+        cout << "  " << d->help << endl;
+}
+
+static void quiet_logger(const char* fmt, ...) {
+
+}
+
+int main(int argc, char** argv)
+{
+    int sim_axes = 0;
+    bool verbose = false;
+    int c;
+    while((c = getopt(argc, argv, "+s:qvh")) != -1) {
+        switch(c) {
+            case 's': sim_axes = atoi(optarg); break;
+            case 'q': quiet = true; break;
+            case 'v': verbose = true; break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if(optind >= argc || sim_axes < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Backend
+    USMC_Simulator* sim = NULL;
+    if(sim_axes > 0) {
+        sim = new USMC_Simulator();
+        for(int i = 0; i < sim_axes; i++) {
+            USMC_SimAxisConfig config;
+            USMC_Simulator::defaults(&config, i);
+            sim->addAxis(config);
+        }
+    }
+    usmc_driver = sim ? USMC::getInstance(sim) : USMC::getInstance();
+    if(!verbose) {
+        usmc_driver->set_info_logger(quiet_logger);
+        usmc_driver->set_warn_logger(quiet_logger);
+    }
+
+    // Probe once for the whole invocation
+    int ndev = usmc_driver->probeDevices();
+    if(ndev <= 0) {
+        cerr << "No devices found" << endl;
+        USMC::shutdown();
+        delete sim;
+        return 1;
+    }
+
+    vector<string> tokens(argv + optind, argv + argc);
+    vector<command> cmds;
+    int res = 0;
+    string err = parse_command(tokens, 0, cmds);
+    if(!err.empty()) {
+        cerr << "error: " << err << endl;
+        res = 1;
+    } else if(cmds[0].def == find_command("script")) {
+        string filename = cmds[0].args[0];
+        cmds.clear();
+        if(load_script(filename.c_str(), cmds) < 0)
+            res = 1;
+        else if(run(cmds) > 0)
+            res = 2;
+    } else if(run(cmds) > 0) {
+        res = 2;
+    }
+
+    USMC::shutdown();
+    delete sim;
+    return res;
+}